@@ -190,6 +190,7 @@ filter("platforms:Windows")
     "shlwapi",
     "dxguid",
     "bcrypt",
+    "synchronization",
   })
 
 -- Create scratch/ path
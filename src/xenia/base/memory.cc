@@ -9,15 +9,30 @@
 
 #include "xenia/base/memory.h"
 #include "xenia/base/cvar.h"
+#include "xenia/base/math.h"
 #include "xenia/base/platform.h"
 
 #include <algorithm>
 
+#if XE_ARCH_AMD64
+#include "third_party/xbyak/xbyak/xbyak_util.h"
+#endif  // XE_ARCH_AMD64
+
 DEFINE_bool(
     writable_executable_memory, true,
     "Allow mapping memory with both write and execute access, for simulating "
     "behavior on platforms where that's not supported",
     "Memory");
+DEFINE_bool(
+    huge_pages, false,
+    "Back guest memory and the generated code region with huge host pages "
+    "where the host supports it, to reduce TLB misses. On Linux, guest "
+    "memory is shared memory and requires "
+    "/sys/kernel/mm/transparent_hugepage/shmem_enabled to be \"advise\" or "
+    "\"always\" (it defaults to \"never\"), and the generated code region "
+    "requires /sys/kernel/mm/transparent_hugepage/enabled to be \"madvise\" "
+    "or \"always\".",
+    "Memory");
 
 namespace xe {
 namespace memory {
@@ -27,9 +42,10 @@ bool IsWritableExecutableMemoryPreferred() {
          cvars::writable_executable_memory;
 }
 
+bool IsHugePageBackingPreferred() { return cvars::huge_pages; }
+
 }  // namespace memory
 
-// TODO(benvanik): fancy AVX versions.
 // https://github.com/gnuradio/volk/blob/master/kernels/volk/volk_16u_byteswap.h
 // https://github.com/gnuradio/volk/blob/master/kernels/volk/volk_32u_byteswap.h
 // https://github.com/gnuradio/volk/blob/master/kernels/volk/volk_64u_byteswap.h
@@ -43,6 +59,101 @@ void copy_128_aligned(void* dest, const void* src, size_t count) {
 }
 
 #if XE_ARCH_AMD64
+// AVX2 isn't required by Xenia, so the AVX2 kernels are compiled for it
+// separately and only used if the host supports it. They process whole 32-byte
+// blocks and return how far they got, and the callers finish the rest.
+#if XE_COMPILER_MSVC
+#define XE_AVX2_FUNCTION
+#else
+#define XE_AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+static bool HasAVX2() {
+  static const bool has_avx2 =
+      Xbyak::util::Cpu().has(Xbyak::util::Cpu::tAVX2);
+  return has_avx2;
+}
+
+XE_AVX2_FUNCTION static size_t copy_and_swap_avx2(void* dest_ptr,
+                                                  const void* src_ptr,
+                                                  size_t size,
+                                                  __m128i shufmask) {
+  auto dest = reinterpret_cast<uint8_t*>(dest_ptr);
+  auto src = reinterpret_cast<const uint8_t*>(src_ptr);
+  __m256i shufmask_256 = _mm256_broadcastsi128_si256(shufmask);
+  size_t i;
+  for (i = 0; i + 32 <= size; i += 32) {
+    __m256i input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&src[i]));
+    __m256i output = _mm256_shuffle_epi8(input, shufmask_256);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&dest[i]), output);
+  }
+  return i;
+}
+
+XE_AVX2_FUNCTION static size_t count_equal_bytes_avx2(const void* a_ptr,
+                                                      const void* b_ptr,
+                                                      size_t size,
+                                                      size_t* out_count) {
+  auto a = reinterpret_cast<const uint8_t*>(a_ptr);
+  auto b = reinterpret_cast<const uint8_t*>(b_ptr);
+  size_t count = 0;
+  size_t i;
+  for (i = 0; i + 32 <= size; i += 32) {
+    __m256i a_bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&a[i]));
+    __m256i b_bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&b[i]));
+    count += xe::bit_count(
+        uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(a_bytes, b_bytes))));
+  }
+  *out_count = count;
+  return i;
+}
+
+XE_AVX2_FUNCTION static size_t count_equal_32_avx2(const uint32_t* src,
+                                                   uint32_t value,
+                                                   size_t count,
+                                                   size_t* out_count) {
+  __m256i value_256 = _mm256_set1_epi32(int32_t(value));
+  size_t equal_count = 0;
+  size_t i;
+  for (i = 0; i + 8 <= count; i += 8) {
+    __m256i input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&src[i]));
+    equal_count += xe::bit_count(uint32_t(_mm256_movemask_ps(
+        _mm256_castsi256_ps(_mm256_cmpeq_epi32(input, value_256)))));
+  }
+  *out_count = equal_count;
+  return i;
+}
+
+XE_AVX2_FUNCTION static size_t fill_32_avx2(uint32_t* dest, uint32_t value,
+                                            size_t count) {
+  __m256i value_256 = _mm256_set1_epi32(int32_t(value));
+  size_t i;
+  for (i = 0; i + 8 <= count; i += 8) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&dest[i]), value_256);
+  }
+  return i;
+}
+
+// Stops at the first block containing the value.
+XE_AVX2_FUNCTION static size_t find_32_avx2(const uint32_t* src,
+                                            uint32_t value, size_t count) {
+  __m256i value_256 = _mm256_set1_epi32(int32_t(value));
+  size_t i;
+  for (i = 0; i + 8 <= count; i += 8) {
+    __m256i input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&src[i]));
+    if (!_mm256_testz_si256(_mm256_cmpeq_epi32(input, value_256),
+                            _mm256_set1_epi32(-1))) {
+      break;
+    }
+  }
+  return i;
+}
+
 void copy_and_swap_16_aligned(void* dest_ptr, const void* src_ptr,
                               size_t count) {
   assert_zero(reinterpret_cast<uintptr_t>(dest_ptr) & 0xF);
@@ -55,7 +166,11 @@ void copy_and_swap_16_aligned(void* dest_ptr, const void* src_ptr,
                    0x04, 0x05, 0x02, 0x03, 0x00, 0x01);
 
   size_t i = 0;
-  for (i = 0; i + 8 <= count; i += 8) {
+  if (HasAVX2()) {
+    i = copy_and_swap_avx2(dest, src, count * sizeof(*src), shufmask) /
+        sizeof(*src);
+  }
+  for (; i + 8 <= count; i += 8) {
     __m128i input = _mm_load_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output = _mm_shuffle_epi8(input, shufmask);
     _mm_store_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
@@ -73,8 +188,12 @@ void copy_and_swap_16_unaligned(void* dest_ptr, const void* src_ptr,
       _mm_set_epi8(0x0E, 0x0F, 0x0C, 0x0D, 0x0A, 0x0B, 0x08, 0x09, 0x06, 0x07,
                    0x04, 0x05, 0x02, 0x03, 0x00, 0x01);
 
-  size_t i;
-  for (i = 0; i + 8 <= count; i += 8) {
+  size_t i = 0;
+  if (HasAVX2()) {
+    i = copy_and_swap_avx2(dest, src, count * sizeof(*src), shufmask) /
+        sizeof(*src);
+  }
+  for (; i + 8 <= count; i += 8) {
     __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output = _mm_shuffle_epi8(input, shufmask);
     _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
@@ -95,8 +214,12 @@ void copy_and_swap_32_aligned(void* dest_ptr, const void* src_ptr,
       _mm_set_epi8(0x0C, 0x0D, 0x0E, 0x0F, 0x08, 0x09, 0x0A, 0x0B, 0x04, 0x05,
                    0x06, 0x07, 0x00, 0x01, 0x02, 0x03);
 
-  size_t i;
-  for (i = 0; i + 4 <= count; i += 4) {
+  size_t i = 0;
+  if (HasAVX2()) {
+    i = copy_and_swap_avx2(dest, src, count * sizeof(*src), shufmask) /
+        sizeof(*src);
+  }
+  for (; i + 4 <= count; i += 4) {
     __m128i input = _mm_load_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output = _mm_shuffle_epi8(input, shufmask);
     _mm_store_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
@@ -114,8 +237,12 @@ void copy_and_swap_32_unaligned(void* dest_ptr, const void* src_ptr,
       _mm_set_epi8(0x0C, 0x0D, 0x0E, 0x0F, 0x08, 0x09, 0x0A, 0x0B, 0x04, 0x05,
                    0x06, 0x07, 0x00, 0x01, 0x02, 0x03);
 
-  size_t i;
-  for (i = 0; i + 4 <= count; i += 4) {
+  size_t i = 0;
+  if (HasAVX2()) {
+    i = copy_and_swap_avx2(dest, src, count * sizeof(*src), shufmask) /
+        sizeof(*src);
+  }
+  for (; i + 4 <= count; i += 4) {
     __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output = _mm_shuffle_epi8(input, shufmask);
     _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
@@ -136,8 +263,12 @@ void copy_and_swap_64_aligned(void* dest_ptr, const void* src_ptr,
       _mm_set_epi8(0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x00, 0x01,
                    0x02, 0x03, 0x04, 0x05, 0x06, 0x07);
 
-  size_t i;
-  for (i = 0; i + 2 <= count; i += 2) {
+  size_t i = 0;
+  if (HasAVX2()) {
+    i = copy_and_swap_avx2(dest, src, count * sizeof(*src), shufmask) /
+        sizeof(*src);
+  }
+  for (; i + 2 <= count; i += 2) {
     __m128i input = _mm_load_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output = _mm_shuffle_epi8(input, shufmask);
     _mm_store_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
@@ -155,8 +286,12 @@ void copy_and_swap_64_unaligned(void* dest_ptr, const void* src_ptr,
       _mm_set_epi8(0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x00, 0x01,
                    0x02, 0x03, 0x04, 0x05, 0x06, 0x07);
 
-  size_t i;
-  for (i = 0; i + 2 <= count; i += 2) {
+  size_t i = 0;
+  if (HasAVX2()) {
+    i = copy_and_swap_avx2(dest, src, count * sizeof(*src), shufmask) /
+        sizeof(*src);
+  }
+  for (; i + 2 <= count; i += 2) {
     __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output = _mm_shuffle_epi8(input, shufmask);
     _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
@@ -197,6 +332,83 @@ void copy_and_swap_16_in_32_unaligned(void* dest_ptr, const void* src_ptr,
     dest[i] = (src[i] >> 16) | (src[i] << 16);
   }
 }
+
+size_t count_equal_bytes(const void* a_ptr, const void* b_ptr, size_t size) {
+  auto a = reinterpret_cast<const uint8_t*>(a_ptr);
+  auto b = reinterpret_cast<const uint8_t*>(b_ptr);
+  size_t count = 0;
+  size_t i = 0;
+  if (HasAVX2()) {
+    i = count_equal_bytes_avx2(a, b, size, &count);
+  }
+  for (; i + 16 <= size; i += 16) {
+    __m128i a_bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&a[i]));
+    __m128i b_bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&b[i]));
+    count += xe::bit_count(
+        uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(a_bytes, b_bytes))));
+  }
+  for (; i < size; ++i) {  // handle residual elements
+    count += a[i] == b[i];
+  }
+  return count;
+}
+
+size_t count_equal_32(const void* src_ptr, uint32_t value, size_t count) {
+  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
+  size_t equal_count = 0;
+  size_t i = 0;
+  if (HasAVX2()) {
+    i = count_equal_32_avx2(src, value, count, &equal_count);
+  }
+  __m128i value_128 = _mm_set1_epi32(int32_t(value));
+  for (; i + 4 <= count; i += 4) {
+    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
+    equal_count += xe::bit_count(uint32_t(_mm_movemask_ps(
+        _mm_castsi128_ps(_mm_cmpeq_epi32(input, value_128)))));
+  }
+  for (; i < count; ++i) {  // handle residual elements
+    equal_count += src[i] == value;
+  }
+  return equal_count;
+}
+
+void fill_32(void* dest_ptr, uint32_t value, size_t count) {
+  auto dest = reinterpret_cast<uint32_t*>(dest_ptr);
+  size_t i = 0;
+  if (HasAVX2()) {
+    i = fill_32_avx2(dest, value, count);
+  }
+  __m128i value_128 = _mm_set1_epi32(int32_t(value));
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), value_128);
+  }
+  for (; i < count; ++i) {  // handle residual elements
+    dest[i] = value;
+  }
+}
+
+size_t find_32(const void* src_ptr, uint32_t value, size_t count) {
+  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
+  size_t i = 0;
+  if (HasAVX2()) {
+    i = find_32_avx2(src, value, count);
+  }
+  __m128i value_128 = _mm_set1_epi32(int32_t(value));
+  for (; i + 4 <= count; i += 4) {
+    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
+    uint32_t mask = uint32_t(
+        _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(input, value_128))));
+    if (mask) {
+      return i + xe::tzcnt(mask);
+    }
+  }
+  for (; i < count; ++i) {  // handle residual elements
+    if (src[i] == value) {
+      return i;
+    }
+  }
+  return count;
+}
 #else
 // Generic routines.
 void copy_and_swap_16_aligned(void* dest, const void* src, size_t count) {
@@ -250,6 +462,31 @@ void copy_and_swap_16_in_32_unaligned(void* dest_ptr, const void* src_ptr,
     dest[i] = (src[i] >> 16) | (src[i] << 16);
   }
 }
+
+size_t count_equal_bytes(const void* a_ptr, const void* b_ptr, size_t size) {
+  auto a = reinterpret_cast<const uint8_t*>(a_ptr);
+  auto b = reinterpret_cast<const uint8_t*>(b_ptr);
+  size_t count = 0;
+  for (size_t i = 0; i < size; ++i) {
+    count += a[i] == b[i];
+  }
+  return count;
+}
+
+size_t count_equal_32(const void* src_ptr, uint32_t value, size_t count) {
+  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
+  return std::count(src, src + count, value);
+}
+
+void fill_32(void* dest_ptr, uint32_t value, size_t count) {
+  auto dest = reinterpret_cast<uint32_t*>(dest_ptr);
+  std::fill_n(dest, count, value);
+}
+
+size_t find_32(const void* src_ptr, uint32_t value, size_t count) {
+  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
+  return std::find(src, src + count, value) - src;
+}
 #endif
 
 }  // namespace xe
@@ -60,6 +60,16 @@ bool IsWritableExecutableMemorySupported();
 // writable executable memory on a system with it.
 bool IsWritableExecutableMemoryPreferred();
 
+// Whether large, frequently accessed regions should be backed by huge host
+// pages to reduce TLB misses, as requested by the user.
+bool IsHugePageBackingPreferred();
+
+// Hints that the pages in the range should be backed by huge host pages where
+// possible, such as transparent huge pages on Linux. Protection of individual
+// pages keeps working, but splits the huge pages it affects. Returns false if
+// the host doesn't support the hint.
+bool AdviseHugePages(void* base_address, size_t length);
+
 // Allocates a block of memory at the given page-aligned base address.
 // Fails if the memory is not available.
 // Specify nullptr for base_address to leave it up to the system.
@@ -156,6 +166,16 @@ void copy_and_swap_16_in_32_aligned(void* dest, const void* src, size_t count);
 void copy_and_swap_16_in_32_unaligned(void* dest, const void* src,
                                       size_t count);
 
+// Returns the number of positions at which the bytes of a and b are equal.
+size_t count_equal_bytes(const void* a, const void* b, size_t size);
+// Returns the number of 32-bit elements equal to value, which is compared
+// without swapping.
+size_t count_equal_32(const void* src, uint32_t value, size_t count);
+void fill_32(void* dest, uint32_t value, size_t count);
+// Returns the index of the first 32-bit element equal to value, or count if
+// there's none.
+size_t find_32(const void* src, uint32_t value, size_t count);
+
 template <typename T>
 void copy_and_swap(T* dest, const T* src, size_t count) {
   bool is_aligned = reinterpret_cast<uintptr_t>(dest) % 32 == 0 &&
@@ -82,6 +82,16 @@ bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
   return false;
 }
 
+bool AdviseHugePages(void* base_address, size_t length) {
+#ifdef MADV_HUGEPAGE
+  // Explicit huge pages (MAP_HUGETLB) aren't used as they can't be protected
+  // or unmapped in parts, and need to be reserved by the system administrator.
+  return madvise(base_address, length, MADV_HUGEPAGE) == 0;
+#else
+  return false;
+#endif
+}
+
 FileMappingHandle CreateFileMappingHandle(const std::filesystem::path& path,
                                           size_t length, PageAccess access,
                                           bool commit) {
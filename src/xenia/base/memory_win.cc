@@ -172,6 +172,12 @@ bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
   return true;
 }
 
+bool AdviseHugePages(void* base_address, size_t length) {
+  // Large pages on Windows require SeLockMemoryPrivilege, must be allocated
+  // with MEM_LARGE_PAGES upfront, and can't be protected in parts.
+  return false;
+}
+
 FileMappingHandle CreateFileMappingHandle(const std::filesystem::path& path,
                                           size_t length, PageAccess access,
                                           bool commit) {
@@ -9,10 +9,20 @@
 
 #include "xenia/base/memory.h"
 
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#if XE_PLATFORM_LINUX
+#include <sys/mman.h>
+#endif  // XE_PLATFORM_LINUX
+
 #include "third_party/catch/include/catch.hpp"
 #include "third_party/fmt/include/fmt/format.h"
 
 #include "xenia/base/clock.h"
+#include "xenia/base/math.h"
 
 namespace xe {
 namespace base {
@@ -417,6 +427,183 @@ TEST_CASE("copy_and_swap_16_in_32_unaligned", "Copy and Swap") {
   REQUIRE(true == true);
 }
 
+TEST_CASE("count_equal_bytes", "Bulk Memory") {
+  std::vector<uint8_t> a(1000), b(1000);
+  size_t expected_count = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    a[i] = uint8_t(i);
+    b[i] = uint8_t(i % 7 ? i : ~i);
+    expected_count += a[i] == b[i];
+  }
+  // All sizes and offsets to cover the residual elements.
+  for (size_t offset = 0; offset < 40; ++offset) {
+    size_t size = a.size() - offset;
+    size_t count = 0;
+    for (size_t i = offset; i < a.size(); ++i) {
+      count += a[i] == b[i];
+    }
+    REQUIRE(count_equal_bytes(&a[offset], &b[offset], size) == count);
+  }
+  REQUIRE(count_equal_bytes(a.data(), b.data(), a.size()) == expected_count);
+  REQUIRE(count_equal_bytes(a.data(), a.data(), a.size()) == a.size());
+  REQUIRE(count_equal_bytes(a.data(), b.data(), 0) == 0);
+}
+
+TEST_CASE("count_equal_32", "Bulk Memory") {
+  std::vector<uint32_t> src(1000);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = i % 3 ? 0x12345678 : uint32_t(i);
+  }
+  for (size_t count = 0; count < 40; ++count) {
+    REQUIRE(count_equal_32(src.data(), 0x12345678, count) ==
+            size_t(std::count(src.begin(), src.begin() + count, 0x12345678)));
+  }
+  REQUIRE(count_equal_32(src.data() + 1, 0x12345678, src.size() - 1) ==
+          size_t(std::count(src.begin() + 1, src.end(), 0x12345678)));
+}
+
+TEST_CASE("fill_32", "Bulk Memory") {
+  for (size_t count = 0; count < 40; ++count) {
+    std::vector<uint32_t> dest(count + 2, 0);
+    fill_32(&dest[1], 0xABCD1234, count);
+    REQUIRE(dest[0] == 0);
+    REQUIRE(std::count(dest.begin() + 1, dest.end() - 1, 0xABCD1234) ==
+            int(count));
+    REQUIRE(dest.back() == 0);
+  }
+}
+
+TEST_CASE("find_32", "Bulk Memory") {
+  std::vector<uint32_t> src(100, 0);
+  REQUIRE(find_32(src.data(), 1, src.size()) == src.size());
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = 1;
+    REQUIRE(find_32(src.data(), 1, src.size()) == i);
+    REQUIRE(find_32(src.data(), 1, i) == i);
+    src[i] = 0;
+  }
+}
+
+// Timing only - hidden, run with the [benchmark] tag. Compares the bulk
+// functions to the loops they replace.
+TEST_CASE("Bulk Memory Throughput", "[.][benchmark]") {
+  const size_t size = 16 * 1024 * 1024;
+  const uint32_t iteration_count = 16;
+  std::vector<uint8_t> a(size), b(size);
+  for (size_t i = 0; i < size; ++i) {
+    a[i] = uint8_t(i * 7);
+    b[i] = uint8_t(i % 5 ? i * 7 : i);
+  }
+  auto a32 = reinterpret_cast<uint32_t*>(a.data());
+  auto b32 = reinterpret_cast<uint32_t*>(b.data());
+  size_t result = 0;
+  auto time = [&](const char* name, auto function) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iteration_count; ++i) {
+      result += function();
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    WARN(name << ": " << duration.count() / iteration_count << " us");
+  };
+
+  time("copy_and_swap_32 (scalar)", [&]() {
+    for (size_t i = 0; i < size / 4; ++i) {
+      b32[i] = xe::byte_swap(a32[i]);
+    }
+    return b32[1];
+  });
+  time("copy_and_swap_32", [&]() {
+    copy_and_swap_32_unaligned(b32, a32, size / 4);
+    return b32[1];
+  });
+  time("count_equal_bytes (scalar)", [&]() {
+    size_t count = 0;
+    for (size_t i = 0; i < size; ++i) {
+      count += a[i] == b[i];
+    }
+    return count;
+  });
+  time("count_equal_bytes",
+       [&]() { return count_equal_bytes(a.data(), b.data(), size); });
+  time("count_equal_32 (scalar)", [&]() {
+    size_t count = 0;
+    for (size_t i = 0; i < size / 4; ++i) {
+      count += a32[i] == 0x12345678;
+    }
+    return count;
+  });
+  time("count_equal_32",
+       [&]() { return count_equal_32(a32, 0x12345678, size / 4); });
+  time("fill_32 (scalar)", [&]() {
+    for (size_t i = 0; i < size / 4; ++i) {
+      b32[i] = 0x12345678;
+    }
+    return b32[1];
+  });
+  time("fill_32", [&]() {
+    fill_32(b32, 0x12345678, size / 4);
+    return b32[1];
+  });
+  time("find_32 (scalar)", [&]() {
+    size_t i = 0;
+    while (i < size / 4 && b32[i] != 0xFFFFFFFF) {
+      ++i;
+    }
+    return i;
+  });
+  time("find_32", [&]() { return find_32(b32, 0xFFFFFFFF, size / 4); });
+  REQUIRE(result != 0);
+}
+
+// Timing only - hidden, run with the [benchmark] tag. Dependent random reads
+// over a file mapping view, like guest memory, much larger than what the TLB
+// covers with small pages.
+TEST_CASE("Random Access With Huge Pages", "[.][benchmark]") {
+  const size_t size = 512 * 1024 * 1024;
+  const uint32_t read_count = 4 * 1024 * 1024;
+  for (bool huge_pages : {false, true}) {
+    auto path = fmt::format("xenia_test_{}", Clock::QueryHostTickCount());
+    auto mapping = xe::memory::CreateFileMappingHandle(
+        path, size, xe::memory::PageAccess::kReadWrite, false);
+    REQUIRE(mapping != xe::memory::kFileMappingHandleInvalid);
+    auto data = reinterpret_cast<uint64_t*>(xe::memory::MapFileView(
+        mapping, nullptr, size, xe::memory::PageAccess::kReadWrite, 0));
+    REQUIRE(data != nullptr);
+    if (huge_pages) {
+      if (!xe::memory::AdviseHugePages(data, size)) {
+        WARN("Huge pages are not supported on this host");
+        xe::memory::UnmapFileView(mapping, data, size);
+        xe::memory::CloseFileMappingHandle(mapping, path);
+        continue;
+      }
+    } else {
+#if XE_PLATFORM_LINUX
+      // Keep the baseline on small pages when transparent huge pages are
+      // enabled in the "always" mode.
+      madvise(data, size, MADV_NOHUGEPAGE);
+#endif  // XE_PLATFORM_LINUX
+    }
+    std::memset(data, 0, size);
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t index = 0;
+    for (uint32_t i = 0; i < read_count; ++i) {
+      index = (index * 6364136223846793005ull + 1442695040888963407ull +
+               data[index]) &
+              (size / sizeof(uint64_t) - 1);
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    WARN((huge_pages ? "Huge pages" : "Small pages")
+         << ": " << read_count << " reads: " << duration.count() << " us");
+    REQUIRE(index < size / sizeof(uint64_t));
+
+    xe::memory::UnmapFileView(mapping, data, size);
+    xe::memory::CloseFileMappingHandle(mapping, path);
+  }
+}
+
 TEST_CASE("create_and_close_file_mapping", "Virtual Memory Mapping") {
   auto path = fmt::format("xenia_test_{}", Clock::QueryHostTickCount());
   auto memory = xe::memory::CreateFileMappingHandle(
@@ -228,6 +228,135 @@ TEST_CASE("Wait on Multiple Handles", "Wait") {
   REQUIRE(all_result == WaitResult::kSuccess);
 }
 
+TEST_CASE("Wait on Multiple Handles from Multiple Threads", "Wait") {
+  const uint32_t thread_count = 4;
+  const uint32_t item_count = 4000;
+
+  // WaitAny consuming from two semaphores, with a lost wake-up causing a
+  // timeout.
+  auto semaphore_a = Semaphore::Create(0, item_count);
+  auto semaphore_b = Semaphore::Create(0, item_count);
+  auto stop_event = Event::CreateManualResetEvent(false);
+  std::atomic<uint32_t> consumed(0);
+  std::atomic<uint32_t> timeouts(0);
+  std::vector<std::thread> consumers;
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    consumers.emplace_back([&] {
+      std::vector<WaitHandle*> handles = {
+          semaphore_a.get(),
+          semaphore_b.get(),
+          stop_event.get(),
+      };
+      while (true) {
+        auto result = WaitAny(handles, false, 2000ms);
+        if (result.first != WaitResult::kSuccess) {
+          ++timeouts;
+          break;
+        }
+        if (result.second == 2) {
+          break;
+        }
+        ++consumed;
+      }
+    });
+  }
+  for (uint32_t i = 0; i < item_count; ++i) {
+    (i & 1 ? semaphore_b : semaphore_a)->Release(1, nullptr);
+    if (!(i & 63)) {
+      MaybeYield();
+    }
+  }
+  for (uint32_t i = 0; i < 400 && consumed < item_count; ++i) {
+    Sleep(5ms);
+  }
+  stop_event->Set();
+  for (auto& consumer : consumers) {
+    consumer.join();
+  }
+  REQUIRE(consumed == item_count);
+  REQUIRE(timeouts == 0);
+
+  // WaitAll acquiring two mutants atomically.
+  auto mutant_a = Mutant::Create(false);
+  auto mutant_b = Mutant::Create(false);
+  uint32_t counter = 0;
+  std::atomic<uint32_t> owners(0);
+  std::atomic<uint32_t> overlaps(0);
+  std::vector<std::thread> lockers;
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    lockers.emplace_back([&] {
+      std::vector<WaitHandle*> handles = {
+          mutant_a.get(),
+          mutant_b.get(),
+      };
+      for (uint32_t j = 0; j < item_count / thread_count; ++j) {
+        if (WaitAll(handles, false, 2000ms) != WaitResult::kSuccess) {
+          ++timeouts;
+          return;
+        }
+        if (owners.fetch_add(1)) {
+          ++overlaps;
+        }
+        ++counter;
+        owners.fetch_sub(1);
+        mutant_b->Release();
+        mutant_a->Release();
+      }
+    });
+  }
+  for (auto& locker : lockers) {
+    locker.join();
+  }
+  REQUIRE(timeouts == 0);
+  REQUIRE(overlaps == 0);
+  REQUIRE(counter == item_count);
+}
+
+// Timing only - hidden, run with the [benchmark] tag. Measures the round trip
+// of two threads waking each other with events while other threads wait on
+// unrelated events.
+TEST_CASE("Event Wake-up Latency", "[.][benchmark]") {
+  const uint32_t round_trip_count = 2000;
+  for (uint32_t idle_count : {0u, 16u, 64u}) {
+    std::vector<std::unique_ptr<Event>> idle_events;
+    std::vector<std::thread> idle_threads;
+    for (uint32_t i = 0; i < idle_count; ++i) {
+      idle_events.push_back(Event::CreateAutoResetEvent(false));
+      auto idle_event = idle_events.back().get();
+      idle_threads.emplace_back([idle_event] { Wait(idle_event, false); });
+    }
+
+    auto ping = Event::CreateAutoResetEvent(false);
+    auto pong = Event::CreateAutoResetEvent(false);
+    auto responder = std::thread([&ping, &pong, round_trip_count] {
+      for (uint32_t i = 0; i < round_trip_count; ++i) {
+        Wait(ping.get(), false);
+        pong->Set();
+      }
+    });
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < round_trip_count; ++i) {
+      ping->Set();
+      REQUIRE(Wait(pong.get(), false, 2000ms) == WaitResult::kSuccess);
+    }
+    auto duration = std::chrono::steady_clock::now() - start;
+    responder.join();
+
+    for (auto& idle_event : idle_events) {
+      idle_event->Set();
+    }
+    for (auto& idle_thread : idle_threads) {
+      idle_thread.join();
+    }
+    WARN(idle_count << " idle waiters: "
+                    << std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           duration)
+                               .count() /
+                           round_trip_count
+                    << " ns per round trip");
+  }
+}
+
 TEST_CASE("Signal and Wait") {
   WaitResult result;
   auto mutant = Mutant::Create(true);
@@ -244,6 +373,124 @@ TEST_CASE("Signal and Wait") {
   REQUIRE(result == WaitResult::kSuccess);
 }
 
+TEST_CASE("Wait on Futex", "Futex") {
+  volatile uint32_t value = 0;
+  WaitResult result;
+
+  // Call wait with a different value
+  result = FutexWait(&value, 1, 50ms);
+  REQUIRE(result == WaitResult::kSuccess);
+
+  // Call wait with no wake
+  result = FutexWait(&value, 0, 50ms);
+  REQUIRE(result == WaitResult::kTimeout);
+
+  // Wake a waiting thread
+  std::atomic<bool> woken(false);
+  auto thread = std::thread([&value, &woken] {
+    while (value == 0) {
+      FutexWait(&value, 0);
+    }
+    woken = true;
+  });
+  Sleep(50ms);
+  REQUIRE(!woken);
+  value = 1;
+  FutexWake(&value);
+  thread.join();
+  REQUIRE(woken);
+
+  // Waking without waiters
+  FutexWake(&value, true);
+}
+
+// Lock with the protocol of guest critical sections - a count of the threads
+// in or waiting for the lock, and an auto-reset event handing the lock over
+// to a single waiter on release.
+template <typename T>
+class ContentionTestLock {
+ public:
+  void Lock() {
+    if (lock_count_.fetch_add(1) != -1) {
+      waiter_.Wait();
+    }
+  }
+  void Unlock() {
+    if (lock_count_.fetch_sub(1) != 0) {
+      waiter_.Set();
+    }
+  }
+
+ private:
+  std::atomic<int32_t> lock_count_{-1};
+  T waiter_;
+};
+
+class FutexContentionWaiter {
+ public:
+  void Wait() {
+    uint32_t signaled = 1;
+    while (!signal_state_.compare_exchange_strong(signaled, 0)) {
+      FutexWait(reinterpret_cast<volatile uint32_t*>(&signal_state_), 0);
+      signaled = 1;
+    }
+  }
+  void Set() {
+    signal_state_ = 1;
+    FutexWake(reinterpret_cast<volatile uint32_t*>(&signal_state_));
+  }
+
+ private:
+  std::atomic<uint32_t> signal_state_{0};
+};
+
+class EventContentionWaiter {
+ public:
+  void Wait() { threading::Wait(event_.get(), false); }
+  void Set() { event_->Set(); }
+
+ private:
+  std::unique_ptr<Event> event_ = Event::CreateAutoResetEvent(false);
+};
+
+template <typename T>
+std::chrono::microseconds RunLockContention(uint32_t thread_count,
+                                            uint32_t iteration_count) {
+  ContentionTestLock<T> lock;
+  uint64_t counter = 0;
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    threads.emplace_back([&lock, &counter, iteration_count] {
+      for (uint32_t j = 0; j < iteration_count; ++j) {
+        lock.Lock();
+        ++counter;
+        lock.Unlock();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto duration = std::chrono::steady_clock::now() - start;
+  REQUIRE(counter == uint64_t(thread_count) * iteration_count);
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration);
+}
+
+// Timing only - hidden, run with the [benchmark] tag.
+TEST_CASE("Critical Section Lock Contention", "[.][benchmark]") {
+  const uint32_t iteration_count = 100000;
+  for (uint32_t thread_count : {2u, 4u, 8u}) {
+    auto futex_time =
+        RunLockContention<FutexContentionWaiter>(thread_count, iteration_count);
+    auto event_time =
+        RunLockContention<EventContentionWaiter>(thread_count, iteration_count);
+    WARN(thread_count << " threads x " << iteration_count
+                      << " iterations: futex " << futex_time.count()
+                      << " us, event " << event_time.count() << " us");
+  }
+}
+
 TEST_CASE("Wait on Event", "Event") {
   auto evt = Event::CreateAutoResetEvent(false);
   WaitResult result;
@@ -827,6 +1074,112 @@ TEST_CASE("Create and Run Thread", "Thread") {
   // TODO(bwrsandman): Test setting and getting thread affinity
 }
 
+TEST_CASE("Terminate Threads Blocked in Waits", "Thread") {
+  auto event_a = Event::CreateAutoResetEvent(false);
+  auto event_b = Event::CreateAutoResetEvent(false);
+  auto semaphore = Semaphore::Create(0, 1);
+  Thread::CreationParameters params = {};
+  WaitResult result;
+
+  auto threads = std::array<std::unique_ptr<Thread>, 2>{
+      Thread::Create(params,
+                     [&] {
+                       WaitAny({event_a.get(), semaphore.get()}, false);
+                     }),
+      Thread::Create(params,
+                     [&] {
+                       WaitAll({event_a.get(), event_b.get(), semaphore.get()},
+                               false);
+                     }),
+  };
+  for (auto& thread : threads) {
+    result = Wait(thread.get(), false, 50ms);
+    REQUIRE(result == WaitResult::kTimeout);
+    thread->Terminate(-1);
+    result = Wait(thread.get(), false, 50ms);
+    REQUIRE(result == WaitResult::kSuccess);
+  }
+
+  // The terminated waiters must not be notified, nor consume the signal - fill
+  // the stacks they were on, likely reused by new threads, to see if they're
+  // written to
+  auto done = Event::CreateManualResetEvent(false);
+  std::atomic<bool> stacks_intact(true);
+  auto fill_stack = [&] {
+    std::array<volatile uint8_t, 32 * 1024> stack_fill;
+    for (auto& value : stack_fill) {
+      value = 0xCD;
+    }
+    Wait(done.get(), false);
+    for (auto& value : stack_fill) {
+      if (value != 0xCD) {
+        stacks_intact = false;
+      }
+    }
+  };
+  for (auto& thread : threads) {
+    thread = Thread::Create(params, fill_stack);
+  }
+  Sleep(20ms);
+  event_a->Set();
+  event_b->Set();
+  REQUIRE(semaphore->Release(1, nullptr));
+  done->Set();
+  for (auto& thread : threads) {
+    result = Wait(thread.get(), false, 50ms);
+    REQUIRE(result == WaitResult::kSuccess);
+  }
+  REQUIRE(stacks_intact);
+  result =
+      WaitAll({event_a.get(), event_b.get(), semaphore.get()}, false, 50ms);
+  REQUIRE(result == WaitResult::kSuccess);
+
+  // New waiters on the same objects are still woken
+  auto thread = Thread::Create(params, [&] {
+    WaitAll({event_a.get(), event_b.get(), semaphore.get()}, false);
+  });
+  result = Wait(thread.get(), false, 50ms);
+  REQUIRE(result == WaitResult::kTimeout);
+  event_a->Set();
+  event_b->Set();
+  REQUIRE(semaphore->Release(1, nullptr));
+  result = Wait(thread.get(), false, 50ms);
+  REQUIRE(result == WaitResult::kSuccess);
+}
+
+TEST_CASE("Set Thread Priority and Query Statistics", "Thread") {
+  ThreadStatistics statistics;
+  std::atomic<bool> busy_done(false);
+  std::atomic<bool> statistics_queried(false);
+  auto thread = Thread::Create({}, [&busy_done, &statistics_queried] {
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < 100ms) {
+    }
+    busy_done = true;
+    while (!statistics_queried) {
+      Sleep(1ms);
+    }
+  });
+
+  // Lowered priorities can be raised back to normal without privileges.
+  thread->set_priority(ThreadPriority::kLowest);
+  REQUIRE(thread->priority() == int32_t(ThreadPriority::kLowest));
+  thread->set_priority(ThreadPriority::kNormal);
+  REQUIRE(thread->priority() == int32_t(ThreadPriority::kNormal));
+  thread->set_priority(ThreadPriority::kBelowNormal);
+  REQUIRE(thread->priority() == int32_t(ThreadPriority::kBelowNormal));
+
+  while (!busy_done) {
+    Sleep(1ms);
+  }
+  REQUIRE(thread->QueryStatistics(&statistics));
+  REQUIRE(statistics.user_time + statistics.kernel_time >= 10ms);
+  statistics_queried = true;
+
+  auto result = Wait(thread.get(), false, 1000ms);
+  REQUIRE(result == WaitResult::kSuccess);
+}
+
 TEST_CASE("Test Suspending Thread", "Thread") {
   std::unique_ptr<Thread> thread;
   WaitResult result;
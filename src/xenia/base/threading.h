@@ -240,6 +240,18 @@ inline std::pair<WaitResult, size_t> WaitAny(
                  timeout);
 }
 
+// Waits while the 32-bit value at the address is equal to expected, until
+// FutexWake is called for the address or the timeout interval elapses, without
+// creating any object (a futex on Linux, WaitOnAddress on Windows). The wait
+// may also end spuriously, so the value must be checked again. Only the
+// threads waiting on the same host address are woken, so memory mapped at
+// multiple addresses must always be waited on through the same one.
+WaitResult FutexWait(
+    volatile uint32_t* address, uint32_t expected,
+    std::chrono::milliseconds timeout = std::chrono::milliseconds::max());
+// Wakes one thread waiting on the address, or all if wake_all is true.
+void FutexWake(volatile uint32_t* address, bool wake_all = false);
+
 // Models a Win32-like event object.
 // https://msdn.microsoft.com/en-us/library/windows/desktop/ms682396(v=vs.85).aspx
 class Event : public WaitHandle {
@@ -357,6 +369,16 @@ struct ThreadPriority {
   static const int32_t kHighest = 2;
 };
 
+// Scheduling statistics of a thread since it was created.
+struct ThreadStatistics {
+  std::chrono::microseconds user_time{0};
+  std::chrono::microseconds kernel_time{0};
+  // Times the thread gave up the processor, usually to wait.
+  uint64_t voluntary_context_switches = 0;
+  // Times the thread was preempted by another thread.
+  uint64_t involuntary_context_switches = 0;
+};
+
 // Models a Win32-like thread object.
 // https://msdn.microsoft.com/en-us/library/windows/desktop/ms682453(v=vs.85).aspx
 class Thread : public WaitHandle {
@@ -406,6 +428,11 @@ class Thread : public WaitHandle {
   // process of a thread.
   virtual void set_affinity_mask(uint64_t new_affinity_mask) = 0;
 
+  // Gets the time the thread has run for and how many times it has been
+  // switched out. Context switches are not counted on all platforms. Returns
+  // false if the statistics can't be queried, such as after the thread exits.
+  virtual bool QueryStatistics(ThreadStatistics* out_statistics) = 0;
+
   // Adds a user-mode asynchronous procedure call request to the thread queue.
   // When a user-mode APC is queued, the thread is not directed to call the APC
   // function unless it is in an alertable state. After the thread is in an
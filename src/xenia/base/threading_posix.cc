@@ -10,17 +10,22 @@
 #include "xenia/base/threading.h"
 
 #include "xenia/base/assert.h"
+#include "xenia/base/atomic.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/platform.h"
 
+#include <linux/futex.h>
 #include <pthread.h>
 #include <signal.h>
 #include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <array>
+#include <cstdio>
 #include <cstring>
 #include <ctime>
 #include <memory>
@@ -190,93 +195,238 @@ std::unique_ptr<HighResolutionTimer> HighResolutionTimer::CreateRepeating(
   return std::unique_ptr<HighResolutionTimer>(timer.release());
 }
 
+WaitResult FutexWait(volatile uint32_t* address, uint32_t expected,
+                     std::chrono::milliseconds timeout) {
+  timespec timeout_spec;
+  timespec* timeout_ptr = nullptr;
+  if (timeout != std::chrono::milliseconds::max()) {
+    timeout_spec = DurationToTimeSpec(timeout);
+    timeout_ptr = &timeout_spec;
+  }
+  if (syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, timeout_ptr,
+              nullptr, 0) == 0) {
+    return WaitResult::kSuccess;
+  }
+  switch (errno) {
+    case EAGAIN:
+    case EINTR:
+      // The value has already changed, or a signal such as the one used for
+      // suspending the thread has been handled - the caller checks again.
+      return WaitResult::kSuccess;
+    case ETIMEDOUT:
+      return WaitResult::kTimeout;
+    default:
+      return WaitResult::kFailed;
+  }
+}
+
+void FutexWake(volatile uint32_t* address, bool wake_all) {
+  syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, wake_all ? INT_MAX : 1,
+          nullptr, nullptr, 0);
+}
+
+// A thread blocked in a wait, woken by the objects it's registered on when
+// their state changes. It sleeps on a futex, so a notification wakes only this
+// thread, without any lock to contend for.
+class PosixWaiter {
+ public:
+  // Called with the lock of the notifying object held, and a waiter is
+  // unregistered with it held before being destroyed.
+  void Notify() {
+    xe::atomic_exchange(uint32_t(1), &notified_);
+    FutexWake(&notified_);
+  }
+
+  // Must be called with the locks of the objects waited on held, so a
+  // notification can't be lost between the check of their state and the wait.
+  void Reset() { notified_ = 0; }
+
+  // Returns false if the deadline has passed without a notification.
+  bool Wait(bool infinite,
+            std::chrono::steady_clock::time_point deadline) {
+    while (!notified_) {
+      if (infinite) {
+        FutexWait(&notified_, 0);
+        continue;
+      }
+      auto now = std::chrono::steady_clock::now();
+      if (now >= deadline) {
+        return false;
+      }
+      FutexWait(&notified_, 0,
+                std::chrono::ceil<std::chrono::milliseconds>(deadline - now));
+    }
+    return true;
+  }
+
+ private:
+  volatile uint32_t notified_ = 0;
+};
+
 class PosixConditionBase {
  public:
   virtual bool Signal() = 0;
 
   WaitResult Wait(std::chrono::milliseconds timeout) {
-    bool executed;
-    auto predicate = [this] { return this->signaled(); };
-    auto lock = std::unique_lock<std::mutex>(mutex_);
-    if (predicate()) {
-      executed = true;
-    } else {
-      if (timeout == std::chrono::milliseconds::max()) {
-        cond_.wait(lock, predicate);
-        executed = true;  // Did not time out;
-      } else {
-        executed = cond_.wait_for(lock, timeout, predicate);
+    {
+      auto lock = std::unique_lock<std::mutex>(mutex_);
+      if (signaled()) {
+        post_execution();
+        return WaitResult::kSuccess;
+      }
+      if (timeout == std::chrono::milliseconds::zero()) {
+        return WaitResult::kTimeout;
       }
     }
-    if (executed) {
-      post_execution();
-      return WaitResult::kSuccess;
-    } else {
-      return WaitResult::kTimeout;
-    }
+    return WaitMultiple({this}, false, timeout).first;
   }
 
+  // Each object has its own lock and list of waiters, and only the threads
+  // waiting on an object are woken when its state changes. The locks of all
+  // the objects are taken, in the order of their addresses, to check and
+  // modify their state atomically in WaitAll.
   static std::pair<WaitResult, size_t> WaitMultiple(
       std::vector<PosixConditionBase*>&& handles, bool wait_all,
       std::chrono::milliseconds timeout) {
-    using iter_t = std::vector<PosixConditionBase*>::const_iterator;
-    bool executed;
-    auto predicate = [](auto h) { return h->signaled(); };
-
-    // Construct a condition for all or any depending on wait_all
-    auto operation = wait_all ? std::all_of<iter_t, decltype(predicate)>
-                              : std::any_of<iter_t, decltype(predicate)>;
-    auto aggregate = [&handles, operation, predicate] {
-      return operation(handles.cbegin(), handles.cend(), predicate);
-    };
-
-    // TODO(bwrsandman, Triang3l) This is controversial, see issue #1677
-    // This will probably cause a deadlock on the next thread doing any waiting
-    // if the thread is suspended between locking and waiting
-    std::unique_lock<std::mutex> lock(PosixConditionBase::mutex_);
-
-    // Check if the aggregate lambda (all or any) is already satisfied
-    if (aggregate()) {
-      executed = true;
-    } else {
-      // If the aggregate is not yet satisfied and the timeout is infinite,
-      // wait without timeout.
-      if (timeout == std::chrono::milliseconds::max()) {
-        PosixConditionBase::cond_.wait(lock, aggregate);
-        executed = true;
-      } else {
-        // Wait with timeout.
-        executed = PosixConditionBase::cond_.wait_for(lock, timeout, aggregate);
-      }
+    std::vector<PosixConditionBase*> lock_order(handles);
+    std::sort(lock_order.begin(), lock_order.end());
+    lock_order.erase(std::unique(lock_order.begin(), lock_order.end()),
+                     lock_order.end());
+
+    bool infinite = timeout == std::chrono::milliseconds::max();
+    std::chrono::steady_clock::time_point deadline;
+    if (!infinite) {
+      deadline = std::chrono::steady_clock::now() + timeout;
     }
-    if (executed) {
+
+    // The locks of the objects must not be held by a terminated thread, and the
+    // waiter must not stay registered after the stack it's on is gone.
+    bool termination_was_deferred = SetTerminationDeferred(true);
+    PosixWaiter waiter;
+    WaiterRegistration registration = {&lock_order, &waiter};
+    bool registered = false;
+    while (true) {
+      for (auto handle : lock_order) {
+        handle->mutex_.lock();
+      }
+
+      // Check if all or any of the objects are signaled depending on wait_all.
+      bool executed =
+          wait_all ? std::all_of(handles.cbegin(), handles.cend(),
+                                 [](auto h) { return h->signaled(); })
+                   : std::any_of(handles.cbegin(), handles.cend(),
+                                 [](auto h) { return h->signaled(); });
       auto first_signaled = std::numeric_limits<size_t>::max();
-      for (auto i = 0u; i < handles.size(); ++i) {
-        if (handles[i]->signaled()) {
-          if (first_signaled > i) {
-            first_signaled = i;
+      if (executed) {
+        for (auto i = 0u; i < handles.size(); ++i) {
+          if (handles[i]->signaled()) {
+            if (first_signaled > i) {
+              first_signaled = i;
+            }
+            handles[i]->post_execution();
+            if (!wait_all) break;
+          }
+        }
+      }
+      bool timed_out = !executed && !infinite &&
+                       std::chrono::steady_clock::now() >= deadline;
+
+      if (executed || timed_out) {
+        if (registered) {
+          for (auto handle : lock_order) {
+            auto& waiters = handle->waiters_;
+            waiters.erase(std::find(waiters.begin(), waiters.end(), &waiter));
           }
-          handles[i]->post_execution();
-          if (!wait_all) break;
         }
+        for (auto it = lock_order.crbegin(); it != lock_order.crend(); ++it) {
+          (*it)->mutex_.unlock();
+        }
+        SetTerminationDeferred(termination_was_deferred);
+        if (executed) {
+          return std::make_pair(WaitResult::kSuccess, first_signaled);
+        }
+        return std::make_pair<WaitResult, size_t>(WaitResult::kTimeout, 0);
+      }
+
+      if (!registered) {
+        for (auto handle : lock_order) {
+          handle->waiters_.push_back(&waiter);
+        }
+        registered = true;
+      }
+      waiter.Reset();
+      for (auto it = lock_order.crbegin(); it != lock_order.crend(); ++it) {
+        (*it)->mutex_.unlock();
+      }
+      // Checked again even if timed out, as the state may have changed at the
+      // same time.
+      // If the thread is terminated while blocked, the cleanup handler
+      // unregisters the waiter - called by the destructor of the cleanup object
+      // during the unwinding done by pthread_cancel, or by pthread_exit in the
+      // signal handler on Android.
+      pthread_cleanup_push(UnregisterWaiter, &registration);
+      if (!termination_was_deferred) {
+        SetTerminationDeferred(false);
       }
-      return std::make_pair(WaitResult::kSuccess, first_signaled);
-    } else {
-      return std::make_pair<WaitResult, size_t>(WaitResult::kTimeout, 0);
+      waiter.Wait(infinite, deadline);
+      SetTerminationDeferred(true);
+      pthread_cleanup_pop(0);
+    }
+  }
+
+  virtual void* native_handle() const { return mutex_.native_handle(); }
+
+ private:
+  struct WaiterRegistration {
+    const std::vector<PosixConditionBase*>* handles;
+    PosixWaiter* waiter;
+  };
+
+  static void UnregisterWaiter(void* registration_ptr) {
+    auto registration =
+        reinterpret_cast<const WaiterRegistration*>(registration_ptr);
+    for (auto handle : *registration->handles) {
+      std::lock_guard<std::mutex> lock(handle->mutex_);
+      auto& waiters = handle->waiters_;
+      waiters.erase(
+          std::find(waiters.begin(), waiters.end(), registration->waiter));
     }
   }
 
-  virtual void* native_handle() const { return cond_.native_handle(); }
+  // Defers or allows termination of the calling thread with pthread_cancel, or
+  // with the terminate signal on Android, returning whether it was deferred.
+  static bool SetTerminationDeferred(bool deferred) {
+#if XE_PLATFORM_ANDROID
+    int terminate_signal = GetSystemSignal(SignalType::kThreadTerminate);
+    sigset_t signal_set, old_signal_set;
+    sigemptyset(&signal_set);
+    sigaddset(&signal_set, terminate_signal);
+    pthread_sigmask(deferred ? SIG_BLOCK : SIG_UNBLOCK, &signal_set,
+                    &old_signal_set);
+    return sigismember(&old_signal_set, terminate_signal) == 1;
+#else
+    int old_state;
+    pthread_setcancelstate(
+        deferred ? PTHREAD_CANCEL_DISABLE : PTHREAD_CANCEL_ENABLE, &old_state);
+    return old_state == PTHREAD_CANCEL_DISABLE;
+#endif
+  }
 
  protected:
   inline virtual bool signaled() const = 0;
   inline virtual void post_execution() = 0;
-  static std::condition_variable cond_;
-  static std::mutex mutex_;
-};
 
-std::condition_variable PosixConditionBase::cond_;
-std::mutex PosixConditionBase::mutex_;
+  // Wakes the threads waiting on the object after it may have become
+  // signaled. Must be called with mutex_ held.
+  void NotifyWaiters() {
+    for (auto waiter : waiters_) {
+      waiter->Notify();
+    }
+  }
+
+  mutable std::mutex mutex_;
+  std::vector<PosixWaiter*> waiters_;
+};
 
 // There really is no native POSIX handle for a single wait/signal construct
 // pthreads is at a lower level with more handles for such a mechanism.
@@ -295,13 +445,9 @@ class PosixCondition<Event> : public PosixConditionBase {
   bool Signal() override {
     auto lock = std::unique_lock<std::mutex>(mutex_);
     signal_ = true;
-    if (manual_reset_) {
-      cond_.notify_all();
-    } else {
-      // FIXME(bwrsandman): Potential cause for deadlock
-      // See issue #1678 for possible fix and discussion
-      cond_.notify_one();
-    }
+    // All the waiters are woken even for an auto-reset event, as some may be
+    // waiting for other objects too - the first to lock it consumes it.
+    NotifyWaiters();
     return true;
   }
 
@@ -330,11 +476,11 @@ class PosixCondition<Semaphore> : public PosixConditionBase {
   bool Signal() override { return Release(1, nullptr); }
 
   bool Release(uint32_t release_count, int* out_previous_count) {
+    auto lock = std::unique_lock<std::mutex>(mutex_);
     if (maximum_count_ - count_ >= release_count) {
-      auto lock = std::unique_lock<std::mutex>(mutex_);
       if (out_previous_count) *out_previous_count = count_;
       count_ += release_count;
-      cond_.notify_all();
+      NotifyWaiters();
       return true;
     }
     return false;
@@ -342,10 +488,7 @@ class PosixCondition<Semaphore> : public PosixConditionBase {
 
  private:
   inline bool signaled() const override { return count_ > 0; }
-  inline void post_execution() override {
-    count_--;
-    cond_.notify_all();
-  }
+  inline void post_execution() override { count_--; }
   uint32_t count_;
   const uint32_t maximum_count_;
 };
@@ -368,15 +511,13 @@ class PosixCondition<Mutant> : public PosixConditionBase {
       --count_;
       // Free to be acquired by another thread
       if (count_ == 0) {
-        cond_.notify_one();
+        NotifyWaiters();
       }
       return true;
     }
     return false;
   }
 
-  void* native_handle() const override { return mutex_.native_handle(); }
-
  private:
   inline bool signaled() const override {
     return count_ == 0 || owner_ == std::this_thread::get_id();
@@ -437,11 +578,7 @@ class PosixCondition<Timer> : public PosixConditionBase {
       // Store callback
       if (callback_) callback = callback_;
       signal_ = true;
-      if (manual_reset_) {
-        cond_.notify_all();
-      } else {
-        cond_.notify_one();
-      }
+      NotifyWaiters();
     }
     // Call callback
     if (callback) callback();
@@ -535,7 +672,9 @@ class PosixCondition<Thread> : public PosixConditionBase {
       : thread_(thread),
         signaled_(false),
         exit_code_(0),
-        state_(State::kRunning) {
+        state_(State::kRunning),
+        system_tid_(pid_t(syscall(SYS_gettid))),
+        base_nice_(getpriority(PRIO_PROCESS, 0)) {
 #if XE_PLATFORM_ANDROID
     android_pre_api_26_name_[0] = '\0';
 #endif
@@ -629,7 +768,7 @@ class PosixCondition<Thread> : public PosixConditionBase {
     auto cpu_count = std::min(CPU_SETSIZE, 64);
     for (auto i = 0u; i < cpu_count; i++) {
       auto set = CPU_ISSET(i, &cpu_set);
-      result |= set << i;
+      result |= uint64_t(set ? 1 : 0) << i;
     }
     return result;
   }
@@ -639,7 +778,7 @@ class PosixCondition<Thread> : public PosixConditionBase {
     cpu_set_t cpu_set;
     CPU_ZERO(&cpu_set);
     for (auto i = 0u; i < 64; i++) {
-      if (mask & (1 << i)) {
+      if (mask & (uint64_t(1) << i)) {
         CPU_SET(i, &cpu_set);
       }
     }
@@ -657,22 +796,89 @@ class PosixCondition<Thread> : public PosixConditionBase {
 
   int priority() {
     WaitStarted();
-    int policy;
-    sched_param param{};
-    int ret = pthread_getschedparam(thread_, &policy, &param);
-    if (ret != 0) {
-      return -1;
-    }
-
-    return param.sched_priority;
+    return priority_;
   }
 
   void set_priority(int new_priority) {
     WaitStarted();
+    // Mapped to the non-real-time policies, as the real-time ones need
+    // privileges and may starve the rest of the system. Priorities below
+    // normal use SCHED_BATCH rather than a higher nice value, which couldn't be
+    // lowered back without privileges, like leaving SCHED_IDLE. Priorities
+    // above normal lower the nice value relative to the one the thread started
+    // with, which needs privileges - without them, the priority stays normal.
+    int32_t priority = std::min(std::max(new_priority, ThreadPriority::kLowest),
+                                ThreadPriority::kHighest);
+    int policy = priority < ThreadPriority::kNormal ? SCHED_BATCH : SCHED_OTHER;
     sched_param param{};
-    param.sched_priority = new_priority;
-    if (pthread_setschedparam(thread_, SCHED_FIFO, &param) != 0)
-      assert_always();
+    if (sched_setscheduler(system_tid_, policy, &param) != 0) {
+      return;
+    }
+    if (priority > ThreadPriority::kNormal &&
+        setpriority(PRIO_PROCESS, system_tid_, base_nice_ - priority * 5) !=
+            0) {
+      priority = ThreadPriority::kNormal;
+    }
+    if (priority <= ThreadPriority::kNormal) {
+      // Raising the nice value back doesn't need privileges.
+      setpriority(PRIO_PROCESS, system_tid_, base_nice_);
+    }
+    priority_ = priority;
+  }
+
+  bool QueryStatistics(ThreadStatistics* out_statistics) {
+    WaitStarted();
+    pid_t tid;
+    {
+      std::unique_lock<std::mutex> lock(state_mutex_);
+      if (state_ == State::kFinished) {
+        return false;
+      }
+      tid = system_tid_;
+    }
+    std::string task_path = "/proc/self/task/" + std::to_string(tid);
+
+    // The fields after the parenthesized name, which may contain spaces -
+    // utime and stime are the 14th and the 15th, in clock ticks.
+    FILE* file = std::fopen((task_path + "/stat").c_str(), "r");
+    if (!file) {
+      return false;
+    }
+    char stat[1024];
+    size_t stat_length = std::fread(stat, 1, sizeof(stat) - 1, file);
+    std::fclose(file);
+    stat[stat_length] = '\0';
+    const char* stat_fields = std::strrchr(stat, ')');
+    unsigned long long user_ticks, kernel_ticks;
+    if (!stat_fields ||
+        std::sscanf(stat_fields + 1,
+                    " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                    &user_ticks, &kernel_ticks) != 2) {
+      return false;
+    }
+    *out_statistics = ThreadStatistics();
+    uint64_t ticks_per_second = uint64_t(sysconf(_SC_CLK_TCK));
+    out_statistics->user_time =
+        std::chrono::microseconds(user_ticks * 1000000 / ticks_per_second);
+    out_statistics->kernel_time =
+        std::chrono::microseconds(kernel_ticks * 1000000 / ticks_per_second);
+
+    file = std::fopen((task_path + "/status").c_str(), "r");
+    if (!file) {
+      return false;
+    }
+    char line[256];
+    unsigned long long count;
+    while (std::fgets(line, sizeof(line), file)) {
+      if (std::sscanf(line, "voluntary_ctxt_switches: %llu", &count) == 1) {
+        out_statistics->voluntary_context_switches = count;
+      } else if (std::sscanf(line, "nonvoluntary_ctxt_switches: %llu",
+                             &count) == 1) {
+        out_statistics->involuntary_context_switches = count;
+      }
+    }
+    std::fclose(file);
+    return true;
   }
 
   void QueueUserCallback(std::function<void()> callback) {
@@ -741,7 +947,7 @@ class PosixCondition<Thread> : public PosixConditionBase {
 
     exit_code_ = exit_code;
     signaled_ = true;
-    cond_.notify_all();
+    NotifyWaiters();
 
 #ifdef XE_PLATFORM_ANDROID
     if (pthread_kill(thread, GetSystemSignal(SignalType::kThreadTerminate)) !=
@@ -786,6 +992,11 @@ class PosixCondition<Thread> : public PosixConditionBase {
   int exit_code_;
   volatile State state_;
   volatile uint32_t suspend_count_;
+  // Kernel thread ID, for the functions taking it rather than a pthread_t.
+  pid_t system_tid_ = 0;
+  // Nice value of the thread when it started, for the normal priority.
+  int base_nice_ = 0;
+  int32_t priority_ = ThreadPriority::kNormal;
   mutable std::mutex state_mutex_;
   mutable std::mutex callback_mutex_;
   mutable std::condition_variable state_signal_;
@@ -1009,6 +1220,10 @@ class PosixThread : public PosixConditionHandle<Thread> {
     handle_.set_affinity_mask(mask);
   }
 
+  bool QueryStatistics(ThreadStatistics* out_statistics) override {
+    return handle_.QueryStatistics(out_statistics);
+  }
+
   int priority() override { return handle_.priority(); }
   void set_priority(int new_priority) override {
     handle_.set_priority(new_priority);
@@ -1053,6 +1268,9 @@ void* PosixCondition<Thread>::ThreadStartRoutine(void* parameter) {
   current_thread_ = thread;
   {
     std::unique_lock<std::mutex> lock(thread->handle_.state_mutex_);
+    thread->handle_.system_tid_ = pid_t(syscall(SYS_gettid));
+    // Per thread on Linux, inherited from the creating thread.
+    thread->handle_.base_nice_ = getpriority(PRIO_PROCESS, 0);
     thread->handle_.state_ =
         create_suspended ? State::kSuspended : State::kRunning;
     thread->handle_.state_signal_.notify_all();
@@ -1072,10 +1290,10 @@ void* PosixCondition<Thread>::ThreadStartRoutine(void* parameter) {
     thread->handle_.state_ = State::kFinished;
   }
 
-  std::unique_lock<std::mutex> lock(mutex_);
+  std::unique_lock<std::mutex> lock(thread->handle_.mutex_);
   thread->handle_.exit_code_ = 0;
   thread->handle_.signaled_ = true;
-  cond_.notify_all();
+  thread->handle_.NotifyWaiters();
 
   current_thread_ = nullptr;
   return nullptr;
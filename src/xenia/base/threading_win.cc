@@ -234,6 +234,26 @@ std::pair<WaitResult, size_t> WaitMultiple(WaitHandle* wait_handles[],
   }
 }
 
+WaitResult FutexWait(volatile uint32_t* address, uint32_t expected,
+                     std::chrono::milliseconds timeout) {
+  DWORD timeout_ms = timeout == std::chrono::milliseconds::max()
+                         ? INFINITE
+                         : DWORD(timeout.count());
+  if (WaitOnAddress(address, &expected, sizeof(expected), timeout_ms)) {
+    return WaitResult::kSuccess;
+  }
+  return GetLastError() == ERROR_TIMEOUT ? WaitResult::kTimeout
+                                         : WaitResult::kFailed;
+}
+
+void FutexWake(volatile uint32_t* address, bool wake_all) {
+  if (wake_all) {
+    WakeByAddressAll(const_cast<uint32_t*>(address));
+  } else {
+    WakeByAddressSingle(const_cast<uint32_t*>(address));
+  }
+}
+
 class Win32Event : public Win32Handle<Event> {
  public:
   explicit Win32Event(HANDLE handle) : Win32Handle(handle) {}
@@ -374,6 +394,25 @@ class Win32Thread : public Win32Handle<Thread> {
     SetThreadAffinityMask(handle_, new_affinity_mask);
   }
 
+  bool QueryStatistics(ThreadStatistics* out_statistics) override {
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!GetThreadTimes(handle_, &creation_time, &exit_time, &kernel_time,
+                        &user_time)) {
+      return false;
+    }
+    // In 100 ns units.
+    auto to_microseconds = [](const FILETIME& time) {
+      return std::chrono::microseconds(
+          ((uint64_t(time.dwHighDateTime) << 32) | time.dwLowDateTime) / 10);
+    };
+    *out_statistics = ThreadStatistics();
+    out_statistics->user_time = to_microseconds(user_time);
+    out_statistics->kernel_time = to_microseconds(kernel_time);
+    // Context switches are only exposed for all the threads in the system,
+    // through NtQuerySystemInformation.
+    return true;
+  }
+
   struct ApcData {
     std::function<void()> callback;
   };
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_BACKEND_BACKEND_H_
 #define XENIA_CPU_BACKEND_BACKEND_H_
 
+#include <filesystem>
 #include <memory>
 
 #include "xenia/cpu/backend/machine_info.h"
@@ -54,6 +55,24 @@ class Backend {
   virtual std::unique_ptr<GuestFunction> CreateGuestFunction(
       Module* module, uint32_t address) = 0;
 
+  // Opens the persistent storage of code generated for the guest code range of
+  // the module, if the backend supports it. Code stored in previous sessions
+  // becomes available to RestoreFunction.
+  virtual void InitializeCodeStorage(const std::filesystem::path& cache_root,
+                                     Module* module, uint32_t guest_low,
+                                     uint32_t guest_high) {}
+  // Defines the function using code from the persistent storage instead of
+  // translating it, if it has been stored and its guest code is unchanged.
+  virtual bool RestoreFunction(GuestFunction* function) { return false; }
+
+  // Stops dispatching calls to the code of the function after its guest code
+  // has been modified, so the next call resolves it again. Threads already
+  // executing the code may finish doing so.
+  virtual void InvalidateFunction(GuestFunction* function) {}
+  // Dispatches calls to the current code of an invalidated function again, if
+  // its guest code turned out to be unchanged.
+  virtual void RevalidateFunction(GuestFunction* function) {}
+
   // Calculates the next host instruction based on the current thread state and
   // current PC. This will look for branches and other control flow
   // instructions.
@@ -74,32 +74,39 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   // Reset when we leave.
   xe::make_reset_scope(this);
 
-  // Lower HIR -> x64.
+  // Lower HIR -> x64. The function may be running its old code, so nothing
+  // describing it is replaced until the new code is ready.
   void* machine_code = nullptr;
   size_t code_size = 0;
+  std::vector<SourceMapEntry> source_map;
   if (!emitter_->Emit(function, builder, debug_info_flags, debug_info.get(),
-                      &machine_code, &code_size, &function->source_map())) {
+                      &machine_code, &code_size, &source_map)) {
     return false;
   }
 
   // Stash generated machine code.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmMachineCode) {
-    DumpMachineCode(machine_code, code_size, function->source_map(),
-                    &string_buffer_);
+    DumpMachineCode(machine_code, code_size, source_map, &string_buffer_);
     debug_info->set_machine_code_disasm(strdup(string_buffer_.buffer()));
     string_buffer_.Reset();
   }
 
-  function->set_debug_info(std::move(debug_info));
-  static_cast<X64Function*>(function)->Setup(
-      reinterpret_cast<uint8_t*>(machine_code), code_size);
+  auto x64_function = static_cast<X64Function*>(function);
+  uint8_t* old_machine_code = x64_function->machine_code();
+  x64_function->Setup(reinterpret_cast<uint8_t*>(machine_code), code_size,
+                      std::move(source_map), std::move(debug_info));
 
   // Install into indirection table.
   uint64_t host_address = reinterpret_cast<uint64_t>(machine_code);
   assert_true((host_address >> 32) == 0);
-  reinterpret_cast<X64CodeCache*>(backend_->code_cache())
-      ->AddIndirection(function->address(),
-                       static_cast<uint32_t>(host_address));
+  auto code_cache = reinterpret_cast<X64CodeCache*>(backend_->code_cache());
+  code_cache->AddIndirection(function->address(),
+                             static_cast<uint32_t>(host_address));
+
+  // Retranslated - the old code is not looked up anymore.
+  if (old_machine_code) {
+    code_cache->RetireGuestCode(old_machine_code);
+  }
 
   return true;
 }
@@ -14,15 +14,21 @@
 #include "third_party/capstone/include/capstone/capstone.h"
 #include "third_party/capstone/include/capstone/x86.h"
 
+#include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/exception_handler.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/mapped_memory.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
+#include "xenia/cpu/backend/x64/x64_code_storage.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
 #include "xenia/cpu/backend/x64/x64_function.h"
 #include "xenia/cpu/backend/x64/x64_sequences.h"
 #include "xenia/cpu/backend/x64/x64_stack_layout.h"
 #include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/stack_walker.h"
 
@@ -30,6 +36,17 @@ DEFINE_bool(
     use_haswell_instructions, true,
     "Uses the AVX2/FMA/etc instructions on Haswell processors when available.",
     "CPU");
+DEFINE_bool(use_avx512_instructions, true,
+            "Uses the AVX-512 instructions on processors supporting them when "
+            "use_haswell_instructions is enabled.",
+            "CPU");
+DEFINE_bool(store_generated_code, false,
+            "Store the code generated for guest functions in the cache "
+            "directory and reuse it in later sessions instead of translating "
+            "the functions again.",
+            "CPU");
+
+DECLARE_bool(patch_direct_calls);
 
 namespace xe {
 namespace cpu {
@@ -116,6 +133,7 @@ bool X64Backend::Initialize(Processor* processor) {
   host_to_guest_thunk_ = thunk_emitter.EmitHostToGuestThunk();
   guest_to_host_thunk_ = thunk_emitter.EmitGuestToHostThunk();
   resolve_function_thunk_ = thunk_emitter.EmitResolveFunctionThunk();
+  emitter_feature_flags_ = thunk_emitter.feature_flags();
 
   // Set the code cache to use the ResolveFunction thunk for default
   // indirections.
@@ -149,6 +167,217 @@ std::unique_ptr<GuestFunction> X64Backend::CreateGuestFunction(
   return std::make_unique<X64Function>(module, address);
 }
 
+void X64Backend::InitializeCodeStorage(const std::filesystem::path& cache_root,
+                                       Module* module, uint32_t guest_low,
+                                       uint32_t guest_high) {
+  if (!cvars::store_generated_code || cache_root.empty() ||
+      guest_low >= guest_high) {
+    return;
+  }
+  // Tracing, profiling and breakpoint code refers to per-session data, and
+  // restored code wouldn't contain it.
+  if (cvars::disassemble_functions || cvars::trace_functions ||
+      cvars::trace_function_coverage || cvars::trace_function_references ||
+      cvars::trace_function_data || cvars::break_on_instruction ||
+      cvars::profile_function_calls) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(code_storage_mutex_);
+
+  // Code refers to functions and data in the executable directly, so it can
+  // only be reused by exactly the same build.
+  if (!host_binary_hash_) {
+    auto executable_path = xe::filesystem::GetExecutablePath();
+    auto executable =
+        MappedMemory::Open(executable_path, MappedMemory::Mode::kRead);
+    if (!executable) {
+      XELOGE(
+          "Failed to open the executable for hashing, persistent code storage "
+          "will be disabled: {}",
+          xe::path_to_utf8(executable_path));
+      return;
+    }
+    host_binary_hash_ = XXH3_64bits(executable->data(), executable->size());
+  }
+
+  X64CodeStorage::Key key = {};
+  key.host_binary_hash = host_binary_hash_;
+  key.module_hash =
+      X64CodeStorage::HashGuestCode(processor_->memory(), guest_low, guest_high);
+  key.guest_low = guest_low;
+  key.guest_high = guest_high;
+  key.feature_flags = emitter_feature_flags_;
+  key.emitter_data = emitter_data_;
+  key.host_to_guest_thunk = reinterpret_cast<uint64_t>(host_to_guest_thunk_);
+  key.guest_to_host_thunk = reinterpret_cast<uint64_t>(guest_to_host_thunk_);
+  key.resolve_function_thunk =
+      reinterpret_cast<uint64_t>(resolve_function_thunk_);
+
+  auto path = cache_root / "jit" /
+              fmt::format("{:016X}.{:08X}.x64.xjit", key.module_hash,
+                          key.feature_flags);
+  auto code_storage = X64CodeStorage::Open(path, key, processor_->memory());
+  if (code_storage) {
+    code_storages_.push_back(std::move(code_storage));
+  }
+}
+
+X64CodeStorage* X64Backend::LookupCodeStorage(uint32_t guest_address) {
+  std::lock_guard<std::mutex> lock(code_storage_mutex_);
+  for (auto& code_storage : code_storages_) {
+    if (code_storage->Contains(guest_address)) {
+      return code_storage.get();
+    }
+  }
+  return nullptr;
+}
+
+bool X64Backend::RestoreFunction(GuestFunction* function) {
+  auto code_storage = LookupCodeStorage(function->address());
+  if (!code_storage) {
+    return false;
+  }
+  auto stored_function = code_storage->Lookup(function->address());
+  if (!stored_function ||
+      stored_function->guest_end_address <= function->address()) {
+    return false;
+  }
+
+  // The guest code may have been patched since the function was stored.
+  if (X64CodeStorage::HashGuestCode(processor_->memory(), function->address(),
+                                    stored_function->guest_end_address) !=
+      stored_function->guest_code_hash) {
+    return false;
+  }
+
+  // Patch the host pointers for this session.
+  std::vector<uint8_t> code(stored_function->code);
+  for (const CodeRelocation& relocation : stored_function->relocations) {
+    uint64_t value;
+    if (relocation.code_offset + sizeof(value) > code.size() ||
+        !ResolveCodeRelocation(relocation, code_storage->host_image_delta(),
+                               &value)) {
+      return false;
+    }
+    std::memcpy(code.data() + relocation.code_offset, &value, sizeof(value));
+  }
+  // Direct calls are patched atomically as an aligned qword.
+  for (const DirectCallSite& call_site : stored_function->direct_call_sites) {
+    if (call_site.code_offset + 5 > code.size() ||
+        (call_site.code_offset & 7) > 3 ||
+        (code[call_site.code_offset] != 0xE8 &&
+         code[call_site.code_offset] != 0xE9)) {
+      return false;
+    }
+  }
+
+  function->set_end_address(stored_function->guest_end_address);
+  void* code_execute_address;
+  void* code_write_address;
+  if (!code_cache_->PlaceGuestCode(function->address(), code.data(),
+                                   stored_function->func_info, function,
+                                   code_execute_address, code_write_address)) {
+    return false;
+  }
+  static_cast<X64Function*>(function)->Setup(
+      reinterpret_cast<uint8_t*>(code_execute_address),
+      stored_function->func_info.code_size.total, stored_function->source_map,
+      nullptr);
+
+  // Without patching, the calls keep going through the stubs, which is also
+  // valid.
+  if (cvars::patch_direct_calls &&
+      !stored_function->direct_call_sites.empty()) {
+    code_cache_->AddDirectCallSites(code_execute_address,
+                                    stored_function->direct_call_sites);
+  }
+
+  // Install into indirection table.
+  uint64_t host_address = reinterpret_cast<uint64_t>(code_execute_address);
+  assert_true((host_address >> 32) == 0);
+  code_cache_->AddIndirection(function->address(),
+                              static_cast<uint32_t>(host_address));
+
+  return true;
+}
+
+void X64Backend::InvalidateFunction(GuestFunction* function) {
+  code_cache_->RemoveIndirection(function->address());
+}
+
+void X64Backend::RevalidateFunction(GuestFunction* function) {
+  uint64_t host_address = reinterpret_cast<uint64_t>(function->machine_code());
+  assert_true((host_address >> 32) == 0);
+  code_cache_->AddIndirection(function->address(),
+                              static_cast<uint32_t>(host_address));
+}
+
+bool X64Backend::ResolveCodeRelocation(const CodeRelocation& relocation,
+                                       int64_t host_image_delta,
+                                       uint64_t* value_out) {
+  switch (relocation.type) {
+    case CodeRelocation::Type::kHostImage:
+      *value_out = relocation.target + uint64_t(host_image_delta);
+      return true;
+    case CodeRelocation::Type::kBuiltinHandler:
+    case CodeRelocation::Type::kBuiltinArg0:
+    case CodeRelocation::Type::kBuiltinArg1: {
+      auto function = processor_->LookupFunction(uint32_t(relocation.target));
+      if (!function ||
+          function->behavior() != Function::Behavior::kBuiltin) {
+        return false;
+      }
+      auto builtin_function = static_cast<BuiltinFunction*>(function);
+      if (relocation.type == CodeRelocation::Type::kBuiltinHandler) {
+        *value_out = reinterpret_cast<uint64_t>(builtin_function->handler());
+      } else if (relocation.type == CodeRelocation::Type::kBuiltinArg0) {
+        *value_out = reinterpret_cast<uint64_t>(builtin_function->arg0());
+      } else {
+        *value_out = reinterpret_cast<uint64_t>(builtin_function->arg1());
+      }
+      return true;
+    }
+    case CodeRelocation::Type::kExternHandler: {
+      auto function = processor_->LookupFunction(uint32_t(relocation.target));
+      if (!function || function->behavior() != Function::Behavior::kExtern) {
+        return false;
+      }
+      auto extern_handler =
+          static_cast<GuestFunction*>(function)->extern_handler();
+      if (!extern_handler) {
+        return false;
+      }
+      *value_out = reinterpret_cast<uint64_t>(extern_handler);
+      return true;
+    }
+    case CodeRelocation::Type::kExternFastCall: {
+      auto function = processor_->LookupFunction(uint32_t(relocation.target));
+      if (!function || function->behavior() != Function::Behavior::kExtern) {
+        return false;
+      }
+      auto export_data = static_cast<GuestFunction*>(function)->export_data();
+      if (!export_data || !export_data->function_data.fast_call) {
+        return false;
+      }
+      *value_out =
+          reinterpret_cast<uint64_t>(export_data->function_data.fast_call);
+      return true;
+    }
+    case CodeRelocation::Type::kMmioCallbackContext: {
+      auto mmio_range = processor_->memory()->LookupVirtualMappedRange(
+          uint32_t(relocation.target));
+      if (!mmio_range) {
+        return false;
+      }
+      *value_out = reinterpret_cast<uint64_t>(mmio_range->callback_context);
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
 uint64_t ReadCapstoneReg(X64Context* context, x86_reg reg) {
   switch (reg) {
     case X86_REG_RAX:
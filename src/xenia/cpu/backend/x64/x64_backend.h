@@ -11,11 +11,15 @@
 #define XENIA_CPU_BACKEND_X64_X64_BACKEND_H_
 
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "xenia/base/cvar.h"
 #include "xenia/cpu/backend/backend.h"
 
 DECLARE_bool(use_haswell_instructions);
+DECLARE_bool(use_avx512_instructions);
+DECLARE_bool(store_generated_code);
 
 namespace xe {
 class Exception;
@@ -26,6 +30,8 @@ namespace backend {
 namespace x64 {
 
 class X64CodeCache;
+class X64CodeStorage;
+struct CodeRelocation;
 
 #define XENIA_HAS_X64_BACKEND 1
 
@@ -61,6 +67,16 @@ class X64Backend : public Backend {
   std::unique_ptr<GuestFunction> CreateGuestFunction(Module* module,
                                                      uint32_t address) override;
 
+  void InitializeCodeStorage(const std::filesystem::path& cache_root,
+                             Module* module, uint32_t guest_low,
+                             uint32_t guest_high) override;
+  bool RestoreFunction(GuestFunction* function) override;
+  void InvalidateFunction(GuestFunction* function) override;
+  void RevalidateFunction(GuestFunction* function) override;
+  // Persistent storage newly generated code for the guest address should be
+  // appended to, or nullptr if it's not stored.
+  X64CodeStorage* LookupCodeStorage(uint32_t guest_address);
+
   uint64_t CalculateNextHostInstruction(ThreadDebugInfo* thread_info,
                                         uint64_t current_pc) override;
 
@@ -72,6 +88,9 @@ class X64Backend : public Backend {
   static bool ExceptionCallbackThunk(Exception* ex, void* data);
   bool ExceptionCallback(Exception* ex);
 
+  bool ResolveCodeRelocation(const CodeRelocation& relocation,
+                             int64_t host_image_delta, uint64_t* value_out);
+
   uintptr_t capstone_handle_ = 0;
 
   std::unique_ptr<X64CodeCache> code_cache_;
@@ -80,6 +99,13 @@ class X64Backend : public Backend {
   HostToGuestThunk host_to_guest_thunk_;
   GuestToHostThunk guest_to_host_thunk_;
   ResolveFunctionThunk resolve_function_thunk_;
+
+  uint32_t emitter_feature_flags_ = 0;
+
+  std::mutex code_storage_mutex_;
+  // Hash of the executable, calculated when the first storage is opened.
+  uint64_t host_binary_hash_ = 0;
+  std::vector<std::unique_ptr<X64CodeStorage>> code_storages_;
 };
 
 }  // namespace x64
@@ -9,6 +9,7 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 
@@ -19,6 +20,7 @@
 
 #include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/assert.h"
+#include "xenia/base/atomic.h"
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
@@ -133,9 +135,103 @@ void X64CodeCache::AddIndirection(uint32_t guest_address,
     return;
   }
 
+  std::lock_guard<std::mutex> lock(direct_call_mutex_);
   uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
       indirection_table_base_ + (guest_address - kIndirectionTableBase));
   *indirection_slot = host_address;
+
+  auto it = direct_call_sites_.find(guest_address);
+  if (it != direct_call_sites_.end()) {
+    for (const PlacedDirectCallSite& call_site : it->second) {
+      PatchDirectCallSite(
+          call_site, int32_t(int64_t(host_address) -
+                             int64_t(uint64_t(call_site.execute_address) + 5)));
+    }
+  }
+}
+
+void X64CodeCache::RemoveIndirection(uint32_t guest_address) {
+  if (!indirection_table_base_) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(direct_call_mutex_);
+  uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
+      indirection_table_base_ + (guest_address - kIndirectionTableBase));
+  *indirection_slot = indirection_default_value_;
+
+  auto it = direct_call_sites_.find(guest_address);
+  if (it != direct_call_sites_.end()) {
+    for (const PlacedDirectCallSite& call_site : it->second) {
+      PatchDirectCallSite(call_site, call_site.stub_displacement);
+    }
+  }
+}
+
+void X64CodeCache::AddDirectCallSites(
+    void* code_execute_address, const std::vector<DirectCallSite>& call_sites) {
+  if (!indirection_table_base_) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(direct_call_mutex_);
+  std::vector<uint32_t>& callees = direct_call_callees_[code_execute_address];
+  for (const DirectCallSite& call_site : call_sites) {
+    PlacedDirectCallSite placed_call_site;
+    placed_call_site.execute_address =
+        reinterpret_cast<uint8_t*>(code_execute_address) +
+        call_site.code_offset;
+    std::memcpy(&placed_call_site.stub_displacement,
+                placed_call_site.execute_address + 1, sizeof(int32_t));
+    direct_call_sites_[call_site.guest_address].push_back(placed_call_site);
+    callees.push_back(call_site.guest_address);
+
+    uint32_t host_address = *reinterpret_cast<const uint32_t*>(
+        indirection_table_base_ +
+        (call_site.guest_address - kIndirectionTableBase));
+    if (host_address != indirection_default_value_) {
+      PatchDirectCallSite(
+          placed_call_site,
+          int32_t(int64_t(host_address) -
+                  int64_t(uint64_t(placed_call_site.execute_address) + 5)));
+    }
+  }
+}
+
+void X64CodeCache::PatchDirectCallSite(const PlacedDirectCallSite& call_site,
+                                       int32_t displacement) {
+  // Replace the whole aligned qword containing the instruction with a single
+  // store, so other threads either execute the old or the new instruction.
+  size_t code_offset =
+      size_t(call_site.execute_address - generated_code_execute_base_);
+  size_t displacement_shift = ((code_offset & 7) + 1) * 8;
+  assert_true(displacement_shift + 32 <= 64);
+  auto qword = reinterpret_cast<volatile uint64_t*>(
+      generated_code_write_base_ + (code_offset & ~size_t(7)));
+  uint64_t value = *qword;
+  value &= ~(uint64_t(0xFFFFFFFF) << displacement_shift);
+  value |= uint64_t(uint32_t(displacement)) << displacement_shift;
+  xe::atomic_exchange(value, qword);
+}
+
+void X64CodeCache::CommitGeneratedCode(size_t size) {
+  if (generated_code_execute_base_ == generated_code_write_base_) {
+    xe::memory::AllocFixed(generated_code_execute_base_, size,
+                           xe::memory::AllocationType::kCommit,
+                           xe::memory::PageAccess::kExecuteReadWrite);
+  } else {
+    xe::memory::AllocFixed(generated_code_execute_base_, size,
+                           xe::memory::AllocationType::kCommit,
+                           xe::memory::PageAccess::kExecuteReadOnly);
+    xe::memory::AllocFixed(generated_code_write_base_, size,
+                           xe::memory::AllocationType::kCommit,
+                           xe::memory::PageAccess::kReadWrite);
+  }
+  if (xe::memory::IsHugePageBackingPreferred()) {
+    // Generated code is branchy and spread over the whole region, so it's
+    // executed with fewer instruction TLB misses on huge pages.
+    xe::memory::AdviseHugePages(generated_code_execute_base_, size);
+  }
 }
 
 void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
@@ -149,6 +245,12 @@ void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
       indirection_table_base_ + (guest_low - kIndirectionTableBase),
       guest_high - guest_low, xe::memory::AllocationType::kCommit,
       xe::memory::PageAccess::kReadWrite);
+  if (xe::memory::IsHugePageBackingPreferred()) {
+    // Looked up on every indirect branch.
+    xe::memory::AdviseHugePages(
+        indirection_table_base_ + (guest_low - kIndirectionTableBase),
+        guest_high - guest_low);
+  }
 
   // Fill memory with the default value.
   uint32_t* p = reinterpret_cast<uint32_t*>(indirection_table_base_);
@@ -157,17 +259,17 @@ void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
   }
 }
 
-void X64CodeCache::PlaceHostCode(uint32_t guest_address, void* machine_code,
+bool X64CodeCache::PlaceHostCode(uint32_t guest_address, void* machine_code,
                                  const EmitFunctionInfo& func_info,
                                  void*& code_execute_address_out,
                                  void*& code_write_address_out) {
   // Same for now. We may use different pools or whatnot later on, like when
   // we only want to place guest code in a serialized cache on disk.
-  PlaceGuestCode(guest_address, machine_code, func_info, nullptr,
-                 code_execute_address_out, code_write_address_out);
+  return PlaceGuestCode(guest_address, machine_code, func_info, nullptr,
+                        code_execute_address_out, code_write_address_out);
 }
 
-void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
+bool X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
                                   const EmitFunctionInfo& func_info,
                                   GuestFunction* function_info,
                                   void*& code_execute_address_out,
@@ -181,6 +283,26 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
   {
     auto global_lock = global_critical_region_.Acquire();
 
+    // Retired code isn't reused, so retranslating functions over and over can
+    // use the region up.
+    if (generated_code_offset_ + xe::round_up(func_info.code_size.total, 16) +
+            kMaximumUnwindReservationSize >
+        kGeneratedCodeSize) {
+      XELOGE("Out of space for generated code placing code for {:08X}",
+             guest_address);
+      code_execute_address_out = nullptr;
+      code_write_address_out = nullptr;
+      return false;
+    }
+    if (placed_code_count_ >= kMaximumFunctionCount) {
+      XELOGE("Out of unwind table slots placing code for {:08X}",
+             guest_address);
+      code_execute_address_out = nullptr;
+      code_write_address_out = nullptr;
+      return false;
+    }
+    ++placed_code_count_;
+
     low_mark = generated_code_offset_;
 
     // Reserve code.
@@ -201,6 +323,7 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
     // need it, and a few extra bytes of padding isn't the worst thing.
     unwind_reservation = RequestUnwindReservation(generated_code_write_base_ +
                                                   generated_code_offset_);
+    assert_true(unwind_reservation.data_size <= kMaximumUnwindReservationSize);
     generated_code_offset_ += xe::round_up(unwind_reservation.data_size, 16);
 
     auto end_write_address =
@@ -228,18 +351,7 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
       if (high_mark <= old_commit_mark) break;
 
       new_commit_mark = old_commit_mark + 16 * 1024 * 1024;
-      if (generated_code_execute_base_ == generated_code_write_base_) {
-        xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kExecuteReadWrite);
-      } else {
-        xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kExecuteReadOnly);
-        xe::memory::AllocFixed(generated_code_write_base_, new_commit_mark,
-                               xe::memory::AllocationType::kCommit,
-                               xe::memory::PageAccess::kReadWrite);
-      }
+      CommitGeneratedCode(new_commit_mark);
     } while (generated_code_commit_mark_.compare_exchange_weak(
         old_commit_mark, new_commit_mark));
 
@@ -285,6 +397,8 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
     *indirection_slot =
         uint32_t(reinterpret_cast<uint64_t>(code_execute_address));
   }
+
+  return true;
 }
 
 uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
@@ -311,18 +425,7 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
     if (high_mark <= old_commit_mark) break;
 
     new_commit_mark = old_commit_mark + 16 * 1024 * 1024;
-    if (generated_code_execute_base_ == generated_code_write_base_) {
-      xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                             xe::memory::AllocationType::kCommit,
-                             xe::memory::PageAccess::kExecuteReadWrite);
-    } else {
-      xe::memory::AllocFixed(generated_code_execute_base_, new_commit_mark,
-                             xe::memory::AllocationType::kCommit,
-                             xe::memory::PageAccess::kExecuteReadOnly);
-      xe::memory::AllocFixed(generated_code_write_base_, new_commit_mark,
-                             xe::memory::AllocationType::kCommit,
-                             xe::memory::PageAccess::kReadWrite);
-    }
+    CommitGeneratedCode(new_commit_mark);
   } while (generated_code_commit_mark_.compare_exchange_weak(old_commit_mark,
                                                              new_commit_mark));
 
@@ -332,10 +435,57 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
   return uint32_t(uintptr_t(data_address));
 }
 
+void X64CodeCache::RetireGuestCode(void* code_execute_address) {
+  auto global_lock = global_critical_region_.Acquire();
+  uint64_t code_offset = uint64_t(
+      reinterpret_cast<uint8_t*>(code_execute_address) -
+      generated_code_execute_base_);
+  auto it = std::lower_bound(
+      generated_code_map_.begin(), generated_code_map_.end(), code_offset << 32,
+      [](const std::pair<uint64_t, GuestFunction*>& entry, uint64_t key) {
+        return entry.first < key;
+      });
+  if (it == generated_code_map_.end() || (it->first >> 32) != code_offset) {
+    return;
+  }
+  uint8_t* code_begin = reinterpret_cast<uint8_t*>(code_execute_address);
+  uint8_t* code_end =
+      generated_code_execute_base_ + uint32_t(it->first & 0xFFFFFFFF);
+  generated_code_map_.erase(it);
+
+  // Stop patching the direct calls in the retired code.
+  std::lock_guard<std::mutex> lock(direct_call_mutex_);
+  auto callees_it = direct_call_callees_.find(code_execute_address);
+  if (callees_it == direct_call_callees_.end()) {
+    return;
+  }
+  for (uint32_t callee_address : callees_it->second) {
+    auto call_sites_it = direct_call_sites_.find(callee_address);
+    if (call_sites_it == direct_call_sites_.end()) {
+      continue;
+    }
+    std::vector<PlacedDirectCallSite>& call_sites = call_sites_it->second;
+    call_sites.erase(
+        std::remove_if(
+            call_sites.begin(), call_sites.end(),
+            [code_begin, code_end](const PlacedDirectCallSite& call_site) {
+              return call_site.execute_address >= code_begin &&
+                     call_site.execute_address < code_end;
+            }),
+        call_sites.end());
+    if (call_sites.empty()) {
+      direct_call_sites_.erase(call_sites_it);
+    }
+  }
+  direct_call_callees_.erase(callees_it);
+}
+
 GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
+  // The map may be modified when code is retired.
+  auto global_lock = global_critical_region_.Acquire();
   uint32_t key = uint32_t(host_pc - kGeneratedCodeExecuteBase);
   void* fn_entry = std::bsearch(
-      &key, generated_code_map_.data(), generated_code_map_.size() + 1,
+      &key, generated_code_map_.data(), generated_code_map_.size(),
       sizeof(std::pair<uint32_t, Function*>),
       [](const void* key_ptr, const void* element_ptr) {
         auto key = *reinterpret_cast<const uint32_t*>(key_ptr);
@@ -14,7 +14,9 @@
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -39,6 +41,43 @@ struct EmitFunctionInfo {
   size_t stack_size;
 };
 
+// A 64-bit host pointer embedded as an immediate in generated code. These are
+// recorded so the code can be stored and patched when reloaded by another
+// process, where heap objects and the host image are at different addresses.
+struct CodeRelocation {
+  enum class Type : uint32_t {
+    // Function or static data in the host executable image.
+    kHostImage,
+    // Handler and arguments of the builtin function at the guest address.
+    kBuiltinHandler,
+    kBuiltinArg0,
+    kBuiltinArg1,
+    // Host handler of the extern function at the guest address.
+    kExternHandler,
+    // Fast entry point of the export of the extern function at the guest
+    // address.
+    kExternFastCall,
+    // Callback context of the MMIO range containing the guest address.
+    kMmioCallbackContext,
+  };
+  // Offset of the 8 byte immediate from the start of the function.
+  uint32_t code_offset;
+  Type type;
+  // Host address at emission time for kHostImage, guest address otherwise.
+  uint64_t target;
+};
+
+// A call or jmp rel32 instruction from generated code to the code of a guest
+// function. It initially targets a stub in the calling function loading the
+// target from the indirection table, and is patched to target the code of the
+// function directly once it's placed.
+struct DirectCallSite {
+  // Offset of the 5 byte instruction from the start of the function. It must
+  // not cross an 8 byte boundary, so it can be patched atomically.
+  uint32_t code_offset;
+  uint32_t guest_address;
+};
+
 class X64CodeCache : public CodeCache {
  public:
   ~X64CodeCache() override;
@@ -60,19 +99,38 @@ class X64CodeCache : public CodeCache {
   bool has_indirection_table() { return indirection_table_base_ != nullptr; }
   void set_indirection_default(uint32_t default_value);
   void AddIndirection(uint32_t guest_address, uint32_t host_address);
+  // Resets the indirection of an invalidated function, unpatching all direct
+  // calls to it.
+  void RemoveIndirection(uint32_t guest_address);
+
+  // Registers the direct calls in placed code, patching those to already placed
+  // functions immediately and others when they're added to the indirection
+  // table.
+  void AddDirectCallSites(void* code_execute_address,
+                          const std::vector<DirectCallSite>& call_sites);
 
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high);
+  // Commits the first size bytes of the generated code region.
+  void CommitGeneratedCode(size_t size);
 
-  void PlaceHostCode(uint32_t guest_address, void* machine_code,
+  // Returns false if the generated code region has been used up.
+  bool PlaceHostCode(uint32_t guest_address, void* machine_code,
                      const EmitFunctionInfo& func_info,
                      void*& code_execute_address_out,
                      void*& code_write_address_out);
-  void PlaceGuestCode(uint32_t guest_address, void* machine_code,
+  bool PlaceGuestCode(uint32_t guest_address, void* machine_code,
                       const EmitFunctionInfo& func_info,
                       GuestFunction* function_info,
                       void*& code_execute_address_out,
                       void*& code_write_address_out);
   uint32_t PlaceData(const void* data, size_t length);
+  // Removes replaced code of a guest function from the host PC lookup. The
+  // code itself and its unwind information are kept, as other threads may
+  // still be executing it or return to it, but its direct calls are no longer
+  // patched. Its space and its unwind table slot are never reused, so code
+  // placement fails once retranslations have used up kGeneratedCodeSize or
+  // kMaximumFunctionCount.
+  void RetireGuestCode(void* code_execute_address);
 
   GuestFunction* LookupFunction(uint64_t host_pc) override;
 
@@ -91,9 +149,12 @@ class X64CodeCache : public CodeCache {
       kGeneratedCodeExecuteBase + kGeneratedCodeSize + 1;
 
   // This is picked to be high enough to cover whatever we can reasonably
-  // expect. If we hit issues with this it probably means some corner case
-  // in analysis triggering.
-  static const size_t kMaximumFunctionCount = 100000;
+  // expect, including retranslated functions, which take new slots. If we hit
+  // issues with this it probably means some corner case in analysis
+  // triggering.
+  static const size_t kMaximumFunctionCount = 250000;
+  // Upper bound of UnwindReservation::data_size.
+  static const size_t kMaximumUnwindReservationSize = 64;
 
   struct UnwindReservation {
     size_t data_size = 0;
@@ -111,6 +172,16 @@ class X64CodeCache : public CodeCache {
                          void* code_execute_address,
                          UnwindReservation unwind_reservation) {}
 
+  struct PlacedDirectCallSite {
+    uint8_t* execute_address;
+    // Displacement to the stub, for unpatching.
+    int32_t stub_displacement;
+  };
+  // Changes the rel32 displacement of a call or jmp instruction in placed code
+  // while it may be executed by other threads.
+  void PatchDirectCallSite(const PlacedDirectCallSite& call_site,
+                           int32_t displacement);
+
   std::filesystem::path file_name_;
   xe::memory::FileMappingHandle mapping_ =
       xe::memory::kFileMappingHandleInvalid;
@@ -135,12 +206,25 @@ class X64CodeCache : public CodeCache {
   uint8_t* generated_code_write_base_ = nullptr;
   // Current offset to empty space in generated code.
   size_t generated_code_offset_ = 0;
+  // Number of functions placed, including retired ones, as each has taken an
+  // unwind table slot.
+  size_t placed_code_count_ = 0;
   // Current high water mark of COMMITTED code.
   std::atomic<size_t> generated_code_commit_mark_ = {0};
   // Sorted map by host PC base offsets to source function info.
   // This can be used to bsearch on host PC to find the guest function.
   // The key is [start address | end address].
   std::vector<std::pair<uint64_t, GuestFunction*>> generated_code_map_;
+
+  // Guards direct call patching and the indirection table entries of functions
+  // with direct calls to them.
+  std::mutex direct_call_mutex_;
+  // Direct calls by the guest address of the callee.
+  std::unordered_map<uint32_t, std::vector<PlacedDirectCallSite>>
+      direct_call_sites_;
+  // Guest addresses of the functions called directly from placed code, by the
+  // code execute address, for dropping the call sites of retired code.
+  std::unordered_map<void*, std::vector<uint32_t>> direct_call_callees_;
 };
 
 }  // namespace x64
@@ -0,0 +1,267 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/backend/x64/x64_code_storage.h"
+
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/xxhash.h"
+#include "xenia/memory.h"
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace x64 {
+
+namespace {
+
+// 'XJIT'.
+const uint32_t kStorageMagic = 0x54494A58;
+// Bump when the file layout or the code generation changes in a way not
+// covered by the host binary hash.
+const uint32_t kStorageVersion = 2;
+
+// Sanity limit for the size of a single stored function, matching the maximum
+// emitter buffer size.
+const uint32_t kMaxStoredCodeSize = 1 * 1024 * 1024;
+
+struct StorageHeader {
+  uint32_t magic;
+  uint32_t version;
+  X64CodeStorage::Key key;
+  // Address of a function in the host image when the file was written, for
+  // rebasing kHostImage relocations if the image is loaded elsewhere (ASLR).
+  uint64_t host_image_anchor;
+};
+
+struct StoredFunctionHeader {
+  uint32_t guest_address;
+  uint32_t guest_end_address;
+  uint64_t guest_code_hash;
+  uint32_t prolog_size;
+  uint32_t body_size;
+  uint32_t epilog_size;
+  uint32_t tail_size;
+  uint32_t total_size;
+  uint32_t prolog_stack_alloc_offset;
+  uint32_t stack_size;
+  uint32_t source_map_count;
+  uint32_t relocation_count;
+  uint32_t direct_call_site_count;
+  // Hash of the code, the source map, the relocations and the direct call
+  // sites following the header.
+  uint64_t data_hash;
+};
+static_assert(sizeof(StoredFunctionHeader) == 64,
+              "Stored function header must have no padding");
+
+uint64_t GetHostImageAnchor() {
+  return reinterpret_cast<uint64_t>(&GetHostImageAnchor);
+}
+
+}  // namespace
+
+X64CodeStorage::X64CodeStorage(FILE* file, const Key& key, Memory* memory)
+    : file_(file), key_(key), memory_(memory) {}
+
+X64CodeStorage::~X64CodeStorage() {
+  if (file_) {
+    fclose(file_);
+    file_ = nullptr;
+  }
+}
+
+std::unique_ptr<X64CodeStorage> X64CodeStorage::Open(
+    const std::filesystem::path& path, const Key& key, Memory* memory) {
+  if (!xe::filesystem::CreateParentFolder(path)) {
+    XELOGE(
+        "Failed to create the code storage directory, persistent code storage "
+        "will be disabled: {}",
+        xe::path_to_utf8(path.parent_path()));
+    return nullptr;
+  }
+  FILE* file = xe::filesystem::OpenFile(path, "a+b");
+  if (!file) {
+    XELOGE(
+        "Failed to open the code storage file for writing, persistent code "
+        "storage will be disabled: {}",
+        xe::path_to_utf8(path));
+    return nullptr;
+  }
+
+  auto storage =
+      std::unique_ptr<X64CodeStorage>(new X64CodeStorage(file, key, memory));
+  if (!storage->Load(path)) {
+    // Missing, outdated or generated by a different host - start over.
+    xe::filesystem::TruncateStdioFile(file, 0);
+    StorageHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = kStorageMagic;
+    header.version = kStorageVersion;
+    header.key = key;
+    header.host_image_anchor = GetHostImageAnchor();
+    fwrite(&header, sizeof(header), 1, file);
+    fflush(file);
+  }
+  return storage;
+}
+
+bool X64CodeStorage::Load(const std::filesystem::path& path) {
+  StorageHeader header;
+  if (!xe::filesystem::Seek(file_, 0, SEEK_SET) ||
+      !fread(&header, sizeof(header), 1, file_) ||
+      header.magic != kStorageMagic || header.version != kStorageVersion ||
+      std::memcmp(&header.key, &key_, sizeof(key_))) {
+    return false;
+  }
+  host_image_delta_ = int64_t(GetHostImageAnchor() - header.host_image_anchor);
+
+  uint64_t valid_end = sizeof(header);
+  std::vector<uint8_t> data;
+  while (true) {
+    StoredFunctionHeader function_header;
+    if (!fread(&function_header, sizeof(function_header), 1, file_)) {
+      break;
+    }
+    if (function_header.total_size > kMaxStoredCodeSize ||
+        function_header.source_map_count > kMaxStoredCodeSize ||
+        function_header.relocation_count > kMaxStoredCodeSize ||
+        function_header.direct_call_site_count > kMaxStoredCodeSize) {
+      break;
+    }
+    size_t source_map_size =
+        sizeof(SourceMapEntry) * function_header.source_map_count;
+    size_t relocations_size =
+        sizeof(CodeRelocation) * function_header.relocation_count;
+    size_t direct_call_sites_size =
+        sizeof(DirectCallSite) * function_header.direct_call_site_count;
+    size_t data_size = function_header.total_size + source_map_size +
+                       relocations_size + direct_call_sites_size;
+    data.resize(data_size);
+    if (data_size && !fread(data.data(), data_size, 1, file_)) {
+      break;
+    }
+    // Stop at the first record that was written partially or got corrupted.
+    if (XXH3_64bits(data.data(), data_size) != function_header.data_hash) {
+      break;
+    }
+    valid_end += sizeof(function_header) + data_size;
+
+    // Functions may be stored multiple times if the guest code has changed
+    // between sessions - the latest one is the most likely to be valid.
+    StoredFunction& stored_function =
+        stored_functions_[function_header.guest_address];
+    stored_function.guest_address = function_header.guest_address;
+    stored_function.guest_end_address = function_header.guest_end_address;
+    stored_function.guest_code_hash = function_header.guest_code_hash;
+    auto& func_info = stored_function.func_info;
+    func_info.code_size.prolog = function_header.prolog_size;
+    func_info.code_size.body = function_header.body_size;
+    func_info.code_size.epilog = function_header.epilog_size;
+    func_info.code_size.tail = function_header.tail_size;
+    func_info.code_size.total = function_header.total_size;
+    func_info.prolog_stack_alloc_offset =
+        function_header.prolog_stack_alloc_offset;
+    func_info.stack_size = function_header.stack_size;
+    const uint8_t* data_ptr = data.data();
+    stored_function.code.assign(data_ptr,
+                                data_ptr + function_header.total_size);
+    data_ptr += function_header.total_size;
+    stored_function.source_map.resize(function_header.source_map_count);
+    std::memcpy(stored_function.source_map.data(), data_ptr, source_map_size);
+    data_ptr += source_map_size;
+    stored_function.relocations.resize(function_header.relocation_count);
+    std::memcpy(stored_function.relocations.data(), data_ptr,
+                relocations_size);
+    data_ptr += relocations_size;
+    stored_function.direct_call_sites.resize(
+        function_header.direct_call_site_count);
+    std::memcpy(stored_function.direct_call_sites.data(), data_ptr,
+                direct_call_sites_size);
+  }
+
+  // Drop the invalid tail, if any, so new functions are appended after the
+  // last valid one.
+  xe::filesystem::TruncateStdioFile(file_, valid_end);
+
+  XELOGI("Loaded {} functions from the code storage {}",
+         stored_functions_.size(), xe::path_to_utf8(path));
+  return true;
+}
+
+uint64_t X64CodeStorage::HashGuestCode(Memory* memory, uint32_t guest_address,
+                                       uint32_t guest_end_address) {
+  assert_true(guest_end_address >= guest_address);
+  return XXH3_64bits(memory->TranslateVirtual(guest_address),
+                     guest_end_address - guest_address);
+}
+
+const X64CodeStorage::StoredFunction* X64CodeStorage::Lookup(
+    uint32_t guest_address) const {
+  auto it = stored_functions_.find(guest_address);
+  return it != stored_functions_.end() ? &it->second : nullptr;
+}
+
+void X64CodeStorage::Append(const GuestFunction* function,
+                            const EmitFunctionInfo& func_info,
+                            const void* code,
+                            const std::vector<SourceMapEntry>& source_map,
+                            const std::vector<CodeRelocation>& relocations,
+                            const std::vector<DirectCallSite>& call_sites) {
+  // Only the guest code of the function itself is checked when restoring, so
+  // code depending on the guest code of inlined callees isn't stored.
+  if (!function->has_end_address() || !function->inlined_ranges().empty() ||
+      func_info.code_size.total > kMaxStoredCodeSize) {
+    return;
+  }
+
+  StoredFunctionHeader function_header;
+  function_header.guest_address = function->address();
+  function_header.guest_end_address = function->end_address();
+  function_header.guest_code_hash =
+      HashGuestCode(memory_, function->address(), function->end_address());
+  function_header.prolog_size = uint32_t(func_info.code_size.prolog);
+  function_header.body_size = uint32_t(func_info.code_size.body);
+  function_header.epilog_size = uint32_t(func_info.code_size.epilog);
+  function_header.tail_size = uint32_t(func_info.code_size.tail);
+  function_header.total_size = uint32_t(func_info.code_size.total);
+  function_header.prolog_stack_alloc_offset =
+      uint32_t(func_info.prolog_stack_alloc_offset);
+  function_header.stack_size = uint32_t(func_info.stack_size);
+  function_header.source_map_count = uint32_t(source_map.size());
+  function_header.relocation_count = uint32_t(relocations.size());
+  function_header.direct_call_site_count = uint32_t(call_sites.size());
+
+  size_t source_map_size = sizeof(SourceMapEntry) * source_map.size();
+  size_t relocations_size = sizeof(CodeRelocation) * relocations.size();
+  size_t call_sites_size = sizeof(DirectCallSite) * call_sites.size();
+  std::vector<uint8_t> data(func_info.code_size.total + source_map_size +
+                            relocations_size + call_sites_size);
+  uint8_t* data_ptr = data.data();
+  std::memcpy(data_ptr, code, func_info.code_size.total);
+  data_ptr += func_info.code_size.total;
+  std::memcpy(data_ptr, source_map.data(), source_map_size);
+  data_ptr += source_map_size;
+  std::memcpy(data_ptr, relocations.data(), relocations_size);
+  data_ptr += relocations_size;
+  std::memcpy(data_ptr, call_sites.data(), call_sites_size);
+  function_header.data_hash = XXH3_64bits(data.data(), data.size());
+
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  fwrite(&function_header, sizeof(function_header), 1, file_);
+  fwrite(data.data(), data.size(), 1, file_);
+}
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
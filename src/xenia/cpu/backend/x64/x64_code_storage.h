@@ -0,0 +1,123 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_BACKEND_X64_X64_CODE_STORAGE_H_
+#define XENIA_CPU_BACKEND_X64_X64_CODE_STORAGE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
+#include "xenia/cpu/function.h"
+
+namespace xe {
+class Memory;
+}  // namespace xe
+
+namespace xe {
+namespace cpu {
+namespace backend {
+namespace x64 {
+
+// Persistent storage of the code generated for the guest functions of one
+// module, so it can be reused in later sessions instead of being translated
+// again. Functions are appended to the file as they are generated, and
+// everything stored is read back when the storage is opened.
+class X64CodeStorage {
+ public:
+  // Everything the generated code depends on besides the guest code of the
+  // function itself. Storage files with a different key are discarded.
+  struct Key {
+    // Hash of the host executable, as code refers to functions and data in it.
+    uint64_t host_binary_hash;
+    // Hash of the guest code range of the module.
+    uint64_t module_hash;
+    uint32_t guest_low;
+    uint32_t guest_high;
+    // X64Emitter feature flags the code was generated with.
+    uint32_t feature_flags;
+    uint32_t reserved;
+    // Fixed addresses referenced directly by the generated code.
+    uint64_t emitter_data;
+    uint64_t host_to_guest_thunk;
+    uint64_t guest_to_host_thunk;
+    uint64_t resolve_function_thunk;
+  };
+
+  struct StoredFunction {
+    uint32_t guest_address;
+    uint32_t guest_end_address;
+    uint64_t guest_code_hash;
+    EmitFunctionInfo func_info;
+    std::vector<uint8_t> code;
+    std::vector<SourceMapEntry> source_map;
+    std::vector<CodeRelocation> relocations;
+    // Direct calls in the code, still targeting the stub of the function.
+    std::vector<DirectCallSite> direct_call_sites;
+  };
+
+  ~X64CodeStorage();
+
+  // Opens or creates the storage file, loading the functions in it if it was
+  // written with the same key.
+  static std::unique_ptr<X64CodeStorage> Open(const std::filesystem::path& path,
+                                              const Key& key, Memory* memory);
+
+  // Hash of the guest instructions in [guest_address, guest_end_address).
+  static uint64_t HashGuestCode(Memory* memory, uint32_t guest_address,
+                                uint32_t guest_end_address);
+
+  uint32_t guest_low() const { return key_.guest_low; }
+  uint32_t guest_high() const { return key_.guest_high; }
+  bool Contains(uint32_t guest_address) const {
+    return guest_address >= key_.guest_low && guest_address < key_.guest_high;
+  }
+
+  size_t stored_function_count() const { return stored_functions_.size(); }
+  // Difference between the current host image base and the one the stored
+  // code was generated with.
+  int64_t host_image_delta() const { return host_image_delta_; }
+
+  // Returns the stored code for the function at the address, or nullptr if
+  // there is none.
+  const StoredFunction* Lookup(uint32_t guest_address) const;
+
+  // Appends newly generated code for the function to the file. The direct
+  // calls in the code must not be patched yet.
+  void Append(const GuestFunction* function, const EmitFunctionInfo& func_info,
+              const void* code,
+              const std::vector<SourceMapEntry>& source_map,
+              const std::vector<CodeRelocation>& relocations,
+              const std::vector<DirectCallSite>& call_sites);
+
+ private:
+  X64CodeStorage(FILE* file, const Key& key, Memory* memory);
+
+  bool Load(const std::filesystem::path& path);
+
+  FILE* file_;
+  Key key_;
+  Memory* memory_;
+  int64_t host_image_delta_ = 0;
+
+  std::mutex write_mutex_;
+  std::unordered_map<uint32_t, StoredFunction> stored_functions_;
+};
+
+}  // namespace x64
+}  // namespace backend
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_BACKEND_X64_X64_CODE_STORAGE_H_
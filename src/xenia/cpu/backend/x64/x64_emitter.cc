@@ -11,6 +11,7 @@
 
 #include <stddef.h>
 
+#include <algorithm>
 #include <climits>
 #include <cstring>
 
@@ -25,10 +26,12 @@
 #include "xenia/base/vec128.h"
 #include "xenia/cpu/backend/x64/x64_backend.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
+#include "xenia/cpu/backend/x64/x64_code_storage.h"
 #include "xenia/cpu/backend/x64/x64_function.h"
 #include "xenia/cpu/backend/x64/x64_sequences.h"
 #include "xenia/cpu/backend/x64/x64_stack_layout.h"
 #include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/function_debug_info.h"
 #include "xenia/cpu/processor.h"
@@ -42,6 +45,16 @@ DEFINE_bool(ignore_undefined_externs, true,
 DEFINE_bool(emit_source_annotations, false,
             "Add extra movs and nops to make disassembly easier to read.",
             "CPU");
+DEFINE_bool(patch_direct_calls, true,
+            "Patch calls between guest functions to call the target code "
+            "directly instead of through the indirection table once it's "
+            "generated.",
+            "CPU");
+DEFINE_bool(fast_kernel_calls, true,
+            "Call kernel exports tagged as never blocking or calling back into "
+            "guest code directly with the arguments in host registers, "
+            "instead of through the thunk preserving the volatile registers.",
+            "CPU");
 
 namespace xe {
 namespace cpu {
@@ -79,6 +92,16 @@ X64Emitter::X64Emitter(X64Backend* backend, XbyakAllocator* allocator)
     feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tBMI2) ? kX64EmitBMI2 : 0;
     feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tF16C) ? kX64EmitF16C : 0;
     feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tMOVBE) ? kX64EmitMovbe : 0;
+    if (cvars::use_avx512_instructions) {
+      feature_flags_ |=
+          cpu_.has(Xbyak::util::Cpu::tAVX512F) ? kX64EmitAVX512F : 0;
+      feature_flags_ |=
+          cpu_.has(Xbyak::util::Cpu::tAVX512VL) ? kX64EmitAVX512VL : 0;
+      feature_flags_ |=
+          cpu_.has(Xbyak::util::Cpu::tAVX512BW) ? kX64EmitAVX512BW : 0;
+      feature_flags_ |=
+          cpu_.has(Xbyak::util::Cpu::tAVX512_VBMI) ? kX64EmitAVX512VBMI : 0;
+    }
   }
 
   if (!cpu_.has(Xbyak::util::Cpu::tAVX)) {
@@ -91,6 +114,26 @@ X64Emitter::X64Emitter(X64Backend* backend, XbyakAllocator* allocator)
 
 X64Emitter::~X64Emitter() = default;
 
+uint32_t GetBlockAddress(const hir::Block* block) {
+  // Execution counts are kept by the guest address of the first instruction of
+  // the block, which also identifies it when recompiling.
+  for (auto instr = block->instr_head; instr; instr = instr->next) {
+    if (instr->opcode == &hir::OPCODE_SOURCE_OFFSET_info) {
+      return static_cast<uint32_t>(instr->src1.offset);
+    }
+  }
+  return 0;
+}
+
+uint64_t RecompileHotFunction(void* raw_context, uint64_t function_ptr) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  auto function = reinterpret_cast<GuestFunction*>(function_ptr);
+  if (function->RequestRecompilation()) {
+    thread_state->processor()->frontend()->RecompileFunction(function);
+  }
+  return 0;
+}
+
 bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
                       uint32_t debug_info_flags, FunctionDebugInfo* debug_info,
                       void** out_code_address, size_t* out_code_size,
@@ -102,6 +145,29 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   debug_info_flags_ = debug_info_flags;
   trace_data_ = &function->trace_data();
   source_map_arena_.Reset();
+  // Debug and tracing code refers to per-session data.
+  code_storage_ = debug_info_flags
+                      ? nullptr
+                      : backend_->LookupCodeStorage(function->address());
+  storable_ = code_storage_ != nullptr;
+  relocations_.clear();
+  direct_call_sites_.clear();
+
+  fast_tier_function_ = nullptr;
+  if (function->is_fast_tier()) {
+    // Counters are per-session data, and the code is replaced soon anyway.
+    fast_tier_function_ = function;
+    storable_ = false;
+    std::vector<uint32_t> block_addresses;
+    for (auto block = builder->first_block(); block; block = block->next) {
+      uint32_t block_address = GetBlockAddress(block);
+      if (block_address) {
+        block_addresses.push_back(block_address);
+      }
+    }
+    function->AllocateBlockExecutionCounts(std::move(block_addresses));
+  }
+  profiled_function_ = cvars::profile_function_calls ? function : nullptr;
 
   // Fill the generator with code.
   EmitFunctionInfo func_info = {};
@@ -112,10 +178,26 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   // Copy the final code to the cache and relocate it.
   *out_code_size = getSize();
   *out_code_address = Emplace(func_info, function);
+  if (!*out_code_address) {
+    return false;
+  }
 
   // Stash source map.
   source_map_arena_.CloneContents(out_source_map);
 
+  if (storable_) {
+    code_storage_->Append(function, func_info, *out_code_address,
+                          *out_source_map, relocations_, direct_call_sites_);
+  }
+  code_storage_ = nullptr;
+  fast_tier_function_ = nullptr;
+  profiled_function_ = nullptr;
+
+  // Only after storing, as patched calls are specific to this session.
+  if (!direct_call_sites_.empty()) {
+    code_cache_->AddDirectCallSites(*out_code_address, direct_call_sites_);
+  }
+
   return true;
 }
 
@@ -133,12 +215,18 @@ void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
   void* new_execute_address;
   void* new_write_address;
   assert_true(func_info.code_size.total == size_);
+  bool placed;
   if (function) {
-    code_cache_->PlaceGuestCode(function->address(), top_, func_info, function,
-                                new_execute_address, new_write_address);
+    placed = code_cache_->PlaceGuestCode(function->address(), top_, func_info,
+                                         function, new_execute_address,
+                                         new_write_address);
   } else {
-    code_cache_->PlaceHostCode(0, top_, func_info, new_execute_address,
-                               new_write_address);
+    placed = code_cache_->PlaceHostCode(0, top_, func_info,
+                                        new_execute_address, new_write_address);
+  }
+  if (!placed) {
+    reset();
+    return nullptr;
   }
   top_ = reinterpret_cast<uint8_t*>(new_write_address);
   ready();
@@ -150,6 +238,10 @@ void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
 bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   Xbyak::Label epilog_label;
   epilog_label_ = &epilog_label;
+  Xbyak::Label direct_call_stub_label;
+  direct_call_stub_label_ = &direct_call_stub_label;
+  Xbyak::Label tier_up_label;
+  Xbyak::Label tier_up_return_label;
 
   // Calculate stack size. We need to align things to their natural sizes.
   // This could be much better (sort by type/etc).
@@ -200,6 +292,24 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   mov(qword[rsp + StackLayout::GUEST_RET_ADDR], rcx);
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], 0);
 
+  if (fast_tier_function_) {
+    // Request recompilation exactly once when the threshold is reached, even
+    // though the count isn't updated atomically.
+    mov(rax,
+        reinterpret_cast<uint64_t>(fast_tier_function_->call_count_ptr()));
+    inc(dword[rax]);
+    cmp(dword[rax], uint32_t(std::max(cvars::tiered_compilation_threshold, 1)));
+    je(tier_up_label, CodeGenerator::T_NEAR);
+    L(tier_up_return_label);
+  }
+
+  if (profiled_function_) {
+    // Not locked - an occasionally lost call is fine for profiling.
+    mov(rax, reinterpret_cast<uint64_t>(
+                 profiled_function_->profile_call_count_ptr()));
+    inc(qword[rax]);
+  }
+
   // Safe now to do some tracing.
   if (debug_info_flags_ & DebugInfoFlags::kDebugInfoTraceFunctions) {
     // We require 32-bit addresses.
@@ -242,6 +352,16 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
       label = label->next;
     }
 
+    if (fast_tier_function_) {
+      uint32_t* execution_count =
+          fast_tier_function_->LookupBlockExecutionCount(
+              GetBlockAddress(block));
+      if (execution_count) {
+        mov(rax, reinterpret_cast<uint64_t>(execution_count));
+        inc(dword[rax]);
+      }
+    }
+
     // Process instructions.
     const Instr* instr = block->instr_head;
     while (instr) {
@@ -273,6 +393,22 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
 
   code_offsets.tail = getSize();
 
+  // Target of the direct calls not patched yet, with the callee address in
+  // ebx.
+  if (!direct_call_sites_.empty()) {
+    L(direct_call_stub_label);
+    mov(eax, dword[ebx]);
+    jmp(rax);
+  }
+  direct_call_stub_label_ = nullptr;
+
+  if (fast_tier_function_) {
+    L(tier_up_label);
+    CallNative(RecompileHotFunction,
+               reinterpret_cast<uint64_t>(fast_tier_function_));
+    jmp(tier_up_return_label, CodeGenerator::T_NEAR);
+  }
+
   if (cvars::emit_source_annotations) {
     nop();
     nop();
@@ -401,8 +537,41 @@ extern "C" uint64_t ResolveFunction(void* raw_context,
 void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   assert_not_null(function);
   auto fn = static_cast<X64Function*>(function);
+  if (cvars::patch_direct_calls && code_cache_->has_indirection_table()) {
+    // Call through the stub loading the target from the indirection table,
+    // until X64CodeCache patches the call to the code of the function.
+    mov(ebx, function->address());
+    if (instr->flags & hir::CALL_TAIL) {
+      // Since we skip the prolog we need to mark the return here.
+      EmitTraceUserCallReturn();
+
+      // Pass the callers return address over.
+      mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+
+      add(rsp, static_cast<uint32_t>(stack_size()));
+    } else {
+      // Return address is from the previous SET_RETURN_ADDRESS.
+      mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+    }
+    // Keep the rel32 instruction within an aligned qword.
+    size_t qword_offset = getSize() & 7;
+    if (qword_offset > 3) {
+      nop(8 - qword_offset);
+    }
+    direct_call_sites_.push_back({uint32_t(getSize()), function->address()});
+    if (instr->flags & hir::CALL_TAIL) {
+      jmp(*direct_call_stub_label_, CodeGenerator::T_NEAR);
+    } else {
+      call(*direct_call_stub_label_);
+    }
+    assert_true(getSize() - direct_call_sites_.back().code_offset == 5);
+    return;
+  }
+
   // Resolve address to the function to call and store in rax.
-  if (fn->machine_code()) {
+  // Stored code can't refer to code cache addresses of other functions, as
+  // they're placed in a different order in every session.
+  if (fn->machine_code() && !code_storage_) {
     // TODO(benvanik): is it worth it to do this? It removes the need for
     // a ResolveFunction call, but makes the table less useful.
     assert_zero(uint64_t(fn->machine_code()) & 0xFFFFFFFF00000000);
@@ -458,7 +627,7 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
     mov(edx, reg.cvt32());
-    mov(rax, reinterpret_cast<uint64_t>(ResolveFunction));
+    MovHostImageAddress(rax, reinterpret_cast<void*>(ResolveFunction));
     mov(rcx, GetContextReg());
     call(rax);
   }
@@ -504,15 +673,29 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // r9  = arg2
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
-      mov(rcx, reinterpret_cast<uint64_t>(builtin_function->handler()));
-      mov(rdx, reinterpret_cast<uint64_t>(builtin_function->arg0()));
-      mov(r8, reinterpret_cast<uint64_t>(builtin_function->arg1()));
+      MovRelocatable(rcx,
+                     reinterpret_cast<uint64_t>(builtin_function->handler()),
+                     CodeRelocation::Type::kBuiltinHandler,
+                     function->address());
+      MovRelocatable(rdx, reinterpret_cast<uint64_t>(builtin_function->arg0()),
+                     CodeRelocation::Type::kBuiltinArg0, function->address());
+      MovRelocatable(r8, reinterpret_cast<uint64_t>(builtin_function->arg1()),
+                     CodeRelocation::Type::kBuiltinArg1, function->address());
       call(rax);
       // rax = host return
     }
   } else if (function->behavior() == Function::Behavior::kExtern) {
     auto extern_function = static_cast<const GuestFunction*>(function);
-    if (extern_function->extern_handler()) {
+    auto export_data = extern_function->export_data();
+    if (cvars::fast_kernel_calls && export_data &&
+        (export_data->tags & ExportTag::kFastCall) &&
+        export_data->function_data.fast_call &&
+        extern_function->extern_handler() ==
+            reinterpret_cast<GuestFunction::ExternHandler>(
+                export_data->function_data.trampoline)) {
+      undefined = false;
+      CallExternFast(extern_function);
+    } else if (extern_function->extern_handler()) {
       undefined = false;
       // rcx = target function
       // rdx = arg0
@@ -520,7 +703,9 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // r9  = arg2
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
-      mov(rcx, reinterpret_cast<uint64_t>(extern_function->extern_handler()));
+      MovRelocatable(
+          rcx, reinterpret_cast<uint64_t>(extern_function->extern_handler()),
+          CodeRelocation::Type::kExternHandler, function->address());
       mov(rdx,
           qword[GetContextReg() + offsetof(ppc::PPCContext, kernel_state)]);
       call(rax);
@@ -528,10 +713,52 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     }
   }
   if (undefined) {
+    MarkNotStorable();
     CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(function));
   }
 }
 
+void X64Emitter::CallExternFast(const GuestFunction* function) {
+  // Extern calls are the only code of import thunks, which are never inlined,
+  // so no values are kept in registers across them, and the volatile ones
+  // don't need to be preserved. The stack is aligned, and the argument
+  // temporaries at its bottom can be used as the home space for the callee.
+#if XE_PLATFORM_WIN32
+  // rcx = context
+  // rdx = r3
+  // r8  = r4
+  // r9  = r5
+  const Xbyak::Reg64 arg_regs[] = {rcx, rdx, r8, r9};
+#else
+  // rdi = context
+  // rsi = r3
+  // rdx = r4
+  // rcx = r5
+  const Xbyak::Reg64 arg_regs[] = {rdi, rsi, rdx, rcx};
+#endif
+  static_assert(Export::kFastCallMaxArgCount == 3,
+                "Fast call arguments must all be passed in registers");
+  auto gpr = [this](uint32_t n) {
+    return qword[GetContextReg() + offsetof(ppc::PPCContext, r) +
+                 n * sizeof(uint64_t)];
+  };
+  // The context register is an argument register on Linux, so it's
+  // overwritten last.
+  mov(arg_regs[3], gpr(5));
+  mov(arg_regs[2], gpr(4));
+  mov(arg_regs[0], GetContextReg());
+  mov(arg_regs[1], gpr(3));
+  auto fast_call = function->export_data()->function_data.fast_call;
+  MovRelocatable(rax, reinterpret_cast<uint64_t>(fast_call),
+                 CodeRelocation::Type::kExternFastCall, function->address());
+  call(rax);
+#if !XE_PLATFORM_WIN32
+  // The context and membase registers aren't preserved by the callee.
+  ReloadContext();
+  ReloadMembase();
+#endif
+}
+
 void X64Emitter::CallNative(void* fn) { CallNativeSafe(fn); }
 
 void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context)) {
@@ -555,11 +782,25 @@ void X64Emitter::CallNativeSafe(void* fn) {
   // r9  = arg2
   auto thunk = backend()->guest_to_host_thunk();
   mov(rax, reinterpret_cast<uint64_t>(thunk));
-  mov(rcx, reinterpret_cast<uint64_t>(fn));
+  MovHostImageAddress(rcx, fn);
   call(rax);
   // rax = host return
 }
 
+void X64Emitter::MovRelocatable(const Xbyak::Reg64& dest, uint64_t value,
+                                CodeRelocation::Type type, uint64_t target) {
+  // mov r64, imm64 - xbyak would pick a shorter encoding for small values.
+  int index = dest.getIdx();
+  db(0x48 | (index >= 8 ? 0x01 : 0x00));
+  db(0xB8 | (index & 7));
+  CodeRelocation relocation;
+  relocation.code_offset = uint32_t(getSize());
+  relocation.type = type;
+  relocation.target = target;
+  relocations_.push_back(relocation);
+  dq(value);
+}
+
 void X64Emitter::SetReturnAddress(uint64_t value) {
   mov(rax, value);
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], rax);
@@ -748,6 +989,11 @@ static const vec128_t xmm_consts[] = {
     /* XMMQNaN                */ vec128i(0x7FC00000u),
     /* XMMInt127              */ vec128i(0x7Fu),
     /* XMM2To32               */ vec128f(0x1.0p32f),
+    /* XMMShiftMaskPI8        */ vec128b(0x07),
+    /* XMMShiftMaskPI16       */ vec128s(0x000F),
+    /* XMMLowByteMaskPI16     */ vec128s(0x00FF),
+    /* XMMPack8_IN_16_Permute */
+    vec128i(0x02000604u, 0x0A080E0Cu, 0x12101614u, 0x1A181E1Cu),
 };
 
 // First location to try and place constants.
@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "xenia/base/arena.h"
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/function_trace_data.h"
 #include "xenia/cpu/hir/hir_builder.h"
@@ -38,8 +39,7 @@ namespace x64 {
 
 class X64Backend;
 class X64CodeCache;
-
-struct EmitFunctionInfo;
+class X64CodeStorage;
 
 enum RegisterFlags {
   REG_DEST = (1 << 0),
@@ -116,6 +116,10 @@ enum XmmConst {
   XMMQNaN,
   XMMInt127,
   XMM2To32,
+  XMMShiftMaskPI8,
+  XMMShiftMaskPI16,
+  XMMLowByteMaskPI16,
+  XMMPack8_IN_16_Permute,
 };
 
 // Unfortunately due to the design of xbyak we have to pass this to the ctor.
@@ -131,6 +135,10 @@ enum X64EmitterFeatureFlags {
   kX64EmitBMI2 = 1 << 4,
   kX64EmitF16C = 1 << 5,
   kX64EmitMovbe = 1 << 6,
+  kX64EmitAVX512F = 1 << 7,
+  kX64EmitAVX512VL = 1 << 8,
+  kX64EmitAVX512BW = 1 << 9,
+  kX64EmitAVX512VBMI = 1 << 10,
 };
 
 class X64Emitter : public Xbyak::CodeGenerator {
@@ -190,6 +198,9 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void Call(const hir::Instr* instr, GuestFunction* function);
   void CallIndirect(const hir::Instr* instr, const Xbyak::Reg64& reg);
   void CallExtern(const hir::Instr* instr, const Function* function);
+  // Calls the fast entry point of a kernel export tagged with kFastCall,
+  // bypassing the guest-to-host thunk.
+  void CallExternFast(const GuestFunction* function);
   void CallNative(void* fn);
   void CallNative(uint64_t (*fn)(void* raw_context));
   void CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0));
@@ -198,6 +209,20 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void CallNativeSafe(void* fn);
   void SetReturnAddress(uint64_t value);
 
+  // Loads a 64-bit host pointer, always using the full width immediate, and
+  // records it so the code can be relocated when restored from storage.
+  void MovRelocatable(const Xbyak::Reg64& dest, uint64_t value,
+                      CodeRelocation::Type type, uint64_t target);
+  // Loads the address of a host function or static data.
+  void MovHostImageAddress(const Xbyak::Reg64& dest, const void* address) {
+    MovRelocatable(dest, reinterpret_cast<uint64_t>(address),
+                   CodeRelocation::Type::kHostImage,
+                   reinterpret_cast<uint64_t>(address));
+  }
+  // Prevents the function being emitted from being stored persistently, for
+  // code referring to host objects that can't be located in another session.
+  void MarkNotStorable() { storable_ = false; }
+
   Xbyak::Reg64 GetNativeParam(uint32_t param);
 
   Xbyak::Reg64 GetContextReg();
@@ -220,8 +245,10 @@ class X64Emitter : public Xbyak::CodeGenerator {
   Xbyak::Address StashConstantXmm(int index, double v);
   Xbyak::Address StashConstantXmm(int index, const vec128_t& v);
 
+  uint32_t feature_flags() const { return feature_flags_; }
+  // Multiple flags may be passed to check if all of them are enabled.
   bool IsFeatureEnabled(uint32_t feature_flag) const {
-    return (feature_flags_ & feature_flag) != 0;
+    return (feature_flags_ & feature_flag) == feature_flag;
   }
 
   FunctionDebugInfo* debug_info() const { return debug_info_; }
@@ -229,6 +256,7 @@ class X64Emitter : public Xbyak::CodeGenerator {
   size_t stack_size() const { return stack_size_; }
 
  protected:
+  // Copies the code to the code cache, or returns nullptr if it's full.
   void* Emplace(const EmitFunctionInfo& func_info,
                 GuestFunction* function = nullptr);
   bool Emit(hir::HIRBuilder* builder, EmitFunctionInfo& func_info);
@@ -244,6 +272,7 @@ class X64Emitter : public Xbyak::CodeGenerator {
   uint32_t feature_flags_ = 0;
 
   Xbyak::Label* epilog_label_ = nullptr;
+  Xbyak::Label* direct_call_stub_label_ = nullptr;
 
   hir::Instr* current_instr_ = nullptr;
 
@@ -252,6 +281,19 @@ class X64Emitter : public Xbyak::CodeGenerator {
   FunctionTraceData* trace_data_ = nullptr;
   Arena source_map_arena_;
 
+  // Persistent storage for the function being emitted, if it has one.
+  X64CodeStorage* code_storage_ = nullptr;
+  bool storable_ = false;
+  std::vector<CodeRelocation> relocations_;
+
+  std::vector<DirectCallSite> direct_call_sites_;
+
+  // Function being emitted in the fast tier of tiered compilation, counting
+  // its calls and block executions.
+  GuestFunction* fast_tier_function_ = nullptr;
+  // Function being emitted with a call counter for the profiler.
+  GuestFunction* profiled_function_ = nullptr;
+
   size_t stack_size_ = 0;
 
   static const uint32_t gpr_reg_map_[GPR_COUNT];
@@ -25,7 +25,10 @@ X64Function::~X64Function() {
   // machine_code_ is freed by code cache.
 }
 
-void X64Function::Setup(uint8_t* machine_code, size_t machine_code_length) {
+void X64Function::Setup(uint8_t* machine_code, size_t machine_code_length,
+                        std::vector<SourceMapEntry> source_map,
+                        std::unique_ptr<FunctionDebugInfo> debug_info) {
+  PublishTranslation(std::move(source_map), std::move(debug_info));
   machine_code_ = machine_code;
   machine_code_length_ = machine_code_length;
 }
@@ -26,7 +26,10 @@ class X64Function : public GuestFunction {
   uint8_t* machine_code() const override { return machine_code_; }
   size_t machine_code_length() const override { return machine_code_length_; }
 
-  void Setup(uint8_t* machine_code, size_t machine_code_length);
+  // Makes the machine code current along with its source map and debug info.
+  void Setup(uint8_t* machine_code, size_t machine_code_length,
+             std::vector<SourceMapEntry> source_map,
+             std::unique_ptr<FunctionDebugInfo> debug_info);
 
  protected:
   bool CallImpl(ThreadState* thread_state, uint32_t return_address) override;
@@ -15,6 +15,7 @@
 #include "xenia/base/memory.h"
 #include "xenia/cpu/backend/x64/x64_op.h"
 #include "xenia/cpu/backend/x64/x64_tracers.h"
+#include "xenia/cpu/ppc/ppc_context.h"
 
 namespace xe {
 namespace cpu {
@@ -213,6 +214,124 @@ struct ATOMIC_COMPARE_EXCHANGE_I64
 EMITTER_OPCODE_TABLE(OPCODE_ATOMIC_COMPARE_EXCHANGE,
                      ATOMIC_COMPARE_EXCHANGE_I32, ATOMIC_COMPARE_EXCHANGE_I64);
 
+// ============================================================================
+// OPCODE_RESERVED_LOAD
+// ============================================================================
+// The reservation is the guest address and the value loaded from it, stored in
+// the context of the thread. Reserved stores are compare-exchanges against the
+// loaded value, so they fail if another thread changed the memory in between.
+static Xbyak::Address ReservedAddress(X64Emitter& e) {
+  return e.dword[e.GetContextReg() +
+                 offsetof(ppc::PPCContext, reserved_address)];
+}
+template <typename T>
+void StoreReservedAddress(X64Emitter& e, const T& guest) {
+  // Before the load, as the destination may share the register of the address.
+  if (guest.is_constant) {
+    e.mov(ReservedAddress(e), static_cast<uint32_t>(guest.constant()));
+  } else {
+    e.mov(ReservedAddress(e), guest.reg().cvt32());
+  }
+}
+struct RESERVED_LOAD_I32
+    : Sequence<RESERVED_LOAD_I32, I<OPCODE_RESERVED_LOAD, I32Op, I64Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    StoreReservedAddress(e, i.src1);
+    auto addr = ComputeMemoryAddress(e, i.src1);
+    e.mov(i.dest, e.dword[addr]);
+    e.mov(e.dword[e.GetContextReg() + offsetof(ppc::PPCContext, reserved_val)],
+          i.dest);
+  }
+};
+struct RESERVED_LOAD_I64
+    : Sequence<RESERVED_LOAD_I64, I<OPCODE_RESERVED_LOAD, I64Op, I64Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    StoreReservedAddress(e, i.src1);
+    auto addr = ComputeMemoryAddress(e, i.src1);
+    e.mov(i.dest, e.qword[addr]);
+    e.mov(e.qword[e.GetContextReg() + offsetof(ppc::PPCContext, reserved_val)],
+          i.dest);
+  }
+};
+EMITTER_OPCODE_TABLE(OPCODE_RESERVED_LOAD, RESERVED_LOAD_I32,
+                     RESERVED_LOAD_I64);
+
+// ============================================================================
+// OPCODE_RESERVED_STORE
+// ============================================================================
+// Leaves the host address in rcx, the expected value in rax, and the new value
+// in rdx, or jumps to the failure label if the address isn't reserved.
+template <typename REG, typename ARGS>
+void EmitReservedStorePrologue(X64Emitter& e, const ARGS& i,
+                               const REG& value_reg, Xbyak::Label& fail_label) {
+  // Copied first, as the destination may share a register with the sources.
+  if (i.src2.is_constant) {
+    e.mov(value_reg, i.src2.constant());
+  } else {
+    e.mov(value_reg, i.src2);
+  }
+  if (i.src1.is_constant) {
+    e.mov(e.ecx, static_cast<uint32_t>(i.src1.constant()));
+  } else {
+    e.mov(e.ecx, i.src1.reg().cvt32());
+  }
+  e.cmp(e.ecx, ReservedAddress(e));
+  e.jne(fail_label, CodeGenerator::T_NEAR);
+  if (xe::memory::allocation_granularity() > 0x1000) {
+    // Emulate the 4 KB physical address offset in 0xE0000000+ when can't do
+    // it via memory mapping.
+    e.cmp(e.ecx, 0xE0000000);
+    e.setae(e.al);
+    e.movzx(e.eax, e.al);
+    e.shl(e.eax, 12);
+    e.add(e.ecx, e.eax);
+  }
+  e.mov(e.rax,
+        e.qword[e.GetContextReg() + offsetof(ppc::PPCContext, reserved_val)]);
+}
+template <typename ARGS>
+void EmitReservedStoreEpilogue(X64Emitter& e, const ARGS& i,
+                               Xbyak::Label& fail_label) {
+  Xbyak::Label done_label;
+  e.sete(i.dest);
+  e.jmp(done_label, CodeGenerator::T_NEAR);
+  e.L(fail_label);
+  e.xor_(i.dest, i.dest);
+  e.L(done_label);
+  e.mov(ReservedAddress(e), 0);
+}
+struct RESERVED_STORE_I32
+    : Sequence<RESERVED_STORE_I32,
+               I<OPCODE_RESERVED_STORE, I8Op, I64Op, I32Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xbyak::Label fail_label;
+    EmitReservedStorePrologue(e, i, e.edx, fail_label);
+    // Without an atomic operation if the value has already been changed by
+    // another thread, so contended locks don't keep taking the cache line
+    // exclusively for stores that would fail.
+    e.cmp(e.dword[e.GetMembaseReg() + e.rcx], e.eax);
+    e.jne(fail_label, CodeGenerator::T_NEAR);
+    e.lock();
+    e.cmpxchg(e.dword[e.GetMembaseReg() + e.rcx], e.edx);
+    EmitReservedStoreEpilogue(e, i, fail_label);
+  }
+};
+struct RESERVED_STORE_I64
+    : Sequence<RESERVED_STORE_I64,
+               I<OPCODE_RESERVED_STORE, I8Op, I64Op, I64Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xbyak::Label fail_label;
+    EmitReservedStorePrologue(e, i, e.rdx, fail_label);
+    e.cmp(e.qword[e.GetMembaseReg() + e.rcx], e.rax);
+    e.jne(fail_label, CodeGenerator::T_NEAR);
+    e.lock();
+    e.cmpxchg(e.qword[e.GetMembaseReg() + e.rcx], e.rdx);
+    EmitReservedStoreEpilogue(e, i, fail_label);
+  }
+};
+EMITTER_OPCODE_TABLE(OPCODE_RESERVED_STORE, RESERVED_STORE_I32,
+                     RESERVED_STORE_I64);
+
 // ============================================================================
 // OPCODE_LOAD_LOCAL
 // ============================================================================
@@ -556,7 +675,9 @@ struct LOAD_MMIO_I32
     // uint64_t (context, addr)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto read_address = uint32_t(i.src2.value);
-    e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
+    e.MovRelocatable(e.GetNativeParam(0),
+                     reinterpret_cast<uint64_t>(mmio_range->callback_context),
+                     CodeRelocation::Type::kMmioCallbackContext, read_address);
     e.mov(e.GetNativeParam(1).cvt32(), read_address);
     e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
     e.bswap(e.eax);
@@ -581,7 +702,9 @@ struct STORE_MMIO_I32
     // void (context, addr, value)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto write_address = uint32_t(i.src2.value);
-    e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
+    e.MovRelocatable(e.GetNativeParam(0),
+                     reinterpret_cast<uint64_t>(mmio_range->callback_context),
+                     CodeRelocation::Type::kMmioCallbackContext, write_address);
     e.mov(e.GetNativeParam(1).cvt32(), write_address);
     if (i.src3.is_constant) {
       e.mov(e.GetNativeParam(2).cvt32(), xe::byte_swap(i.src3.constant()));
@@ -603,6 +726,80 @@ struct STORE_MMIO_I32
 };
 EMITTER_OPCODE_TABLE(OPCODE_STORE_MMIO, STORE_MMIO_I32);
 
+// ============================================================================
+// OPCODE_LOAD_MMIO_CHECKED
+// ============================================================================
+// Accesses found to be to an MMIO range by a guest address not known at
+// translation time. The range callbacks are called directly if the address is
+// in the range, rather than faulting and emulating the access.
+template <typename T>
+void EmitCheckMmioRange(X64Emitter& e, const MMIORange* mmio_range,
+                        const T& guest, Xbyak::Label& memory_label) {
+  // The address is kept as the argument of the callback.
+  if (guest.is_constant) {
+    e.mov(e.GetNativeParam(1).cvt32(), static_cast<uint32_t>(guest.constant()));
+  } else {
+    e.mov(e.GetNativeParam(1).cvt32(), guest.reg().cvt32());
+  }
+  e.mov(e.eax, e.GetNativeParam(1).cvt32());
+  e.and_(e.eax, mmio_range->mask);
+  e.cmp(e.eax, mmio_range->address);
+  e.jne(memory_label, CodeGenerator::T_NEAR);
+  e.MovRelocatable(e.GetNativeParam(0),
+                   reinterpret_cast<uint64_t>(mmio_range->callback_context),
+                   CodeRelocation::Type::kMmioCallbackContext,
+                   mmio_range->address);
+}
+struct LOAD_MMIO_CHECKED_I32
+    : Sequence<LOAD_MMIO_CHECKED_I32,
+               I<OPCODE_LOAD_MMIO_CHECKED, I32Op, OffsetOp, I64Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    // uint64_t (context, addr)
+    auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
+    Xbyak::Label memory_label, done_label;
+    EmitCheckMmioRange(e, mmio_range, i.src2, memory_label);
+    e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
+    e.bswap(e.eax);
+    e.mov(i.dest, e.eax);
+    e.jmp(done_label, CodeGenerator::T_NEAR);
+    e.L(memory_label);
+    e.mov(i.dest, e.dword[ComputeMemoryAddress(e, i.src2)]);
+    e.L(done_label);
+  }
+};
+EMITTER_OPCODE_TABLE(OPCODE_LOAD_MMIO_CHECKED, LOAD_MMIO_CHECKED_I32);
+
+// ============================================================================
+// OPCODE_STORE_MMIO_CHECKED
+// ============================================================================
+struct STORE_MMIO_CHECKED_I32
+    : Sequence<STORE_MMIO_CHECKED_I32,
+               I<OPCODE_STORE_MMIO_CHECKED, VoidOp, OffsetOp, I64Op, I32Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    // void (context, addr, value)
+    auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
+    Xbyak::Label memory_label, done_label;
+    EmitCheckMmioRange(e, mmio_range, i.src2, memory_label);
+    if (i.src3.is_constant) {
+      e.mov(e.GetNativeParam(2).cvt32(), xe::byte_swap(i.src3.constant()));
+    } else {
+      e.mov(e.GetNativeParam(2).cvt32(), i.src3);
+      e.bswap(e.GetNativeParam(2).cvt32());
+    }
+    e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->write));
+    e.jmp(done_label, CodeGenerator::T_NEAR);
+    e.L(memory_label);
+    auto addr = ComputeMemoryAddress(e, i.src2);
+    if (i.src3.is_constant) {
+      e.mov(e.dword[addr], i.src3.constant());
+    } else {
+      e.mov(e.dword[addr], i.src3);
+    }
+    e.L(done_label);
+  }
+};
+EMITTER_OPCODE_TABLE(OPCODE_STORE_MMIO_CHECKED, STORE_MMIO_CHECKED_I32);
+
 // ============================================================================
 // OPCODE_LOAD_OFFSET
 // ============================================================================
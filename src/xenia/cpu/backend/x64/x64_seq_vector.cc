@@ -154,14 +154,14 @@ struct LOAD_VECTOR_SHL_I8
     if (i.src1.is_constant) {
       auto sh = i.src1.constant();
       assert_true(sh < xe::countof(lvsl_table));
-      e.mov(e.rax, (uintptr_t)&lvsl_table[sh]);
+      e.MovHostImageAddress(e.rax, &lvsl_table[sh]);
       e.vmovaps(i.dest, e.ptr[e.rax]);
     } else {
       // TODO(benvanik): find a cheaper way of doing this.
       e.movzx(e.rdx, i.src1);
       e.and_(e.dx, 0xF);
       e.shl(e.dx, 4);
-      e.mov(e.rax, (uintptr_t)lvsl_table);
+      e.MovHostImageAddress(e.rax, lvsl_table);
       e.vmovaps(i.dest, e.ptr[e.rax + e.rdx]);
     }
   }
@@ -195,14 +195,14 @@ struct LOAD_VECTOR_SHR_I8
     if (i.src1.is_constant) {
       auto sh = i.src1.constant();
       assert_true(sh < xe::countof(lvsr_table));
-      e.mov(e.rax, (uintptr_t)&lvsr_table[sh]);
+      e.MovHostImageAddress(e.rax, &lvsr_table[sh]);
       e.vmovaps(i.dest, e.ptr[e.rax]);
     } else {
       // TODO(benvanik): find a cheaper way of doing this.
       e.movzx(e.rdx, i.src1);
       e.and_(e.dx, 0xF);
       e.shl(e.dx, 4);
-      e.mov(e.rax, (uintptr_t)lvsr_table);
+      e.MovHostImageAddress(e.rax, lvsr_table);
       e.vmovaps(i.dest, e.ptr[e.rax + e.rdx]);
     }
   }
@@ -689,6 +689,184 @@ struct VECTOR_SUB
 };
 EMITTER_OPCODE_TABLE(OPCODE_VECTOR_SUB, VECTOR_SUB);
 
+// ============================================================================
+// Variable 8 and 16-bit lane shifts
+// ============================================================================
+// x86 has per-lane variable shifts only for 32-bit lanes in AVX2 and for 16-bit
+// lanes in AVX-512BW, so narrower lanes are shifted within wider ones.
+enum class VectorShiftType {
+  kLeft,
+  kRightLogical,
+  kRightArithmetic,
+};
+
+static void EmitVectorShiftDwords(X64Emitter& e, VectorShiftType type,
+                                  const Xmm& dest, const Xmm& src,
+                                  const Xmm& counts) {
+  switch (type) {
+    case VectorShiftType::kLeft:
+      e.vpsllvd(dest, src, counts);
+      break;
+    case VectorShiftType::kRightLogical:
+      e.vpsrlvd(dest, src, counts);
+      break;
+    case VectorShiftType::kRightArithmetic:
+      e.vpsravd(dest, src, counts);
+      break;
+  }
+}
+
+static void EmitVectorShiftWords(X64Emitter& e, VectorShiftType type,
+                                 const Xmm& dest, const Xmm& src,
+                                 const Xmm& counts) {
+  switch (type) {
+    case VectorShiftType::kLeft:
+      e.vpsllvw(dest, src, counts);
+      break;
+    case VectorShiftType::kRightLogical:
+      e.vpsrlvw(dest, src, counts);
+      break;
+    case VectorShiftType::kRightArithmetic:
+      e.vpsravw(dest, src, counts);
+      break;
+  }
+}
+
+template <typename ARGS>
+static Xmm LoadVectorShiftSource(X64Emitter& e, const ARGS& i) {
+  if (i.src1.is_constant) {
+    e.LoadConstantXmm(e.xmm2, i.src1.constant());
+    return e.xmm2;
+  }
+  return i.src1;
+}
+
+// Shifts every byte within the top or the bottom byte of its dword, one byte
+// position of the dwords at a time.
+template <typename ARGS>
+static void EmitVectorShiftInt8AVX2(X64Emitter& e, const ARGS& i,
+                                    VectorShiftType type) {
+  Xmm src1 = LoadVectorShiftSource(e, i);
+  for (uint8_t n = 0; n < 4; ++n) {
+    // Counts of byte n of the dwords in xmm0.
+    if (i.src2.is_constant) {
+      vec128_t counts;
+      for (size_t m = 0; m < 4; ++m) {
+        counts.u32[m] = i.src2.constant().u8[m * 4 + n] & 0x7;
+      }
+      e.LoadConstantXmm(e.xmm0, counts);
+    } else {
+      e.vpslld(e.xmm0, i.src2, 29 - n * 8);
+      e.vpsrld(e.xmm0, e.xmm0, 29);
+    }
+    // Shifted bytes are accumulated in xmm3.
+    Xmm shifted = n ? e.xmm1 : e.xmm3;
+    if (type == VectorShiftType::kLeft) {
+      // At the bottom, with the upper bytes cleared so nothing is shifted in.
+      if (n) {
+        e.vpsrld(shifted, src1, n * 8);
+        e.vpand(shifted, shifted, e.GetXmmConstPtr(XMMShiftByteMask));
+      } else {
+        e.vpand(shifted, src1, e.GetXmmConstPtr(XMMShiftByteMask));
+      }
+      e.vpsllvd(shifted, shifted, e.xmm0);
+      e.vpand(shifted, shifted, e.GetXmmConstPtr(XMMShiftByteMask));
+    } else {
+      // At the top, so zeros or the sign bits are shifted in.
+      if (n != 3) {
+        e.vpslld(shifted, src1, 24 - n * 8);
+        EmitVectorShiftDwords(e, type, shifted, shifted, e.xmm0);
+      } else {
+        EmitVectorShiftDwords(e, type, shifted, src1, e.xmm0);
+      }
+      e.vpsrld(shifted, shifted, 24);
+    }
+    if (n) {
+      e.vpslld(shifted, shifted, n * 8);
+      if (n != 3) {
+        e.vpor(e.xmm3, e.xmm3, shifted);
+      } else {
+        e.vpor(i.dest, e.xmm3, shifted);
+      }
+    }
+  }
+}
+
+// Shifts the even words after moving them to the upper half of their dwords,
+// and the odd words in place.
+template <typename ARGS>
+static void EmitVectorShiftInt16AVX2(X64Emitter& e, const ARGS& i,
+                                     VectorShiftType type) {
+  Xmm src1 = LoadVectorShiftSource(e, i);
+  // Counts of the even words in xmm0, and of the odd words in xmm1.
+  if (i.src2.is_constant) {
+    vec128_t even_counts, odd_counts;
+    for (size_t n = 0; n < 4; ++n) {
+      even_counts.u32[n] = i.src2.constant().u16[n * 2] & 0xF;
+      odd_counts.u32[n] = i.src2.constant().u16[n * 2 + 1] & 0xF;
+    }
+    e.LoadConstantXmm(e.xmm0, even_counts);
+    e.LoadConstantXmm(e.xmm1, odd_counts);
+  } else {
+    e.vpand(e.xmm0, i.src2, e.GetXmmConstPtr(XMMShiftMaskEvenPI16));
+    e.vpsrld(e.xmm1, i.src2, 16);
+    e.vpand(e.xmm1, e.xmm1, e.GetXmmConstPtr(XMMShiftMaskEvenPI16));
+  }
+  e.vpslld(e.xmm3, src1, 16);
+  EmitVectorShiftDwords(e, type, e.xmm3, e.xmm3, e.xmm0);
+  e.vpsrld(e.xmm3, e.xmm3, 16);
+  if (type == VectorShiftType::kLeft) {
+    // Clear the even words so they're not shifted into the odd ones.
+    e.vpsrld(e.xmm0, src1, 16);
+    e.vpslld(e.xmm0, e.xmm0, 16);
+    EmitVectorShiftDwords(e, type, e.xmm0, e.xmm0, e.xmm1);
+  } else {
+    EmitVectorShiftDwords(e, type, e.xmm0, src1, e.xmm1);
+  }
+  e.vpblendw(i.dest, e.xmm3, e.xmm0, 0b10101010);
+}
+
+// Shifts the bytes extended to words in a ymm register.
+template <typename ARGS>
+static void EmitVectorShiftInt8AVX512(X64Emitter& e, const ARGS& i,
+                                      VectorShiftType type) {
+  Xmm src1 = LoadVectorShiftSource(e, i);
+  if (type == VectorShiftType::kRightArithmetic) {
+    e.vpmovsxbw(e.ymm1, src1);
+  } else {
+    e.vpmovzxbw(e.ymm1, src1);
+  }
+  if (i.src2.is_constant) {
+    vec128_t counts = i.src2.constant();
+    for (size_t n = 0; n < 16; ++n) {
+      counts.u8[n] &= 0x7;
+    }
+    e.LoadConstantXmm(e.xmm0, counts);
+  } else {
+    e.vpand(e.xmm0, i.src2, e.GetXmmConstPtr(XMMShiftMaskPI8));
+  }
+  e.vpmovzxbw(e.ymm0, e.xmm0);
+  EmitVectorShiftWords(e, type, e.ymm1, e.ymm1, e.ymm0);
+  e.vpmovwb(i.dest, e.ymm1);
+  e.vzeroupper();
+}
+
+template <typename ARGS>
+static void EmitVectorShiftInt16AVX512(X64Emitter& e, const ARGS& i,
+                                       VectorShiftType type) {
+  Xmm src1 = LoadVectorShiftSource(e, i);
+  if (i.src2.is_constant) {
+    vec128_t counts = i.src2.constant();
+    for (size_t n = 0; n < 8; ++n) {
+      counts.u16[n] &= 0xF;
+    }
+    e.LoadConstantXmm(e.xmm0, counts);
+  } else {
+    e.vpand(e.xmm0, i.src2, e.GetXmmConstPtr(XMMShiftMaskPI16));
+  }
+  EmitVectorShiftWords(e, type, i.dest, src1, e.xmm0);
+}
+
 // ============================================================================
 // OPCODE_VECTOR_SHL
 // ============================================================================
@@ -729,7 +907,14 @@ struct VECTOR_SHL_V128
   }
 
   static void EmitInt8(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
+    if (e.IsFeatureEnabled(kX64EmitAVX512BW | kX64EmitAVX512VL)) {
+      EmitVectorShiftInt8AVX512(e, i, VectorShiftType::kLeft);
+      return;
+    }
+    if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      EmitVectorShiftInt8AVX2(e, i, VectorShiftType::kLeft);
+      return;
+    }
     if (i.src2.is_constant) {
       e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
     } else {
@@ -765,6 +950,15 @@ struct VECTOR_SHL_V128
       }
     }
 
+    if (e.IsFeatureEnabled(kX64EmitAVX512BW | kX64EmitAVX512VL)) {
+      EmitVectorShiftInt16AVX512(e, i, VectorShiftType::kLeft);
+      return;
+    }
+    if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      EmitVectorShiftInt16AVX2(e, i, VectorShiftType::kLeft);
+      return;
+    }
+
     // Shift 8 words in src1 by amount specified in src2.
     Xbyak::Label emu, end;
 
@@ -918,7 +1112,14 @@ struct VECTOR_SHR_V128
   }
 
   static void EmitInt8(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
+    if (e.IsFeatureEnabled(kX64EmitAVX512BW | kX64EmitAVX512VL)) {
+      EmitVectorShiftInt8AVX512(e, i, VectorShiftType::kRightLogical);
+      return;
+    }
+    if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      EmitVectorShiftInt8AVX2(e, i, VectorShiftType::kRightLogical);
+      return;
+    }
     if (i.src2.is_constant) {
       e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
     } else {
@@ -946,6 +1147,15 @@ struct VECTOR_SHR_V128
       }
     }
 
+    if (e.IsFeatureEnabled(kX64EmitAVX512BW | kX64EmitAVX512VL)) {
+      EmitVectorShiftInt16AVX512(e, i, VectorShiftType::kRightLogical);
+      return;
+    }
+    if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      EmitVectorShiftInt16AVX2(e, i, VectorShiftType::kRightLogical);
+      return;
+    }
+
     // Shift 8 words in src1 by amount specified in src2.
     Xbyak::Label emu, end;
 
@@ -1082,7 +1292,14 @@ struct VECTOR_SHA_V128
   }
 
   static void EmitInt8(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
+    if (e.IsFeatureEnabled(kX64EmitAVX512BW | kX64EmitAVX512VL)) {
+      EmitVectorShiftInt8AVX512(e, i, VectorShiftType::kRightArithmetic);
+      return;
+    }
+    if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      EmitVectorShiftInt8AVX2(e, i, VectorShiftType::kRightArithmetic);
+      return;
+    }
     if (i.src2.is_constant) {
       e.lea(e.GetNativeParam(1), e.StashConstantXmm(1, i.src2.constant()));
     } else {
@@ -1110,6 +1327,15 @@ struct VECTOR_SHA_V128
       }
     }
 
+    if (e.IsFeatureEnabled(kX64EmitAVX512BW | kX64EmitAVX512VL)) {
+      EmitVectorShiftInt16AVX512(e, i, VectorShiftType::kRightArithmetic);
+      return;
+    }
+    if (e.IsFeatureEnabled(kX64EmitAVX2)) {
+      EmitVectorShiftInt16AVX2(e, i, VectorShiftType::kRightArithmetic);
+      return;
+    }
+
     // Shift 8 words in src1 by amount specified in src2.
     Xbyak::Label emu, end;
 
@@ -1498,7 +1724,7 @@ struct EXTRACT_I32
       e.mov(e.al, i.src2);
       e.and_(e.al, 0x03);
       e.shl(e.al, 4);
-      e.mov(e.rdx, reinterpret_cast<uint64_t>(extract_table_32));
+      e.MovHostImageAddress(e.rdx, extract_table_32);
       e.vmovaps(e.xmm0, e.ptr[e.rdx + e.rax]);
       e.vpshufb(e.xmm0, src1, e.xmm0);
       e.vpextrd(i.dest, e.xmm0, 0);
@@ -2043,55 +2269,44 @@ struct PACK : Sequence<PACK, I<OPCODE_PACK, V128Op, V128Op, V128Op>> {
     // Merge XZ and YW.
     e.vorps(i.dest, e.xmm0);
   }
-  static __m128i EmulatePack8_IN_16_UN_UN_SAT(void*, __m128i src1,
-                                              __m128i src2) {
-    alignas(16) uint16_t a[8];
-    alignas(16) uint16_t b[8];
-    alignas(16) uint8_t c[16];
-    _mm_store_si128(reinterpret_cast<__m128i*>(a), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(b), src2);
-    for (int i = 0; i < 8; ++i) {
-      c[i] = uint8_t(std::max(uint16_t(0), std::min(uint16_t(255), a[i])));
-      c[i + 8] = uint8_t(std::max(uint16_t(0), std::min(uint16_t(255), b[i])));
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(c));
-  }
-  static __m128i EmulatePack8_IN_16_UN_UN(void*, __m128i src1, __m128i src2) {
-    alignas(16) uint8_t a[16];
-    alignas(16) uint8_t b[16];
-    alignas(16) uint8_t c[16];
-    _mm_store_si128(reinterpret_cast<__m128i*>(a), src1);
-    _mm_store_si128(reinterpret_cast<__m128i*>(b), src2);
-    for (int i = 0; i < 8; ++i) {
-      c[i] = a[i * 2];
-      c[i + 8] = b[i * 2];
-    }
-    return _mm_load_si128(reinterpret_cast<__m128i*>(c));
-  }
   static void Emit8_IN_16(X64Emitter& e, const EmitArgType& i, uint32_t flags) {
     // TODO(benvanik): handle src2 (or src1) being constant zero
     if (IsPackInUnsigned(flags)) {
       if (IsPackOutUnsigned(flags)) {
+        Xmm src1, src2;
+        if (i.src1.is_constant) {
+          src1 = e.xmm0;
+          e.LoadConstantXmm(src1, i.src1.constant());
+        } else {
+          src1 = i.src1;
+        }
+        if (i.src2.is_constant) {
+          src2 = e.xmm1;
+          e.LoadConstantXmm(src2, i.src2.constant());
+        } else {
+          src2 = i.src2;
+        }
         if (IsPackOutSaturate(flags)) {
           // unsigned -> unsigned + saturate
-          if (i.src2.is_constant) {
-            e.lea(e.GetNativeParam(1),
-                  e.StashConstantXmm(1, i.src2.constant()));
-          } else {
-            e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
-          }
-          e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-          e.CallNativeSafe(
-              reinterpret_cast<void*>(EmulatePack8_IN_16_UN_UN_SAT));
-          e.vmovaps(i.dest, e.xmm0);
+          // Clamp to 255 so the signed saturation of vpackuswb does nothing.
+          e.vpminuw(e.xmm0, src1, e.GetXmmConstPtr(XMMLowByteMaskPI16));
+          e.vpminuw(e.xmm1, src2, e.GetXmmConstPtr(XMMLowByteMaskPI16));
+          e.vpackuswb(i.dest, e.xmm0, e.xmm1);
           e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMByteOrderMask));
         } else {
           // unsigned -> unsigned
-          e.lea(e.GetNativeParam(1), e.StashXmm(1, i.src2));
-          e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-          e.CallNativeSafe(reinterpret_cast<void*>(EmulatePack8_IN_16_UN_UN));
-          e.vmovaps(i.dest, e.xmm0);
-          e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMByteOrderMask));
+          if (e.IsFeatureEnabled(kX64EmitAVX512VBMI | kX64EmitAVX512VL)) {
+            // Select the low bytes of the words in the final byte order.
+            e.vmovdqa(e.xmm2, e.GetXmmConstPtr(XMMPack8_IN_16_Permute));
+            e.vpermi2b(e.xmm2, src1, src2);
+            e.vmovdqa(i.dest, e.xmm2);
+          } else {
+            // Truncate to 8 bits so vpackuswb doesn't saturate.
+            e.vpand(e.xmm0, src1, e.GetXmmConstPtr(XMMLowByteMaskPI16));
+            e.vpand(e.xmm1, src2, e.GetXmmConstPtr(XMMLowByteMaskPI16));
+            e.vpackuswb(i.dest, e.xmm0, e.xmm1);
+            e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMByteOrderMask));
+          }
         }
       } else {
         if (IsPackOutSaturate(flags)) {
@@ -64,6 +64,7 @@ struct COMMENT : Sequence<COMMENT, I<OPCODE_COMMENT, VoidOp, OffsetOp>> {
       // TODO(benvanik): pass through.
       // TODO(benvanik): don't just leak this memory.
       auto str_copy = strdup(str);
+      e.MarkNotStorable();
       e.mov(e.rdx, reinterpret_cast<uint64_t>(str_copy));
       e.CallNative(reinterpret_cast<void*>(TraceString));
     }
@@ -2802,28 +2803,32 @@ struct SHL_I64 : Sequence<SHL_I64, I<OPCODE_SHL, I64Op, I64Op, I8Op>> {
 };
 struct SHL_V128 : Sequence<SHL_V128, I<OPCODE_SHL, V128Op, V128Op, I8Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.mov(e.GetNativeParam(1), i.src2.constant());
+    // The vector is shifted as a whole, with the elements in big-endian order,
+    // by [0,7] bits (almost always 1, but not constant). Each dword is shifted
+    // and the top bits of the next, less significant, dword are shifted in.
+    Xmm src1;
+    if (i.src1.is_constant) {
+      src1 = e.xmm2;
+      e.LoadConstantXmm(src1, i.src1.constant());
     } else {
-      e.mov(e.GetNativeParam(1), i.src2);
+      src1 = i.src1;
     }
-    e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateShlV128));
-    e.vmovaps(i.dest, e.xmm0);
-  }
-  static __m128i EmulateShlV128(void*, __m128i src1, uint8_t src2) {
-    // Almost all instances are shamt = 1, but non-constant.
-    // shamt is [0,7]
-    uint8_t shamt = src2 & 0x7;
-    alignas(16) vec128_t value;
-    _mm_store_si128(reinterpret_cast<__m128i*>(&value), src1);
-    for (int i = 0; i < 15; ++i) {
-      value.u8[i ^ 0x3] = (value.u8[i ^ 0x3] << shamt) |
-                          (value.u8[(i + 1) ^ 0x3] >> (8 - shamt));
+    e.vpsrldq(e.xmm3, src1, 4);
+    if (i.src2.is_constant) {
+      uint8_t shamt = i.src2.constant() & 0x7;
+      e.vpsrld(e.xmm3, e.xmm3, 32 - shamt);
+      e.vpslld(e.xmm0, src1, shamt);
+    } else {
+      e.movzx(e.eax, i.src2);
+      e.and_(e.eax, 0x7);
+      e.vmovd(e.xmm0, e.eax);
+      e.neg(e.eax);
+      e.add(e.eax, 32);
+      e.vmovd(e.xmm1, e.eax);
+      e.vpsrld(e.xmm3, e.xmm3, e.xmm1);
+      e.vpslld(e.xmm0, src1, e.xmm0);
     }
-    value.u8[15 ^ 0x3] = value.u8[15 ^ 0x3] << shamt;
-    return _mm_load_si128(reinterpret_cast<__m128i*>(&value));
+    e.vpor(i.dest, e.xmm0, e.xmm3);
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_SHL, SHL_I8, SHL_I16, SHL_I32, SHL_I64, SHL_V128);
@@ -2879,28 +2884,33 @@ struct SHR_I64 : Sequence<SHR_I64, I<OPCODE_SHR, I64Op, I64Op, I8Op>> {
 };
 struct SHR_V128 : Sequence<SHR_V128, I<OPCODE_SHR, V128Op, V128Op, I8Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // TODO(benvanik): native version (with shift magic).
-    if (i.src2.is_constant) {
-      e.mov(e.GetNativeParam(1), i.src2.constant());
+    // The vector is shifted as a whole, with the elements in big-endian order,
+    // by [0,7] bits (almost always 1, but not constant). Each dword is shifted
+    // and the bottom bits of the previous, more significant, dword are shifted
+    // in.
+    Xmm src1;
+    if (i.src1.is_constant) {
+      src1 = e.xmm2;
+      e.LoadConstantXmm(src1, i.src1.constant());
     } else {
-      e.mov(e.GetNativeParam(1), i.src2);
+      src1 = i.src1;
     }
-    e.lea(e.GetNativeParam(0), e.StashXmm(0, i.src1));
-    e.CallNativeSafe(reinterpret_cast<void*>(EmulateShrV128));
-    e.vmovaps(i.dest, e.xmm0);
-  }
-  static __m128i EmulateShrV128(void*, __m128i src1, uint8_t src2) {
-    // Almost all instances are shamt = 1, but non-constant.
-    // shamt is [0,7]
-    uint8_t shamt = src2 & 0x7;
-    alignas(16) vec128_t value;
-    _mm_store_si128(reinterpret_cast<__m128i*>(&value), src1);
-    for (int i = 15; i > 0; --i) {
-      value.u8[i ^ 0x3] = (value.u8[i ^ 0x3] >> shamt) |
-                          (value.u8[(i - 1) ^ 0x3] << (8 - shamt));
+    e.vpslldq(e.xmm3, src1, 4);
+    if (i.src2.is_constant) {
+      uint8_t shamt = i.src2.constant() & 0x7;
+      e.vpslld(e.xmm3, e.xmm3, 32 - shamt);
+      e.vpsrld(e.xmm0, src1, shamt);
+    } else {
+      e.movzx(e.eax, i.src2);
+      e.and_(e.eax, 0x7);
+      e.vmovd(e.xmm0, e.eax);
+      e.neg(e.eax);
+      e.add(e.eax, 32);
+      e.vmovd(e.xmm1, e.eax);
+      e.vpslld(e.xmm3, e.xmm3, e.xmm1);
+      e.vpsrld(e.xmm0, src1, e.xmm0);
     }
-    value.u8[0 ^ 0x3] = value.u8[0 ^ 0x3] >> shamt;
-    return _mm_load_si128(reinterpret_cast<__m128i*>(&value));
+    e.vpor(i.dest, e.xmm0, e.xmm3);
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_SHR, SHR_I8, SHR_I16, SHR_I32, SHR_I64, SHR_V128);
@@ -3150,7 +3160,7 @@ struct SET_ROUNDING_MODE_I32
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.mov(e.rcx, i.src1);
     e.and_(e.rcx, 0x7);
-    e.mov(e.rax, uintptr_t(mxcsr_table));
+    e.MovHostImageAddress(e.rax, mxcsr_table);
     e.vldmxcsr(e.ptr[e.rax + e.rcx * 4]);
   }
 };
@@ -0,0 +1,126 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/block_layout_pass.h"
+
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Label;
+
+BlockLayoutPass::BlockLayoutPass() : CompilerPass() {}
+
+BlockLayoutPass::~BlockLayoutPass() {}
+
+bool BlockLayoutPass::Run(HIRBuilder* builder) {
+  if (!function_) {
+    return true;
+  }
+
+  // Code falling through at the end of the function reaches the epilog, so
+  // nothing can be placed after it. Empty unlabeled blocks are left by passes
+  // appending instructions and then moving them elsewhere.
+  Block* tail = builder->last_block();
+  while (tail && !tail->instr_head && !tail->label_head) {
+    tail = tail->prev;
+  }
+  if (!tail || tail->FallsThrough()) {
+    return true;
+  }
+
+  std::vector<Block*> cold_blocks;
+  Block* block = builder->first_block()->next;
+  while (block && block != tail) {
+    if (IsCold(block)) {
+      cold_blocks.push_back(block);
+    }
+    block = block->next;
+  }
+
+  for (Block* cold_block : cold_blocks) {
+    Block* prev_block = cold_block->prev;
+    Block* next_block = cold_block->next;
+    if (prev_block->FallsThrough()) {
+      Instr* branch = prev_block->instr_tail;
+      if (branch &&
+          (branch->opcode == &OPCODE_BRANCH_TRUE_info ||
+           branch->opcode == &OPCODE_BRANCH_FALSE_info) &&
+          branch->src2.label->block == next_block) {
+        // Branching over the cold block - branch to it instead, and fall
+        // through to the hot path.
+        if (!cold_block->label_head) {
+          Label* label = builder->NewLabel();
+          builder->MarkLabel(label, cold_block);
+        }
+        branch->opcode = branch->opcode == &OPCODE_BRANCH_TRUE_info
+                             ? &OPCODE_BRANCH_FALSE_info
+                             : &OPCODE_BRANCH_TRUE_info;
+        branch->src2.label = cold_block->label_head;
+      } else if (prev_block->instr_tail) {
+        AppendBranch(builder, prev_block, cold_block);
+      } else {
+        continue;
+      }
+    }
+    if (cold_block->FallsThrough()) {
+      AppendBranch(builder, cold_block, next_block);
+    }
+    builder->MoveBlockToEnd(cold_block);
+  }
+
+  return true;
+}
+
+bool BlockLayoutPass::IsCold(Block* block) {
+  // Blocks are identified by the guest address of their first instruction, as
+  // in the emitter placing the counters.
+  Instr* instr = block->instr_head;
+  while (instr && instr->opcode != &OPCODE_SOURCE_OFFSET_info) {
+    instr = instr->next;
+  }
+  if (!instr || !block->instr_tail) {
+    return false;
+  }
+  uint32_t* execution_count =
+      function_->LookupBlockExecutionCount(uint32_t(instr->src1.offset));
+  return execution_count && !*execution_count;
+}
+
+void BlockLayoutPass::AppendBranch(HIRBuilder* builder, Block* block,
+                                   Block* target) {
+  // The builder appends to the current block if there is one, or to a new
+  // block at the end.
+  Block* current_block = builder->current_block();
+  builder->Branch(target);
+  Block* appended_block = current_block ? current_block : builder->last_block();
+  Instr* branch = appended_block->instr_tail;
+  Instr* tail = block->instr_tail;
+  branch->MoveBefore(tail);
+  tail->MoveBefore(branch);
+  if (appended_block != current_block) {
+    builder->RemoveBlock(appended_block);
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,49 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_BLOCK_LAYOUT_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_BLOCK_LAYOUT_PASS_H_
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/function.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Moves the blocks never executed by the fast tier code of the function to the
+// end, so the frequently executed code is contiguous, and conditional branches
+// skipping the cold blocks are inverted to fall through on the hot path. The
+// edges are out of date afterwards.
+class BlockLayoutPass : public CompilerPass {
+ public:
+  BlockLayoutPass();
+  ~BlockLayoutPass() override;
+
+  // Function the block execution counts are taken from, or null to keep the
+  // layout.
+  void set_function(GuestFunction* function) { function_ = function; }
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  bool IsCold(hir::Block* block);
+  void AppendBranch(hir::HIRBuilder* builder, hir::Block* block,
+                    hir::Block* target);
+
+  GuestFunction* function_ = nullptr;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_BLOCK_LAYOUT_PASS_H_
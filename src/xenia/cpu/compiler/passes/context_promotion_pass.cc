@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/compiler/passes/context_promotion_pass.h"
 
+#include <algorithm>
+
 #include "xenia/apu/apu_flags.h"
 #include "xenia/base/cvar.h"
 #include "xenia/base/profiling.h"
@@ -34,18 +36,26 @@ using xe::cpu::hir::HIRBuilder;
 using xe::cpu::hir::Instr;
 using xe::cpu::hir::Value;
 
-ContextPromotionPass::ContextPromotionPass() : CompilerPass() {}
+ContextPromotionPass::ContextPromotionPass(bool promote_across_blocks)
+    : CompilerPass(), promote_across_blocks_(promote_across_blocks) {}
 
 ContextPromotionPass::~ContextPromotionPass() {}
 
+bool ContextPromotionPass::IsContextBarrier(const Instr* instr) {
+  if (instr->opcode == &OPCODE_BRANCH_TRUE_info ||
+      instr->opcode == &OPCODE_BRANCH_FALSE_info) {
+    return false;
+  }
+  return (instr->opcode->flags & OPCODE_FLAG_VOLATILE) ||
+         instr->opcode == &OPCODE_CONTEXT_BARRIER_info;
+}
+
 bool ContextPromotionPass::Initialize(Compiler* compiler) {
   if (!CompilerPass::Initialize(compiler)) {
     return false;
   }
 
-  // This is a terrible implementation.
-  context_values_.resize(sizeof(ppc::PPCContext));
-  context_validity_.resize(static_cast<uint32_t>(sizeof(ppc::PPCContext)));
+  byte_indices_.resize(sizeof(ppc::PPCContext), -1);
 
   return true;
 }
@@ -59,89 +69,285 @@ bool ContextPromotionPass::Run(HIRBuilder* builder) {
   //   v1 = load_context +100  <-- replace with v1 = v0
   //   store_context +200, v1
   //
-  // It'd be possible in this stage to also remove redundant context stores:
   // Example of dead store elimination:
   //   store_context +100, v0  <-- removed due to following store
   //   store_context +100, v1
-  // This is more generally done by DSE, however if it could be done here
-  // instead as it may be faster (at least on the block-level).
+  //
+  // Both work across blocks. A value is promoted if it's in the context
+  // location on every path to the load, and a store is removed if every path
+  // from it overwrites the location before reading it or leaving the function.
+  NumberBlocks(builder);
 
   // Promote loads to values.
-  // Process each block independently, for now.
-  auto block = builder->first_block();
-  while (block) {
-    PromoteBlock(block);
-    block = block->next;
-  }
+  PromoteValues(builder);
 
   // Remove all dead stores.
   // This will break debugging as we can't recover this information when
   // trying to extract stack traces/register values, so we don't do that.
   if (!cvars::debug && !cvars::store_all_context_values) {
-    block = builder->first_block();
-    while (block) {
-      RemoveDeadStoresBlock(block);
-      block = block->next;
-    }
+    RemoveDeadStores(builder);
   }
 
+  blocks_.clear();
   return true;
 }
 
-void ContextPromotionPass::PromoteBlock(Block* block) {
-  auto& validity = context_validity_;
-  validity.reset();
+bool ContextPromotionPass::CompareOffset(const ContextValue& value,
+                                         uint32_t offset) {
+  return value.offset < offset;
+}
+
+void ContextPromotionPass::NumberBlocks(HIRBuilder* builder) {
+  blocks_.clear();
+  auto block = builder->first_block();
+  while (block) {
+    block->ordinal = static_cast<uint16_t>(blocks_.size());
+    blocks_.push_back(block);
+    block = block->next;
+  }
+}
+
+void ContextPromotionPass::PromoteValues(HIRBuilder* builder) {
+  ContextValues values;
+  if (!promote_across_blocks_) {
+    for (auto block : blocks_) {
+      values.clear();
+      PromoteBlock(block, &values, true);
+    }
+    return;
+  }
+
+  // Find the values available at the end of every block, optimistically
+  // assuming blocks not processed yet don't limit them, until nothing changes.
+  block_values_.clear();
+  block_values_.resize(blocks_.size());
+  block_values_valid_.clear();
+  block_values_valid_.resize(blocks_.size(), false);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto block : blocks_) {
+      GetIncomingValues(builder, block, &values);
+      PromoteBlock(block, &values, false);
+      auto& block_values = block_values_[block->ordinal];
+      if (!block_values_valid_[block->ordinal] ||
+          values.size() != block_values.size() ||
+          !std::equal(values.begin(), values.end(), block_values.begin(),
+                      [](const ContextValue& a, const ContextValue& b) {
+                        return a.offset == b.offset && a.value == b.value;
+                      })) {
+        block_values.swap(values);
+        block_values_valid_[block->ordinal] = true;
+        changed = true;
+      }
+    }
+  }
+
+  for (auto block : blocks_) {
+    GetIncomingValues(builder, block, &values);
+    PromoteBlock(block, &values, true);
+  }
+  block_values_.clear();
+}
+
+void ContextPromotionPass::GetIncomingValues(HIRBuilder* builder, Block* block,
+                                             ContextValues* values_out) {
+  values_out->clear();
+  // Nothing is known when entering the function.
+  if (block == builder->first_block()) {
+    return;
+  }
+  bool first = true;
+  auto merge = [this, values_out, &first](const Block* src) {
+    if (!block_values_valid_[src->ordinal]) {
+      return;
+    }
+    auto& src_values = block_values_[src->ordinal];
+    if (first) {
+      *values_out = src_values;
+      first = false;
+      return;
+    }
+    // Only keep values that are in the location on all paths.
+    values_out->erase(
+        std::remove_if(values_out->begin(), values_out->end(),
+                       [&src_values](const ContextValue& value) {
+                         auto it = std::lower_bound(
+                             src_values.begin(), src_values.end(),
+                             value.offset, CompareOffset);
+                         return it == src_values.end() ||
+                                it->offset != value.offset ||
+                                it->value != value.value;
+                       }),
+        values_out->end());
+  };
+  auto edge = block->incoming_edge_head;
+  while (edge) {
+    merge(edge->src);
+    edge = edge->incoming_next;
+  }
+  if (block->prev && block->prev->FallsThrough()) {
+    merge(block->prev);
+  }
+}
+
+void ContextPromotionPass::PromoteBlock(Block* block, ContextValues* values,
+                                        bool rewrite) {
+  // Forgets the values in locations overlapping the range.
+  auto invalidate = [values](uint32_t offset, uint32_t size) {
+    auto it = std::lower_bound(values->begin(), values->end(),
+                               offset >= 16 ? offset - 15 : 0,
+                               CompareOffset);
+    while (it != values->end() && it->offset + it->size <= offset) {
+      ++it;
+    }
+    auto end = it;
+    while (end != values->end() && end->offset < offset + size) {
+      ++end;
+    }
+    return values->erase(it, end);
+  };
 
   Instr* i = block->instr_head;
   while (i) {
     auto next = i->next;
-    if (i->opcode->flags & OPCODE_FLAG_VOLATILE) {
+    if (IsContextBarrier(i)) {
       // Volatile instruction - requires all context values be flushed.
-      validity.reset();
+      values->clear();
     } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
-      size_t offset = i->src1.offset;
-      if (validity.test(static_cast<uint32_t>(offset))) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      auto it = std::lower_bound(values->begin(), values->end(), offset,
+                                 CompareOffset);
+      if (it != values->end() && it->offset == offset &&
+          it->value->type == i->dest->type) {
         // Legit previous value, reuse.
-        Value* previous_value = context_values_[offset];
-        i->opcode = &hir::OPCODE_ASSIGN_info;
-        i->set_src1(previous_value);
+        if (rewrite) {
+          Value* previous_value = it->value;
+          i->opcode = &hir::OPCODE_ASSIGN_info;
+          i->set_src1(previous_value);
+        }
       } else {
         // Store the loaded value into the table.
-        context_values_[offset] = i->dest;
-        validity.set(static_cast<uint32_t>(offset));
+        uint32_t size = static_cast<uint32_t>(GetTypeSize(i->dest->type));
+        it = invalidate(offset, size);
+        values->insert(it, {offset, size, i->dest});
       }
     } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
-      size_t offset = i->src1.offset;
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
       Value* value = i->src2.value;
       // Store value into the table for later.
-      context_values_[offset] = value;
-      validity.set(static_cast<uint32_t>(offset));
+      uint32_t size = static_cast<uint32_t>(GetTypeSize(value->type));
+      auto it = invalidate(offset, size);
+      values->insert(it, {offset, size, value});
     }
     i = next;
   }
 }
 
-void ContextPromotionPass::RemoveDeadStoresBlock(Block* block) {
-  auto& validity = context_validity_;
-  validity.reset();
+void ContextPromotionPass::RemoveDeadStores(HIRBuilder* builder) {
+  // Only track the liveness of the bytes the function stores to.
+  for (auto block : blocks_) {
+    Instr* i = block->instr_head;
+    while (i) {
+      if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+        size_t offset = i->src1.offset;
+        size_t size = GetTypeSize(i->src2.value->type);
+        for (size_t j = offset; j < offset + size; ++j) {
+          if (byte_indices_[j] < 0) {
+            byte_indices_[j] = int32_t(stored_bytes_.size());
+            stored_bytes_.push_back(uint32_t(j));
+          }
+        }
+      }
+      i = i->next;
+    }
+  }
+  if (stored_bytes_.empty()) {
+    return;
+  }
+
+  // Find the bytes live at the start of every block, walking backwards until
+  // nothing changes.
+  auto tracked_count = static_cast<unsigned>(stored_bytes_.size());
+  block_live_in_.clear();
+  block_live_in_.resize(blocks_.size(), llvm::BitVector(tracked_count));
+  llvm::BitVector live(tracked_count);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto it = blocks_.rbegin(); it != blocks_.rend(); ++it) {
+      Block* block = *it;
+      GetLiveOutBytes(block, &live);
+      RemoveDeadStoresBlock(block, &live, false);
+      if (live != block_live_in_[block->ordinal]) {
+        block_live_in_[block->ordinal] = live;
+        changed = true;
+      }
+    }
+  }
 
-  // Walk backwards and mark offsets that are written to.
-  // If the offset was written to earlier, ignore the store.
+  for (auto block : blocks_) {
+    GetLiveOutBytes(block, &live);
+    RemoveDeadStoresBlock(block, &live, true);
+  }
+
+  block_live_in_.clear();
+  for (uint32_t offset : stored_bytes_) {
+    byte_indices_[offset] = -1;
+  }
+  stored_bytes_.clear();
+}
+
+void ContextPromotionPass::GetLiveOutBytes(Block* block,
+                                           llvm::BitVector* live_out) {
+  bool falls_through = block->FallsThrough();
+  if (falls_through && !block->next) {
+    // Leaving the function, everything may be read by the caller.
+    live_out->set();
+    return;
+  }
+  live_out->reset();
+  auto edge = block->outgoing_edge_head;
+  while (edge) {
+    *live_out |= block_live_in_[edge->dest->ordinal];
+    edge = edge->outgoing_next;
+  }
+  if (falls_through) {
+    *live_out |= block_live_in_[block->next->ordinal];
+  }
+}
+
+void ContextPromotionPass::RemoveDeadStoresBlock(Block* block,
+                                                 llvm::BitVector* live,
+                                                 bool remove) {
+  // Walk backwards, marking the bytes read before being written.
   Instr* i = block->instr_tail;
   while (i) {
     Instr* prev = i->prev;
-    if (i->opcode->flags & (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH)) {
+    if (IsContextBarrier(i)) {
       // Volatile instruction - requires all context values be flushed.
-      validity.reset();
+      live->set();
     } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
       size_t offset = i->src1.offset;
-      if (!validity.test(static_cast<uint32_t>(offset))) {
-        // Offset not yet written, mark and continue.
-        validity.set(static_cast<uint32_t>(offset));
-      } else {
-        // Already written to. Remove this store.
+      size_t size = GetTypeSize(i->src2.value->type);
+      bool any_live = false;
+      for (size_t j = offset; j < offset + size; ++j) {
+        unsigned index = unsigned(byte_indices_[j]);
+        any_live |= live->test(index);
+        live->reset(index);
+      }
+      if (!any_live && remove) {
+        // Overwritten before being read. Remove this store.
         i->Remove();
       }
+    } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      size_t offset = i->src1.offset;
+      size_t size = GetTypeSize(i->dest->type);
+      for (size_t j = offset; j < offset + size; ++j) {
+        if (byte_indices_[j] >= 0) {
+          live->set(unsigned(byte_indices_[j]));
+        }
+      }
     }
     i = prev;
   }
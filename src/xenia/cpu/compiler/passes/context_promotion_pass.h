@@ -31,22 +31,60 @@ namespace cpu {
 namespace compiler {
 namespace passes {
 
+// Promotes context loads to the values last loaded from or stored to the same
+// context location, and removes context stores that are overwritten before
+// being read. Both are done over the whole control flow graph, so the edges
+// from ControlFlowAnalysisPass must be up to date. Promoted values may be used
+// in blocks other than the one defining them only if promote_across_blocks is
+// set, as the register allocator must be able to keep values across blocks.
 class ContextPromotionPass : public CompilerPass {
  public:
-  ContextPromotionPass();
+  explicit ContextPromotionPass(bool promote_across_blocks = false);
   virtual ~ContextPromotionPass() override;
 
   bool Initialize(Compiler* compiler) override;
 
   bool Run(hir::HIRBuilder* builder) override;
 
+  // Whether the instruction may read or write any context location, or leave
+  // the function. Conditional branches are flagged volatile, but are handled
+  // by following the control flow graph.
+  static bool IsContextBarrier(const hir::Instr* instr);
+
  private:
-  void PromoteBlock(hir::Block* block);
-  void RemoveDeadStoresBlock(hir::Block* block);
+  // A context location known to contain a value.
+  struct ContextValue {
+    uint32_t offset;
+    uint32_t size;
+    hir::Value* value;
+  };
+  // Sorted by offset, not overlapping.
+  typedef std::vector<ContextValue> ContextValues;
+  static bool CompareOffset(const ContextValue& value, uint32_t offset);
+
+  void NumberBlocks(hir::HIRBuilder* builder);
+  void PromoteValues(hir::HIRBuilder* builder);
+  void GetIncomingValues(hir::HIRBuilder* builder, hir::Block* block,
+                         ContextValues* values_out);
+  void PromoteBlock(hir::Block* block, ContextValues* values, bool rewrite);
+  void RemoveDeadStores(hir::HIRBuilder* builder);
+  void GetLiveOutBytes(hir::Block* block, llvm::BitVector* live_out);
+  void RemoveDeadStoresBlock(hir::Block* block, llvm::BitVector* live,
+                             bool remove);
 
  private:
-  std::vector<hir::Value*> context_values_;
-  llvm::BitVector context_validity_;
+  bool promote_across_blocks_;
+
+  std::vector<hir::Block*> blocks_;
+  // Per block ordinal, the values in the context at the end of the block.
+  std::vector<ContextValues> block_values_;
+  std::vector<bool> block_values_valid_;
+  // Per context byte, the index of the bit tracking its liveness, or -1 if the
+  // function doesn't store to it.
+  std::vector<int32_t> byte_indices_;
+  std::vector<uint32_t> stored_bytes_;
+  // Per block ordinal, the stored context bytes live at the start of the block.
+  std::vector<llvm::BitVector> block_live_in_;
 };
 
 }  // namespace passes
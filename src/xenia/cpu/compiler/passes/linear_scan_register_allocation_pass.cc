@@ -0,0 +1,476 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/linear_scan_register_allocation_pass.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/platform.h"
+
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::backend::MachineInfo;
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::OpcodeSignatureType;
+using xe::cpu::hir::Value;
+
+namespace {
+
+// Rounds of allocation and spilling before giving up.
+const uint32_t kMaxAllocationRounds = 16;
+
+// Instructions after which the callee may have overwritten any register.
+bool IsCall(const Instr* instr) {
+  return instr->opcode == &OPCODE_CALL_info ||
+         instr->opcode == &OPCODE_CALL_TRUE_info ||
+         instr->opcode == &OPCODE_CALL_INDIRECT_info ||
+         instr->opcode == &OPCODE_CALL_INDIRECT_TRUE_info ||
+         instr->opcode == &OPCODE_CALL_EXTERN_info;
+}
+
+// Nothing can be inserted between paired instructions.
+Instr* GetPairHead(Instr* instr) {
+  while (instr->prev && instr->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+    instr = instr->prev;
+  }
+  return instr;
+}
+Instr* GetPairTail(Instr* instr) {
+  while (instr->next && instr->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+    instr = instr->next;
+  }
+  return instr;
+}
+
+void ReplaceSourceValue(Instr* instr, Value* old_value, Value* new_value) {
+  uint32_t signature = instr->opcode->signature;
+  if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+      instr->src1.value == old_value) {
+    instr->set_src1(new_value);
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+      instr->src2.value == old_value) {
+    instr->set_src2(new_value);
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+      instr->src3.value == old_value) {
+    instr->set_src3(new_value);
+  }
+}
+
+}  // namespace
+
+LinearScanRegisterAllocationPass::LinearScanRegisterAllocationPass(
+    const MachineInfo* machine_info)
+    : CompilerPass() {
+  auto mi_sets = machine_info->register_sets;
+  for (size_t i = 0;
+       i < xe::countof(machine_info->register_sets) && mi_sets[i].count; ++i) {
+    auto& mi_set = mi_sets[i];
+    auto usage_set = &register_sets_[i];
+    usage_set->set = &mi_set;
+    usage_set->count = mi_set.count;
+    if (mi_set.types & MachineInfo::RegisterSet::INT_TYPES) {
+      int_set_ = usage_set;
+    }
+    if (mi_set.types & MachineInfo::RegisterSet::FLOAT_TYPES) {
+      float_set_ = usage_set;
+    }
+    if (mi_set.types & MachineInfo::RegisterSet::VEC_TYPES) {
+      vec_set_ = usage_set;
+    }
+  }
+}
+
+LinearScanRegisterAllocationPass::~LinearScanRegisterAllocationPass() = default;
+
+bool LinearScanRegisterAllocationPass::Run(HIRBuilder* builder) {
+  std::vector<Value*> spilled_values;
+  for (uint32_t round = 0; round < kMaxAllocationRounds; ++round) {
+    NumberInstructions(builder);
+    ComputeLiveness(builder);
+    BuildIntervals();
+
+    spilled_values.clear();
+    if (!AllocateRegisters(&spilled_values)) {
+      XELOGE("Register allocation failed");
+      assert_always();
+      return false;
+    }
+    if (spilled_values.empty()) {
+      return true;
+    }
+
+    // Split the spilled values into shorter ones and try again.
+    for (Value* value : spilled_values) {
+      SpillValue(builder, value);
+    }
+  }
+
+  XELOGE("Register allocation failed to converge");
+  assert_always();
+  return false;
+}
+
+void LinearScanRegisterAllocationPass::NumberInstructions(HIRBuilder* builder) {
+  blocks_.clear();
+  block_start_positions_.clear();
+  block_end_positions_.clear();
+  values_.clear();
+  values_.resize(builder->max_value_ordinal(), nullptr);
+  call_positions_.clear();
+
+  uint16_t block_ordinal = 0;
+  uint32_t instr_ordinal = 0;
+  auto block = builder->first_block();
+  while (block) {
+    block->ordinal = block_ordinal++;
+    blocks_.push_back(block);
+    block_start_positions_.push_back(instr_ordinal * 2);
+    auto instr = block->instr_head;
+    while (instr) {
+      instr->ordinal = instr_ordinal++;
+      if (GET_OPCODE_SIG_TYPE_DEST(instr->opcode->signature) ==
+              OPCODE_SIG_TYPE_V &&
+          instr->dest) {
+        values_[instr->dest->ordinal] = instr->dest;
+      }
+      if (IsCall(instr)) {
+        call_positions_.push_back(instr->ordinal * 2);
+      }
+      instr = instr->next;
+    }
+    // Values live out of the block are live past all of its instructions.
+    block_end_positions_.push_back(instr_ordinal * 2);
+    block = block->next;
+  }
+}
+
+void LinearScanRegisterAllocationPass::ComputeLiveness(HIRBuilder* builder) {
+  size_t value_count = values_.size();
+  size_t block_count = blocks_.size();
+
+  // Values used in each block but defined in another, and defined in it.
+  std::vector<llvm::BitVector> uses(block_count,
+                                    llvm::BitVector(unsigned(value_count)));
+  std::vector<llvm::BitVector> defs(block_count,
+                                    llvm::BitVector(unsigned(value_count)));
+  for (Block* block : blocks_) {
+    auto& block_uses = uses[block->ordinal];
+    auto& block_defs = defs[block->ordinal];
+    auto instr = block->instr_head;
+    while (instr) {
+      uint32_t signature = instr->opcode->signature;
+#define ADD_USE(v)                        \
+  if (v->def && v->def->block != block) { \
+    block_uses.set(v->ordinal);           \
+  }
+      if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V) {
+        ADD_USE(instr->src1.value);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V) {
+        ADD_USE(instr->src2.value);
+      }
+      if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V) {
+        ADD_USE(instr->src3.value);
+      }
+#undef ADD_USE
+      if (GET_OPCODE_SIG_TYPE_DEST(signature) == OPCODE_SIG_TYPE_V &&
+          instr->dest) {
+        block_defs.set(instr->dest->ordinal);
+      }
+      instr = instr->next;
+    }
+  }
+
+  // Iterate until the live sets are stable, in reverse order so most forward
+  // edges are handled in the first iteration.
+  std::vector<llvm::BitVector> live_in(block_count,
+                                       llvm::BitVector(unsigned(value_count)));
+  std::vector<llvm::BitVector> live_out(
+      block_count, llvm::BitVector(unsigned(value_count)));
+  llvm::BitVector new_live_in(static_cast<unsigned>(value_count));
+  bool changed;
+  do {
+    changed = false;
+    for (size_t i = block_count; i-- > 0;) {
+      Block* block = blocks_[i];
+      auto& block_live_out = live_out[i];
+      auto edge = block->outgoing_edge_head;
+      while (edge) {
+        block_live_out |= live_in[edge->dest->ordinal];
+        edge = edge->outgoing_next;
+      }
+      if (block->next && block->FallsThrough()) {
+        block_live_out |= live_in[block->next->ordinal];
+      }
+      new_live_in = block_live_out;
+      new_live_in.reset(defs[i]);
+      new_live_in |= uses[i];
+      if (new_live_in != live_in[i]) {
+        live_in[i] = new_live_in;
+        changed = true;
+      }
+    }
+  } while (changed);
+
+  live_in_starts_.clear();
+  live_in_starts_.resize(value_count, UINT32_MAX);
+  live_out_ends_.clear();
+  live_out_ends_.resize(value_count, 0);
+  for (size_t i = 0; i < block_count; ++i) {
+    auto ordinal = live_in[i].find_first();
+    while (ordinal != -1) {
+      live_in_starts_[ordinal] =
+          std::min(live_in_starts_[ordinal], block_start_positions_[i]);
+      ordinal = live_in[i].find_next(ordinal);
+    }
+    ordinal = live_out[i].find_first();
+    while (ordinal != -1) {
+      live_out_ends_[ordinal] =
+          std::max(live_out_ends_[ordinal], block_end_positions_[i]);
+      ordinal = live_out[i].find_next(ordinal);
+    }
+  }
+}
+
+void LinearScanRegisterAllocationPass::BuildIntervals() {
+  intervals_.clear();
+  for (Value* value : values_) {
+    if (!value) {
+      continue;
+    }
+    value->reg.set = nullptr;
+    value->reg.index = -1;
+
+    // Without holes - a value is kept in the same register from the first
+    // position it's live at to the last, covering all blocks it's live in,
+    // including ones laid out before its definition, such as loop bodies
+    // placed before the block entering the loop.
+    Interval interval;
+    interval.value = value;
+    interval.start =
+        std::min(value->def->ordinal * 2 + 1, live_in_starts_[value->ordinal]);
+    interval.end = std::max(interval.start, live_out_ends_[value->ordinal]);
+    Instr* use_instr = nullptr;
+    bool single_use_instr = true;
+    for (auto use = value->use_head; use; use = use->next) {
+      interval.end = std::max(interval.end, use->instr->ordinal * 2);
+      if (use_instr && use->instr != use_instr) {
+        single_use_instr = false;
+      }
+      use_instr = use->instr;
+    }
+    // Reloads used by a single instruction can't be split any further.
+    interval.spillable =
+        interval.end - interval.start > 1 &&
+        !(value->def->opcode == &OPCODE_LOAD_LOCAL_info && value->local_slot &&
+          single_use_instr && live_in_starts_[value->ordinal] == UINT32_MAX &&
+          !live_out_ends_[value->ordinal]);
+    intervals_.push_back(interval);
+  }
+  std::sort(intervals_.begin(), intervals_.end(),
+            [](const Interval& a, const Interval& b) {
+              return a.start < b.start;
+            });
+}
+
+bool LinearScanRegisterAllocationPass::AllocateRegisters(
+    std::vector<Value*>* spilled_values) {
+  for (auto& usage_set : register_sets_) {
+    usage_set.availability.set();
+  }
+
+  // Intervals currently holding a register.
+  std::vector<Interval*> active;
+  for (Interval& interval : intervals_) {
+    Value* value = interval.value;
+
+    // Callees don't preserve any of the allocatable registers.
+    auto call_it = std::upper_bound(call_positions_.cbegin(),
+                                    call_positions_.cend(), interval.start);
+    if (call_it != call_positions_.cend() && *call_it + 1 < interval.end) {
+      spilled_values->push_back(value);
+      continue;
+    }
+
+    // Release the registers of values not used anymore, including the ones
+    // last used as sources of this instruction.
+    for (auto it = active.begin(); it != active.end();) {
+      if ((*it)->end < interval.start) {
+        RegisterSetForValue((*it)->value)
+            ->availability.set((*it)->value->reg.index);
+        it = active.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    RegisterSetUsage* usage_set = RegisterSetForValue(value);
+    int32_t reg_index = -1;
+
+    // X64 instructions mostly overwrite their first operand, so try to reuse
+    // the register of src1.
+    Instr* def = value->def;
+    if (GET_OPCODE_SIG_TYPE_SRC1(def->opcode->signature) ==
+        OPCODE_SIG_TYPE_V) {
+      const auto& src1_reg = def->src1.value->reg;
+      if (src1_reg.set == usage_set->set && src1_reg.index >= 0 &&
+          usage_set->availability.test(src1_reg.index)) {
+        reg_index = src1_reg.index;
+      }
+    }
+
+    if (reg_index < 0) {
+      uint32_t first_unused;
+      if (xe::bit_scan_forward(
+              static_cast<uint32_t>(usage_set->availability.to_ulong()),
+              &first_unused) &&
+          first_unused < usage_set->count) {
+        reg_index = int32_t(first_unused);
+      }
+    }
+
+    if (reg_index < 0) {
+      // Out of registers - spill the value in the set staying alive for the
+      // longest.
+      auto furthest = active.end();
+      for (auto it = active.begin(); it != active.end(); ++it) {
+        if ((*it)->spillable &&
+            RegisterSetForValue((*it)->value) == usage_set &&
+            (furthest == active.end() || (*it)->end > (*furthest)->end)) {
+          furthest = it;
+        }
+      }
+      if (furthest != active.end() &&
+          ((*furthest)->end > interval.end || !interval.spillable)) {
+        Value* furthest_value = (*furthest)->value;
+        reg_index = furthest_value->reg.index;
+        furthest_value->reg.set = nullptr;
+        furthest_value->reg.index = -1;
+        spilled_values->push_back(furthest_value);
+        active.erase(furthest);
+      } else if (interval.spillable) {
+        spilled_values->push_back(value);
+        continue;
+      } else {
+        return false;
+      }
+    }
+
+    value->reg.set = usage_set->set;
+    value->reg.index = reg_index;
+    usage_set->availability.reset(reg_index);
+    active.push_back(&interval);
+  }
+  return true;
+}
+
+void LinearScanRegisterAllocationPass::SpillValue(HIRBuilder* builder,
+                                                  Value* value) {
+  Instr* def = value->def;
+  if (!value->local_slot) {
+    value->local_slot = builder->AllocLocal(value->type);
+    builder->StoreLocal(value->local_slot, value);
+    builder->last_instr()->MoveAfter(GetPairTail(def));
+  }
+
+  // Instructions using the value, other than the spill store.
+  std::vector<Instr*> use_instrs;
+  bool used_in_other_blocks = false;
+  for (auto use = value->use_head; use; use = use->next) {
+    Instr* instr = use->instr;
+    if (instr->opcode == &OPCODE_STORE_LOCAL_info &&
+        instr->src1.value == value->local_slot) {
+      continue;
+    }
+    if (std::find(use_instrs.begin(), use_instrs.end(), instr) ==
+        use_instrs.end()) {
+      use_instrs.push_back(instr);
+    }
+    // Uses before the definition in its own block are reached through other
+    // blocks, from the previous iteration of a loop.
+    used_in_other_blocks |=
+        instr->block != def->block || instr->ordinal < def->ordinal;
+  }
+  std::sort(use_instrs.begin(), use_instrs.end(),
+            [](const Instr* a, const Instr* b) {
+              return a->ordinal < b->ordinal;
+            });
+
+  // Values used in multiple blocks are first split into one reload per block,
+  // with the defining block still using the original value after the
+  // definition. Values local to a block are reloaded for every use.
+  Instr* def_pair_head = GetPairHead(def);
+  Block* reload_block = nullptr;
+  Value* reload_value = nullptr;
+  for (Instr* instr : use_instrs) {
+    Instr* pair_head = GetPairHead(instr);
+    if (used_in_other_blocks) {
+      if (instr->block == def->block && instr->ordinal > def->ordinal) {
+        continue;
+      }
+      if (instr->block == reload_block) {
+        ReplaceSourceValue(instr, value, reload_value);
+        continue;
+      }
+      reload_block = instr->block;
+    } else if (pair_head == def_pair_head) {
+      // Paired with the definition, before the store.
+      continue;
+    }
+    reload_value = builder->LoadLocal(value->local_slot);
+    builder->last_instr()->MoveBefore(pair_head);
+    // Already in memory if spilled again.
+    reload_value->local_slot = value->local_slot;
+    ReplaceSourceValue(instr, value, reload_value);
+  }
+
+  // Reloads that had all their uses moved to new reloads.
+  if (!value->use_head && def->opcode == &OPCODE_LOAD_LOCAL_info) {
+    def->Remove();
+  }
+}
+
+LinearScanRegisterAllocationPass::RegisterSetUsage*
+LinearScanRegisterAllocationPass::RegisterSetForValue(const Value* value) {
+  if (value->type <= INT64_TYPE) {
+    return int_set_;
+  } else if (value->type <= FLOAT64_TYPE) {
+    return float_set_;
+  } else {
+    return vec_set_;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
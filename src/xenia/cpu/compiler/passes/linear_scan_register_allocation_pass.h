@@ -0,0 +1,90 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_REGISTER_ALLOCATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_REGISTER_ALLOCATION_PASS_H_
+
+#include <bitset>
+#include <vector>
+
+#include "xenia/cpu/backend/machine_info.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Register allocator working on the whole function rather than on individual
+// blocks. Live intervals are computed from liveness across the control flow
+// graph (the edges from ControlFlowAnalysisPass must be up to date), so values
+// used in multiple blocks, such as in loops, stay in host registers. Values
+// live across calls, and values spilled when running out of registers, are
+// stored to locals and reloaded, after which allocation is redone until
+// everything fits.
+class LinearScanRegisterAllocationPass : public CompilerPass {
+ public:
+  explicit LinearScanRegisterAllocationPass(
+      const backend::MachineInfo* machine_info);
+  ~LinearScanRegisterAllocationPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  struct Interval {
+    hir::Value* value;
+    // Positions are twice the ordinal of the instruction for reading its
+    // sources, and one more for writing its destination.
+    uint32_t start;
+    uint32_t end;
+    // Whether spilling would make the interval shorter.
+    bool spillable;
+  };
+  struct RegisterSetUsage {
+    const backend::MachineInfo::RegisterSet* set = nullptr;
+    uint32_t count = 0;
+    std::bitset<32> availability;
+  };
+
+  void NumberInstructions(hir::HIRBuilder* builder);
+  void ComputeLiveness(hir::HIRBuilder* builder);
+  void BuildIntervals();
+  bool AllocateRegisters(std::vector<hir::Value*>* spilled_values);
+  void SpillValue(hir::HIRBuilder* builder, hir::Value* value);
+
+  RegisterSetUsage* RegisterSetForValue(const hir::Value* value);
+
+  // Types may share a set, like floats and vectors in the same registers.
+  RegisterSetUsage register_sets_[8];
+  RegisterSetUsage* int_set_ = nullptr;
+  RegisterSetUsage* float_set_ = nullptr;
+  RegisterSetUsage* vec_set_ = nullptr;
+
+  // Per block ordinal.
+  std::vector<hir::Block*> blocks_;
+  std::vector<uint32_t> block_start_positions_;
+  std::vector<uint32_t> block_end_positions_;
+  // Per value ordinal, null for values not defined by an instruction.
+  std::vector<hir::Value*> values_;
+  // Per value ordinal, the first block start position the value is live at, or
+  // UINT32_MAX if it's not live into any block.
+  std::vector<uint32_t> live_in_starts_;
+  // Per value ordinal, the last block end position the value is live at.
+  std::vector<uint32_t> live_out_ends_;
+  // Sorted read positions of instructions calling other code.
+  std::vector<uint32_t> call_positions_;
+  std::vector<Interval> intervals_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_REGISTER_ALLOCATION_PASS_H_
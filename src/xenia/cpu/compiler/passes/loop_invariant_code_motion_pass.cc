@@ -0,0 +1,560 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/loop_invariant_code_motion_pass.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/passes/context_promotion_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+namespace {
+
+// Instructions without side effects that can't fault, so they can be executed
+// on paths where they originally weren't.
+bool IsSpeculatable(const Instr* instr) {
+  if (!instr->dest) {
+    return false;
+  }
+  switch (instr->opcode->num) {
+    case OPCODE_ASSIGN:
+    case OPCODE_CAST:
+    case OPCODE_ZERO_EXTEND:
+    case OPCODE_SIGN_EXTEND:
+    case OPCODE_TRUNCATE:
+    case OPCODE_SELECT:
+    case OPCODE_IS_TRUE:
+    case OPCODE_IS_FALSE:
+    case OPCODE_COMPARE_EQ:
+    case OPCODE_COMPARE_NE:
+    case OPCODE_COMPARE_SLT:
+    case OPCODE_COMPARE_SLE:
+    case OPCODE_COMPARE_SGT:
+    case OPCODE_COMPARE_SGE:
+    case OPCODE_COMPARE_ULT:
+    case OPCODE_COMPARE_ULE:
+    case OPCODE_COMPARE_UGT:
+    case OPCODE_COMPARE_UGE:
+    case OPCODE_AND:
+    case OPCODE_OR:
+    case OPCODE_XOR:
+    case OPCODE_NOT:
+    case OPCODE_BYTE_SWAP:
+    case OPCODE_LOAD_VECTOR_SHL:
+    case OPCODE_LOAD_VECTOR_SHR:
+    case OPCODE_SPLAT:
+    case OPCODE_PERMUTE:
+    case OPCODE_SWIZZLE:
+    case OPCODE_INSERT:
+    case OPCODE_EXTRACT:
+      return true;
+    case OPCODE_ADD:
+    case OPCODE_SUB:
+    case OPCODE_MUL:
+    case OPCODE_MUL_HI:
+    case OPCODE_NEG:
+    case OPCODE_SHL:
+    case OPCODE_SHR:
+    case OPCODE_SHA:
+    case OPCODE_ROTATE_LEFT:
+    case OPCODE_CNTLZ:
+      // Floating-point results depend on the rounding mode, which the loop may
+      // change.
+      return instr->dest->type <= INT64_TYPE;
+    default:
+      return false;
+  }
+}
+
+bool RangesOverlap(size_t offset_a, size_t size_a, size_t offset_b,
+                   size_t size_b) {
+  return offset_a < offset_b + size_b && offset_b < offset_a + size_a;
+}
+
+}  // namespace
+
+LoopInvariantCodeMotionPass::LoopInvariantCodeMotionPass() : CompilerPass() {}
+
+LoopInvariantCodeMotionPass::~LoopInvariantCodeMotionPass() {}
+
+bool LoopInvariantCodeMotionPass::Run(HIRBuilder* builder) {
+  BuildGraph(builder);
+  ComputeDominators();
+  FindLoops(builder);
+
+  // Inner loops first, so invariants of nested loops move out one level at a
+  // time.
+  std::sort(loops_.begin(), loops_.end(), [](const Loop& a, const Loop& b) {
+    return a.blocks.count() < b.blocks.count();
+  });
+  for (auto& loop : loops_) {
+    if (!loop.preheader) {
+      continue;
+    }
+    HoistInvariants(loop);
+    if (!loop.contains_loops) {
+      ReduceInductionVariables(builder, loop);
+    }
+  }
+
+  blocks_.clear();
+  predecessors_.clear();
+  successors_.clear();
+  dominators_.clear();
+  loops_.clear();
+  return true;
+}
+
+void LoopInvariantCodeMotionPass::BuildGraph(HIRBuilder* builder) {
+  blocks_.clear();
+  auto block = builder->first_block();
+  while (block) {
+    block->ordinal = static_cast<uint16_t>(blocks_.size());
+    blocks_.push_back(block);
+    block = block->next;
+  }
+
+  predecessors_.clear();
+  predecessors_.resize(blocks_.size());
+  successors_.clear();
+  successors_.resize(blocks_.size());
+  for (auto src : blocks_) {
+    auto edge = src->outgoing_edge_head;
+    while (edge) {
+      successors_[src->ordinal].push_back(edge->dest->ordinal);
+      predecessors_[edge->dest->ordinal].push_back(src->ordinal);
+      edge = edge->outgoing_next;
+    }
+    if (src->next && src->FallsThrough()) {
+      successors_[src->ordinal].push_back(src->next->ordinal);
+      predecessors_[src->next->ordinal].push_back(src->ordinal);
+    }
+  }
+}
+
+void LoopInvariantCodeMotionPass::ComputeDominators() {
+  auto block_count = static_cast<unsigned>(blocks_.size());
+  dominators_.clear();
+  dominators_.resize(block_count, llvm::BitVector(block_count, true));
+  if (!block_count) {
+    return;
+  }
+  dominators_[0].reset();
+  dominators_[0].set(0);
+  llvm::BitVector dominators(block_count);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t i = 1; i < block_count; ++i) {
+      dominators.set();
+      for (uint32_t predecessor : predecessors_[i]) {
+        dominators &= dominators_[predecessor];
+      }
+      dominators.set(i);
+      if (dominators != dominators_[i]) {
+        dominators_[i] = dominators;
+        changed = true;
+      }
+    }
+  }
+}
+
+bool LoopInvariantCodeMotionPass::Dominates(const Block* a,
+                                            const Block* b) const {
+  return dominators_[b->ordinal].test(a->ordinal);
+}
+
+void LoopInvariantCodeMotionPass::FindLoops(HIRBuilder* builder) {
+  auto block_count = static_cast<unsigned>(blocks_.size());
+  loops_.clear();
+  if (!block_count) {
+    return;
+  }
+
+  // Unreachable blocks are dominated by everything, so back edges are only
+  // looked for in reachable ones.
+  llvm::BitVector reachable(block_count);
+  std::vector<uint32_t> worklist;
+  reachable.set(0);
+  worklist.push_back(0);
+  while (!worklist.empty()) {
+    uint32_t ordinal = worklist.back();
+    worklist.pop_back();
+    for (uint32_t successor : successors_[ordinal]) {
+      if (!reachable.test(successor)) {
+        reachable.set(successor);
+        worklist.push_back(successor);
+      }
+    }
+  }
+
+  // Each edge to a block dominating its source closes a loop, made of the
+  // header and all blocks reaching the source without passing the header.
+  // Loops with the same header are merged.
+  for (uint32_t i = 0; i < block_count; ++i) {
+    if (!reachable.test(i)) {
+      continue;
+    }
+    for (uint32_t successor : successors_[i]) {
+      if (!dominators_[i].test(successor)) {
+        continue;
+      }
+      Block* header = blocks_[successor];
+      auto it = std::find_if(
+          loops_.begin(), loops_.end(),
+          [header](const Loop& loop) { return loop.header == header; });
+      if (it == loops_.end()) {
+        Loop loop;
+        loop.header = header;
+        loop.preheader = nullptr;
+        loop.blocks.resize(block_count);
+        loop.blocks.set(successor);
+        loop.has_context_barrier = false;
+        loop.contains_loops = false;
+        loops_.push_back(std::move(loop));
+        it = loops_.end() - 1;
+      }
+      it->latches.push_back(blocks_[i]);
+      if (!it->blocks.test(i)) {
+        it->blocks.set(i);
+        worklist.push_back(i);
+      }
+      while (!worklist.empty()) {
+        uint32_t ordinal = worklist.back();
+        worklist.pop_back();
+        for (uint32_t predecessor : predecessors_[ordinal]) {
+          if (!it->blocks.test(predecessor)) {
+            it->blocks.set(predecessor);
+            worklist.push_back(predecessor);
+          }
+        }
+      }
+    }
+  }
+
+  for (auto& loop : loops_) {
+    for (int i = loop.blocks.find_first(); i != -1;
+         i = loop.blocks.find_next(i)) {
+      Instr* instr = blocks_[i]->instr_head;
+      while (instr) {
+        if (ContextPromotionPass::IsContextBarrier(instr)) {
+          loop.has_context_barrier = true;
+          break;
+        }
+        instr = instr->next;
+      }
+    }
+    for (auto& other_loop : loops_) {
+      if (&other_loop != &loop &&
+          loop.blocks.test(other_loop.header->ordinal)) {
+        loop.contains_loops = true;
+        break;
+      }
+    }
+    loop.preheader = FindPreheader(builder, loop);
+  }
+}
+
+Block* LoopInvariantCodeMotionPass::FindPreheader(HIRBuilder* builder,
+                                                  const Loop& loop) const {
+  // The function entry is a predecessor too.
+  if (loop.header == builder->first_block()) {
+    return nullptr;
+  }
+  Block* preheader = nullptr;
+  for (uint32_t predecessor : predecessors_[loop.header->ordinal]) {
+    if (loop.blocks.test(predecessor)) {
+      continue;
+    }
+    if (preheader && preheader != blocks_[predecessor]) {
+      return nullptr;
+    }
+    preheader = blocks_[predecessor];
+  }
+  // Instructions are moved before the branches ending the preheader, and
+  // nothing can be placed after a call.
+  if (!preheader || !preheader->instr_tail ||
+      ContextPromotionPass::IsContextBarrier(preheader->instr_tail)) {
+    return nullptr;
+  }
+  return preheader;
+}
+
+bool LoopInvariantCodeMotionPass::IsDefinedInLoop(const Loop& loop,
+                                                  const Value* value) const {
+  return value->def && loop.blocks.test(value->def->block->ordinal);
+}
+
+bool LoopInvariantCodeMotionPass::IsInvariant(const Loop& loop,
+                                              const Instr* instr) const {
+  // Nothing can be inserted between paired instructions.
+  if ((instr->opcode->flags & OPCODE_FLAG_PAIRED_PREV) ||
+      (instr->next && (instr->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV))) {
+    return false;
+  }
+
+  if (instr->opcode == &OPCODE_LOAD_CONTEXT_info) {
+    if (loop.has_context_barrier) {
+      return false;
+    }
+    size_t offset = instr->src1.offset;
+    size_t size = GetTypeSize(instr->dest->type);
+    for (int i = loop.blocks.find_first(); i != -1;
+         i = loop.blocks.find_next(i)) {
+      Instr* other = blocks_[i]->instr_head;
+      while (other) {
+        if (other->opcode == &OPCODE_STORE_CONTEXT_info &&
+            RangesOverlap(offset, size, other->src1.offset,
+                          GetTypeSize(other->src2.value->type))) {
+          return false;
+        }
+        other = other->next;
+      }
+    }
+    return true;
+  }
+
+  if (!IsSpeculatable(instr)) {
+    return false;
+  }
+  uint32_t signature = instr->opcode->signature;
+  if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+      IsDefinedInLoop(loop, instr->src1.value)) {
+    return false;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+      IsDefinedInLoop(loop, instr->src2.value)) {
+    return false;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+      IsDefinedInLoop(loop, instr->src3.value)) {
+    return false;
+  }
+  return true;
+}
+
+void LoopInvariantCodeMotionPass::MoveToPreheader(const Loop& loop,
+                                                  Instr* instr) {
+  Block* preheader = loop.preheader;
+  Instr* first_branch = nullptr;
+  Instr* tail = preheader->instr_tail;
+  while (tail && (tail->opcode->flags & OPCODE_FLAG_BRANCH)) {
+    first_branch = tail;
+    tail = tail->prev;
+  }
+  if (first_branch) {
+    instr->MoveBefore(first_branch);
+  } else {
+    instr->MoveAfter(preheader->instr_tail);
+  }
+}
+
+void LoopInvariantCodeMotionPass::HoistInvariants(Loop& loop) {
+  // Context loads already moved, to reuse for other loads of the location.
+  std::vector<Instr*> hoisted_loads;
+  // Moving an instruction may make the ones using it invariant.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = loop.blocks.find_first(); i != -1;
+         i = loop.blocks.find_next(i)) {
+      Instr* instr = blocks_[i]->instr_head;
+      while (instr) {
+        Instr* next = instr->next;
+        if (IsInvariant(loop, instr)) {
+          Instr* hoisted_load = nullptr;
+          if (instr->opcode == &OPCODE_LOAD_CONTEXT_info) {
+            for (Instr* load : hoisted_loads) {
+              if (load->src1.offset == instr->src1.offset &&
+                  load->dest->type == instr->dest->type) {
+                hoisted_load = load;
+                break;
+              }
+            }
+          }
+          if (hoisted_load) {
+            instr->Replace(&OPCODE_ASSIGN_info, 0);
+            instr->set_src1(hoisted_load->dest);
+          } else {
+            MoveToPreheader(loop, instr);
+            if (instr->opcode == &OPCODE_LOAD_CONTEXT_info) {
+              hoisted_loads.push_back(instr);
+            }
+          }
+          changed = true;
+        }
+        instr = next;
+      }
+    }
+  }
+}
+
+void LoopInvariantCodeMotionPass::ReduceInductionVariables(HIRBuilder* builder,
+                                                           Loop& loop) {
+  // Anything may change the context in calls.
+  if (loop.has_context_barrier) {
+    return;
+  }
+
+  std::vector<Instr*> stores;
+  for (int i = loop.blocks.find_first(); i != -1;
+       i = loop.blocks.find_next(i)) {
+    Instr* instr = blocks_[i]->instr_head;
+    while (instr) {
+      if (instr->opcode == &OPCODE_STORE_CONTEXT_info) {
+        stores.push_back(instr);
+      }
+      instr = instr->next;
+    }
+  }
+
+  for (Instr* store : stores) {
+    // Induction variables are context locations loaded in the header and
+    // stored once in the loop, advanced by a constant:
+    //   v0 = load_context +100       (in the header)
+    //   v1 = add v0, 4
+    //   store_context +100, v1       (on every path to the back edges)
+    size_t offset = store->src1.offset;
+    Value* next_value = store->src2.value;
+    if (next_value->type > INT64_TYPE || !next_value->def) {
+      continue;
+    }
+    size_t size = GetTypeSize(next_value->type);
+    bool overwritten = false;
+    for (Instr* other : stores) {
+      if (other != store &&
+          RangesOverlap(offset, size, other->src1.offset,
+                        GetTypeSize(other->src2.value->type))) {
+        overwritten = true;
+        break;
+      }
+    }
+    if (overwritten) {
+      continue;
+    }
+
+    Instr* advance = next_value->def;
+    Value* current_value;
+    Value* step;
+    if (advance->opcode == &OPCODE_ADD_info &&
+        advance->src2.value->IsConstant()) {
+      current_value = advance->src1.value;
+      step = advance->src2.value;
+    } else if (advance->opcode == &OPCODE_ADD_info &&
+               advance->src1.value->IsConstant()) {
+      current_value = advance->src2.value;
+      step = advance->src1.value;
+    } else if (advance->opcode == &OPCODE_SUB_info &&
+               advance->src2.value->IsConstant()) {
+      current_value = advance->src1.value;
+      step = advance->src2.value;
+    } else {
+      continue;
+    }
+    Instr* load = current_value->def;
+    if (!load || load->opcode != &OPCODE_LOAD_CONTEXT_info ||
+        load->src1.offset != offset || load->block != loop.header) {
+      continue;
+    }
+    bool advanced_every_iteration = true;
+    for (Block* latch : loop.latches) {
+      if (!Dominates(store->block, latch)) {
+        advanced_every_iteration = false;
+        break;
+      }
+    }
+    if (!advanced_every_iteration) {
+      continue;
+    }
+
+    // Multiplications of the value at the start of the iteration by constants.
+    std::vector<Instr*> multiplications;
+    for (auto use = current_value->use_head; use; use = use->next) {
+      Instr* instr = use->instr;
+      if (instr->opcode != &OPCODE_MUL_info ||
+          instr->dest->type != current_value->type ||
+          std::find(multiplications.begin(), multiplications.end(), instr) !=
+              multiplications.end()) {
+        continue;
+      }
+      if ((instr->src1.value == current_value &&
+           instr->src2.value->IsConstant()) ||
+          (instr->src2.value == current_value &&
+           instr->src1.value->IsConstant())) {
+        multiplications.push_back(instr);
+      }
+    }
+
+    // Each distinct factor is kept in a local, advanced by factor * step right
+    // before the store of the induction variable:
+    //   v2 = mul v0, 12  ->  v2 = load_local slot  (at the header start)
+    //                        store_local slot, v2 + 12 * 4
+    while (!multiplications.empty()) {
+      Instr* first = multiplications.front();
+      Value* factor = first->src1.value == current_value ? first->src2.value
+                                                         : first->src1.value;
+
+      Value* slot = builder->AllocLocal(current_value->type);
+      // The value on entry to the loop.
+      Value* entry_value = builder->LoadContext(offset, current_value->type);
+      MoveToPreheader(loop, builder->last_instr());
+      Value* entry_product = builder->Mul(entry_value, factor);
+      MoveToPreheader(loop, builder->last_instr());
+      builder->StoreLocal(slot, entry_product);
+      MoveToPreheader(loop, builder->last_instr());
+
+      Value* product = builder->LoadLocal(slot);
+      builder->last_instr()->MoveBefore(loop.header->instr_head);
+
+      Value* product_step = builder->CloneValue(factor);
+      product_step->Mul(step);
+      if (advance->opcode == &OPCODE_SUB_info) {
+        product_step->Neg();
+      }
+      Value* next_product = builder->Add(product, product_step);
+      builder->last_instr()->MoveBefore(store);
+      builder->StoreLocal(slot, next_product);
+      builder->last_instr()->MoveBefore(store);
+
+      auto it = multiplications.begin();
+      while (it != multiplications.end()) {
+        Instr* instr = *it;
+        Value* instr_factor = instr->src1.value == current_value
+                                  ? instr->src2.value
+                                  : instr->src1.value;
+        if (instr != first && !instr_factor->IsConstantEQ(factor)) {
+          ++it;
+          continue;
+        }
+        instr->Replace(&OPCODE_ASSIGN_info, 0);
+        instr->set_src1(product);
+        it = multiplications.erase(it);
+      }
+    }
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,87 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+
+#include <vector>
+
+#include "xenia/base/platform.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Finds the natural loops of the function and moves computations that give the
+// same result in every iteration, such as loads of context locations the loop
+// doesn't store to, to the block entering the loop. Multiplications of
+// induction variables (context locations changed by a constant in every
+// iteration) by constants are replaced with values advanced along with the
+// induction variable. The edges from ControlFlowAnalysisPass must be up to
+// date, and the moved values are used in other blocks, which only the linear
+// scan register allocator supports.
+class LoopInvariantCodeMotionPass : public CompilerPass {
+ public:
+  LoopInvariantCodeMotionPass();
+  ~LoopInvariantCodeMotionPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  struct Loop {
+    hir::Block* header;
+    // The only block entering the loop, or null if there are multiple.
+    hir::Block* preheader;
+    // Blocks branching back to the header.
+    std::vector<hir::Block*> latches;
+    // Block ordinals in the loop.
+    llvm::BitVector blocks;
+    // Whether the loop contains instructions which may access any context
+    // location, like calls.
+    bool has_context_barrier;
+    bool contains_loops;
+  };
+
+  void BuildGraph(hir::HIRBuilder* builder);
+  void ComputeDominators();
+  bool Dominates(const hir::Block* a, const hir::Block* b) const;
+  void FindLoops(hir::HIRBuilder* builder);
+  hir::Block* FindPreheader(hir::HIRBuilder* builder, const Loop& loop) const;
+  bool IsInvariant(const Loop& loop, const hir::Instr* instr) const;
+  bool IsDefinedInLoop(const Loop& loop, const hir::Value* value) const;
+  void HoistInvariants(Loop& loop);
+  void ReduceInductionVariables(hir::HIRBuilder* builder, Loop& loop);
+  void MoveToPreheader(const Loop& loop, hir::Instr* instr);
+
+  // Per block ordinal.
+  std::vector<hir::Block*> blocks_;
+  std::vector<std::vector<uint32_t>> predecessors_;
+  std::vector<std::vector<uint32_t>> successors_;
+  std::vector<llvm::BitVector> dominators_;
+  std::vector<Loop> loops_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
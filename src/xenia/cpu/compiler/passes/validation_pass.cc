@@ -26,6 +26,7 @@ using namespace xe::cpu::hir;
 using xe::cpu::hir::Block;
 using xe::cpu::hir::HIRBuilder;
 using xe::cpu::hir::Instr;
+using xe::cpu::hir::Label;
 using xe::cpu::hir::OpcodeSignatureType;
 using xe::cpu::hir::Value;
 
@@ -42,6 +43,8 @@ bool ValidationPass::Run(HIRBuilder* builder) {
   str.Reset();
 #endif  // 0
 
+  ComputeDominators(builder);
+
   auto block = builder->first_block();
   while (block) {
     auto label = block->label_head;
@@ -64,9 +67,76 @@ bool ValidationPass::Run(HIRBuilder* builder) {
     block = block->next;
   }
 
+  block_indices_.clear();
+  dominators_.clear();
   return true;
 }
 
+void ValidationPass::ComputeDominators(HIRBuilder* builder) {
+  block_indices_.clear();
+  std::vector<Block*> blocks;
+  auto block = builder->first_block();
+  while (block) {
+    block_indices_.emplace(block, uint32_t(blocks.size()));
+    blocks.push_back(block);
+    block = block->next;
+  }
+  auto block_count = static_cast<unsigned>(blocks.size());
+
+  // Taken from the branches rather than the edges, which may be out of date.
+  std::vector<std::vector<uint32_t>> predecessors(block_count);
+  for (uint32_t i = 0; i < block_count; ++i) {
+    auto instr = blocks[i]->instr_tail;
+    while (instr && (instr->opcode->flags & OPCODE_FLAG_BRANCH)) {
+      Label* label = nullptr;
+      if (instr->opcode == &OPCODE_BRANCH_info) {
+        label = instr->src1.label;
+      } else if (instr->opcode == &OPCODE_BRANCH_TRUE_info ||
+                 instr->opcode == &OPCODE_BRANCH_FALSE_info) {
+        label = instr->src2.label;
+      }
+      if (label) {
+        predecessors[block_indices_[label->block]].push_back(i);
+      }
+      instr = instr->prev;
+    }
+    if (i + 1 < block_count && blocks[i]->FallsThrough()) {
+      predecessors[i + 1].push_back(i);
+    }
+  }
+
+  dominators_.clear();
+  dominators_.resize(block_count, llvm::BitVector(block_count, true));
+  if (!block_count) {
+    return;
+  }
+  dominators_[0].reset();
+  dominators_[0].set(0);
+  llvm::BitVector dominators(block_count);
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t i = 1; i < block_count; ++i) {
+      dominators.set();
+      for (uint32_t predecessor : predecessors[i]) {
+        dominators &= dominators_[predecessor];
+      }
+      dominators.set(i);
+      if (dominators != dominators_[i]) {
+        dominators_[i] = dominators;
+        changed = true;
+      }
+    }
+  }
+}
+
+bool ValidationPass::Dominates(const Block* a, const Block* b) {
+  if (a == b) {
+    return true;
+  }
+  return dominators_[block_indices_[b]].test(block_indices_[a]);
+}
+
 bool ValidationPass::ValidateInstruction(Block* block, Instr* instr) {
   assert_true(instr->block == block);
   if (instr->block != block) {
@@ -77,7 +147,9 @@ bool ValidationPass::ValidateInstruction(Block* block, Instr* instr) {
     assert_true(instr->dest->def == instr);
     auto use = instr->dest->use_head;
     while (use) {
-      assert_true(use->instr->block == block);
+      // Values may be used in other blocks only if defined on every path to
+      // them.
+      assert_true(Dominates(block, use->instr->block));
       use = use->next;
     }
   }
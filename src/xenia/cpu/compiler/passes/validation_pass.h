@@ -10,8 +10,22 @@
 #ifndef XENIA_CPU_COMPILER_PASSES_VALIDATION_PASS_H_
 #define XENIA_CPU_COMPILER_PASSES_VALIDATION_PASS_H_
 
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/platform.h"
 #include "xenia/cpu/compiler/compiler_pass.h"
 
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
 namespace xe {
 namespace cpu {
 namespace compiler {
@@ -25,8 +39,15 @@ class ValidationPass : public CompilerPass {
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
+  void ComputeDominators(hir::HIRBuilder* builder);
+  // Whether every path from the function entry to block b goes through a.
+  bool Dominates(const hir::Block* a, const hir::Block* b);
   bool ValidateInstruction(hir::Block* block, hir::Instr* instr);
   bool ValidateValue(hir::Block* block, hir::Instr* instr, hir::Value* value);
+
+  std::unordered_map<const hir::Block*, uint32_t> block_indices_;
+  // Per block index, the indices of the blocks dominating it.
+  std::vector<llvm::BitVector> dominators_;
 };
 
 }  // namespace passes
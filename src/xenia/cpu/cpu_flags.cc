@@ -38,6 +38,63 @@ DEFINE_bool(
 DEFINE_bool(validate_hir, false,
             "Perform validation checks on the HIR during compilation.", "CPU");
 
+DEFINE_bool(linear_scan_register_allocation, false,
+            "Allocate host registers for the whole function using linear scan "
+            "instead of for each block separately, keeping values in "
+            "registers across blocks.",
+            "CPU");
+
+DEFINE_int32(
+    prefetch_compiler_threads, 0,
+    "Number of background threads translating functions before they're first "
+    "called (known function starts of loaded modules and call targets of "
+    "translated functions). -1 to pick based on the number of logical "
+    "processors, 0 to translate functions only on demand.",
+    "CPU");
+
+DEFINE_bool(tiered_compilation, false,
+            "Translate functions quickly with fewer optimizations first, and "
+            "retranslate them with all optimizations and the gathered block "
+            "execution counts once they're called often.",
+            "CPU");
+DEFINE_int32(tiered_compilation_threshold, 1000,
+             "Number of calls after which a function translated quickly is "
+             "retranslated with all optimizations.",
+             "CPU");
+DEFINE_int32(inline_function_max_instructions, 0,
+             "Maximum number of instructions, including the return, in "
+             "functions without branches that are translated in place of "
+             "direct calls to them, such as 24. Functions containing inlined "
+             "callees aren't stored persistently, and the inlined callees are "
+             "missing from guest stack traces and profiles. 0 to always call "
+             "functions.",
+             "CPU");
+DEFINE_bool(invalidate_modified_code, true,
+            "Watch the guest memory of translated functions for writes, and "
+            "retranslate the functions if their guest code has been modified, "
+            "for titles patching or decrypting their code at runtime.",
+            "CPU");
+DEFINE_bool(recompile_mmio_access_sites, true,
+            "Retranslate functions accessing MMIO ranges through addresses "
+            "not known at translation time to call the range callbacks "
+            "directly, instead of handling an access violation every time.",
+            "CPU");
+
+// Profiling:
+DEFINE_bool(profile_function_calls, false,
+            "Count the calls of every guest function in the translated code, "
+            "for the hot list written to --profile_functions_path.",
+            "CPU");
+DEFINE_int32(profile_sampling_interval, 1,
+             "Milliseconds between samples of the guest thread call stacks "
+             "when --profile_functions_path is set.",
+             "CPU");
+DEFINE_path(profile_functions_path, "",
+            "Sample the guest thread call stacks while running, and write "
+            "collapsed stacks for flame graphs to <path>.folded and the "
+            "hottest functions to <path>.txt on exit.",
+            "CPU");
+
 // Breakpoints:
 DEFINE_uint64(break_on_instruction, 0,
               "int3 before the given guest address is executed.", "CPU");
@@ -26,6 +26,20 @@ DECLARE_bool(disable_global_lock);
 
 DECLARE_bool(validate_hir);
 
+DECLARE_bool(linear_scan_register_allocation);
+
+DECLARE_int32(prefetch_compiler_threads);
+
+DECLARE_bool(tiered_compilation);
+DECLARE_int32(tiered_compilation_threshold);
+DECLARE_int32(inline_function_max_instructions);
+DECLARE_bool(invalidate_modified_code);
+DECLARE_bool(recompile_mmio_access_sites);
+
+DECLARE_bool(profile_function_calls);
+DECLARE_int32(profile_sampling_interval);
+DECLARE_path(profile_functions_path);
+
 DECLARE_uint64(break_on_instruction);
 DECLARE_int32(break_condition_gpr);
 DECLARE_uint64(break_condition_value);
@@ -9,26 +9,62 @@
 
 #include "xenia/cpu/entry_table.h"
 
+#include "xenia/base/assert.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
 
 namespace xe {
 namespace cpu {
 
-EntryTable::EntryTable() = default;
+EntryTable::Table::Table(uint32_t size_log2)
+    : size_log2(size_log2),
+      mask((uint32_t(1) << size_log2) - 1),
+      slots(new std::atomic<Entry*>[size_t(1) << size_log2]) {
+  for (uint32_t i = 0; i <= mask; ++i) {
+    slots[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+EntryTable::EntryTable() {
+  tables_.push_back(std::make_unique<Table>(kInitialSizeLog2));
+  table_.store(tables_.back().get(), std::memory_order_release);
+}
 
 EntryTable::~EntryTable() {
-  auto global_lock = global_critical_region_.Acquire();
-  for (auto it : map_) {
-    Entry* entry = it.second;
-    delete entry;
+  std::lock_guard<std::mutex> lock(insert_mutex_);
+  Table* table = table_.load(std::memory_order_relaxed);
+  for (uint32_t i = 0; i <= table->mask; ++i) {
+    delete table->slots[i].load(std::memory_order_relaxed);
+  }
+}
+
+uint32_t EntryTable::GetHomeSlot(const Table* table, uint32_t address) {
+  // Guest code is 4-byte aligned - Fibonacci hashing of the instruction index.
+  return ((address >> 2) * 0x9E3779B1u) >> (32 - table->size_log2);
+}
+
+Entry* EntryTable::Find(const Table* table, uint32_t address) {
+  uint32_t index = GetHomeSlot(table, address);
+  while (true) {
+    Entry* entry = table->slots[index].load(std::memory_order_acquire);
+    if (!entry || entry->address == address) {
+      return entry;
+    }
+    index = (index + 1) & table->mask;
+  }
+}
+
+void EntryTable::Insert(Table* table, Entry* entry) {
+  uint32_t index = GetHomeSlot(table, entry->address);
+  while (table->slots[index].load(std::memory_order_relaxed)) {
+    index = (index + 1) & table->mask;
   }
+  // Publish the fully initialized entry to lock-free readers.
+  table->slots[index].store(entry, std::memory_order_release);
 }
 
 Entry* EntryTable::Get(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
+  Entry* entry = Find(table_.load(std::memory_order_acquire), address);
   if (entry) {
     // TODO(benvanik): wait if needed?
     if (entry->status != Entry::STATUS_READY) {
@@ -38,54 +74,113 @@ Entry* EntryTable::Get(uint32_t address) {
   return entry;
 }
 
+Entry* EntryTable::Lookup(uint32_t address) {
+  return Find(table_.load(std::memory_order_acquire), address);
+}
+
 Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
-  // TODO(benvanik): replace with a map with wait-free for find.
-  // https://github.com/facebook/folly/blob/master/folly/AtomicHashMap.h
+  Entry* entry = Find(table_.load(std::memory_order_acquire), address);
+  if (!entry) {
+    std::lock_guard<std::mutex> lock(insert_mutex_);
+    // May have been inserted by another thread while waiting for the lock.
+    Table* table = table_.load(std::memory_order_relaxed);
+    entry = Find(table, address);
+    if (!entry) {
+      // Create and return for initialization.
+      entry = new Entry();
+      entry->address = address;
+      entry->end_address = 0;
+      entry->status = Entry::STATUS_COMPILING;
+      entry->function = 0;
+      if ((entry_count_ + 1) * 2 > size_t(table->mask) + 1) {
+        // Rehash into a larger table. The old one stays alive for readers
+        // still probing it - they may miss entries added from now on, but
+        // will find them here after taking the lock.
+        auto new_table = std::make_unique<Table>(table->size_log2 + 1);
+        for (uint32_t i = 0; i <= table->mask; ++i) {
+          Entry* old_entry = table->slots[i].load(std::memory_order_relaxed);
+          if (old_entry) {
+            Insert(new_table.get(), old_entry);
+          }
+        }
+        table = new_table.get();
+        tables_.push_back(std::move(new_table));
+        table_.store(table, std::memory_order_release);
+      }
+      Insert(table, entry);
+      ++entry_count_;
+      *out_entry = entry;
+      return Entry::STATUS_NEW;
+    }
+  }
 
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
-  Entry::Status status;
-  if (entry) {
-    // If we aren't ready yet spin and wait.
-    if (entry->status == Entry::STATUS_COMPILING) {
-      // Still compiling, so spin.
-      do {
-        global_lock.unlock();
-        // TODO(benvanik): sleep for less time?
-        xe::threading::Sleep(std::chrono::microseconds(10));
-        global_lock.lock();
-      } while (entry->status == Entry::STATUS_COMPILING);
+  // If we aren't ready yet spin and wait.
+  Entry::Status status = entry->status;
+  while (true) {
+    if (status == Entry::STATUS_NEW) {
+      // Invalidated - the first thread to get here compiles it again.
+      if (entry->status.compare_exchange_weak(status,
+                                              Entry::STATUS_COMPILING)) {
+        *out_entry = entry;
+        return Entry::STATUS_NEW;
+      }
+      continue;
     }
+    if (status != Entry::STATUS_COMPILING &&
+        status != Entry::STATUS_INVALIDATED) {
+      break;
+    }
+    // Still compiling, so spin.
+    // TODO(benvanik): sleep for less time?
+    xe::threading::Sleep(std::chrono::microseconds(10));
     status = entry->status;
-  } else {
-    // Create and return for initialization.
-    entry = new Entry();
-    entry->address = address;
-    entry->end_address = 0;
-    entry->status = Entry::STATUS_COMPILING;
-    entry->function = 0;
-    map_[address] = entry;
-    status = Entry::STATUS_NEW;
   }
-  global_lock.unlock();
   *out_entry = entry;
   return status;
 }
 
 std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
+  std::lock_guard<std::mutex> lock(insert_mutex_);
+  Table* table = table_.load(std::memory_order_relaxed);
   std::vector<Function*> fns;
-  for (auto& it : map_) {
-    Entry* entry = it.second;
+  for (uint32_t i = 0; i <= table->mask; ++i) {
+    Entry* entry = table->slots[i].load(std::memory_order_relaxed);
+    if (!entry || entry->status != Entry::STATUS_READY) {
+      continue;
+    }
     if (address >= entry->address && address <= entry->end_address) {
-      if (entry->status == Entry::STATUS_READY) {
-        fns.push_back(entry->function);
-      }
+      fns.push_back(entry->function);
     }
   }
   return fns;
 }
 
+void EntryTable::Invalidate(Entry* entry) {
+  Entry::Status status = entry->status;
+  while (true) {
+    Entry::Status new_status;
+    if (status == Entry::STATUS_READY) {
+      new_status = Entry::STATUS_NEW;
+    } else if (status == Entry::STATUS_COMPILING) {
+      new_status = Entry::STATUS_INVALIDATED;
+    } else {
+      return;
+    }
+    if (entry->status.compare_exchange_weak(status, new_status)) {
+      return;
+    }
+  }
+}
+
+bool EntryTable::FinishCompiling(Entry* entry) {
+  Entry::Status status = Entry::STATUS_COMPILING;
+  if (entry->status.compare_exchange_strong(status, Entry::STATUS_READY)) {
+    return true;
+  }
+  assert_true(status == Entry::STATUS_INVALIDATED);
+  entry->status = Entry::STATUS_COMPILING;
+  return false;
+}
+
 }  // namespace cpu
 }  // namespace xe
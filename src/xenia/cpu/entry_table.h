@@ -10,11 +10,11 @@
 #ifndef XENIA_CPU_ENTRY_TABLE_H_
 #define XENIA_CPU_ENTRY_TABLE_H_
 
-#include <unordered_map>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <vector>
 
-#include "xenia/base/mutex.h"
-
 namespace xe {
 namespace cpu {
 
@@ -26,28 +26,65 @@ typedef struct Entry_t {
     STATUS_COMPILING,
     STATUS_READY,
     STATUS_FAILED,
+    // Invalidated while compiling - the compiling thread must compile again.
+    STATUS_INVALIDATED,
   } Status;
 
   uint32_t address;
   uint32_t end_address;
-  Status status;
+  // Set to STATUS_READY only after function and end_address are written.
+  std::atomic<Status> status;
   Function* function;
 } Entry;
 
+// Maps guest addresses to their functions. Looking up an existing entry never
+// takes a lock - entries are published in an open addressing table with atomic
+// slots, and only inserting new entries is serialized.
+
 class EntryTable {
  public:
   EntryTable();
   ~EntryTable();
 
   Entry* Get(uint32_t address);
+  // Gets the entry of the address whatever its status, or nullptr if there's
+  // none.
+  Entry* Lookup(uint32_t address);
   Entry::Status GetOrCreate(uint32_t address, Entry** out_entry);
 
   std::vector<Function*> FindWithAddress(uint32_t address);
 
+  // Makes the function of the entry be resolved again. A ready entry becomes
+  // new, to be claimed by the next GetOrCreate, and a compiling one must be
+  // compiled again before FinishCompiling succeeds.
+  void Invalidate(Entry* entry);
+  // Marks an entry claimed by GetOrCreate as ready, unless it has been
+  // invalidated while compiling - then returns false, with it still claimed.
+  bool FinishCompiling(Entry* entry);
+
  private:
-  xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
-  std::unordered_map<uint32_t, Entry*> map_;
+  struct Table {
+    explicit Table(uint32_t size_log2);
+    uint32_t size_log2;
+    uint32_t mask;
+    std::unique_ptr<std::atomic<Entry*>[]> slots;
+  };
+
+  // Initial number of slots. The table is grown when it gets half full, so
+  // probe sequences stay short and always end at an empty slot.
+  static const uint32_t kInitialSizeLog2 = 16;
+
+  static uint32_t GetHomeSlot(const Table* table, uint32_t address);
+  static Entry* Find(const Table* table, uint32_t address);
+  static void Insert(Table* table, Entry* entry);
+
+  // Serializes insertion and growth.
+  std::mutex insert_mutex_;
+  std::atomic<Table*> table_;
+  size_t entry_count_ = 0;
+  // All tables ever created, including the replaced ones, which lock-free
+  // readers may still be probing.
+  std::vector<std::unique_ptr<Table>> tables_;
 };
 
 }  // namespace cpu
@@ -42,7 +42,7 @@ struct ExportTag {
   typedef uint32_t type;
 
   // packed like so:
-  // ll...... cccccccc ........ ..bihssi
+  // ll...... cccccccc ........ .fbihssi
 
   static const int CategoryShift = 16;
 
@@ -58,6 +58,9 @@ struct ExportTag {
   static const type kImportant = 1u << 4;
   // Export blocks the calling thread
   static const type kBlocking = 1u << 5;
+  // Export never blocks or calls back into guest code (including delivering
+  // APCs), so generated code may call its fast entry point directly.
+  static const type kFastCall = 1u << 6;
 
   // Export will be logged on each call.
   static const type kLog = 1u << 30;
@@ -70,6 +73,12 @@ typedef void (*xe_kernel_export_shim_fn)(void*, void*);
 
 typedef void (*ExportTrampoline)(ppc::PPCContext* ppc_context);
 
+// Same as the trampoline, but with the first guest integer arguments (r3 and
+// onwards) passed in host registers by generated code instead of being loaded
+// from the context.
+typedef void (*ExportFastCall)(ppc::PPCContext* ppc_context, uint64_t arg0,
+                               uint64_t arg1, uint64_t arg2);
+
 class Export {
  public:
   enum class Type {
@@ -77,12 +86,15 @@ class Export {
     kVariable = 1,
   };
 
+  // Maximum number of arguments of exports with a fast entry point.
+  static const size_t kFastCallMaxArgCount = 3;
+
   Export(uint16_t ordinal, Type type, const char* name,
          ExportTag::type tags = 0)
       : ordinal(ordinal),
         type(type),
         tags(tags),
-        function_data({nullptr, nullptr, 0}) {
+        function_data({nullptr, nullptr, 0, nullptr}) {
     std::strncpy(this->name, name, xe::countof(this->name));
   }
 
@@ -109,6 +121,10 @@ class Export {
       // Expects only PPC context as first arg.
       ExportTrampoline trampoline;
       uint64_t call_count;
+
+      // Entry point for exports with few enough arguments, used by generated
+      // code if the export is tagged with kFastCall.
+      ExportFastCall fast_call;
     } function_data;
   };
 };
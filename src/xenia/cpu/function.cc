@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/function.h"
 
+#include <algorithm>
+
 #include "xenia/base/logging.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
@@ -16,6 +18,34 @@
 namespace xe {
 namespace cpu {
 
+namespace {
+
+const SourceMapEntry* FindGuestAddress(
+    const std::vector<SourceMapEntry>& source_map, uint32_t guest_address) {
+  // TODO(benvanik): binary search? We know the list is sorted by code order.
+  for (size_t i = 0; i < source_map.size(); ++i) {
+    const auto& entry = source_map[i];
+    if (entry.guest_address == guest_address) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+const SourceMapEntry* FindMachineCodeOffset(
+    const std::vector<SourceMapEntry>& source_map, uint32_t offset) {
+  // TODO(benvanik): binary search? We know the list is sorted by code order.
+  for (int64_t i = source_map.size() - 1; i >= 0; --i) {
+    const auto& entry = source_map[i];
+    if (entry.code_offset <= offset) {
+      return &entry;
+    }
+  }
+  return source_map.empty() ? nullptr : &source_map[0];
+}
+
+}  // namespace
+
 Function::Function(Module* module, uint32_t address)
     : Symbol(Symbol::Type::kFunction, module, address) {}
 
@@ -66,22 +96,58 @@ void GuestFunction::SetupExtern(ExternHandler handler, Export* export_data) {
   export_data_ = export_data;
 }
 
+void GuestFunction::AllocateBlockExecutionCounts(
+    std::vector<uint32_t> guest_addresses) {
+  if (block_execution_counts_) {
+    return;
+  }
+  std::sort(guest_addresses.begin(), guest_addresses.end());
+  guest_addresses.erase(
+      std::unique(guest_addresses.begin(), guest_addresses.end()),
+      guest_addresses.end());
+  block_execution_counts_ =
+      std::make_unique<BlockExecutionCount[]>(guest_addresses.size());
+  block_execution_count_count_ = guest_addresses.size();
+  for (size_t i = 0; i < guest_addresses.size(); ++i) {
+    block_execution_counts_[i].guest_address = guest_addresses[i];
+    block_execution_counts_[i].count = 0;
+  }
+}
+
+uint32_t* GuestFunction::LookupBlockExecutionCount(uint32_t guest_address) {
+  auto begin = block_execution_counts_.get();
+  auto end = begin + block_execution_count_count_;
+  auto it = std::lower_bound(begin, end, guest_address,
+                             [](const BlockExecutionCount& entry,
+                                uint32_t address) {
+                               return entry.guest_address < address;
+                             });
+  if (it == end || it->guest_address != guest_address) {
+    return nullptr;
+  }
+  return &it->count;
+}
+
+void GuestFunction::PublishTranslation(
+    std::vector<SourceMapEntry> source_map,
+    std::unique_ptr<FunctionDebugInfo> debug_info) {
+  std::atomic_store(&source_map_,
+                    std::shared_ptr<const std::vector<SourceMapEntry>>(
+                        std::make_shared<std::vector<SourceMapEntry>>(
+                            std::move(source_map))));
+  debug_info_ = std::move(debug_info);
+}
+
 const SourceMapEntry* GuestFunction::LookupGuestAddress(
     uint32_t guest_address) const {
-  // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
-    if (entry.guest_address == guest_address) {
-      return &entry;
-    }
-  }
-  return nullptr;
+  return FindGuestAddress(*source_map(), guest_address);
 }
 
 const SourceMapEntry* GuestFunction::LookupHIROffset(uint32_t offset) const {
+  auto source_map = this->source_map();
   // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
+  for (size_t i = 0; i < source_map->size(); ++i) {
+    const auto& entry = (*source_map)[i];
     if (entry.hir_offset >= offset) {
       return &entry;
     }
@@ -91,33 +157,30 @@ const SourceMapEntry* GuestFunction::LookupHIROffset(uint32_t offset) const {
 
 const SourceMapEntry* GuestFunction::LookupMachineCodeOffset(
     uint32_t offset) const {
-  // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (int64_t i = source_map_.size() - 1; i >= 0; --i) {
-    const auto& entry = source_map_[i];
-    if (entry.code_offset <= offset) {
-      return &entry;
-    }
-  }
-  return source_map_.empty() ? nullptr : &source_map_[0];
+  return FindMachineCodeOffset(*source_map(), offset);
 }
 
 uint32_t GuestFunction::MapGuestAddressToMachineCodeOffset(
     uint32_t guest_address) const {
-  auto entry = LookupGuestAddress(guest_address);
+  auto source_map = this->source_map();
+  auto entry = FindGuestAddress(*source_map, guest_address);
   return entry ? entry->code_offset : 0;
 }
 
 uintptr_t GuestFunction::MapGuestAddressToMachineCode(
     uint32_t guest_address) const {
-  auto entry = LookupGuestAddress(guest_address);
+  auto source_map = this->source_map();
+  auto entry = FindGuestAddress(*source_map, guest_address);
   return reinterpret_cast<uintptr_t>(machine_code()) +
          (entry ? entry->code_offset : 0);
 }
 
 uint32_t GuestFunction::MapMachineCodeToGuestAddress(
     uintptr_t host_address) const {
-  auto entry = LookupMachineCodeOffset(static_cast<uint32_t>(
-      host_address - reinterpret_cast<uintptr_t>(machine_code())));
+  auto source_map = this->source_map();
+  uint32_t code_offset = static_cast<uint32_t>(
+      host_address - reinterpret_cast<uintptr_t>(machine_code()));
+  auto entry = FindMachineCodeOffset(*source_map, code_offset);
   return entry ? entry->guest_address : address();
 }
 
@@ -10,7 +10,10 @@
 #ifndef XENIA_CPU_FUNCTION_H_
 #define XENIA_CPU_FUNCTION_H_
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <utility>
 #include <vector>
 
 #include "xenia/cpu/function_debug_info.h"
@@ -112,16 +115,19 @@ class GuestFunction : public Function {
   virtual size_t machine_code_length() const = 0;
 
   FunctionDebugInfo* debug_info() const { return debug_info_.get(); }
-  void set_debug_info(std::unique_ptr<FunctionDebugInfo> debug_info) {
-    debug_info_ = std::move(debug_info);
-  }
   FunctionTraceData& trace_data() { return trace_data_; }
-  std::vector<SourceMapEntry>& source_map() { return source_map_; }
+  // Source map of the current machine code. It's replaced as a whole when the
+  // function is retranslated, so the returned one stays valid.
+  std::shared_ptr<const std::vector<SourceMapEntry>> source_map() const {
+    return std::atomic_load(&source_map_);
+  }
 
   ExternHandler extern_handler() const { return extern_handler_; }
   Export* export_data() const { return export_data_; }
   void SetupExtern(ExternHandler handler, Export* export_data = nullptr);
 
+  // The returned entries are valid until the function is retranslated, which
+  // can be prevented by holding its translation mutex.
   const SourceMapEntry* LookupGuestAddress(uint32_t guest_address) const;
   const SourceMapEntry* LookupHIROffset(uint32_t offset) const;
   const SourceMapEntry* LookupMachineCodeOffset(uint32_t offset) const;
@@ -132,15 +138,96 @@ class GuestFunction : public Function {
 
   bool Call(ThreadState* thread_state, uint32_t return_address) override;
 
+  // Whether the current code was translated by the fast tier of tiered
+  // compilation, counting calls and block executions until it's retranslated
+  // with all optimizations.
+  bool is_fast_tier() const { return fast_tier_; }
+  void set_fast_tier(bool fast_tier) { fast_tier_ = fast_tier; }
+  // Incremented by the fast tier code on every call.
+  uint32_t* call_count_ptr() { return &call_count_; }
+  bool recompilation_requested() const { return recompilation_requested_; }
+  // Returns true only for the first request.
+  bool RequestRecompilation() {
+    return !recompilation_requested_.exchange(true);
+  }
+
+  // Held while the function is being retranslated, so retranslations from
+  // different threads, such as the prefetch compiler and the resolver, are
+  // done one after another, each based on the latest state.
+  std::mutex& translation_mutex() { return translation_mutex_; }
+  // Incremented when a retranslation starts, with the translation mutex held.
+  // Retranslation requests record it, and are dropped if a retranslation
+  // started after them, which has seen what they were made for, has run.
+  uint32_t translation_generation() const { return translation_generation_; }
+  void BeginRetranslation() { ++translation_generation_; }
+
+  // Set when the guest code of the function may have been modified, until the
+  // function is resolved again.
+  bool is_invalidated() const { return invalidated_; }
+  void Invalidate() { invalidated_ = true; }
+  // Returns true if the function was invalidated.
+  bool ClearInvalidated() { return invalidated_.exchange(false); }
+  // Hash of the guest code the current machine code was translated from.
+  uint64_t guest_code_hash() const { return guest_code_hash_; }
+  void set_guest_code_hash(uint64_t value) { guest_code_hash_ = value; }
+  // First and last instruction addresses of the functions inlined into the
+  // current machine code, whose guest code it depends on too. Written by the
+  // translation, so only read by the translating thread or with the
+  // translation mutex held.
+  const std::vector<std::pair<uint32_t, uint32_t>>& inlined_ranges() const {
+    return inlined_ranges_;
+  }
+  void set_inlined_ranges(std::vector<std::pair<uint32_t, uint32_t>> ranges) {
+    inlined_ranges_ = std::move(ranges);
+  }
+
+  // Incremented on every call by code translated with
+  // --profile_function_calls. Not updated atomically, so it's approximate when
+  // the function is called from multiple threads at once.
+  uint64_t profile_call_count() const { return profile_call_count_; }
+  uint64_t* profile_call_count_ptr() { return &profile_call_count_; }
+
+  // Sets up execution counters for the blocks of the fast tier code starting
+  // at the guest addresses. They're kept for the lifetime of the function, as
+  // the old code may still be running after being replaced.
+  void AllocateBlockExecutionCounts(std::vector<uint32_t> guest_addresses);
+  // Counter incremented by the fast tier code, or null if the address isn't
+  // the start of a profiled block.
+  uint32_t* LookupBlockExecutionCount(uint32_t guest_address);
+
  protected:
   virtual bool CallImpl(ThreadState* thread_state, uint32_t return_address) = 0;
 
+  // Replaces the source map and the debug info with the ones of new machine
+  // code, built separately so they're never seen partially updated.
+  void PublishTranslation(std::vector<SourceMapEntry> source_map,
+                          std::unique_ptr<FunctionDebugInfo> debug_info);
+
+  struct BlockExecutionCount {
+    uint32_t guest_address;
+    uint32_t count;
+  };
+
  protected:
   std::unique_ptr<FunctionDebugInfo> debug_info_;
   FunctionTraceData trace_data_;
-  std::vector<SourceMapEntry> source_map_;
+  std::shared_ptr<const std::vector<SourceMapEntry>> source_map_ =
+      std::make_shared<const std::vector<SourceMapEntry>>();
   ExternHandler extern_handler_ = nullptr;
   Export* export_data_ = nullptr;
+
+  bool fast_tier_ = false;
+  uint32_t call_count_ = 0;
+  std::atomic<bool> recompilation_requested_ = {false};
+  std::atomic<bool> invalidated_ = {false};
+  std::mutex translation_mutex_;
+  std::atomic<uint32_t> translation_generation_ = {0};
+  uint64_t guest_code_hash_ = 0;
+  std::vector<std::pair<uint32_t, uint32_t>> inlined_ranges_;
+  uint64_t profile_call_count_ = 0;
+  // Sorted by guest address.
+  std::unique_ptr<BlockExecutionCount[]> block_execution_counts_;
+  size_t block_execution_count_count_ = 0;
 };
 
 }  // namespace cpu
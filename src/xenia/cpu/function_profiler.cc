@@ -0,0 +1,288 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/function_profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/mutex.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/module.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/stack_walker.h"
+#include "xenia/cpu/thread.h"
+
+namespace xe {
+namespace cpu {
+
+FunctionProfiler::FunctionProfiler(Processor* processor,
+                                   StackWalker* stack_walker)
+    : processor_(processor), stack_walker_(stack_walker) {}
+
+FunctionProfiler::~FunctionProfiler() { Stop(); }
+
+bool FunctionProfiler::Start(uint32_t interval_ms) {
+  if (!stack_walker_) {
+    XELOGW(
+        "Function profiler: no stack walker on this platform, only call "
+        "counts will be available");
+    return false;
+  }
+  if (sampling_thread_) {
+    return true;
+  }
+  shutdown_event_ = xe::threading::Event::CreateManualResetEvent(false);
+  sampling_thread_ = xe::threading::Thread::Create(
+      {}, [this, interval_ms]() { SamplingThread(interval_ms); });
+  sampling_thread_->set_name("CPU Function Profiler");
+  // Must preempt the guest threads to see what they're doing.
+  sampling_thread_->set_priority(xe::threading::ThreadPriority::kHighest);
+  return true;
+}
+
+void FunctionProfiler::Stop() {
+  if (!sampling_thread_) {
+    return;
+  }
+  shutdown_event_->Set();
+  xe::threading::Wait(sampling_thread_.get(), false);
+  sampling_thread_.reset();
+  shutdown_event_.reset();
+}
+
+void FunctionProfiler::SamplingThread(uint32_t interval_ms) {
+  auto interval = std::chrono::milliseconds(std::max(interval_ms, 1u));
+  while (xe::threading::Wait(shutdown_event_.get(), false, interval) ==
+         xe::threading::WaitResult::kTimeout) {
+    Sample();
+  }
+}
+
+void FunctionProfiler::Sample() {
+  // Thread debug infos are never removed, so the snapshot stays valid, while
+  // the threads themselves are checked again right before suspending them.
+  auto thread_infos = processor_->QueryThreadDebugInfos();
+  xe::global_critical_region global_critical_region;
+  uint64_t frame_host_pcs[kMaxFrameCount];
+  for (auto thread_info : thread_infos) {
+    xe::threading::Thread* thread;
+    {
+      // Suspended with the global lock held, so the thread isn't holding it,
+      // and it can't exit and be destroyed until it's resumed. Only one thread
+      // is suspended at a time, with nothing that may need a lock held by it
+      // (including memory allocation) done until it's resumed.
+      auto global_lock = global_critical_region.Acquire();
+      auto cpu_thread = thread_info->thread;
+      if (!cpu_thread || thread_info->suspended ||
+          thread_info->state == ThreadDebugInfo::State::kExited ||
+          thread_info->state == ThreadDebugInfo::State::kZombie ||
+          !cpu_thread->can_debugger_suspend()) {
+        continue;
+      }
+      thread = cpu_thread->thread();
+      if (!thread->Suspend(nullptr)) {
+        continue;
+      }
+    }
+    size_t frame_count = stack_walker_->CaptureStackTrace(
+        thread->native_handle(), frame_host_pcs, 0, kMaxFrameCount, nullptr,
+        nullptr);
+    thread->Resume();
+    RecordStack(frame_host_pcs, frame_count);
+  }
+}
+
+void FunctionProfiler::RecordStack(const uint64_t* frame_host_pcs,
+                                   size_t frame_count) {
+  auto code_cache = processor_->backend()->code_cache();
+  // Innermost first, as captured.
+  std::vector<GuestFunction*> functions;
+  bool in_host_code = false;
+  GuestFunction* leaf_function = nullptr;
+  uint32_t leaf_guest_address = 0;
+  for (size_t i = 0; i < frame_count; ++i) {
+    auto function = code_cache->LookupFunction(frame_host_pcs[i]);
+    if (!function) {
+      if (!i) {
+        in_host_code = true;
+      }
+      continue;
+    }
+    if (functions.empty() && !in_host_code) {
+      leaf_function = function;
+      // The PC may be in old code if the function has been retranslated since.
+      auto machine_code = uintptr_t(function->machine_code());
+      if (frame_host_pcs[i] >= machine_code &&
+          frame_host_pcs[i] < machine_code + function->machine_code_length()) {
+        leaf_guest_address =
+            function->MapMachineCodeToGuestAddress(frame_host_pcs[i]);
+      } else {
+        leaf_guest_address = function->address();
+      }
+    }
+    functions.push_back(function);
+  }
+  if (functions.empty()) {
+    // Not running guest code.
+    return;
+  }
+  if (in_host_code) {
+    functions.insert(functions.begin(), nullptr);
+  }
+  std::reverse(functions.begin(), functions.end());
+
+  std::lock_guard<std::mutex> lock(samples_mutex_);
+  ++sample_count_;
+  ++stack_counts_[functions];
+  if (leaf_function) {
+    auto& leaf_samples = function_samples_[leaf_function];
+    ++leaf_samples.self_count;
+    ++leaf_samples.instruction_counts[leaf_guest_address];
+  }
+  // Count recursive functions only once per stack.
+  std::sort(functions.begin(), functions.end());
+  functions.erase(std::unique(functions.begin(), functions.end()),
+                  functions.end());
+  for (auto function : functions) {
+    if (function) {
+      ++function_samples_[function].total_count;
+    }
+  }
+}
+
+std::string FunctionProfiler::GetFunctionName(const GuestFunction* function) {
+  if (!function) {
+    return "[host]";
+  }
+  std::string name = function->name();
+  if (name.empty()) {
+    return fmt::format("sub_{:08X}", function->address());
+  }
+  // Spaces and semicolons are separators in the collapsed stack format.
+  std::replace(name.begin(), name.end(), ' ', '_');
+  std::replace(name.begin(), name.end(), ';', '_');
+  return name;
+}
+
+bool FunctionProfiler::WriteCollapsedStacks(const std::filesystem::path& path) {
+  std::string output;
+  {
+    std::lock_guard<std::mutex> lock(samples_mutex_);
+    for (const auto& it : stack_counts_) {
+      for (size_t i = 0; i < it.first.size(); ++i) {
+        if (i) {
+          output.push_back(';');
+        }
+        output += GetFunctionName(it.first[i]);
+      }
+      output += fmt::format(" {}\n", it.second);
+    }
+  }
+  auto file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Function profiler: failed to open {}", xe::path_to_utf8(path));
+    return false;
+  }
+  fwrite(output.data(), 1, output.size(), file);
+  fclose(file);
+  return true;
+}
+
+bool FunctionProfiler::WriteHotList(const std::filesystem::path& path,
+                                    size_t max_count) {
+  struct HotFunction {
+    GuestFunction* function;
+    const FunctionSamples* samples;
+    uint64_t call_count;
+  };
+  std::vector<HotFunction> hot_functions;
+  FunctionSamples no_samples;
+
+  std::lock_guard<std::mutex> lock(samples_mutex_);
+  for (auto module : processor_->GetModules()) {
+    module->ForEachFunction([&](Function* function) {
+      if (!function->is_guest()) {
+        return;
+      }
+      auto guest_function = static_cast<GuestFunction*>(function);
+      auto it = function_samples_.find(guest_function);
+      uint64_t call_count = guest_function->profile_call_count();
+      if (it == function_samples_.end() && !call_count) {
+        return;
+      }
+      hot_functions.push_back(
+          {guest_function,
+           it != function_samples_.end() ? &it->second : &no_samples,
+           call_count});
+    });
+  }
+  std::sort(hot_functions.begin(), hot_functions.end(),
+            [](const HotFunction& a, const HotFunction& b) {
+              if (a.samples->self_count != b.samples->self_count) {
+                return a.samples->self_count > b.samples->self_count;
+              }
+              if (a.samples->total_count != b.samples->total_count) {
+                return a.samples->total_count > b.samples->total_count;
+              }
+              return a.call_count > b.call_count;
+            });
+  if (hot_functions.size() > max_count) {
+    hot_functions.resize(max_count);
+  }
+
+  double percent_scale = sample_count_ ? 100.0 / double(sample_count_) : 0.0;
+  std::string output = fmt::format(
+      "{} samples\n\n"
+      " self%  total%   self samples          calls  address   name\n",
+      sample_count_);
+  for (const auto& hot_function : hot_functions) {
+    const auto& samples = *hot_function.samples;
+    output += fmt::format(
+        "{:6.2f} {:7.2f} {:14} {:14}  {:08X}  {}\n",
+        samples.self_count * percent_scale,
+        samples.total_count * percent_scale, samples.self_count,
+        hot_function.call_count, hot_function.function->address(),
+        GetFunctionName(hot_function.function));
+    // The few hottest instructions, to find the loop worth looking at.
+    std::vector<std::pair<uint64_t, uint32_t>> instructions;
+    for (const auto& it : samples.instruction_counts) {
+      instructions.emplace_back(it.second, it.first);
+    }
+    size_t instruction_count = std::min(instructions.size(), size_t(4));
+    std::partial_sort(instructions.begin(),
+                      instructions.begin() + instruction_count,
+                      instructions.end(),
+                      [](const std::pair<uint64_t, uint32_t>& a,
+                         const std::pair<uint64_t, uint32_t>& b) {
+                        return a.first > b.first;
+                      });
+    for (size_t i = 0; i < instruction_count; ++i) {
+      output += fmt::format("{:30} {:14}    {:08X}\n", "",
+                            instructions[i].first, instructions[i].second);
+    }
+  }
+
+  auto file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Function profiler: failed to open {}", xe::path_to_utf8(path));
+    return false;
+  }
+  fwrite(output.data(), 1, output.size(), file);
+  fclose(file);
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,93 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_FUNCTION_PROFILER_H_
+#define XENIA_CPU_FUNCTION_PROFILER_H_
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+class GuestFunction;
+class Processor;
+class StackWalker;
+}  // namespace cpu
+}  // namespace xe
+
+namespace xe {
+namespace cpu {
+
+// Samples the call stacks of the guest threads periodically, mapping the host
+// PCs in generated code back to guest functions and instructions. Combined
+// with the call counters emitted with --profile_function_calls, produces
+// collapsed stacks for flame graphs and a list of the hottest functions.
+class FunctionProfiler {
+ public:
+  // Frames deeper than this are dropped from the root side.
+  static const size_t kMaxFrameCount = 128;
+
+  FunctionProfiler(Processor* processor, StackWalker* stack_walker);
+  ~FunctionProfiler();
+
+  // Starts the sampling thread. Returns false if stacks can't be captured on
+  // this platform, in which case only the call counters are available.
+  bool Start(uint32_t interval_ms);
+  void Stop();
+
+  uint64_t sample_count() const { return sample_count_; }
+
+  // Writes a line per unique guest call stack, as "root;...;leaf count" in
+  // Brendan Gregg's collapsed stack format. Time spent in host code called
+  // from guest code is attributed to a [host] leaf.
+  bool WriteCollapsedStacks(const std::filesystem::path& path);
+  // Writes up to max_count functions sorted by the samples in their own code,
+  // with their call counts and hottest instructions.
+  bool WriteHotList(const std::filesystem::path& path, size_t max_count);
+
+ private:
+  struct FunctionSamples {
+    // Samples with the function as the innermost guest frame.
+    uint64_t self_count = 0;
+    // Samples with the function anywhere in the stack, once per stack.
+    uint64_t total_count = 0;
+    // Self samples by guest instruction address.
+    std::map<uint32_t, uint64_t> instruction_counts;
+  };
+
+  void SamplingThread(uint32_t interval_ms);
+  void Sample();
+  void RecordStack(const uint64_t* frame_host_pcs, size_t frame_count);
+  static std::string GetFunctionName(const GuestFunction* function);
+
+  Processor* processor_;
+  StackWalker* stack_walker_;
+
+  std::unique_ptr<xe::threading::Event> shutdown_event_;
+  std::unique_ptr<xe::threading::Thread> sampling_thread_;
+
+  std::mutex samples_mutex_;
+  uint64_t sample_count_ = 0;
+  std::unordered_map<GuestFunction*, FunctionSamples> function_samples_;
+  // Guest functions from the root to the leaf, with nullptr for host code.
+  std::map<std::vector<GuestFunction*>, uint64_t> stack_counts_;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_FUNCTION_PROFILER_H_
@@ -16,6 +16,22 @@ namespace xe {
 namespace cpu {
 namespace hir {
 
+bool Block::FallsThrough() const {
+  const Instr* tail = instr_tail;
+  if (!tail) {
+    return true;
+  }
+  if (tail->opcode == &OPCODE_BRANCH_info ||
+      tail->opcode == &OPCODE_RETURN_info) {
+    return false;
+  }
+  if (tail->opcode == &OPCODE_CALL_info ||
+      tail->opcode == &OPCODE_CALL_INDIRECT_info) {
+    return (tail->flags & CALL_TAIL) == 0;
+  }
+  return true;
+}
+
 void Block::AssertNoCycles() {
   Instr* hare = instr_head;
   Instr* tortoise = instr_head;
@@ -63,6 +63,10 @@ class Block {
 
   uint16_t ordinal;
 
+  // Whether execution may continue to the next block after the last
+  // instruction, in addition to the outgoing edges.
+  bool FallsThrough() const;
+
   void AssertNoCycles();
 };
 
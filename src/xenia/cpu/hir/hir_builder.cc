@@ -534,6 +534,23 @@ void HIRBuilder::RemoveBlock(Block* block) {
   block->next = block->prev = nullptr;
 }
 
+void HIRBuilder::MoveBlockToEnd(Block* block) {
+  if (block == block_tail_) {
+    return;
+  }
+  if (block->prev) {
+    block->prev->next = block->next;
+  }
+  block->next->prev = block->prev;
+  if (block == block_head_) {
+    block_head_ = block->next;
+  }
+  block->prev = block_tail_;
+  block->next = nullptr;
+  block_tail_->next = block;
+  block_tail_ = block;
+}
+
 void HIRBuilder::MergeAdjacentBlocks(Block* left, Block* right) {
   assert_true(left->next == right && right->prev == left);
   assert_true(!right->incoming_edge_head ||
@@ -2124,6 +2141,23 @@ Value* HIRBuilder::AtomicCompareExchange(Value* address, Value* old_value,
   return i->dest;
 }
 
+Value* HIRBuilder::ReservedLoad(Value* address, TypeName type) {
+  ASSERT_ADDRESS_TYPE(address);
+  Instr* i = AppendInstr(OPCODE_RESERVED_LOAD_info, 0, AllocValue(type));
+  i->set_src1(address);
+  i->src2.value = i->src3.value = NULL;
+  return i->dest;
+}
+
+Value* HIRBuilder::ReservedStore(Value* address, Value* value) {
+  ASSERT_ADDRESS_TYPE(address);
+  Instr* i = AppendInstr(OPCODE_RESERVED_STORE_info, 0, AllocValue(INT8_TYPE));
+  i->set_src1(address);
+  i->set_src2(value);
+  i->src3.value = NULL;
+  return i->dest;
+}
+
 }  // namespace hir
 }  // namespace cpu
 }  // namespace xe
@@ -65,6 +65,9 @@ class HIRBuilder {
   void RemoveEdge(Edge* edge);
   void RemoveBlock(Block* block);
   void MergeAdjacentBlocks(Block* left, Block* right);
+  // Changes the position of the block in the block list, keeping its edges.
+  // Branches must be added where the block was reached by falling through.
+  void MoveBlockToEnd(Block* block);
 
   // static allocations:
   // Value* AllocStatic(size_t length);
@@ -263,6 +266,13 @@ class HIRBuilder {
   Value* AtomicAdd(Value* address, Value* value);
   Value* AtomicSub(Value* address, Value* value);
 
+  // Loads the value in memory order and reserves the address for the thread.
+  Value* ReservedLoad(Value* address, TypeName type);
+  // Stores the value in memory order if the address is reserved by the thread
+  // and still contains the value loaded when reserving it, returning whether
+  // the store was performed. The reservation is lost either way.
+  Value* ReservedStore(Value* address, Value* value);
+
  protected:
   void DumpValue(StringBuffer* str, Value* value);
   void DumpOp(StringBuffer* str, OpcodeSignatureType sig_type, Instr::Op* op);
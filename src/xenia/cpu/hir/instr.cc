@@ -78,6 +78,19 @@ void Instr::MoveBefore(Instr* other) {
   }
 }
 
+void Instr::MoveAfter(Instr* other) {
+  if (other->next == this) {
+    return;
+  }
+  if (other->next) {
+    MoveBefore(other->next);
+  } else {
+    // Appending to the end of the block.
+    MoveBefore(other);
+    other->MoveBefore(this);
+  }
+}
+
 void Instr::Replace(const OpcodeInfo* new_opcode, uint16_t new_flags) {
   opcode = new_opcode;
   flags = new_flags;
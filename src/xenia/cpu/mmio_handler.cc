@@ -300,8 +300,9 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
   // Access violations are pretty rare, so we can do a linear search here.
   // Only check if in the virtual range, as we only support virtual ranges.
   const MMIORange* range = nullptr;
+  uint32_t fault_virtual_address = 0;
   if (ex->fault_address() < uint64_t(physical_membase_)) {
-    uint32_t fault_virtual_address = host_to_guest_virtual_(
+    fault_virtual_address = host_to_guest_virtual_(
         host_to_guest_virtual_context_, fault_host_address);
     for (const auto& test_range : mapped_ranges_) {
       if ((fault_virtual_address & test_range.mask) == test_range.address) {
@@ -375,6 +376,11 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
   // Advance RIP to the next instruction so that we resume properly.
   ex->set_resume_pc(rip + mov.length);
 
+  if (access_site_callback_) {
+    access_site_callback_(access_site_callback_context_,
+                          reinterpret_cast<void*>(rip), fault_virtual_address);
+  }
+
   return true;
 }
 
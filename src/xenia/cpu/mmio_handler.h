@@ -48,6 +48,11 @@ class MMIOHandler {
   typedef bool (*AccessViolationCallback)(
       std::unique_lock<std::recursive_mutex> global_lock_locked_once,
       void* context, void* host_address, bool is_write);
+  // Called after emulating an access to a range by the host instruction at
+  // host_pc, so the code containing it can be changed to access the range
+  // without faulting.
+  typedef void (*AccessSiteCallback)(void* context, void* host_pc,
+                                     uint32_t virtual_address);
 
   // access_violation_callback is called with global_critical_region locked once
   // on the thread, so if multiple threads trigger an access violation in the
@@ -65,6 +70,12 @@ class MMIOHandler {
                      MMIOWriteCallback write_callback);
   MMIORange* LookupRange(uint32_t virtual_address);
 
+  void SetAccessSiteCallback(AccessSiteCallback callback,
+                             void* callback_context) {
+    access_site_callback_context_ = callback_context;
+    access_site_callback_ = callback;
+  }
+
   bool CheckLoad(uint32_t virtual_address, uint32_t* out_value);
   bool CheckStore(uint32_t virtual_address, uint32_t value);
 
@@ -90,6 +101,9 @@ class MMIOHandler {
   AccessViolationCallback access_violation_callback_;
   void* access_violation_callback_context_;
 
+  AccessSiteCallback access_site_callback_ = nullptr;
+  void* access_site_callback_context_ = nullptr;
+
   static MMIOHandler* global_handler_;
 
   xe::global_critical_region global_critical_region_;
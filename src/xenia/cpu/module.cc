@@ -28,6 +28,11 @@ Module::~Module() = default;
 
 bool Module::ContainsAddress(uint32_t address) { return true; }
 
+bool Module::GetAddressRange(uint32_t* out_low_address,
+                             uint32_t* out_high_address) const {
+  return false;
+}
+
 Symbol* Module::LookupSymbol(uint32_t address, bool wait) {
   auto global_lock = global_critical_region_.Acquire();
   const auto it = map_.find(address);
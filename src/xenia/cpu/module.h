@@ -37,6 +37,11 @@ class Module {
   virtual bool is_executable() const = 0;
 
   virtual bool ContainsAddress(uint32_t address);
+  // Gets the [low, high) guest address range of the module if all addresses it
+  // contains are in a single known range, for looking modules up by address
+  // without asking each of them.
+  virtual bool GetAddressRange(uint32_t* out_low_address,
+                               uint32_t* out_high_address) const;
 
   Symbol* LookupSymbol(uint32_t address, bool wait = true);
   virtual Symbol::Status DeclareFunction(uint32_t address,
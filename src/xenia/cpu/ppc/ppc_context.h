@@ -246,7 +246,8 @@ enum class PPCRegister {
 };
 
 #pragma pack(push, 8)
-typedef struct PPCContext_s {
+// Cache line aligned, so the contexts of different threads don't share lines.
+typedef struct alignas(64) PPCContext_s {
   // Must be stored at 0x0 for now.
   // TODO(benvanik): find a nice way to describe this to the JIT.
   ThreadState* thread_state;  // 0x0
@@ -423,8 +424,11 @@ typedef struct PPCContext_s {
 
   uint8_t* physical_membase;
 
-  // Value of last reserved load
+  // Value of last reserved load, in memory byte order.
   uint64_t reserved_val;
+  // Guest address of the last reserved load, or 0 if the reservation has been
+  // lost.
+  uint32_t reserved_address;
 
   static std::string GetRegisterName(PPCRegister reg);
   std::string GetStringFromValue(PPCRegister reg) const;
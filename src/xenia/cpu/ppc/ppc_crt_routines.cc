@@ -0,0 +1,222 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/ppc/ppc_crt_routines.h"
+
+#include <cstdlib>
+#include <cstring>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/utf8.h"
+#include "xenia/base/xxhash.h"
+#include "xenia/cpu/module.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/memory.h"
+
+DEFINE_bool(replace_crt_routines, false,
+            "Run C runtime routines statically linked into titles, such as "
+            "memcpy and strlen, as host code instead of translating them. No "
+            "signatures are built in, so only the routines named by "
+            "--load_module_map or matching --crt_routine_signatures are "
+            "replaced.",
+            "CPU");
+DEFINE_string(crt_routine_signatures, "",
+              "Comma-separated name:hash pairs of the code of C runtime "
+              "routines to replace, such as memcpy:0123456789ABCDEF. The "
+              "hashes of routines named by --load_module_map are logged.",
+              "CPU");
+
+namespace xe {
+namespace cpu {
+namespace ppc {
+
+namespace {
+
+// arg0 is the Memory.
+uint8_t* TranslateArg(void* memory, uint64_t address) {
+  return reinterpret_cast<Memory*>(memory)->TranslateVirtual(
+      uint32_t(address));
+}
+
+int64_t CompareResult(int result) {
+  return result < 0 ? -1 : (result > 0 ? 1 : 0);
+}
+
+// memcpy and memmove return the destination, which is already in r3.
+void CrtMemmove(PPCContext* ppc_context, void* arg0, void* arg1) {
+  uint32_t size = uint32_t(ppc_context->r[5]);
+  if (size) {
+    std::memmove(TranslateArg(arg0, ppc_context->r[3]),
+                 TranslateArg(arg0, ppc_context->r[4]), size);
+  }
+}
+
+void CrtMemset(PPCContext* ppc_context, void* arg0, void* arg1) {
+  uint32_t size = uint32_t(ppc_context->r[5]);
+  if (size) {
+    std::memset(TranslateArg(arg0, ppc_context->r[3]),
+                uint8_t(ppc_context->r[4]), size);
+  }
+}
+
+void CrtMemcmp(PPCContext* ppc_context, void* arg0, void* arg1) {
+  uint32_t size = uint32_t(ppc_context->r[5]);
+  int result = 0;
+  if (size) {
+    result = std::memcmp(TranslateArg(arg0, ppc_context->r[3]),
+                         TranslateArg(arg0, ppc_context->r[4]), size);
+  }
+  ppc_context->r[3] = uint64_t(CompareResult(result));
+}
+
+void CrtStrlen(PPCContext* ppc_context, void* arg0, void* arg1) {
+  ppc_context->r[3] = std::strlen(
+      reinterpret_cast<const char*>(TranslateArg(arg0, ppc_context->r[3])));
+}
+
+void CrtStrcmp(PPCContext* ppc_context, void* arg0, void* arg1) {
+  int result = std::strcmp(
+      reinterpret_cast<const char*>(TranslateArg(arg0, ppc_context->r[3])),
+      reinterpret_cast<const char*>(TranslateArg(arg0, ppc_context->r[4])));
+  ppc_context->r[3] = uint64_t(CompareResult(result));
+}
+
+}  // namespace
+
+const PPCCrtRoutines::Routine PPCCrtRoutines::kRoutines[] = {
+    {"memcpy", CrtMemmove},  {"memmove", CrtMemmove}, {"memset", CrtMemset},
+    {"memcmp", CrtMemcmp},   {"strlen", CrtStrlen},   {"strcmp", CrtStrcmp},
+};
+
+PPCCrtRoutines::PPCCrtRoutines(Processor* processor) : processor_(processor) {}
+
+PPCCrtRoutines::~PPCCrtRoutines() {
+  std::lock_guard<std::mutex> lock(report_mutex_);
+  for (const auto& module_matches : matches_) {
+    std::string routines;
+    for (const auto& match : module_matches.second) {
+      routines += fmt::format(" {}@{:08X}", match.second, match.first);
+    }
+    XELOGI("C runtime routines replaced in {}:{}", module_matches.first,
+           routines);
+  }
+}
+
+void PPCCrtRoutines::Initialize() {
+  if (!cvars::replace_crt_routines) {
+    return;
+  }
+  auto memory = processor_->memory();
+  for (const auto& routine : kRoutines) {
+    builtins_.push_back(processor_->DefineBuiltin(
+        std::string("__host_") + routine.name, routine.handler, memory,
+        nullptr));
+  }
+
+  for (auto signature :
+       xe::utf8::split(cvars::crt_routine_signatures, ",", true)) {
+    auto separator = signature.find(':');
+    if (separator == std::string_view::npos) {
+      XELOGE("Invalid C runtime routine signature {}", signature);
+      continue;
+    }
+    auto name = signature.substr(0, separator);
+    std::string hash_string(signature.substr(separator + 1));
+    size_t routine_index = 0;
+    for (; routine_index < xe::countof(kRoutines); ++routine_index) {
+      if (name == kRoutines[routine_index].name) {
+        break;
+      }
+    }
+    if (routine_index >= xe::countof(kRoutines)) {
+      XELOGE("Unknown C runtime routine {} in signature {}", name, signature);
+      continue;
+    }
+    signatures_.emplace(std::strtoull(hash_string.c_str(), nullptr, 16),
+                        routine_index);
+  }
+}
+
+uint64_t PPCCrtRoutines::HashCode(Memory* memory, uint32_t address,
+                                  uint32_t end_address) {
+  std::vector<uint32_t> code;
+  code.reserve((end_address - address) / 4 + 1);
+  for (; address <= end_address; address += 4) {
+    uint32_t instr =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    if ((instr >> 26) == 18 && (instr & 1)) {
+      // bl - keep the opcode and the AA and LK bits.
+      instr &= 0xFC000003;
+    }
+    code.push_back(instr);
+  }
+  return XXH3_64bits(code.data(), code.size() * sizeof(uint32_t));
+}
+
+Function* PPCCrtRoutines::LookupReplacement(GuestFunction* function) {
+  if (builtins_.empty() || !function->has_end_address() ||
+      function->behavior() == Function::Behavior::kExtern) {
+    return nullptr;
+  }
+
+  // Map names may have the C decoration.
+  std::string_view name = function->name();
+  if (!name.empty() && name[0] == '_') {
+    name.remove_prefix(1);
+  }
+  size_t routine_index = 0;
+  for (; routine_index < xe::countof(kRoutines); ++routine_index) {
+    if (name == kRoutines[routine_index].name) {
+      break;
+    }
+  }
+  bool matched_by_name = routine_index < xe::countof(kRoutines);
+  uint64_t hash = 0;
+  if (matched_by_name || !signatures_.empty()) {
+    hash = HashCode(processor_->memory(), function->address(),
+                    function->end_address());
+  }
+  if (!matched_by_name) {
+    auto it = signatures_.find(hash);
+    if (it == signatures_.end()) {
+      return nullptr;
+    }
+    routine_index = it->second;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(report_mutex_);
+    auto& module_matches = matches_[function->module()->name()];
+    if (module_matches
+            .emplace(function->address(), kRoutines[routine_index].name)
+            .second) {
+      if (matched_by_name) {
+        // For matching the same code in other titles.
+        XELOGI(
+            "Replacing C runtime routine {} at {:08X} with host code, "
+            "signature {}:{:016X}",
+            kRoutines[routine_index].name, function->address(),
+            kRoutines[routine_index].name, hash);
+      } else {
+        XELOGI("Replacing C runtime routine {} at {:08X} with host code",
+               kRoutines[routine_index].name, function->address());
+      }
+    }
+  }
+  return builtins_[routine_index];
+}
+
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,79 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_PPC_PPC_CRT_ROUTINES_H_
+#define XENIA_CPU_PPC_PPC_CRT_ROUTINES_H_
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/cpu/function.h"
+
+namespace xe {
+class Memory;
+namespace cpu {
+class Processor;
+}  // namespace cpu
+}  // namespace xe
+
+namespace xe {
+namespace cpu {
+namespace ppc {
+
+// Recognizes C runtime routines statically linked into titles, such as memcpy
+// and strlen, so their guest code can be replaced with a call to a builtin
+// implementing them on the host. Functions are matched by the name given to
+// them by a loaded module map, or by the hash of their code if it's listed in
+// --crt_routine_signatures. Off unless --replace_crt_routines is set, as no
+// signatures of common routines are built in.
+class PPCCrtRoutines {
+ public:
+  explicit PPCCrtRoutines(Processor* processor);
+  ~PPCCrtRoutines();
+
+  // Defines the builtins implementing the routines.
+  void Initialize();
+
+  // Returns the builtin to call instead of translating the guest code of the
+  // function, or nullptr if it's not a known routine. The extents of the
+  // function must be known.
+  Function* LookupReplacement(GuestFunction* function);
+
+  // Hash of the code in [address, end_address], ignoring the displacements of
+  // calls to other functions, which depend on where the routine was linked.
+  static uint64_t HashCode(Memory* memory, uint32_t address,
+                           uint32_t end_address);
+
+ private:
+  struct Routine {
+    const char* name;
+    BuiltinFunction::Handler handler;
+  };
+  static const Routine kRoutines[];
+
+  Processor* processor_;
+  // By the index in kRoutines.
+  std::vector<Function*> builtins_;
+  // Routine index by code hash, from --crt_routine_signatures.
+  std::unordered_map<uint64_t, size_t> signatures_;
+
+  std::mutex report_mutex_;
+  // Routine names by module name and guest address, for the report.
+  std::map<std::string, std::map<uint32_t, std::string>> matches_;
+};
+
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_PPC_PPC_CRT_ROUTINES_H_
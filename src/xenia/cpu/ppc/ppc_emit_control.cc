@@ -32,6 +32,14 @@ int InstrEmit_branch(PPCHIRBuilder& f, const char* src, uint64_t cia,
                      bool expect_true = true, bool nia_is_lr = false) {
   uint32_t call_flags = 0;
 
+  // Small functions are emitted in place of direct calls to them, so
+  // optimizations can see across the call.
+  if (!cond && nia->IsConstant() &&
+      f.InlineFunction(uint32_t(nia->AsUint64()),
+                       lk ? uint32_t(cia + 4) : 0)) {
+    return 0;
+  }
+
   // TODO(benvanik): this may be wrong and overwrite LRs when not desired!
   // The docs say always, though...
   // Note that we do the update before we branch/call as we need it to
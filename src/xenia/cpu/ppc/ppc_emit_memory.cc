@@ -759,16 +759,11 @@ int InstrEmit_ldarx(PPCHIRBuilder& f, const InstrData& i) {
   // RESERVE_ADDR <- real_addr(EA)
   // RT <- MEM(EA, 8)
 
-  // NOTE: we assume we are within a global lock.
-  // We could assert here that the block (or its parent) has taken a global lock
-  // already, but I haven't see anything but interrupt callbacks (which are
-  // always under a global lock) do that yet.
-  // We issue a memory barrier here to make sure that we get good values.
-  f.MemoryBarrier();
-
+  // The reservation is tracked per thread by the backend. No barrier is needed
+  // here, as guest code synchronizes with sync/lwsync explicitly where
+  // required.
   Value* ea = CalculateEA_0(f, i.X.RA, i.X.RB);
-  Value* rt = f.ByteSwap(f.Load(ea, INT64_TYPE));
-  f.StoreReserved(rt);
+  Value* rt = f.ByteSwap(f.ReservedLoad(ea, INT64_TYPE));
   f.StoreGPR(i.X.RT, rt);
   return 0;
 }
@@ -784,16 +779,12 @@ int InstrEmit_lwarx(PPCHIRBuilder& f, const InstrData& i) {
   // RESERVE_ADDR <- real_addr(EA)
   // RT <- i32.0 || MEM(EA, 4)
 
-  // NOTE: we assume we are within a global lock.
-  // We could assert here that the block (or its parent) has taken a global lock
-  // already, but I haven't see anything but interrupt callbacks (which are
-  // always under a global lock) do that yet.
-  // We issue a memory barrier here to make sure that we get good values.
-  f.MemoryBarrier();
-
+  // The reservation is tracked per thread by the backend. No barrier is needed
+  // here, as guest code synchronizes with sync/lwsync explicitly where
+  // required.
   Value* ea = CalculateEA_0(f, i.X.RA, i.X.RB);
-  Value* rt = f.ZeroExtend(f.ByteSwap(f.Load(ea, INT32_TYPE)), INT64_TYPE);
-  f.StoreReserved(rt);
+  Value* rt = f.ZeroExtend(f.ByteSwap(f.ReservedLoad(ea, INT32_TYPE)),
+                           INT64_TYPE);
   f.StoreGPR(i.X.RT, rt);
   return 0;
 }
@@ -809,25 +800,16 @@ int InstrEmit_stdcx(PPCHIRBuilder& f, const InstrData& i) {
   // n <- 1 if store performed
   // CR0[LT GT EQ SO] = 0b00 || n || XER[SO]
 
-  // NOTE: we assume we are within a global lock.
-  // As we have been exclusively executing this entire time, we assume that no
-  // one else could have possibly touched the memory and must always succeed.
-  // We use atomic compare exchange here to support reserved load/store without
-  // being under the global lock (flag disable_global_lock - see mtmsr/mtmsrd).
-  // This will always succeed if under the global lock, however.
-
+  // The store is performed if the address is still reserved by this thread and
+  // the memory wasn't changed since the reserved load, atomically, so this
+  // works without the global lock (flag disable_global_lock - see
+  // mtmsr/mtmsrd). The atomic operation is also a full barrier on the host.
   Value* ea = CalculateEA_0(f, i.X.RA, i.X.RB);
   Value* rt = f.ByteSwap(f.LoadGPR(i.X.RT));
-  Value* res = f.ByteSwap(f.LoadReserved());
-  Value* v = f.AtomicCompareExchange(ea, res, rt);
+  Value* v = f.ReservedStore(ea, rt);
   f.StoreContext(offsetof(PPCContext, cr0.cr0_eq), v);
   f.StoreContext(offsetof(PPCContext, cr0.cr0_lt), f.LoadZeroInt8());
   f.StoreContext(offsetof(PPCContext, cr0.cr0_gt), f.LoadZeroInt8());
-
-  // Issue memory barrier for when we go out of lock and want others to see our
-  // updates.
-  f.MemoryBarrier();
-
   return 0;
 }
 
@@ -842,25 +824,16 @@ int InstrEmit_stwcx(PPCHIRBuilder& f, const InstrData& i) {
   // n <- 1 if store performed
   // CR0[LT GT EQ SO] = 0b00 || n || XER[SO]
 
-  // NOTE: we assume we are within a global lock.
-  // As we have been exclusively executing this entire time, we assume that no
-  // one else could have possibly touched the memory and must always succeed.
-  // We use atomic compare exchange here to support reserved load/store without
-  // being under the global lock (flag disable_global_lock - see mtmsr/mtmsrd).
-  // This will always succeed if under the global lock, however.
-
+  // The store is performed if the address is still reserved by this thread and
+  // the memory wasn't changed since the reserved load, atomically, so this
+  // works without the global lock (flag disable_global_lock - see
+  // mtmsr/mtmsrd). The atomic operation is also a full barrier on the host.
   Value* ea = CalculateEA_0(f, i.X.RA, i.X.RB);
   Value* rt = f.ByteSwap(f.Truncate(f.LoadGPR(i.X.RT), INT32_TYPE));
-  Value* res = f.ByteSwap(f.Truncate(f.LoadReserved(), INT32_TYPE));
-  Value* v = f.AtomicCompareExchange(ea, res, rt);
+  Value* v = f.ReservedStore(ea, rt);
   f.StoreContext(offsetof(PPCContext, cr0.cr0_eq), v);
   f.StoreContext(offsetof(PPCContext, cr0.cr0_lt), f.LoadZeroInt8());
   f.StoreContext(offsetof(PPCContext, cr0.cr0_gt), f.LoadZeroInt8());
-
-  // Issue memory barrier for when we go out of lock and want others to see our
-  // updates.
-  f.MemoryBarrier();
-
   return 0;
 }
 
@@ -9,10 +9,18 @@
 
 #include "xenia/cpu/ppc/ppc_frontend.h"
 
+#include <algorithm>
+
 #include "xenia/base/atomic.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/threading.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/ppc/ppc_crt_routines.h"
 #include "xenia/cpu/ppc/ppc_emit.h"
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
+#include "xenia/cpu/ppc/ppc_prefetch_compiler.h"
 #include "xenia/cpu/ppc/ppc_translator.h"
 #include "xenia/cpu/processor.h"
 
@@ -46,6 +54,19 @@ PPCFrontend::PPCFrontend(Processor* processor) : processor_(processor) {
 }
 
 PPCFrontend::~PPCFrontend() {
+  auto mmio_handler = MMIOHandler::global_handler();
+  if (mmio_handler) {
+    mmio_handler->SetAccessSiteCallback(nullptr, nullptr);
+  }
+  if (mmio_access_site_thread_) {
+    mmio_access_site_shutdown_.store(true, std::memory_order_release);
+    xe::atomic_inc(&mmio_access_sequence_);
+    xe::threading::FutexWake(&mmio_access_sequence_);
+    xe::threading::Wait(mmio_access_site_thread_.get(), false);
+    mmio_access_site_thread_.reset();
+  }
+  // Stop the background translation before the translators go away.
+  prefetch_compiler_.reset();
   // Force cleanup now before we deinit.
   translator_pool_.Reset();
 }
@@ -87,6 +108,37 @@ bool PPCFrontend::Initialize() {
       processor_->DefineBuiltin("EnterGlobalLock", EnterGlobalLock, arg0, arg1);
   builtins_.leave_global_lock =
       processor_->DefineBuiltin("LeaveGlobalLock", LeaveGlobalLock, arg0, arg1);
+
+  crt_routines_ = std::make_unique<PPCCrtRoutines>(processor_);
+  crt_routines_->Initialize();
+
+  auto mmio_handler = MMIOHandler::global_handler();
+  if (cvars::recompile_mmio_access_sites && mmio_handler) {
+    mmio_access_site_thread_ = xe::threading::Thread::Create(
+        {}, [this]() { MmioAccessSiteThread(); });
+    mmio_access_site_thread_->set_name("CPU MMIO Access Sites");
+    mmio_handler->SetAccessSiteCallback(MmioAccessSiteCallbackThunk, this);
+  }
+
+  if (cvars::prefetch_compiler_threads != 0) {
+    uint32_t logical_processor_count =
+        xe::threading::logical_processor_count();
+    if (!logical_processor_count) {
+      // Pick some reasonable amount if couldn't determine the number of cores.
+      logical_processor_count = 6;
+    }
+    uint32_t prefetch_thread_count;
+    if (cvars::prefetch_compiler_threads < 0) {
+      // Leave most of the cores to the guest, GPU and audio threads.
+      prefetch_thread_count = std::max(logical_processor_count / 4, uint32_t(1));
+    } else {
+      prefetch_thread_count =
+          std::min(uint32_t(cvars::prefetch_compiler_threads),
+                   logical_processor_count);
+    }
+    prefetch_compiler_ =
+        std::make_unique<PPCPrefetchCompiler>(processor_, prefetch_thread_count);
+  }
   return true;
 }
 
@@ -103,10 +155,153 @@ bool PPCFrontend::DefineFunction(GuestFunction* function,
                                  uint32_t debug_info_flags) {
   auto translator = translator_pool_.Allocate(this);
   bool result = translator->Translate(function, debug_info_flags);
+  if (result && prefetch_compiler_) {
+    // Functions called from here are likely to be needed soon.
+    prefetch_compiler_->OnFunctionTranslated(translator->call_targets());
+  }
+  translator_pool_.Release(translator);
+  return result;
+}
+
+void PPCFrontend::PrefetchFunctions(const std::vector<uint32_t>& addresses) {
+  if (prefetch_compiler_) {
+    prefetch_compiler_->Queue(addresses,
+                              PPCPrefetchCompiler::Priority::kModule);
+  }
+}
+
+void PPCFrontend::RecompileFunction(GuestFunction* function) {
+  uint32_t generation = function->translation_generation();
+  if (prefetch_compiler_) {
+    prefetch_compiler_->QueueRecompilation(function, generation);
+    return;
+  }
+  RetranslateFunction(function, generation);
+}
+
+bool PPCFrontend::RetranslateFunction(GuestFunction* function,
+                                      uint32_t generation) {
+  std::lock_guard<std::mutex> lock(function->translation_mutex());
+  if (function->translation_generation() != generation) {
+    // Already retranslated after the request was made.
+    return true;
+  }
+  return RetranslateFunctionLocked(function);
+}
+
+bool PPCFrontend::RetranslateFunctionLocked(GuestFunction* function) {
+  function->BeginRetranslation();
+  auto translator = translator_pool_.Allocate(this);
+  bool result = translator->Translate(function, 0);
   translator_pool_.Release(translator);
+  if (!result) {
+    XELOGW("Failed to recompile function {:08X}, keeping the old code",
+           function->address());
+  }
+  if (function->is_invalidated()) {
+    // The guest code was modified while being translated, don't call the new
+    // code until the function is resolved again.
+    processor_->backend()->InvalidateFunction(function);
+  }
   return result;
 }
 
+void PPCFrontend::GetMmioAccessSites(
+    uint32_t start_address, uint32_t end_address,
+    std::vector<std::pair<uint32_t, MMIORange*>>* sites_out) {
+  sites_out->clear();
+  std::lock_guard<std::mutex> lock(mmio_access_sites_mutex_);
+  for (auto it = mmio_access_sites_.lower_bound(start_address);
+       it != mmio_access_sites_.end() && it->first <= end_address; ++it) {
+    sites_out->push_back(*it);
+  }
+}
+
+void PPCFrontend::MmioAccessSiteCallbackThunk(void* context, void* host_pc,
+                                              uint32_t virtual_address) {
+  reinterpret_cast<PPCFrontend*>(context)->OnMmioAccessSite(host_pc,
+                                                            virtual_address);
+}
+
+void PPCFrontend::OnMmioAccessSite(void* host_pc, uint32_t virtual_address) {
+  auto host_pc_value = reinterpret_cast<uintptr_t>(host_pc);
+  for (MmioAccess& access : mmio_accesses_) {
+    uintptr_t slot_host_pc = access.host_pc.load(std::memory_order_relaxed);
+    if (slot_host_pc == host_pc_value) {
+      // Already recorded.
+      return;
+    }
+    if (!slot_host_pc &&
+        access.host_pc.compare_exchange_strong(slot_host_pc, 1,
+                                               std::memory_order_acquire)) {
+      access.virtual_address.store(virtual_address, std::memory_order_relaxed);
+      access.host_pc.store(host_pc_value, std::memory_order_release);
+      // A raw futex syscall (or WakeByAddressSingle), safe to call from the
+      // handler.
+      xe::atomic_inc(&mmio_access_sequence_);
+      xe::threading::FutexWake(&mmio_access_sequence_);
+      return;
+    }
+  }
+}
+
+void PPCFrontend::MmioAccessSiteThread() {
+  while (true) {
+    // Read before checking the slots, so an access recorded after the check
+    // changes the sequence and ends the wait immediately.
+    uint32_t sequence = mmio_access_sequence_;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (mmio_access_site_shutdown_.load(std::memory_order_acquire)) {
+      break;
+    }
+    for (MmioAccess& access : mmio_accesses_) {
+      uintptr_t host_pc = access.host_pc.load(std::memory_order_acquire);
+      if (host_pc <= 1) {
+        continue;
+      }
+      uint32_t virtual_address =
+          access.virtual_address.load(std::memory_order_relaxed);
+      access.host_pc.store(0, std::memory_order_release);
+      RetranslateForMmioAccess(reinterpret_cast<void*>(host_pc),
+                               virtual_address);
+    }
+    xe::threading::FutexWait(&mmio_access_sequence_, sequence);
+  }
+}
+
+void PPCFrontend::RetranslateForMmioAccess(void* host_pc,
+                                           uint32_t virtual_address) {
+  // Only generated code can be retranslated, not the kernel or other host code
+  // accessing guest memory.
+  auto function = processor_->backend()->code_cache()->LookupFunction(
+      reinterpret_cast<uint64_t>(host_pc));
+  if (!function) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(function->translation_mutex());
+  auto machine_code = reinterpret_cast<uintptr_t>(function->machine_code());
+  auto code_offset = reinterpret_cast<uintptr_t>(host_pc) - machine_code;
+  if (!machine_code || code_offset >= function->machine_code_length()) {
+    // Retranslated since the access.
+    return;
+  }
+  auto entry = function->LookupMachineCodeOffset(uint32_t(code_offset));
+  auto mmio_range = memory()->LookupVirtualMappedRange(virtual_address);
+  if (!entry || !mmio_range) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> sites_lock(mmio_access_sites_mutex_);
+    if (!mmio_access_sites_.emplace(entry->guest_address, mmio_range).second) {
+      // Already retranslated for this site.
+      return;
+    }
+  }
+  XELOGD("Retranslating function {:08X} for MMIO access at {:08X}",
+         function->address(), entry->guest_address);
+  RetranslateFunctionLocked(function);
+}
+
 }  // namespace ppc
 }  // namespace cpu
 }  // namespace xe
@@ -10,8 +10,14 @@
 #ifndef XENIA_CPU_PPC_PPC_FRONTEND_H_
 #define XENIA_CPU_PPC_PPC_FRONTEND_H_
 
+#include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
+#include "xenia/base/threading.h"
 #include "xenia/base/type_pool.h"
 #include "xenia/cpu/function.h"
 #include "xenia/memory.h"
@@ -26,6 +32,8 @@ namespace xe {
 namespace cpu {
 namespace ppc {
 
+class PPCCrtRoutines;
+class PPCPrefetchCompiler;
 class PPCTranslator;
 
 struct PPCBuiltins {
@@ -45,14 +53,75 @@ class PPCFrontend {
   Processor* processor() const { return processor_; }
   Memory* memory() const;
   PPCBuiltins* builtins() { return &builtins_; }
+  PPCCrtRoutines* crt_routines() const { return crt_routines_.get(); }
+
+  PPCPrefetchCompiler* prefetch_compiler() const {
+    return prefetch_compiler_.get();
+  }
 
   bool DeclareFunction(GuestFunction* function);
   bool DefineFunction(GuestFunction* function, uint32_t debug_info_flags);
 
+  // Queues known function starts, such as ones from a newly loaded module, for
+  // translation in the background if prefetching is enabled.
+  void PrefetchFunctions(const std::vector<uint32_t>& addresses);
+
+  // Recompiles a function, such as one from the fast tier of tiered
+  // compilation that needs all optimizations, in the background if
+  // prefetching is enabled. Guest code keeps running the old code until the
+  // new code replaces it.
+  void RecompileFunction(GuestFunction* function);
+  // Translates an already defined function again, replacing its code, unless
+  // it has been retranslated since its translation generation was generation.
+  bool RetranslateFunction(GuestFunction* function, uint32_t generation);
+  // Translates an already defined function again, replacing its code. The
+  // translation mutex of the function must be held.
+  bool RetranslateFunctionLocked(GuestFunction* function);
+
+  // Gets the guest instructions in the range found to access MMIO ranges, and
+  // the ranges they access, sorted by address.
+  void GetMmioAccessSites(
+      uint32_t start_address, uint32_t end_address,
+      std::vector<std::pair<uint32_t, MMIORange*>>* sites_out);
+
  private:
+  // Accesses recorded by the access violation handler, for the MMIO access
+  // site thread to retranslate the functions they're from. A slot is free if
+  // host_pc is 0, and being written if it's 1.
+  struct MmioAccess {
+    std::atomic<uintptr_t> host_pc;
+    std::atomic<uint32_t> virtual_address;
+  };
+  // Accesses made while all slots are used are dropped, but the same site will
+  // fault again until its function is retranslated.
+  static const size_t kMmioAccessCount = 64;
+
+  static void MmioAccessSiteCallbackThunk(void* context, void* host_pc,
+                                          uint32_t virtual_address);
+  // Called from the access violation handler, where nothing can be locked, so
+  // the access is only recorded, and the MMIO access site thread is woken with
+  // a futex.
+  void OnMmioAccessSite(void* host_pc, uint32_t virtual_address);
+  void MmioAccessSiteThread();
+  void RetranslateForMmioAccess(void* host_pc, uint32_t virtual_address);
+
   Processor* processor_;
   PPCBuiltins builtins_ = {0};
+  std::unique_ptr<PPCCrtRoutines> crt_routines_;
   TypePool<PPCTranslator, PPCFrontend*> translator_pool_;
+  std::unique_ptr<PPCPrefetchCompiler> prefetch_compiler_;
+
+  std::mutex mmio_access_sites_mutex_;
+  // MMIO ranges accessed by guest instructions that weren't translated to call
+  // the range callbacks directly.
+  std::map<uint32_t, MMIORange*> mmio_access_sites_;
+
+  MmioAccess mmio_accesses_[kMmioAccessCount] = {};
+  // Incremented after recording accesses and on shutdown, the MMIO access site
+  // thread waits for it to change.
+  volatile uint32_t mmio_access_sequence_ = 0;
+  std::atomic<bool> mmio_access_site_shutdown_{false};
+  std::unique_ptr<xe::threading::Thread> mmio_access_site_thread_;
 };
 
 }  // namespace ppc
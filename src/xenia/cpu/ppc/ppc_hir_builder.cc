@@ -22,6 +22,7 @@
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/hir/label.h"
 #include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/ppc/ppc_crt_routines.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
@@ -78,6 +79,7 @@ void PPCHIRBuilder::Reset() {
   instr_offset_list_ = NULL;
   label_list_ = NULL;
   with_debug_info_ = false;
+  inlined_ranges_.clear();
   HIRBuilder::Reset();
 }
 
@@ -89,6 +91,7 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   function_ = function;
   start_address_ = function_->address();
   instr_count_ = (function_->end_address() - function_->address()) / 4 + 1;
+  inlined_ranges_.clear();
 
   with_debug_info_ = (flags & EMIT_DEBUG_COMMENTS) == EMIT_DEBUG_COMMENTS;
   if (with_debug_info_) {
@@ -97,6 +100,15 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
                   function_->name().c_str());
   }
 
+  // Known C runtime routines run as host code instead.
+  auto crt_replacement = frontend_->crt_routines()->LookupReplacement(function);
+  if (crt_replacement) {
+    SourceOffset(start_address_);
+    CallExtern(crt_replacement);
+    Return();
+    return Finalize();
+  }
+
   // Allocate offset list.
   // This is used to quickly map labels to instructions.
   // The list is built as the instructions are traversed, with the values
@@ -112,6 +124,15 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   // Always mark entry with label.
   label_list_[0] = NewLabel();
 
+  if (cvars::recompile_mmio_access_sites) {
+    frontend_->GetMmioAccessSites(function_->address(),
+                                  function_->end_address(),
+                                  &mmio_access_sites_);
+  } else {
+    mmio_access_sites_.clear();
+  }
+  auto mmio_access_site_it = mmio_access_sites_.cbegin();
+
   uint32_t start_address = function_->address();
   uint32_t end_address = function_->end_address();
   for (uint32_t address = start_address, offset = 0; address <= end_address;
@@ -160,30 +181,20 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
     }
     ++opcode_translation_counts[static_cast<int>(opcode)];
 
-    // Synchronize the PPC context as required.
-    // This will ensure all registers are saved to the PPC context before this
-    // instruction executes.
-    if (opcode_info.type == PPCOpcodeType::kSync) {
-      ContextBarrier();
-    }
-
-    MaybeBreakOnInstruction(address);
-
     InstrData i;
     i.address = address;
     i.code = code;
     i.opcode = opcode;
     i.opcode_info = &opcode_info;
-    if (!opcode_info.emit || opcode_info.emit(*this, i)) {
-      auto& disasm_info = GetOpcodeDisasmInfo(opcode);
-      XELOGE(
-          "Unimplemented instr {:08X} {:08X} {} - report the game to Xenia "
-          "developers; to skip, disable break_on_unimplemented_instructions",
-          address, code, disasm_info.name);
-      Comment("UNIMPLEMENTED!");
-      if (cvars::break_on_unimplemented_instructions) {
-        DebugBreak();
-      }
+    EmitInstr(i);
+
+    while (mmio_access_site_it != mmio_access_sites_.cend() &&
+           mmio_access_site_it->first < address) {
+      ++mmio_access_site_it;
+    }
+    if (mmio_access_site_it != mmio_access_sites_.cend() &&
+        mmio_access_site_it->first == address) {
+      ConvertMmioAccesses(first_instr, mmio_access_site_it->second);
     }
   }
 
@@ -194,6 +205,171 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   return Finalize();
 }
 
+void PPCHIRBuilder::EmitInstr(const InstrData& i) {
+  // Synchronize the PPC context as required.
+  // This will ensure all registers are saved to the PPC context before this
+  // instruction executes.
+  if (i.opcode_info->type == PPCOpcodeType::kSync) {
+    ContextBarrier();
+  }
+
+  MaybeBreakOnInstruction(i.address);
+
+  if (!i.opcode_info->emit || i.opcode_info->emit(*this, i)) {
+    auto& disasm_info = GetOpcodeDisasmInfo(i.opcode);
+    XELOGE(
+        "Unimplemented instr {:08X} {:08X} {} - report the game to Xenia "
+        "developers; to skip, disable break_on_unimplemented_instructions",
+        i.address, i.code, disasm_info.name);
+    Comment("UNIMPLEMENTED!");
+    if (cvars::break_on_unimplemented_instructions) {
+      DebugBreak();
+    }
+  }
+}
+
+bool PPCHIRBuilder::InlineFunction(uint32_t address, uint32_t return_address) {
+  if (address >= start_address_ &&
+      address < start_address_ + instr_count_ * 4) {
+    // A branch within the function being emitted.
+    return false;
+  }
+  if (cvars::inline_function_max_instructions <= 0) {
+    return false;
+  }
+  auto function = LookupFunction(address);
+  if (!function || function->behavior() == Function::Behavior::kBuiltin ||
+      function->behavior() == Function::Behavior::kExtern) {
+    return false;
+  }
+
+  // Only functions without branches other than the final return are inlined,
+  // so they don't need labels, and they must leave LR alone when they're
+  // called to return to the instruction after the call. Tail calls return
+  // wherever LR points, so the return is emitted like in the callee.
+  Memory* memory = frontend_->memory();
+  uint32_t instr_count = 0;
+  for (;; ++instr_count) {
+    if (instr_count >= uint32_t(cvars::inline_function_max_instructions)) {
+      return false;
+    }
+    InstrData i;
+    i.address = address + instr_count * 4;
+    i.code = xe::load_and_swap<uint32_t>(memory->TranslateVirtual(i.address));
+    i.opcode = LookupOpcode(i.code);
+    if (i.opcode == PPCOpcode::kInvalid) {
+      return false;
+    }
+    if (i.opcode == PPCOpcode::bclrx && (i.XL.BO & 0x14) == 0x14 &&
+        !i.XL.LK) {
+      break;
+    }
+    if (GetOpcodeInfo(i.opcode).group == PPCOpcodeGroup::kB) {
+      return false;
+    }
+    if (return_address && i.opcode == PPCOpcode::mtspr &&
+        (((i.XFX.spr & 0x1F) << 5) | ((i.XFX.spr >> 5) & 0x1F)) == 8) {
+      return false;
+    }
+  }
+
+  if (with_debug_info_) {
+    CommentFormat("inlined fn {:08X}-{:08X} {}", address,
+                  address + instr_count * 4, function->name().c_str());
+  }
+  inlined_ranges_.emplace_back(address, address + instr_count * 4);
+  // The inlined instructions have their own source offsets, so MMIO accesses
+  // made by them are recorded at the addresses in the callee.
+  std::vector<std::pair<uint32_t, MMIORange*>> mmio_access_sites;
+  if (cvars::recompile_mmio_access_sites) {
+    frontend_->GetMmioAccessSites(address, address + instr_count * 4,
+                                  &mmio_access_sites);
+  }
+  auto mmio_access_site_it = mmio_access_sites.cbegin();
+  if (return_address) {
+    StoreLR(LoadConstantUint64(return_address));
+  } else {
+    // Emit the return too.
+    ++instr_count;
+  }
+  for (uint32_t n = 0; n < instr_count; ++n) {
+    trace_info_.dest_count = 0;
+    InstrData i;
+    i.address = address + n * 4;
+    i.code = xe::load_and_swap<uint32_t>(memory->TranslateVirtual(i.address));
+    i.opcode = LookupOpcode(i.code);
+    i.opcode_info = &GetOpcodeInfo(i.opcode);
+    if (with_debug_info_) {
+      comment_buffer_.Reset();
+      comment_buffer_.AppendFormat("{:08X} {:08X} ", i.address, i.code);
+      DisasmPPC(i.address, i.code, &comment_buffer_);
+      Comment(comment_buffer_);
+    }
+    SourceOffset(i.address);
+    Instr* first_instr = last_instr();
+    EmitInstr(i);
+
+    while (mmio_access_site_it != mmio_access_sites.cend() &&
+           mmio_access_site_it->first < i.address) {
+      ++mmio_access_site_it;
+    }
+    if (mmio_access_site_it != mmio_access_sites.cend() &&
+        mmio_access_site_it->first == i.address) {
+      ConvertMmioAccesses(first_instr, mmio_access_site_it->second);
+    }
+  }
+  return true;
+}
+
+void PPCHIRBuilder::ConvertMmioAccesses(Instr* first_instr,
+                                        MMIORange* mmio_range) {
+  // The instruction accessed the range through an address not known at
+  // translation time, so the access faulted and was emulated. Check the
+  // address at runtime instead, calling the range callbacks directly.
+  // Only 32-bit accesses are supported by the callbacks.
+  for (Instr* i = first_instr->next; i; i = i->next) {
+    if (i->opcode == &hir::OPCODE_LOAD_info ||
+        i->opcode == &hir::OPCODE_LOAD_OFFSET_info) {
+      if (i->dest->type != hir::INT32_TYPE) {
+        continue;
+      }
+      Value* address = i->src1.value;
+      if (i->opcode == &hir::OPCODE_LOAD_OFFSET_info) {
+        address = AddBefore(i, address, i->src2.value);
+      }
+      i->Replace(&hir::OPCODE_LOAD_MMIO_CHECKED_info, 0);
+      i->src1.offset = reinterpret_cast<uint64_t>(mmio_range);
+      i->set_src2(address);
+    } else if (i->opcode == &hir::OPCODE_STORE_info ||
+               i->opcode == &hir::OPCODE_STORE_OFFSET_info) {
+      bool has_offset = i->opcode == &hir::OPCODE_STORE_OFFSET_info;
+      Value* value = has_offset ? i->src3.value : i->src2.value;
+      if (value->type != hir::INT32_TYPE) {
+        continue;
+      }
+      Value* address = i->src1.value;
+      if (has_offset) {
+        address = AddBefore(i, address, i->src2.value);
+      }
+      i->Replace(&hir::OPCODE_STORE_MMIO_CHECKED_info, 0);
+      i->src1.offset = reinterpret_cast<uint64_t>(mmio_range);
+      i->set_src2(address);
+      i->set_src3(value);
+    }
+  }
+}
+
+Value* PPCHIRBuilder::AddBefore(Instr* insert_instr, Value* value1,
+                                Value* value2) {
+  Instr* prev_last_instr = last_instr();
+  Value* result = Add(value1, value2);
+  if (last_instr() != prev_last_instr) {
+    // Not folded to an existing value.
+    last_instr()->MoveBefore(insert_instr);
+  }
+  return result;
+}
+
 void PPCHIRBuilder::MaybeBreakOnInstruction(uint32_t address) {
   if (address != cvars::break_on_instruction) {
     return;
@@ -558,15 +734,6 @@ void PPCHIRBuilder::StoreVR(uint32_t reg, Value* value) {
   trace_reg.value = value;
 }
 
-void PPCHIRBuilder::StoreReserved(Value* val) {
-  assert_true(val->type == INT64_TYPE);
-  StoreContext(offsetof(PPCContext, reserved_val), val);
-}
-
-Value* PPCHIRBuilder::LoadReserved() {
-  return LoadContext(offsetof(PPCContext, reserved_val), INT64_TYPE);
-}
-
 }  // namespace ppc
 }  // namespace cpu
 }  // namespace xe
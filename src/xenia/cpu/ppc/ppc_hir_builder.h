@@ -10,6 +10,9 @@
 #ifndef XENIA_CPU_PPC_PPC_HIR_BUILDER_H_
 #define XENIA_CPU_PPC_PPC_HIR_BUILDER_H_
 
+#include <utility>
+#include <vector>
+
 #include "xenia/base/string_buffer.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/hir/hir_builder.h"
@@ -18,6 +21,7 @@ namespace xe {
 namespace cpu {
 namespace ppc {
 
+struct InstrData;
 struct PPCBuiltins;
 class PPCFrontend;
 
@@ -43,6 +47,15 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   GuestFunction* function() const { return function_; }
   Function* LookupFunction(uint32_t address);
   Label* LookupLabel(uint32_t address);
+  // Emits the function at the address in place of a call to it returning to
+  // return_address, or of a tail call if return_address is 0, if it's small
+  // enough and has no branches other than the final return.
+  bool InlineFunction(uint32_t address, uint32_t return_address);
+  // First and last instruction addresses of the functions inlined by the last
+  // Emit.
+  const std::vector<std::pair<uint32_t, uint32_t>>& inlined_ranges() const {
+    return inlined_ranges_;
+  }
 
   Value* LoadLR();
   void StoreLR(Value* value);
@@ -78,11 +91,11 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   Value* LoadVR(uint32_t reg);
   void StoreVR(uint32_t reg, Value* value);
 
-  void StoreReserved(Value* val);
-  Value* LoadReserved();
-
  private:
   void MaybeBreakOnInstruction(uint32_t address);
+  void EmitInstr(const InstrData& i);
+  void ConvertMmioAccesses(Instr* first_instr, MMIORange* mmio_range);
+  Value* AddBefore(Instr* insert_instr, Value* value1, Value* value2);
   void AnnotateLabel(uint32_t address, Label* label);
 
   PPCFrontend* frontend_;
@@ -97,6 +110,9 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   uint64_t instr_count_;
   Instr** instr_offset_list_;
   Label** label_list_;
+  // Instructions known to access MMIO ranges.
+  std::vector<std::pair<uint32_t, MMIORange*>> mmio_access_sites_;
+  std::vector<std::pair<uint32_t, uint32_t>> inlined_ranges_;
 
   // Reset each instruction.
   struct {
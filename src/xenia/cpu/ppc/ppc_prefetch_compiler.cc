@@ -0,0 +1,189 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/ppc/ppc_prefetch_compiler.h"
+
+#include <tuple>
+
+#include "xenia/base/logging.h"
+#include "xenia/cpu/processor.h"
+
+namespace xe {
+namespace cpu {
+namespace ppc {
+
+namespace {
+
+// Whether the current thread is one of the prefetch worker threads.
+thread_local bool is_prefetch_thread = false;
+
+}  // namespace
+
+PPCPrefetchCompiler::PPCPrefetchCompiler(Processor* processor,
+                                         uint32_t thread_count)
+    : processor_(processor) {
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    auto worker_thread =
+        xe::threading::Thread::Create({}, [this]() { WorkerThread(); });
+    worker_thread->set_name("CPU Prefetch Compiler");
+    worker_thread->set_priority(xe::threading::ThreadPriority::kBelowNormal);
+    worker_threads_.push_back(std::move(worker_thread));
+  }
+}
+
+PPCPrefetchCompiler::~PPCPrefetchCompiler() {
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    shutting_down_ = true;
+  }
+  queue_cond_.notify_all();
+  for (auto& worker_thread : worker_threads_) {
+    xe::threading::Wait(worker_thread.get(), false);
+  }
+  worker_threads_.clear();
+
+  XELOGI(
+      "Prefetch compiler: {} functions translated ahead of time, {} on "
+      "demand, {} requests dropped, {} recompiled",
+      prefetched_count_.load(), demanded_count_.load(), dropped_count_.load(),
+      recompiled_count_.load());
+}
+
+void PPCPrefetchCompiler::Queue(const std::vector<uint32_t>& addresses,
+                                Priority priority) {
+  if (addresses.empty()) {
+    return;
+  }
+  size_t queued = 0;
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (shutting_down_) {
+      return;
+    }
+    auto& queue = queues_[size_t(priority)];
+    for (uint32_t address : addresses) {
+      if (!requested_addresses_.insert(address).second) {
+        continue;
+      }
+      if (priority == Priority::kDemandedNeighbor) {
+        // The most recently executed code is the most relevant.
+        queue.push_front(address);
+      } else {
+        queue.push_back(address);
+      }
+      ++queued;
+      ++queued_count_;
+      if (queued_count_ > kMaxQueuedFunctions) {
+        // Drop the oldest request with the lowest priority, and allow it to be
+        // requested again later.
+        for (size_t i = size_t(Priority::kCount); i-- > 0;) {
+          if (!queues_[i].empty()) {
+            requested_addresses_.erase(queues_[i].back());
+            queues_[i].pop_back();
+            break;
+          }
+        }
+        --queued_count_;
+        ++dropped_count_;
+      }
+    }
+  }
+  if (queued == 1) {
+    queue_cond_.notify_one();
+  } else if (queued) {
+    queue_cond_.notify_all();
+  }
+}
+
+void PPCPrefetchCompiler::QueueRecompilation(GuestFunction* function,
+                                             uint32_t generation) {
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (shutting_down_) {
+      return;
+    }
+    recompilation_queue_.emplace_back(function, generation);
+  }
+  queue_cond_.notify_one();
+}
+
+void PPCPrefetchCompiler::OnFunctionTranslated(
+    const std::vector<uint32_t>& call_targets) {
+  if (is_prefetch_thread) {
+    ++prefetched_count_;
+    Queue(call_targets, Priority::kPrefetchedNeighbor);
+    return;
+  }
+  ++demanded_count_;
+  bool starting = false;
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    starting = !started_;
+    started_ = true;
+  }
+  if (starting) {
+    queue_cond_.notify_all();
+  }
+  Queue(call_targets, Priority::kDemandedNeighbor);
+}
+
+void PPCPrefetchCompiler::WorkerThread() {
+  is_prefetch_thread = true;
+  while (true) {
+    uint32_t address = 0;
+    GuestFunction* recompiled_function = nullptr;
+    uint32_t recompiled_generation = 0;
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      queue_cond_.wait(lock, [this]() {
+        return shutting_down_ || !recompilation_queue_.empty() ||
+               (started_ && queued_count_);
+      });
+      if (shutting_down_) {
+        return;
+      }
+      if (!recompilation_queue_.empty()) {
+        // Hot functions are already executed, and are slow until recompiled.
+        std::tie(recompiled_function, recompiled_generation) =
+            recompilation_queue_.front();
+        recompilation_queue_.pop_front();
+      } else {
+        for (auto& queue : queues_) {
+          if (!queue.empty()) {
+            address = queue.front();
+            queue.pop_front();
+            break;
+          }
+        }
+        --queued_count_;
+      }
+    }
+
+    if (recompiled_function) {
+      if (processor_->frontend()->RetranslateFunction(recompiled_function,
+                                                      recompiled_generation)) {
+        ++recompiled_count_;
+      }
+      continue;
+    }
+
+    // Already translated on demand.
+    if (processor_->QueryFunction(address)) {
+      continue;
+    }
+    // Goes through the entry table like guest calls, so a guest thread
+    // calling the function in the meantime waits for this translation instead
+    // of starting another one.
+    processor_->ResolveFunction(address);
+  }
+}
+
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,111 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_PPC_PPC_PREFETCH_COMPILER_H_
+#define XENIA_CPU_PPC_PPC_PREFETCH_COMPILER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+class GuestFunction;
+class Processor;
+}  // namespace cpu
+}  // namespace xe
+
+namespace xe {
+namespace cpu {
+namespace ppc {
+
+// Translates functions on background threads before guest code first calls
+// them, so guest threads find them ready in the entry table instead of
+// stalling for the whole translation.
+class PPCPrefetchCompiler {
+ public:
+  // Lower values are dequeued first.
+  enum class Priority {
+    // Called by a function that was just translated on demand, thus likely to
+    // be executed soon.
+    kDemandedNeighbor,
+    // Called by a function that was translated ahead of time.
+    kPrefetchedNeighbor,
+    // Known function start of a module, like the entry point or .pdata.
+    kModule,
+
+    kCount,
+  };
+
+  // Maximum number of queued functions. When it's exceeded, the lowest
+  // priority requests are dropped.
+  static const size_t kMaxQueuedFunctions = 64 * 1024;
+
+  PPCPrefetchCompiler(Processor* processor, uint32_t thread_count);
+  ~PPCPrefetchCompiler();
+
+  void Queue(const std::vector<uint32_t>& addresses, Priority priority);
+
+  // Queues a hot function for recompilation with all optimizations, ahead of
+  // any prefetching. Dropped if the function is retranslated after its
+  // translation generation was generation before the request is handled.
+  void QueueRecompilation(GuestFunction* function, uint32_t generation);
+
+  // Called after a function has been translated, on any thread.
+  void OnFunctionTranslated(const std::vector<uint32_t>& call_targets);
+
+  // Functions translated by the background threads.
+  uint64_t prefetched_count() const { return prefetched_count_; }
+  // Functions translated by the thread that first called them.
+  uint64_t demanded_count() const { return demanded_count_; }
+  // Requests dropped because the queue was full.
+  uint64_t dropped_count() const { return dropped_count_; }
+  // Functions recompiled by the background threads.
+  uint64_t recompiled_count() const { return recompiled_count_; }
+
+ private:
+  void WorkerThread();
+
+  Processor* processor_;
+
+  std::mutex queue_mutex_;
+  std::condition_variable queue_cond_;
+  std::deque<uint32_t> queues_[size_t(Priority::kCount)];
+  size_t queued_count_ = 0;
+  // Functions with their translation generation at the time of the request.
+  std::deque<std::pair<GuestFunction*, uint32_t>> recompilation_queue_;
+  // Addresses that are queued or have been dequeued, to request every
+  // function only once.
+  std::unordered_set<uint32_t> requested_addresses_;
+  // Nothing is translated until guest code starts running, as the loader may
+  // still be patching the code of the modules.
+  bool started_ = false;
+  bool shutting_down_ = false;
+
+  std::vector<std::unique_ptr<xe::threading::Thread>> worker_threads_;
+
+  std::atomic<uint64_t> prefetched_count_ = {0};
+  std::atomic<uint64_t> demanded_count_ = {0};
+  std::atomic<uint64_t> dropped_count_ = {0};
+  std::atomic<uint64_t> recompiled_count_ = {0};
+};
+
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_PPC_PPC_PREFETCH_COMPILER_H_
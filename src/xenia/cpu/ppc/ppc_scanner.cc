@@ -41,7 +41,8 @@ bool PPCScanner::IsRestGprLr(uint32_t address) {
   return function && function->behavior() == Function::Behavior::kEpilogReturn;
 }
 
-bool PPCScanner::Scan(GuestFunction* function, FunctionDebugInfo* debug_info) {
+bool PPCScanner::Scan(GuestFunction* function, FunctionDebugInfo* debug_info,
+                      std::vector<uint32_t>* out_call_targets) {
   // This is a simple basic block analyizer. It walks the start address to the
   // end address looking for branches. Each span of instructions between
   // branches is considered a basic block. When the last blr (that has no
@@ -141,7 +142,9 @@ bool PPCScanner::Scan(GuestFunction* function, FunctionDebugInfo* debug_info) {
       if (d.I.LK()) {
         LOGPPC("bl {:08X} -> {:08X}", address, target);
         // Queue call target if needed.
-        // GetOrInsertFunction(target);
+        if (out_call_targets) {
+          out_call_targets->push_back(target);
+        }
       } else {
         LOGPPC("b {:08X} -> {:08X}", address, target);
 
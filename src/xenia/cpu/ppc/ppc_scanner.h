@@ -31,7 +31,10 @@ class PPCScanner {
   explicit PPCScanner(PPCFrontend* frontend);
   ~PPCScanner();
 
-  bool Scan(GuestFunction* function, FunctionDebugInfo* debug_info);
+  // Finds the extents of the function. Targets of the calls made by it are
+  // appended to out_call_targets if it's not null.
+  bool Scan(GuestFunction* function, FunctionDebugInfo* debug_info,
+            std::vector<uint32_t>* out_call_targets = nullptr);
 
   std::vector<BlockInfo> FindBlocks(GuestFunction* function);
 
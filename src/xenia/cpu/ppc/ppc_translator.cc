@@ -49,7 +49,11 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   // Passes are executed in the order they are added. Multiple of the same
   // pass type may be used.
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
+  // Context promotion follows the CFG as it is after simplification. Only the
+  // linear scan allocator can keep the promoted values across blocks.
+  compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+  compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>(
+      cvars::linear_scan_register_allocation));
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   // Grouped simplification + constant propagation.
@@ -61,6 +65,15 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   if (validate) sap->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::move(sap));
 
+  if (cvars::linear_scan_register_allocation) {
+    // Values moved out of loops are used in other blocks, which only the linear
+    // scan allocator supports.
+    compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+    compiler_->AddPass(std::make_unique<passes::LoopInvariantCodeMotionPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+
   if (backend->machine_info()->supports_extended_load_store) {
     // Backend supports the advanced LOAD/STORE instructions.
     // These will save us a lot of HIR opcodes.
@@ -77,6 +90,12 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
+  // Moves blocks never executed in the first tier out of the hot path.
+  auto block_layout_pass = std::make_unique<passes::BlockLayoutPass>();
+  block_layout_pass_ = block_layout_pass.get();
+  compiler_->AddPass(std::move(block_layout_pass));
+  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+
   //// Removes all unneeded variables. Try not to add new ones after this.
   // compiler_->AddPass(new passes::ValueReductionPass());
   // if (validate) compiler_->AddPass(new passes::ValidationPass());
@@ -85,12 +104,52 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   // Will modify the HIR to add loads/stores.
   // This should be the last pass before finalization, as after this all
   // registers are assigned and ready to be emitted.
-  compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
-      backend->machine_info()));
+  if (cvars::linear_scan_register_allocation) {
+    // Liveness across blocks needs the CFG as it is after simplification.
+    compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+    compiler_->AddPass(
+        std::make_unique<passes::LinearScanRegisterAllocationPass>(
+            backend->machine_info()));
+  } else {
+    compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+        backend->machine_info()));
+  }
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   // Must come last. The HIR is not really HIR after this.
   compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+
+  if (cvars::tiered_compilation) {
+    // Single simplification and constant propagation run instead of looping
+    // until nothing changes, and no passes needing values across blocks.
+    fast_compiler_.reset(new Compiler(frontend->processor()));
+    fast_compiler_->AddPass(
+        std::make_unique<passes::ControlFlowAnalysisPass>());
+    fast_compiler_->AddPass(
+        std::make_unique<passes::ControlFlowSimplificationPass>());
+    fast_compiler_->AddPass(
+        std::make_unique<passes::ControlFlowAnalysisPass>());
+    fast_compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
+    if (validate)
+      fast_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+    fast_compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
+    fast_compiler_->AddPass(
+        std::make_unique<passes::ConstantPropagationPass>());
+    if (validate)
+      fast_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+    if (backend->machine_info()->supports_extended_load_store) {
+      fast_compiler_->AddPass(
+          std::make_unique<passes::MemorySequenceCombinationPass>());
+    }
+    fast_compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
+    fast_compiler_->AddPass(
+        std::make_unique<passes::DeadCodeEliminationPass>());
+    fast_compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+        backend->machine_info()));
+    if (validate)
+      fast_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+    fast_compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+  }
 }
 
 PPCTranslator::~PPCTranslator() = default;
@@ -121,13 +180,25 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (cvars::trace_function_data) {
     debug_info_flags |= DebugInfoFlags::kDebugInfoTraceFunctionData;
   }
+
+  // Functions start in the fast tier and are recompiled with the full pipeline
+  // once they're called often enough. Debug info is only generated by the full
+  // pipeline, so it's not lost when recompiling.
+  bool fast_tier = fast_compiler_ && !debug_info_flags &&
+                   !function->recompilation_requested();
+  function->set_fast_tier(fast_tier);
+  Compiler* compiler = fast_tier ? fast_compiler_.get() : compiler_.get();
+  xe::make_reset_scope(compiler);
+  block_layout_pass_->set_function(fast_tier ? nullptr : function);
+
   std::unique_ptr<FunctionDebugInfo> debug_info;
   if (debug_info_flags) {
     debug_info.reset(new FunctionDebugInfo());
   }
 
   // Scan the function to find its extents and gather debug data.
-  if (!scanner_->Scan(function, debug_info.get())) {
+  call_targets_.clear();
+  if (!scanner_->Scan(function, debug_info.get(), &call_targets_)) {
     return false;
   }
 
@@ -167,6 +238,7 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (!builder_->Emit(function, emit_flags)) {
     return false;
   }
+  function->set_inlined_ranges(builder_->inlined_ranges());
 
   // Stash raw HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmRawHir) {
@@ -176,7 +248,7 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Compile/optimize/etc.
-  if (!compiler_->Compile(builder_.get())) {
+  if (!compiler->Compile(builder_.get())) {
     return false;
   }
 
@@ -11,6 +11,7 @@
 #define XENIA_CPU_PPC_PPC_TRANSLATOR_H_
 
 #include <memory>
+#include <vector>
 
 #include "xenia/base/string_buffer.h"
 #include "xenia/cpu/backend/assembler.h"
@@ -19,6 +20,11 @@
 
 namespace xe {
 namespace cpu {
+namespace compiler {
+namespace passes {
+class BlockLayoutPass;
+}  // namespace passes
+}  // namespace compiler
 namespace ppc {
 
 class PPCFrontend;
@@ -32,6 +38,9 @@ class PPCTranslator {
 
   bool Translate(GuestFunction* function, uint32_t debug_info_flags);
 
+  // Targets of the calls made by the last translated function.
+  const std::vector<uint32_t>& call_targets() const { return call_targets_; }
+
  private:
   void DumpSource(GuestFunction* function, StringBuffer* string_buffer);
 
@@ -39,9 +48,15 @@ class PPCTranslator {
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
+  // Pipeline for the first tier of tiered compilation, quick to run but
+  // leaving more to optimize.
+  std::unique_ptr<compiler::Compiler> fast_compiler_;
+  // Owned by compiler_.
+  compiler::passes::BlockLayoutPass* block_layout_pass_ = nullptr;
   std::unique_ptr<backend::Assembler> assembler_;
 
   StringBuffer string_buffer_;
+  std::vector<uint32_t> call_targets_;
 };
 
 }  // namespace ppc
@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/processor.h"
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/atomic.h"
 #include "xenia/base/byte_order.h"
@@ -20,9 +22,11 @@
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/breakpoint.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/export_resolver.h"
+#include "xenia/cpu/function_profiler.h"
 #include "xenia/cpu/module.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
@@ -82,12 +86,34 @@ Processor::Processor(xe::Memory* memory, ExportResolver* export_resolver)
     : memory_(memory), export_resolver_(export_resolver) {}
 
 Processor::~Processor() {
+  if (code_invalidation_callback_handle_) {
+    memory_->UnregisterCodeInvalidationCallback(
+        code_invalidation_callback_handle_);
+    code_invalidation_callback_handle_ = nullptr;
+  }
+
+  // Write the profile while the functions still exist.
+  if (function_profiler_) {
+    function_profiler_->Stop();
+    auto profile_path = cvars::profile_functions_path;
+    function_profiler_->WriteCollapsedStacks(
+        std::filesystem::path(profile_path).concat(".folded"));
+    function_profiler_->WriteHotList(
+        std::filesystem::path(profile_path).concat(".txt"), 1000);
+    XELOGI("Function profiler: {} samples written to {}",
+           function_profiler_->sample_count(), xe::path_to_utf8(profile_path));
+    function_profiler_.reset();
+  }
+
+  // Shut down the frontend first, as its background translation threads may
+  // be using the modules.
+  frontend_.reset();
+
   {
     auto global_lock = global_critical_region_.Acquire();
     modules_.clear();
   }
 
-  frontend_.reset();
   backend_.reset();
 
   if (functions_trace_file_) {
@@ -127,6 +153,12 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
   backend_ = std::move(backend);
   frontend_ = std::move(frontend);
 
+  if (cvars::invalidate_modified_code) {
+    code_invalidation_callback_handle_ =
+        memory_->RegisterCodeInvalidationCallback(CodeInvalidationCallbackThunk,
+                                                  this);
+  }
+
   // Stack walker is used when profiling, debugging, and dumping.
   // Note that creation may fail, in which case we'll have to disable those
   // features.
@@ -146,6 +178,13 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
         functions_trace_path_, 32 * 1024 * 1024, true);
   }
 
+  if (!cvars::profile_functions_path.empty()) {
+    function_profiler_ =
+        std::make_unique<FunctionProfiler>(this, stack_walker_.get());
+    function_profiler_->Start(
+        uint32_t(std::max(cvars::profile_sampling_interval, 1)));
+  }
+
   return true;
 }
 
@@ -234,8 +273,15 @@ Function* Processor::ResolveFunction(uint32_t address) {
       return nullptr;
     }
     entry->function = function;
-    entry->end_address = function->end_address();
-    status = entry->status = Entry::STATUS_READY;
+    // Its guest code may be modified again while it's being retranslated.
+    do {
+      if (!ValidateGuestCode(function)) {
+        entry->status = Entry::STATUS_FAILED;
+        return nullptr;
+      }
+      entry->end_address = function->end_address();
+    } while (!entry_table_.FinishCompiling(entry));
+    status = Entry::STATUS_READY;
   }
   if (status == Entry::STATUS_READY) {
     // Ready to use.
@@ -246,21 +292,65 @@ Function* Processor::ResolveFunction(uint32_t address) {
   }
 }
 
+Module* Processor::LookupIndexedModule(uint32_t address) {
+  auto module_ranges = module_ranges_.load(std::memory_order_acquire);
+  if (!module_ranges) {
+    return nullptr;
+  }
+  // Last range starting at or before the address.
+  auto it = std::upper_bound(
+      module_ranges->cbegin(), module_ranges->cend(), address,
+      [](uint32_t value, const ModuleRange& module_range) {
+        return value < module_range.low_address;
+      });
+  if (it == module_ranges->cbegin()) {
+    return nullptr;
+  }
+  --it;
+  // The range may have changed since the snapshot was made.
+  if (address >= it->high_address || !it->module->ContainsAddress(address)) {
+    return nullptr;
+  }
+  return it->module;
+}
+
+void Processor::UpdateModuleRanges() {
+  auto module_ranges = std::make_unique<std::vector<ModuleRange>>();
+  for (const auto& module : modules_) {
+    ModuleRange module_range;
+    if (module->GetAddressRange(&module_range.low_address,
+                                &module_range.high_address)) {
+      module_range.module = module.get();
+      module_ranges->push_back(module_range);
+    }
+  }
+  std::sort(module_ranges->begin(), module_ranges->end(),
+            [](const ModuleRange& a, const ModuleRange& b) {
+              return a.low_address < b.low_address;
+            });
+  module_ranges_.store(module_ranges.get(), std::memory_order_release);
+  module_range_snapshots_.push_back(std::move(module_ranges));
+}
+
 Function* Processor::LookupFunction(uint32_t address) {
   // TODO(benvanik): fast reject invalid addresses/log errors.
 
   // Find the module that contains the address.
-  Module* code_module = nullptr;
-  {
+  Module* code_module = LookupIndexedModule(address);
+  if (!code_module) {
+    // Not indexed yet, or in a module without a single known range.
     auto global_lock = global_critical_region_.Acquire();
-    // TODO(benvanik): sort by code address (if contiguous) so can bsearch.
-    // TODO(benvanik): cache last module low/high, as likely to be in there.
     for (const auto& module : modules_) {
       if (module->ContainsAddress(address)) {
         code_module = module.get();
         break;
       }
     }
+    uint32_t low_address, high_address;
+    if (code_module &&
+        code_module->GetAddressRange(&low_address, &high_address)) {
+      UpdateModuleRanges();
+    }
   }
   if (!code_module) {
     // No module found that could contain the address.
@@ -293,10 +383,12 @@ bool Processor::DemandFunction(Function* function) {
   auto module = function->module();
   auto symbol_status = module->DefineFunction(function);
   if (symbol_status == Symbol::Status::kNew) {
-    // Symbol is undefined, so define now.
+    // Symbol is undefined, so define now - from previously stored code if
+    // possible, otherwise by translating it.
     assert_true(function->is_guest());
-    if (!frontend_->DefineFunction(static_cast<GuestFunction*>(function),
-                                   debug_info_flags_)) {
+    auto guest_function = static_cast<GuestFunction*>(function);
+    if ((debug_info_flags_ || !backend_->RestoreFunction(guest_function)) &&
+        !frontend_->DefineFunction(guest_function, debug_info_flags_)) {
       function->set_status(Symbol::Status::kFailed);
       return false;
     }
@@ -316,6 +408,116 @@ bool Processor::DemandFunction(Function* function) {
   return true;
 }
 
+bool Processor::ValidateGuestCode(Function* function) {
+  if (!code_invalidation_callback_handle_ || !function->is_guest() ||
+      function->behavior() == Function::Behavior::kExtern) {
+    return true;
+  }
+  auto guest_function = static_cast<GuestFunction*>(function);
+  // Keep retranslations from other threads, which change the extents and the
+  // inlined callees, from happening between hashing and retranslating.
+  std::lock_guard<std::mutex> lock(guest_function->translation_mutex());
+
+  // Watch before hashing, so modifications from now on aren't missed.
+  WatchGuestCode(guest_function);
+  uint64_t guest_code_hash = HashGuestCode(guest_function);
+  if (guest_function->ClearInvalidated()) {
+    if (guest_code_hash == guest_function->guest_code_hash()) {
+      // Only data sharing the pages with the code has been modified.
+      backend_->RevalidateFunction(guest_function);
+    } else {
+      XELOGD("Retranslating function {:08X} with modified guest code",
+             guest_function->address());
+      if (!frontend_->RetranslateFunctionLocked(guest_function)) {
+        return false;
+      }
+      // The extents and the inlined callees may have changed.
+      WatchGuestCode(guest_function);
+      guest_code_hash = HashGuestCode(guest_function);
+    }
+  }
+  guest_function->set_guest_code_hash(guest_code_hash);
+  return true;
+}
+
+void Processor::WatchGuestCode(GuestFunction* function) {
+  std::vector<std::pair<uint32_t, uint32_t>> ranges;
+  ranges.reserve(1 + function->inlined_ranges().size());
+  ranges.emplace_back(function->address(), function->end_address());
+  ranges.insert(ranges.end(), function->inlined_ranges().begin(),
+                function->inlined_ranges().end());
+  for (const auto& range : ranges) {
+    memory_->WatchCode(range.first, range.second + 4 - range.first);
+  }
+  std::lock_guard<std::mutex> lock(code_pages_mutex_);
+  for (const auto& range : ranges) {
+    for (uint32_t page = range.first >> 12; page <= range.second >> 12;
+         ++page) {
+      code_pages_[page].insert(function);
+    }
+  }
+}
+
+uint64_t Processor::HashGuestCode(GuestFunction* function) {
+  uint64_t hash =
+      XXH3_64bits(memory_->TranslateVirtual(function->address()),
+                  function->end_address() + 4 - function->address());
+  for (const auto& range : function->inlined_ranges()) {
+    hash = XXH3_64bits_withSeed(memory_->TranslateVirtual(range.first),
+                                range.second + 4 - range.first, hash);
+  }
+  return hash;
+}
+
+void Processor::CodeInvalidationCallbackThunk(void* context_ptr,
+                                              uint32_t virtual_address,
+                                              uint32_t length) {
+  reinterpret_cast<Processor*>(context_ptr)
+      ->InvalidateGuestCode(virtual_address, length);
+}
+
+void Processor::InvalidateGuestCode(uint32_t virtual_address,
+                                    uint32_t length) {
+  std::vector<Entry*> entries;
+  {
+    std::lock_guard<std::mutex> lock(code_pages_mutex_);
+    for (uint32_t page = virtual_address >> 12;
+         page <= (virtual_address + length - 1) >> 12; ++page) {
+      auto it = code_pages_.find(page);
+      if (it == code_pages_.end()) {
+        continue;
+      }
+      for (GuestFunction* function : it->second) {
+        Entry* entry = entry_table_.Lookup(function->address());
+        if (!entry) {
+          continue;
+        }
+        Entry::Status status = entry->status;
+        if ((status == Entry::STATUS_READY ||
+             status == Entry::STATUS_COMPILING) &&
+            entry->function == function &&
+            std::find(entries.begin(), entries.end(), entry) ==
+                entries.end()) {
+          entries.push_back(entry);
+        }
+      }
+    }
+  }
+  for (Entry* entry : entries) {
+    auto function = entry->function;
+    if (!function || !function->is_guest() ||
+        function->behavior() == Function::Behavior::kExtern) {
+      continue;
+    }
+    auto guest_function = static_cast<GuestFunction*>(function);
+    // Stop dispatching to the old code before the entry can be claimed, so a
+    // thread resolving it again can't have its new code removed.
+    guest_function->Invalidate();
+    backend_->InvalidateFunction(guest_function);
+    entry_table_.Invalidate(entry);
+  }
+}
+
 bool Processor::Execute(ThreadState* thread_state, uint32_t address) {
   SCOPE_profile_cpu_f("cpu");
 
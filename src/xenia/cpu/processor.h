@@ -10,9 +10,13 @@
 #ifndef XENIA_CPU_PROCESSOR_H_
 #define XENIA_CPU_PROCESSOR_H_
 
+#include <atomic>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "xenia/base/cvar.h"
@@ -35,6 +39,7 @@ namespace xe {
 namespace cpu {
 
 class Breakpoint;
+class FunctionProfiler;
 class StackWalker;
 class XexModule;
 
@@ -234,8 +239,37 @@ class Processor {
                                          uint32_t current_pc);
 
   bool DemandFunction(Function* function);
+  // Watches the guest code of a function defined or resolved again for
+  // modification, retranslating it first if it has been invalidated and its
+  // guest code has changed.
+  bool ValidateGuestCode(Function* function);
+  // Watches the guest code of the function and of the functions inlined into
+  // it for modification, indexing the function by its pages.
+  void WatchGuestCode(GuestFunction* function);
+  uint64_t HashGuestCode(GuestFunction* function);
+  static void CodeInvalidationCallbackThunk(void* context_ptr,
+                                            uint32_t virtual_address,
+                                            uint32_t length);
+  // Invalidates the functions with guest code in the range, so they're
+  // resolved again on the next call.
+  void InvalidateGuestCode(uint32_t virtual_address, uint32_t length);
+
+  // Finds the module containing the address in the module range index without
+  // locking, or returns nullptr if it isn't indexed.
+  Module* LookupIndexedModule(uint32_t address);
+  // Rebuilds the module range index from the current module ranges. Must be
+  // called with the global lock held.
+  void UpdateModuleRanges();
 
   Memory* memory_ = nullptr;
+  void* code_invalidation_callback_handle_ = nullptr;
+  // Watched functions by the 4 KB guest pages of their code and of their
+  // inlined callees, so modifying a callee also invalidates the functions it
+  // has been inlined into. Never pruned - invalidating a function that no
+  // longer depends on the page only makes it check its hash again.
+  std::mutex code_pages_mutex_;
+  std::unordered_map<uint32_t, std::unordered_set<GuestFunction*>>
+      code_pages_;
   std::unique_ptr<StackWalker> stack_walker_;
 
   std::function<DebugListener*(Processor*)> debug_listener_handler_;
@@ -246,6 +280,8 @@ class Processor {
   // If specified, the file trace data gets written to when running.
   std::filesystem::path functions_trace_path_;
   std::unique_ptr<ChunkedMappedMemoryWriter> functions_trace_file_;
+  // Samples guest call stacks when --profile_functions_path is set.
+  std::unique_ptr<FunctionProfiler> function_profiler_;
 
   std::unique_ptr<ppc::PPCFrontend> frontend_;
   std::unique_ptr<backend::Backend> backend_;
@@ -256,6 +292,20 @@ class Processor {
   ExecutionState execution_state_ = ExecutionState::kPaused;
   std::vector<std::unique_ptr<Module>> modules_;
   Module* builtin_module_ = nullptr;
+
+  struct ModuleRange {
+    uint32_t low_address;
+    uint32_t high_address;
+    Module* module;
+  };
+  // Immutable snapshot of the ranges of the modules that report one, sorted by
+  // address, for lock-free module lookup. Rebuilt when a lookup has to fall
+  // back to asking each module, such as after a module has been loaded.
+  std::atomic<std::vector<ModuleRange>*> module_ranges_ = {nullptr};
+  // All snapshots ever created, as lock-free readers may still be using the
+  // replaced ones. Guarded with the global lock.
+  std::vector<std::unique_ptr<std::vector<ModuleRange>>>
+      module_range_snapshots_;
   uint32_t next_builtin_address_ = 0xFFFF0000u;
 
   // Maps thread ID to state. Updated on thread create, and threads are never
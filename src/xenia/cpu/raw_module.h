@@ -34,6 +34,8 @@ class RawModule : public Module {
   void set_executable(bool is_executable) { is_executable_ = is_executable; }
 
   bool ContainsAddress(uint32_t address) override;
+  bool GetAddressRange(uint32_t* out_low_address,
+                       uint32_t* out_high_address) const override;
 
  protected:
   std::unique_ptr<Function> CreateFunction(uint32_t address) override;
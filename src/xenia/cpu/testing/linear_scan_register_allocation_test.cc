@@ -0,0 +1,79 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+
+#include "xenia/cpu/backend/machine_info.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/compiler_passes.h"
+#include "xenia/cpu/hir/hir_builder.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+#include "third_party/catch/single_include/catch.hpp"
+
+using namespace xe::cpu::hir;
+using namespace xe::cpu;
+using xe::cpu::backend::MachineInfo;
+using xe::cpu::ppc::PPCContext;
+
+namespace passes = xe::cpu::compiler::passes;
+
+TEST_CASE("LINEAR_SCAN_LOOP_BEFORE_DEF", "[compiler]") {
+  MachineInfo machine_info;
+  std::memset(&machine_info, 0, sizeof(machine_info));
+  machine_info.register_sets[0].id = 0;
+  std::strcpy(machine_info.register_sets[0].name, "gpr");
+  machine_info.register_sets[0].types = MachineInfo::RegisterSet::INT_TYPES;
+  machine_info.register_sets[0].count = 4;
+  machine_info.register_sets[1].id = 1;
+  std::strcpy(machine_info.register_sets[1].name, "xmm");
+  machine_info.register_sets[1].types =
+      MachineInfo::RegisterSet::FLOAT_TYPES |
+      MachineInfo::RegisterSet::VEC_TYPES;
+  machine_info.register_sets[1].count = 4;
+
+  // The loop body is laid out before the block defining the value carried
+  // into it, like after BlockLayoutPass or with a rotated loop. The value is
+  // live through the whole body, so nothing defined there may share its
+  // register.
+  HIRBuilder b;
+  auto body_label = b.NewLabel();
+  auto entry_label = b.NewLabel();
+  b.Branch(entry_label);
+
+  b.MarkLabel(body_label);
+  auto r4 = b.LoadContext(offsetof(PPCContext, r) + 4 * 8, INT64_TYPE);
+  // src1 is replaced with the carried value once it's defined below.
+  auto sum = b.Add(r4, r4);
+  b.StoreContext(offsetof(PPCContext, r) + 4 * 8, sum);
+  auto loop_cond = b.CompareNE(sum, b.LoadZeroInt64());
+  b.BranchTrue(loop_cond, body_label);
+  b.Return();
+
+  b.MarkLabel(entry_label);
+  auto carried = b.LoadContext(offsetof(PPCContext, r) + 3 * 8, INT64_TYPE);
+  b.Branch(body_label);
+  sum->def->set_src1(carried);
+
+  compiler::Compiler compiler(nullptr);
+  compiler.AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+  compiler.AddPass(std::make_unique<passes::LinearScanRegisterAllocationPass>(
+      &machine_info));
+  REQUIRE(compiler.Compile(&b));
+
+  REQUIRE(carried->reg.index >= 0);
+  REQUIRE(r4->reg.index >= 0);
+  REQUIRE(sum->reg.index >= 0);
+  REQUIRE(loop_cond->reg.index >= 0);
+  REQUIRE(carried->reg.index != r4->reg.index);
+  REQUIRE(carried->reg.index != sum->reg.index);
+  REQUIRE(carried->reg.index != loop_cond->reg.index);
+}
@@ -0,0 +1,157 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace xe::cpu::hir;
+using namespace xe::cpu;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+TEST_CASE("RESERVED_STORE_I32", "[instr]") {
+  // r3 = store result, r4 = address, r5 = address of the store, r6 = value
+  // stored to the reserved address in between, or 0 for none.
+  TestFunction test([](HIRBuilder& b) {
+    auto skip_label = b.NewLabel();
+    b.ReservedLoad(LoadGPR(b, 4), INT32_TYPE);
+    auto intervening_value = b.Truncate(LoadGPR(b, 6), INT32_TYPE);
+    b.BranchFalse(intervening_value, skip_label);
+    b.Store(LoadGPR(b, 4), intervening_value);
+    b.MarkLabel(skip_label);
+    StoreGPR(b, 3,
+             b.ZeroExtend(b.ReservedStore(LoadGPR(b, 5),
+                                          b.LoadConstantUint32(0x12345678)),
+                          INT64_TYPE));
+    b.Return();
+  });
+  uint32_t address = test.memory->SystemHeapAlloc(8);
+  auto host_address = test.memory->TranslateVirtual<uint32_t*>(address);
+  test.Run(
+      [address, host_address](PPCContext* ctx) {
+        host_address[0] = 0;
+        ctx->r[4] = address;
+        ctx->r[5] = address;
+        ctx->r[6] = 0;
+      },
+      [host_address](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 1);
+        REQUIRE(host_address[0] == 0x12345678);
+        REQUIRE(ctx->reserved_address == 0);
+      });
+  test.Run(
+      [address, host_address](PPCContext* ctx) {
+        host_address[0] = 0;
+        host_address[1] = 0;
+        ctx->r[4] = address;
+        ctx->r[5] = address + 4;
+        ctx->r[6] = 0;
+      },
+      [host_address](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 0);
+        REQUIRE(host_address[1] == 0);
+      });
+  test.Run(
+      [address, host_address](PPCContext* ctx) {
+        host_address[0] = 0;
+        ctx->r[4] = address;
+        ctx->r[5] = address;
+        ctx->r[6] = 1;
+      },
+      [host_address](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 0);
+        REQUIRE(host_address[0] == 1);
+      });
+  test.memory->SystemHeapFree(address);
+}
+
+namespace {
+
+// Increments a counter non-atomically r4 times, under a spinlock at r5
+// acquired with reserved loads and stores. The counter is at r5 + 4.
+void GenerateSpinlockIncrement(HIRBuilder& b) {
+  auto acquire_label = b.NewLabel();
+  b.MarkLabel(acquire_label);
+  auto lock_value = b.ReservedLoad(LoadGPR(b, 5), INT32_TYPE);
+  b.BranchTrue(lock_value, acquire_label);
+  auto acquired =
+      b.ReservedStore(LoadGPR(b, 5), b.LoadConstantUint32(0x01000000));
+  b.BranchFalse(acquired, acquire_label);
+
+  auto counter_address = b.Add(LoadGPR(b, 5), b.LoadConstantUint64(4));
+  b.Store(counter_address, b.Add(b.Load(counter_address, INT32_TYPE),
+                                 b.LoadConstantInt32(1)));
+  b.MemoryBarrier();
+  b.Store(LoadGPR(b, 5), b.LoadConstantUint32(0));
+
+  auto remaining = b.Sub(LoadGPR(b, 4), b.LoadConstantUint64(1));
+  StoreGPR(b, 4, remaining);
+  b.BranchTrue(remaining, acquire_label);
+  b.Return();
+}
+
+// Runs the spinlock increment on multiple threads at once, checking that no
+// increment was lost, and returns the elapsed time in seconds.
+double RunSpinlockIncrement(TestFunction& test, Processor* processor,
+                            uint32_t thread_count, uint32_t iteration_count) {
+  uint32_t address = test.memory->SystemHeapAlloc(8);
+  auto host_address = test.memory->TranslateVirtual<uint32_t*>(address);
+  host_address[0] = 0;
+  host_address[1] = 0;
+  auto fn = processor->ResolveFunction(0x80000000);
+  REQUIRE(fn);
+
+  auto start_time = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    threads.emplace_back([processor, fn, address, iteration_count, i]() {
+      auto thread_state = std::make_unique<ThreadState>(processor, 0x100 + i);
+      auto ctx = thread_state->context();
+      ctx->lr = 0xBCBCBCBC;
+      ctx->r[4] = iteration_count;
+      ctx->r[5] = address;
+      fn->Call(thread_state.get(), uint32_t(ctx->lr));
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto elapsed = std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - start_time)
+                     .count();
+
+  REQUIRE(host_address[0] == 0);
+  REQUIRE(host_address[1] == thread_count * iteration_count);
+  test.memory->SystemHeapFree(address);
+  return elapsed;
+}
+
+}  // namespace
+
+TEST_CASE("RESERVED_SPINLOCK", "[instr]") {
+  TestFunction test(GenerateSpinlockIncrement);
+  for (auto& processor : test.processors) {
+    RunSpinlockIncrement(test, processor.get(), 2, 1000);
+  }
+}
+
+TEST_CASE("RESERVED_SPINLOCK_STRESS", "[.][benchmark]") {
+  const uint32_t thread_count = 6;
+  const uint32_t iteration_count = 100000;
+  TestFunction test(GenerateSpinlockIncrement);
+  for (auto& processor : test.processors) {
+    double elapsed = RunSpinlockIncrement(test, processor.get(), thread_count,
+                                          iteration_count);
+    WARN(thread_count << " threads: "
+                      << uint64_t(thread_count * iteration_count / elapsed)
+                      << " lock acquisitions per second");
+  }
+}
@@ -232,3 +232,40 @@ TEST_CASE("SHL_I64", "[instr]") {
         REQUIRE(result == 0x8000000000000000ull);
       });
 }
+
+TEST_CASE("SHL_V128", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3, b.Shl(LoadVR(b, 4), b.Truncate(LoadGPR(b, 5), INT8_TYPE)));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128i(0x80000001, 0x80000000, 0x00000000, 0x00000001);
+        ctx->r[5] = 1;
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result ==
+                vec128i(0x00000003, 0x00000000, 0x00000000, 0x00000002));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128i(0x12345678, 0x9ABCDEF0, 0x0FEDCBA9, 0x87654321);
+        ctx->r[5] = 0;
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result ==
+                vec128i(0x12345678, 0x9ABCDEF0, 0x0FEDCBA9, 0x87654321));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128i(0x12345678, 0x9ABCDEF0, 0x0FEDCBA9, 0x87654321);
+        ctx->r[5] = 12;
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result ==
+                vec128i(0x23456789, 0xABCDEF00, 0xFEDCBA98, 0x76543210));
+      });
+}
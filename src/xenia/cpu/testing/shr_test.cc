@@ -280,3 +280,40 @@ TEST_CASE("SHR_V128", "[instr]") {
                 vec128i(0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF));
       });
 }
+
+TEST_CASE("SHR_V128", "[instr]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreVR(b, 3, b.Shr(LoadVR(b, 4), b.Truncate(LoadGPR(b, 5), INT8_TYPE)));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128i(0x80000001, 0x80000000, 0x00000000, 0x00000001);
+        ctx->r[5] = 1;
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result ==
+                vec128i(0x40000000, 0xC0000000, 0x00000000, 0x00000000));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128i(0x12345678, 0x9ABCDEF0, 0x0FEDCBA9, 0x87654321);
+        ctx->r[5] = 0;
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result ==
+                vec128i(0x12345678, 0x9ABCDEF0, 0x0FEDCBA9, 0x87654321));
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->v[4] = vec128i(0x12345678, 0x9ABCDEF0, 0x0FEDCBA9, 0x87654321);
+        ctx->r[5] = 12;
+      },
+      [](PPCContext* ctx) {
+        auto result = ctx->v[3];
+        REQUIRE(result ==
+                vec128i(0x01234567, 0x89ABCDEF, 0x00FEDCBA, 0x98765432));
+      });
+}
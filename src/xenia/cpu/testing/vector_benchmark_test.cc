@@ -0,0 +1,176 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+#include <chrono>
+
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/math.h"
+#include "xenia/cpu/backend/x64/x64_backend.h"
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+// Instruction sets the x64 backend may use. Without AVX2, the variable 8 and
+// 16-bit lane shifts call C helpers.
+struct FeatureConfig {
+  const char* name;
+  bool use_haswell_instructions;
+  bool use_avx512_instructions;
+};
+const FeatureConfig kFeatureConfigs[] = {
+    {"AVX", false, false},
+    {"AVX2", true, false},
+    {"AVX-512", true, true},
+};
+
+// Runs a loop applying the operation to v4 (with the result xored with the
+// original value so it doesn't become constant), reading the operand from v5
+// or r6, in every configuration. Checks that all configurations give the same
+// result, and prints the time per operation.
+void BenchmarkVectorOp(const char* name,
+                       std::function<Value*(HIRBuilder& b, Value* value)> op,
+                       const vec128_t& value, const vec128_t& operand,
+                       uint64_t scalar_operand) {
+  const uint32_t ops_per_iteration = 8;
+  const uint32_t iteration_count = 1000000;
+
+  auto original_haswell = cvars::use_haswell_instructions;
+  auto original_avx512 = cvars::use_avx512_instructions;
+  vec128_t expected_result;
+  for (size_t n = 0; n < xe::countof(kFeatureConfigs); ++n) {
+    const auto& config = kFeatureConfigs[n];
+    cvars::use_haswell_instructions = config.use_haswell_instructions;
+    cvars::use_avx512_instructions = config.use_avx512_instructions;
+    TestFunction test([op, ops_per_iteration](HIRBuilder& b) {
+      auto loop_label = b.NewLabel();
+      b.MarkLabel(loop_label);
+      auto original = LoadVR(b, 4);
+      auto result = original;
+      for (uint32_t i = 0; i < ops_per_iteration; ++i) {
+        result = b.Xor(op(b, result), original);
+      }
+      StoreVR(b, 4, result);
+      auto remaining = b.Sub(LoadGPR(b, 3), b.LoadConstantUint64(1));
+      StoreGPR(b, 3, remaining);
+      b.BranchTrue(remaining, loop_label);
+      b.Return();
+    });
+
+    for (auto& processor : test.processors) {
+      auto fn = processor->ResolveFunction(0x80000000);
+      REQUIRE(fn);
+      auto thread_state = std::make_unique<ThreadState>(processor.get(), 0x100);
+      auto ctx = thread_state->context();
+
+      ctx->lr = 0xBCBCBCBC;
+      ctx->r[3] = 1;
+      ctx->v[4] = value;
+      ctx->v[5] = operand;
+      ctx->r[6] = scalar_operand;
+      fn->Call(thread_state.get(), uint32_t(ctx->lr));
+      if (!n) {
+        expected_result = ctx->v[4];
+      } else {
+        REQUIRE(ctx->v[4] == expected_result);
+      }
+
+      ctx->lr = 0xBCBCBCBC;
+      ctx->r[3] = iteration_count;
+      auto start_time = std::chrono::steady_clock::now();
+      fn->Call(thread_state.get(), uint32_t(ctx->lr));
+      auto elapsed = std::chrono::duration<double, std::nano>(
+                         std::chrono::steady_clock::now() - start_time)
+                         .count();
+      fmt::print("{} ({}): {:.2f} ns per op\n", name, config.name,
+                 elapsed / (iteration_count * ops_per_iteration));
+    }
+  }
+  cvars::use_haswell_instructions = original_haswell;
+  cvars::use_avx512_instructions = original_avx512;
+}
+
+const vec128_t kBenchmarkValue =
+    vec128i(0x12345678, 0x9ABCDEF0, 0x0FEDCBA9, 0x87654321);
+const vec128_t kBenchmarkCounts =
+    vec128b(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+}  // namespace
+
+TEST_CASE("VECTOR_SHIFT_BENCHMARK", "[benchmark][.]") {
+  const struct {
+    const char* name;
+    Opcode opcode;
+    TypeName part_type;
+  } shifts[] = {
+      {"VECTOR_SHL_I8", OPCODE_VECTOR_SHL, INT8_TYPE},
+      {"VECTOR_SHL_I16", OPCODE_VECTOR_SHL, INT16_TYPE},
+      {"VECTOR_SHR_I8", OPCODE_VECTOR_SHR, INT8_TYPE},
+      {"VECTOR_SHR_I16", OPCODE_VECTOR_SHR, INT16_TYPE},
+      {"VECTOR_SHA_I8", OPCODE_VECTOR_SHA, INT8_TYPE},
+      {"VECTOR_SHA_I16", OPCODE_VECTOR_SHA, INT16_TYPE},
+  };
+  for (const auto& shift : shifts) {
+    BenchmarkVectorOp(
+        shift.name,
+        [shift](HIRBuilder& b, Value* value) {
+          switch (shift.opcode) {
+            case OPCODE_VECTOR_SHL:
+              return b.VectorShl(value, LoadVR(b, 5), shift.part_type);
+            case OPCODE_VECTOR_SHR:
+              return b.VectorShr(value, LoadVR(b, 5), shift.part_type);
+            default:
+              return b.VectorSha(value, LoadVR(b, 5), shift.part_type);
+          }
+        },
+        kBenchmarkValue, kBenchmarkCounts, 0);
+  }
+}
+
+TEST_CASE("PACK_8_IN_16_BENCHMARK", "[benchmark][.]") {
+  BenchmarkVectorOp(
+      "PACK_8_IN_16_UN_UN",
+      [](HIRBuilder& b, Value* value) {
+        return b.Pack(value, LoadVR(b, 5),
+                      PACK_TYPE_8_IN_16 | PACK_TYPE_IN_UNSIGNED |
+                          PACK_TYPE_OUT_UNSIGNED);
+      },
+      kBenchmarkValue, vec128s(0x1FF, 0x80, 0x7F, 0, 0x100, 0xFF, 1, 0xFFFF),
+      0);
+  BenchmarkVectorOp(
+      "PACK_8_IN_16_UN_UN_SAT",
+      [](HIRBuilder& b, Value* value) {
+        return b.Pack(value, LoadVR(b, 5),
+                      PACK_TYPE_8_IN_16 | PACK_TYPE_IN_UNSIGNED |
+                          PACK_TYPE_OUT_UNSIGNED | PACK_TYPE_OUT_SATURATE);
+      },
+      kBenchmarkValue, vec128s(0x1FF, 0x80, 0x7F, 0, 0x100, 0xFF, 1, 0xFFFF),
+      0);
+}
+
+TEST_CASE("SHIFT_V128_BENCHMARK", "[benchmark][.]") {
+  BenchmarkVectorOp(
+      "SHL_V128",
+      [](HIRBuilder& b, Value* value) {
+        return b.Shl(value, b.Truncate(LoadGPR(b, 6), INT8_TYPE));
+      },
+      kBenchmarkValue, vec128i(0), 1);
+  BenchmarkVectorOp(
+      "SHR_V128",
+      [](HIRBuilder& b, Value* value) {
+        return b.Shr(value, b.Truncate(LoadGPR(b, 6), INT8_TYPE));
+      },
+      kBenchmarkValue, vec128i(0), 1);
+}
@@ -21,6 +21,7 @@
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/lzx.h"
 #include "xenia/cpu/processor.h"
+#include "xenia/emulator.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/xmodule.h"
 
@@ -1072,6 +1073,13 @@ bool XexModule::LoadContinue() {
     page += desc.page_count;
   }
 
+  // Make code generated for this module in previous sessions available.
+  processor_->backend()->InitializeCodeStorage(
+      kernel_state_->emulator()->cache_root(), this, low_address_,
+      high_address_);
+
+  PrefetchFunctions();
+
   return true;
 }
 
@@ -1276,6 +1284,16 @@ bool XexModule::ContainsAddress(uint32_t address) {
   return address >= low_address_ && address < high_address_;
 }
 
+bool XexModule::GetAddressRange(uint32_t* out_low_address,
+                                uint32_t* out_high_address) const {
+  if (low_address_ >= high_address_) {
+    return false;
+  }
+  *out_low_address = low_address_;
+  *out_high_address = high_address_;
+  return true;
+}
+
 std::unique_ptr<Function> XexModule::CreateFunction(uint32_t address) {
   return std::unique_ptr<Function>(
       processor_->backend()->CreateGuestFunction(this, address));
@@ -1610,5 +1628,37 @@ bool XexModule::FindSaveRest() {
   return true;
 }
 
+void XexModule::PrefetchFunctions() {
+  if (!processor_->frontend()->prefetch_compiler()) {
+    return;
+  }
+
+  std::vector<uint32_t> function_starts;
+
+  uint32_t entry_point = 0;
+  GetOptHeader(XEX_HEADER_ENTRY_POINT, &entry_point);
+  if (entry_point >= low_address_ && entry_point < high_address_) {
+    function_starts.push_back(entry_point);
+  }
+
+  // .pdata contains an IMAGE_CE_RUNTIME_FUNCTION_ENTRY (8 bytes, starting with
+  // the function address) for every function that isn't a leaf.
+  const PESection* pdata = GetPESection(".pdata");
+  if (pdata) {
+    const uint8_t* p = memory()->TranslateVirtual(pdata->address);
+    for (uint32_t offset = 0; offset + 8 <= pdata->size; offset += 8) {
+      uint32_t function_address = xe::load_and_swap<uint32_t>(p + offset);
+      if (!function_address) {
+        break;
+      }
+      if (function_address >= low_address_ && function_address < high_address_) {
+        function_starts.push_back(function_address);
+      }
+    }
+  }
+
+  processor_->frontend()->PrefetchFunctions(function_starts);
+}
+
 }  // namespace cpu
 }  // namespace xe
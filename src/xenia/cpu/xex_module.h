@@ -141,6 +141,8 @@ class XexModule : public xe::cpu::Module {
   bool Unload();
 
   bool ContainsAddress(uint32_t address) override;
+  bool GetAddressRange(uint32_t* out_low_address,
+                       uint32_t* out_high_address) const override;
 
   const std::string& name() const override { return name_; }
   bool is_executable() const override {
@@ -182,6 +184,7 @@ class XexModule : public xe::cpu::Module {
   bool SetupLibraryImports(const std::string_view name,
                            const xex2_import_library* library);
   bool FindSaveRest();
+  void PrefetchFunctions();
 
   Processor* processor_ = nullptr;
   kernel::KernelState* kernel_state_ = nullptr;
@@ -447,7 +447,8 @@ void DebugWindow::DrawGuestFunctionSource() {
   //     if historical data for memory/etc present, show combo boxes
   auto memory = emulator_->memory();
   auto function = static_cast<cpu::GuestFunction*>(state_.function);
-  auto& source_map = function->source_map();
+  auto source_map_snapshot = function->source_map();
+  auto& source_map = *source_map_snapshot;
   uint32_t source_map_index = 0;
 
   bool draw_hir = false;
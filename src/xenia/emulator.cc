@@ -9,6 +9,7 @@
 
 #include "xenia/emulator.h"
 
+#include <algorithm>
 #include <cinttypes>
 
 #include "config.h"
@@ -20,6 +21,7 @@
 #include "xenia/base/cvar.h"
 #include "xenia/base/debugging.h"
 #include "xenia/base/exception_handler.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/mapped_memory.h"
 #include "xenia/base/profiling.h"
@@ -54,6 +56,15 @@ DEFINE_string(
     "or the module specified by the game. Leave blank to launch the default "
     "module.",
     "General");
+DEFINE_bool(incremental_save_states, false,
+            "Only write the guest memory pages changed since the previous save "
+            "state. The save states a state is based on must be kept to "
+            "restore it.",
+            "General");
+DEFINE_bool(background_save_states, false,
+            "Only pause the emulator while the save state is captured, and "
+            "compress and write the guest memory in the background.",
+            "General");
 
 
 DEFINE_bool(ge_remove_blur, false,
@@ -91,6 +102,8 @@ Emulator::Emulator(const std::filesystem::path& command_line,
       restore_fence_() {}
 
 Emulator::~Emulator() {
+  WaitForBackgroundSave();
+
   // Note that we delete things in the reverse order they were initialized.
 
   // Give the systems time to shutdown before we delete them.
@@ -414,7 +427,34 @@ void Emulator::Resume() {
   }
 }
 
+namespace {
+constexpr uint32_t kSaveStateVersion = 1;
+
+bool ReadSaveStateHeader(ByteStream* stream, std::optional<uint32_t>* title_id,
+                         std::string* base_path, uint64_t* memory_offset) {
+  if (stream->Read<uint32_t>() != 'XSAV') {
+    return false;
+  }
+  if (stream->Read<uint32_t>() != kSaveStateVersion) {
+    XELOGE("Unsupported save state version");
+    return false;
+  }
+  auto has_title_id = stream->Read<bool>();
+  if (!has_title_id) {
+    *title_id = {};
+  } else {
+    *title_id = stream->Read<uint32_t>();
+  }
+  *base_path = stream->Read<std::string>();
+  *memory_offset = stream->Read<uint64_t>();
+  return true;
+}
+}  // namespace
+
 bool Emulator::SaveToFile(const std::filesystem::path& path) {
+  // The previous save state may be the base of this one.
+  WaitForBackgroundSave();
+
   Pause();
 
   filesystem::CreateFile(path);
@@ -424,13 +464,29 @@ bool Emulator::SaveToFile(const std::filesystem::path& path) {
     return false;
   }
 
+  // An incremental save state can't overwrite one it's based on.
+  auto absolute_path = std::filesystem::absolute(path);
+  bool incremental =
+      cvars::incremental_save_states && !save_state_chain_.empty() &&
+      std::find(save_state_chain_.begin(), save_state_chain_.end(),
+                absolute_path) == save_state_chain_.end();
+  if (!incremental) {
+    save_state_chain_.clear();
+  }
+
   // Save the emulator state to a file
   ByteStream stream(map->data(), map->size());
   stream.Write('XSAV');
+  stream.Write(kSaveStateVersion);
   stream.Write(title_id_.has_value());
   if (title_id_.has_value()) {
     stream.Write(title_id_.value());
   }
+  stream.Write(incremental ? xe::path_to_utf8(save_state_chain_.back())
+                           : std::string());
+  // Written once the other parts are saved.
+  size_t memory_offset_offset = stream.offset();
+  stream.Write(uint64_t(0));
 
   // It's important we don't hold the global lock here! XThreads need to step
   // forward (possibly through guarded regions) without worry!
@@ -438,14 +494,90 @@ bool Emulator::SaveToFile(const std::filesystem::path& path) {
   graphics_system_->Save(&stream);
   audio_system_->Save(&stream);
   kernel_state_->Save(&stream);
-  memory_->Save(&stream);
-  map->Close(stream.offset());
+  uint64_t memory_offset = stream.offset();
+  auto finish = [memory_offset_offset, memory_offset](MappedMemory* map,
+                                                      ByteStream* stream) {
+    size_t size = stream->offset();
+    stream->set_offset(memory_offset_offset);
+    stream->Write(memory_offset);
+    map->Close(size);
+  };
+  save_state_chain_.push_back(absolute_path);
+
+  if (cvars::background_save_states) {
+    // Copying the memory is much faster than compressing it, so the title
+    // only stops for the copy.
+    auto snapshot = std::make_unique<Memory::Snapshot>();
+    memory_->CaptureSnapshot(snapshot.get());
+    Resume();
+    // The result is checked by WaitForBackgroundSave, so the save state chain
+    // is only accessed by the thread saving and restoring.
+    background_save_succeeded_ = false;
+    save_thread_ = std::thread([this, map = std::move(map), stream, path,
+                                snapshot = std::move(snapshot), incremental,
+                                finish]() mutable {
+      xe::threading::set_name("Save State Writer");
+      background_save_succeeded_ =
+          memory_->SaveSnapshot(*snapshot, &stream, incremental);
+      if (!background_save_succeeded_) {
+        XELOGE("Failed to save the memory to the save state {}",
+               xe::path_to_utf8(path));
+      }
+      finish(map.get(), &stream);
+    });
+    return true;
+  }
+
+  bool result = memory_->Save(&stream, incremental);
+  finish(map.get(), &stream);
+  if (!result) {
+    XELOGE("Failed to save the memory to the save state {}",
+           xe::path_to_utf8(path));
+    // The page hashes may have been partially updated, so the next save state
+    // must be a full one.
+    save_state_chain_.clear();
+  }
 
   Resume();
-  return true;
+  return result;
+}
+
+bool Emulator::WaitForBackgroundSave() {
+  if (!save_thread_.joinable()) {
+    return true;
+  }
+  save_thread_.join();
+  if (!background_save_succeeded_) {
+    // The page hashes may have been partially updated, so the next save state
+    // must be a full one.
+    save_state_chain_.clear();
+  }
+  return background_save_succeeded_;
+}
+
+bool Emulator::RestoreMemoryFromFile(const std::filesystem::path& path) {
+  auto map = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+  if (!map) {
+    XELOGE("Could not open save state {}!", xe::path_to_utf8(path));
+    return false;
+  }
+  ByteStream stream(map->data(), map->size());
+  std::optional<uint32_t> title_id;
+  std::string base_path;
+  uint64_t memory_offset;
+  if (!ReadSaveStateHeader(&stream, &title_id, &base_path, &memory_offset)) {
+    return false;
+  }
+  if (!base_path.empty() && !RestoreMemoryFromFile(base_path)) {
+    return false;
+  }
+  stream.set_offset(memory_offset);
+  return memory_->Restore(&stream);
 }
 
 bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
+  WaitForBackgroundSave();
+
   // Restore the emulator state from a file
   auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite);
   if (!map) {
@@ -460,16 +592,11 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
 
   auto lock = global_critical_region::AcquireDirect();
   ByteStream stream(map->data(), map->size());
-  if (stream.Read<uint32_t>() != 'XSAV') {
-    return false;
-  }
-
-  auto has_title_id = stream.Read<bool>();
   std::optional<uint32_t> title_id;
-  if (!has_title_id) {
-    title_id = {};
-  } else {
-    title_id = stream.Read<uint32_t>();
+  std::string base_path;
+  uint64_t memory_offset;
+  if (!ReadSaveStateHeader(&stream, &title_id, &base_path, &memory_offset)) {
+    return false;
   }
   if (title_id_.has_value() != title_id.has_value() ||
       title_id_.value() != title_id.value()) {
@@ -494,6 +621,10 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
     XELOGE("Could not restore kernel state!");
     return false;
   }
+  if (!base_path.empty() && !RestoreMemoryFromFile(base_path)) {
+    XELOGE("Could not restore memory from the base save state!");
+    return false;
+  }
   if (!memory_->Restore(&stream)) {
     XELOGE("Could not restore memory!");
     return false;
@@ -13,6 +13,8 @@
 #include <functional>
 #include <optional>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "xenia/base/delegate.h"
 #include "xenia/base/exception_handler.h"
@@ -152,6 +154,8 @@ class Emulator {
   void Resume();
   bool is_paused() const { return paused_; }
 
+  // With background_save_states, the guest memory is written on another
+  // thread after the emulator is resumed.
   bool SaveToFile(const std::filesystem::path& path);
   bool RestoreFromFile(const std::filesystem::path& path);
 
@@ -176,6 +180,12 @@ class Emulator {
   X_STATUS CompleteLaunch(const std::filesystem::path& path,
                           const std::string_view module_path);
 
+  // Restores the guest memory from a save state, after restoring it from the
+  // save states an incremental one is based on.
+  bool RestoreMemoryFromFile(const std::filesystem::path& path);
+  // Returns whether the last background save state has been written.
+  bool WaitForBackgroundSave();
+
   std::filesystem::path command_line_;
   std::filesystem::path storage_root_;
   std::filesystem::path content_root_;
@@ -203,6 +213,12 @@ class Emulator {
 
   bool paused_;
   bool restoring_;
+  // Absolute paths of the save states the next incremental save state will
+  // be based on, oldest first.
+  std::vector<std::filesystem::path> save_state_chain_;
+  // Writes the memory of the last save state with background_save_states.
+  std::thread save_thread_;
+  bool background_save_succeeded_ = true;
   threading::Fence restore_fence_;  // Fired on restore finish.
 };
 
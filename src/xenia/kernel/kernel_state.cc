@@ -461,6 +461,10 @@ void KernelState::TerminateTitle() {
   terminate_notifications_.clear();
   */
 
+  for (auto& it : threads_by_id_) {
+    it.second->LogStatistics();
+  }
+
   // Kill all guest threads.
   for (auto it = threads_by_id_.begin(); it != threads_by_id_.end();) {
     if (!XThread::IsInThread(it->second) && it->second->is_guest_thread()) {
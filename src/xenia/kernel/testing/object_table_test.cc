@@ -0,0 +1,225 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "xenia/base/byte_stream.h"
+#include "xenia/base/threading.h"
+#include "xenia/kernel/util/object_table.h"
+#include "xenia/kernel/xobject.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace kernel {
+namespace test {
+using util::ObjectTable;
+
+// Objects created without a kernel state aren't added to any table by
+// themselves.
+static XObject* CreateObject(ObjectTable* table, X_HANDLE* out_handle) {
+  auto object = new XObject(XObject::Type::Event);
+  REQUIRE(table->AddHandle(object, out_handle) == X_STATUS_SUCCESS);
+  // The table keeps the object alive from now on.
+  object->Release();
+  return object;
+}
+
+TEST_CASE("Add, Look Up and Remove Handles", "[object_table]") {
+  ObjectTable table;
+
+  X_HANDLE handle_a, handle_b;
+  auto object_a = CreateObject(&table, &handle_a);
+  auto object_b = CreateObject(&table, &handle_b);
+  REQUIRE(handle_a != handle_b);
+  REQUIRE(table.LookupObject<XObject>(handle_a).get() == object_a);
+  REQUIRE(table.LookupObject<XObject>(handle_b).get() == object_b);
+
+  // A duplicated handle refers to the same object, and keeps it alive when
+  // the original handle is closed.
+  X_HANDLE handle_a2;
+  REQUIRE(table.DuplicateHandle(handle_a, &handle_a2) == X_STATUS_SUCCESS);
+  REQUIRE(table.ReleaseHandle(handle_a) == X_STATUS_SUCCESS);
+  REQUIRE(!table.LookupObject<XObject>(handle_a));
+  REQUIRE(table.LookupObject<XObject>(handle_a2).get() == object_a);
+
+  // Handles are only removed when their last reference is released.
+  REQUIRE(table.RetainHandle(handle_b) == X_STATUS_SUCCESS);
+  REQUIRE(table.ReleaseHandle(handle_b) == X_STATUS_SUCCESS);
+  REQUIRE(table.LookupObject<XObject>(handle_b).get() == object_b);
+  REQUIRE(table.ReleaseHandle(handle_b) == X_STATUS_SUCCESS);
+  REQUIRE(!table.LookupObject<XObject>(handle_b));
+
+  REQUIRE(table.ReleaseHandle(handle_a2) == X_STATUS_SUCCESS);
+  REQUIRE(!table.LookupObject<XObject>(handle_a2));
+  REQUIRE(!table.LookupObject<XObject>(0));
+  REQUIRE(!table.LookupObject<XObject>(XObject::kHandleBase + 0x100000));
+}
+
+TEST_CASE("Save and Restore Handles", "[object_table]") {
+  ObjectTable table;
+  X_HANDLE handle;
+  auto object = CreateObject(&table, &handle);
+  REQUIRE(table.RetainHandle(handle) == X_STATUS_SUCCESS);
+
+  std::vector<uint8_t> buffer(1024 * 1024);
+  ByteStream save_stream(buffer.data(), buffer.size());
+  REQUIRE(table.Save(&save_stream));
+
+  ObjectTable restored_table;
+  ByteStream restore_stream(buffer.data(), buffer.size());
+  REQUIRE(restored_table.Restore(&restore_stream));
+  REQUIRE(restored_table.RestoreHandle(handle, object) == X_STATUS_SUCCESS);
+  REQUIRE(restored_table.LookupObject<XObject>(handle).get() == object);
+
+  // Both handle references have been restored.
+  REQUIRE(restored_table.ReleaseHandle(handle) == X_STATUS_SUCCESS);
+  REQUIRE(restored_table.LookupObject<XObject>(handle).get() == object);
+  REQUIRE(restored_table.ReleaseHandle(handle) == X_STATUS_SUCCESS);
+  REQUIRE(!restored_table.LookupObject<XObject>(handle));
+
+  REQUIRE(table.ReleaseHandle(handle) == X_STATUS_SUCCESS);
+  REQUIRE(table.ReleaseHandle(handle) == X_STATUS_SUCCESS);
+}
+
+TEST_CASE("Look Up Handles While Others Are Added and Removed",
+          "[object_table]") {
+  ObjectTable table;
+
+  // Looked up by the readers, and never removed while they're running.
+  std::vector<X_HANDLE> stable_handles(64);
+  std::vector<XObject*> stable_objects;
+  for (auto& handle : stable_handles) {
+    stable_objects.push_back(CreateObject(&table, &handle));
+  }
+
+  std::atomic<bool> done = false;
+  std::atomic<uint32_t> failure_count = 0;
+  std::vector<std::thread> readers;
+  for (uint32_t i = 0; i < 4; ++i) {
+    readers.emplace_back([&, i] {
+      size_t n = i;
+      while (!done) {
+        size_t index = n++ % stable_handles.size();
+        auto object = table.LookupObject<XObject>(stable_handles[index]);
+        if (object.get() != stable_objects[index]) {
+          ++failure_count;
+        }
+        // Let the writer run on machines with few cores.
+        std::this_thread::yield();
+      }
+    });
+  }
+
+  // Enough live handles for the table to grow a few times while the readers
+  // are running, and handles being removed and their slots being reused.
+  std::vector<X_HANDLE> handles;
+  for (uint32_t i = 0; i < 32 * 1024; ++i) {
+    X_HANDLE handle;
+    CreateObject(&table, &handle);
+    handles.push_back(handle);
+    if (i % 3 == 0) {
+      size_t index = (i * 7919) % handles.size();
+      REQUIRE(table.ReleaseHandle(handles[index]) == X_STATUS_SUCCESS);
+      handles[index] = handles.back();
+      handles.pop_back();
+    }
+  }
+
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  REQUIRE(failure_count == 0);
+
+  for (X_HANDLE handle : handles) {
+    REQUIRE(table.ReleaseHandle(handle) == X_STATUS_SUCCESS);
+  }
+  for (X_HANDLE handle : stable_handles) {
+    REQUIRE(table.ReleaseHandle(handle) == X_STATUS_SUCCESS);
+  }
+}
+
+TEST_CASE("Remove Handles While a Lookup Is Suspended", "[object_table]") {
+  ObjectTable table;
+  X_HANDLE stable_handle;
+  auto stable_object = CreateObject(&table, &stable_handle);
+
+  // Mostly suspended in the middle of a lookup, like by a guest thread
+  // suspending another one, which must not keep handles from being removed.
+  std::atomic<bool> done = false;
+  std::atomic<uint32_t> failure_count = 0;
+  auto reader = xe::threading::Thread::Create({}, [&] {
+    while (!done) {
+      if (table.LookupObject<XObject>(stable_handle).get() != stable_object) {
+        ++failure_count;
+      }
+    }
+  });
+  for (uint32_t i = 0; i < 200; ++i) {
+    REQUIRE(reader->Suspend());
+    // Suspension is asynchronous - let the reader stop wherever it is.
+    xe::threading::Sleep(std::chrono::milliseconds(1));
+    X_HANDLE handle;
+    CreateObject(&table, &handle);
+    REQUIRE(table.ReleaseHandle(handle) == X_STATUS_SUCCESS);
+    REQUIRE(reader->Resume());
+  }
+  done = true;
+  xe::threading::Wait(reader.get(), false);
+  REQUIRE(failure_count == 0);
+
+  REQUIRE(table.ReleaseHandle(stable_handle) == X_STATUS_SUCCESS);
+}
+
+// Timing only - hidden, run with the [benchmark] tag.
+TEST_CASE("Object Table Lookup Throughput", "[.][benchmark]") {
+  ObjectTable table;
+  std::vector<X_HANDLE> handles(1024);
+  for (auto& handle : handles) {
+    CreateObject(&table, &handle);
+  }
+
+  const uint32_t lookup_count = 1000000;
+  std::atomic<uint32_t> failure_count = 0;
+  for (uint32_t thread_count : {1u, 8u}) {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < thread_count; ++i) {
+      threads.emplace_back([&, i] {
+        for (uint32_t n = 0; n < lookup_count; ++n) {
+          auto object = table.LookupObject<XObject>(
+              handles[(n * 31 + i) % handles.size()]);
+          if (!object) {
+            ++failure_count;
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    WARN(thread_count << " threads x " << lookup_count << " lookups: "
+                      << duration.count() << " us");
+  }
+  REQUIRE(failure_count == 0);
+
+  for (X_HANDLE handle : handles) {
+    REQUIRE(table.ReleaseHandle(handle) == X_STATUS_SUCCESS);
+  }
+}
+
+}  // namespace test
+}  // namespace kernel
+}  // namespace xe
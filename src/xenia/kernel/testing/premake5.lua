@@ -0,0 +1,21 @@
+project_root = "../../../.."
+include(project_root.."/tools/build")
+
+test_suite("xenia-kernel-tests", project_root, ".", {
+  links = {
+    "aes_128",
+    "capstone",
+    "fmt",
+    "mspack",
+    "xenia-apu",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-cpu-backend-x64",
+    "xenia-hid",
+    "xenia-kernel",
+    "xenia-ui", -- needed by xenia-base
+    "xenia-vfs",
+    "xxhash",
+  },
+})
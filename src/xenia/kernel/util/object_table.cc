@@ -14,6 +14,7 @@
 
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/threading.h"
 #include "xenia/kernel/xobject.h"
 #include "xenia/kernel/xthread.h"
 
@@ -28,32 +29,49 @@ ObjectTable::~ObjectTable() { Reset(); }
 void ObjectTable::Reset() {
   auto global_lock = global_critical_region_.Acquire();
 
+  EntryTable* table = table_.exchange(nullptr);
+  last_free_entry_ = 0;
+
+  // Only reset once the table isn't used anymore, so nothing is reading it.
+  std::vector<RetiredItem> retired_items;
+  retired_items.swap(retired_items_);
+  for (const RetiredItem& item : retired_items) {
+    if (item.object) {
+      item.object->Release();
+    }
+    delete item.table;
+  }
+  if (!table) {
+    return;
+  }
+
   // Release all objects.
-  for (uint32_t n = 0; n < table_capacity_; n++) {
-    ObjectTableEntry& entry = table_[n];
-    if (entry.object) {
-      entry.object->Release();
+  for (uint32_t n = 0; n < table->capacity; n++) {
+    ObjectTableEntry& entry = table->entries[n];
+    XObject* object = entry.object.load(std::memory_order_relaxed);
+    if (object) {
+      object->Release();
     }
   }
 
-  table_capacity_ = 0;
-  last_free_entry_ = 0;
-  free(table_);
-  table_ = nullptr;
+  delete table;
 }
 
 X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot) {
+  EntryTable* table = table_.load(std::memory_order_relaxed);
+  uint32_t table_capacity = table ? table->capacity : 0;
+
   // Find a free slot.
   uint32_t slot = last_free_entry_;
   uint32_t scan_count = 0;
-  while (scan_count < table_capacity_) {
-    ObjectTableEntry& entry = table_[slot];
-    if (!entry.object) {
+  while (scan_count < table_capacity) {
+    ObjectTableEntry& entry = table->entries[slot];
+    if (!entry.object.load(std::memory_order_relaxed)) {
       *out_slot = slot;
       return X_STATUS_SUCCESS;
     }
     scan_count++;
-    slot = (slot + 1) % table_capacity_;
+    slot = (slot + 1) % table_capacity;
     if (slot == 0) {
       // Never allow 0 handles.
       scan_count++;
@@ -62,7 +80,7 @@ X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot) {
   }
 
   // Table out of slots, expand.
-  uint32_t new_table_capacity = std::max(16 * 1024u, table_capacity_ * 2);
+  uint32_t new_table_capacity = std::max(16 * 1024u, table_capacity * 2);
   if (!Resize(new_table_capacity)) {
     return X_STATUS_NO_MEMORY;
   }
@@ -75,23 +93,30 @@ X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot) {
 }
 
 bool ObjectTable::Resize(uint32_t new_capacity) {
-  uint32_t new_size = new_capacity * sizeof(ObjectTableEntry);
-  uint32_t old_size = table_capacity_ * sizeof(ObjectTableEntry);
-  auto new_table =
-      reinterpret_cast<ObjectTableEntry*>(realloc(table_, new_size));
-  if (!new_table) {
-    return false;
+  EntryTable* old_table = table_.load(std::memory_order_relaxed);
+  auto new_table = new EntryTable(new_capacity);
+
+  uint32_t old_capacity = 0;
+  if (old_table) {
+    old_capacity = old_table->capacity;
+    for (uint32_t n = 0; n < std::min(old_capacity, new_capacity); n++) {
+      ObjectTableEntry& old_entry = old_table->entries[n];
+      ObjectTableEntry& new_entry = new_table->entries[n];
+      new_entry.handle_ref_count = old_entry.handle_ref_count;
+      new_entry.object.store(old_entry.object.load(std::memory_order_relaxed),
+                             std::memory_order_relaxed);
+    }
   }
 
-  // Zero out new entries.
-  if (new_size > old_size) {
-    std::memset(reinterpret_cast<uint8_t*>(new_table) + old_size, 0,
-                new_size - old_size);
-  }
+  last_free_entry_ = old_capacity;
+  table_.store(new_table);
 
-  last_free_entry_ = table_capacity_;
-  table_capacity_ = new_capacity;
-  table_ = new_table;
+  // Lookups that started before the new table was published may still be
+  // reading the old one.
+  if (old_table) {
+    RetireTable(old_table);
+    ReclaimRetired();
+  }
 
   return true;
 }
@@ -109,17 +134,20 @@ X_STATUS ObjectTable::AddHandle(XObject* object, X_HANDLE* out_handle) {
 
     // Stash.
     if (XSUCCEEDED(result)) {
-      ObjectTableEntry& entry = table_[slot];
-      entry.object = object;
+      ObjectTableEntry& entry =
+          table_.load(std::memory_order_relaxed)->entries[slot];
       entry.handle_ref_count = 1;
       handle = XObject::kHandleBase + (slot << 2);
       object->handles().push_back(handle);
 
       // Retain so long as the object is in the table.
       object->Retain();
+      entry.object.store(object, std::memory_order_release);
 
       XELOGI("Added handle:{:08X} for {}", handle, typeid(*object).name());
     }
+
+    ReclaimRetired();
   }
 
   if (XSUCCEEDED(result)) {
@@ -135,7 +163,7 @@ X_STATUS ObjectTable::DuplicateHandle(X_HANDLE handle, X_HANDLE* out_handle) {
   X_STATUS result = X_STATUS_SUCCESS;
   handle = TranslateHandle(handle);
 
-  XObject* object = LookupObject(handle, false);
+  XObject* object = LookupObject(handle);
   if (object) {
     result = AddHandle(object, out_handle);
     object->Release();  // Release the ref that LookupObject took
@@ -184,15 +212,15 @@ X_STATUS ObjectTable::RemoveHandle(X_HANDLE handle) {
     return X_STATUS_INVALID_HANDLE;
   }
 
+  auto global_lock = global_critical_region_.Acquire();
   ObjectTableEntry* entry = LookupTable(handle);
   if (!entry) {
     return X_STATUS_INVALID_HANDLE;
   }
 
-  auto global_lock = global_critical_region_.Acquire();
-  if (entry->object) {
-    auto object = entry->object;
-    entry->object = nullptr;
+  auto object = entry->object.load(std::memory_order_relaxed);
+  if (object) {
+    entry->object.store(nullptr);
     assert_zero(entry->handle_ref_count);
     entry->handle_ref_count = 0;
 
@@ -205,8 +233,9 @@ X_STATUS ObjectTable::RemoveHandle(X_HANDLE handle) {
 
     XELOGI("Removed handle:{:08X} for {}", handle, typeid(*object).name());
 
-    // Release now that the object has been removed from the table.
-    object->Release();
+    // Release once no lookup that has seen it is about to retain it anymore.
+    RetireObject(object);
+    ReclaimRetired();
   }
 
   return X_STATUS_SUCCESS;
@@ -216,12 +245,15 @@ std::vector<object_ref<XObject>> ObjectTable::GetAllObjects() {
   auto lock = global_critical_region_.Acquire();
   std::vector<object_ref<XObject>> results;
 
-  for (uint32_t slot = 0; slot < table_capacity_; slot++) {
-    auto& entry = table_[slot];
-    if (entry.object && std::find(results.begin(), results.end(),
-                                  entry.object) == results.end()) {
-      entry.object->Retain();
-      results.push_back(object_ref<XObject>(entry.object));
+  EntryTable* table = table_.load(std::memory_order_relaxed);
+  uint32_t table_capacity = table ? table->capacity : 0;
+  for (uint32_t slot = 0; slot < table_capacity; slot++) {
+    XObject* object =
+        table->entries[slot].object.load(std::memory_order_relaxed);
+    if (object &&
+        std::find(results.begin(), results.end(), object) == results.end()) {
+      object->Retain();
+      results.push_back(object_ref<XObject>(object));
     }
   }
 
@@ -230,15 +262,24 @@ std::vector<object_ref<XObject>> ObjectTable::GetAllObjects() {
 
 void ObjectTable::PurgeAllObjects() {
   auto lock = global_critical_region_.Acquire();
-  for (uint32_t slot = 0; slot < table_capacity_; slot++) {
-    auto& entry = table_[slot];
-    if (entry.object && !entry.object->is_host_object()) {
+  std::vector<XObject*> purged_objects;
+
+  EntryTable* table = table_.load(std::memory_order_relaxed);
+  uint32_t table_capacity = table ? table->capacity : 0;
+  for (uint32_t slot = 0; slot < table_capacity; slot++) {
+    auto& entry = table->entries[slot];
+    XObject* object = entry.object.load(std::memory_order_relaxed);
+    if (object && !object->is_host_object()) {
       entry.handle_ref_count = 0;
-      entry.object->Release();
-
-      entry.object = nullptr;
+      entry.object.store(nullptr);
+      purged_objects.push_back(object);
     }
   }
+
+  for (XObject* object : purged_objects) {
+    RetireObject(object);
+  }
+  ReclaimRetired();
 }
 
 ObjectTable::ObjectTableEntry* ObjectTable::LookupTable(X_HANDLE handle) {
@@ -251,8 +292,9 @@ ObjectTable::ObjectTableEntry* ObjectTable::LookupTable(X_HANDLE handle) {
 
   // Lower 2 bits are ignored.
   uint32_t slot = GetHandleSlot(handle);
-  if (slot <= table_capacity_) {
-    return &table_[slot];
+  EntryTable* table = table_.load(std::memory_order_relaxed);
+  if (table && slot < table->capacity) {
+    return &table->entries[slot];
   }
 
   return nullptr;
@@ -261,54 +303,105 @@ ObjectTable::ObjectTableEntry* ObjectTable::LookupTable(X_HANDLE handle) {
 // Generic lookup
 template <>
 object_ref<XObject> ObjectTable::LookupObject<XObject>(X_HANDLE handle) {
-  auto object = ObjectTable::LookupObject(handle, false);
+  auto object = ObjectTable::LookupObject(handle);
   auto result = object_ref<XObject>(reinterpret_cast<XObject*>(object));
   return result;
 }
 
-XObject* ObjectTable::LookupObject(X_HANDLE handle, bool already_locked) {
+XObject* ObjectTable::LookupObject(X_HANDLE handle) {
   handle = TranslateHandle(handle);
   if (!handle) {
     return nullptr;
   }
 
   XObject* object = nullptr;
-  if (!already_locked) {
-    global_critical_region_.mutex().lock();
-  }
+  uint32_t epoch = BeginRead();
 
   // Lower 2 bits are ignored.
   uint32_t slot = GetHandleSlot(handle);
 
   // Verify slot.
-  if (slot < table_capacity_) {
-    ObjectTableEntry& entry = table_[slot];
-    if (entry.object) {
-      object = entry.object;
-    }
+  EntryTable* table = table_.load();
+  if (table && slot < table->capacity) {
+    object = table->entries[slot].object.load();
   }
 
-  // Retain the object pointer.
+  // Retain the object pointer. The table keeps its reference until this read
+  // ends, even if the handle is removed concurrently.
   if (object) {
     object->Retain();
   }
 
-  if (!already_locked) {
-    global_critical_region_.mutex().unlock();
-  }
+  EndRead(epoch);
 
   return object;
 }
 
+uint32_t ObjectTable::BeginRead() {
+  uint32_t epoch = reader_epoch_.load() & 1;
+  reader_counts_[epoch].fetch_add(1);
+  return epoch;
+}
+
+void ObjectTable::EndRead(uint32_t epoch) {
+  reader_counts_[epoch].fetch_sub(1);
+}
+
+void ObjectTable::RetireObject(XObject* object) {
+  retired_items_.push_back({reader_epoch_.load(), object, nullptr});
+}
+
+void ObjectTable::RetireTable(EntryTable* table) {
+  retired_items_.push_back({reader_epoch_.load(), nullptr, table});
+}
+
+void ObjectTable::ReclaimRetired() {
+  // Everything here is sequentially consistent, so a reader whose increment
+  // isn't seen by the check below is guaranteed to see the writes made before
+  // it. Readers may take arbitrarily long between loading the epoch and
+  // incrementing the counter though, so an item is only released after two
+  // epoch changes following its retirement, each followed by the counter of
+  // the previous epoch being seen drained. If a reader is still there, this is
+  // checked again by the next write instead of waiting.
+  while (!retired_items_.empty()) {
+    uint32_t epoch = reader_epoch_.load();
+    if (drained_epoch_ == epoch) {
+      reader_epoch_.fetch_add(1);
+      continue;
+    }
+    if (reader_counts_[(epoch - 1) & 1].load()) {
+      break;
+    }
+    drained_epoch_ = epoch;
+    // Retired in epoch order. Releasing an object may remove other handles,
+    // so the released items are taken out of the list first.
+    auto reclaimed_end = std::find_if(
+        retired_items_.begin(), retired_items_.end(),
+        [epoch](const RetiredItem& item) { return epoch - item.epoch < 2; });
+    std::vector<RetiredItem> reclaimed_items(retired_items_.begin(),
+                                             reclaimed_end);
+    retired_items_.erase(retired_items_.begin(), reclaimed_end);
+    for (const RetiredItem& item : reclaimed_items) {
+      if (item.object) {
+        item.object->Release();
+      }
+      delete item.table;
+    }
+  }
+}
+
 void ObjectTable::GetObjectsByType(XObject::Type type,
                                    std::vector<object_ref<XObject>>* results) {
   auto global_lock = global_critical_region_.Acquire();
-  for (uint32_t slot = 0; slot < table_capacity_; ++slot) {
-    auto& entry = table_[slot];
-    if (entry.object) {
-      if (entry.object->type() == type) {
-        entry.object->Retain();
-        results->push_back(object_ref<XObject>(entry.object));
+  EntryTable* table = table_.load(std::memory_order_relaxed);
+  uint32_t table_capacity = table ? table->capacity : 0;
+  for (uint32_t slot = 0; slot < table_capacity; ++slot) {
+    XObject* object =
+        table->entries[slot].object.load(std::memory_order_relaxed);
+    if (object) {
+      if (object->type() == type) {
+        object->Retain();
+        results->push_back(object_ref<XObject>(object));
       }
     }
   }
@@ -358,7 +451,7 @@ X_STATUS ObjectTable::GetObjectByName(const std::string_view name,
   *out_handle = it->second;
 
   // We need to ref the handle. I think.
-  auto obj = LookupObject(it->second, true);
+  auto obj = LookupObject(it->second);
   if (obj) {
     obj->RetainHandle();
     obj->Release();
@@ -368,9 +461,12 @@ X_STATUS ObjectTable::GetObjectByName(const std::string_view name,
 }
 
 bool ObjectTable::Save(ByteStream* stream) {
-  stream->Write<uint32_t>(table_capacity_);
-  for (uint32_t i = 0; i < table_capacity_; i++) {
-    auto& entry = table_[i];
+  auto global_lock = global_critical_region_.Acquire();
+  EntryTable* table = table_.load(std::memory_order_relaxed);
+  uint32_t table_capacity = table ? table->capacity : 0;
+  stream->Write<uint32_t>(table_capacity);
+  for (uint32_t i = 0; i < table_capacity; i++) {
+    auto& entry = table->entries[i];
     stream->Write<int32_t>(entry.handle_ref_count);
   }
 
@@ -378,9 +474,11 @@ bool ObjectTable::Save(ByteStream* stream) {
 }
 
 bool ObjectTable::Restore(ByteStream* stream) {
+  auto global_lock = global_critical_region_.Acquire();
   Resize(stream->Read<uint32_t>());
-  for (uint32_t i = 0; i < table_capacity_; i++) {
-    auto& entry = table_[i];
+  EntryTable* table = table_.load(std::memory_order_relaxed);
+  for (uint32_t i = 0; i < table->capacity; i++) {
+    auto& entry = table->entries[i];
     // entry.object = nullptr;
     entry.handle_ref_count = stream->Read<int32_t>();
   }
@@ -389,13 +487,15 @@ bool ObjectTable::Restore(ByteStream* stream) {
 }
 
 X_STATUS ObjectTable::RestoreHandle(X_HANDLE handle, XObject* object) {
+  auto global_lock = global_critical_region_.Acquire();
   uint32_t slot = GetHandleSlot(handle);
-  assert_true(table_capacity_ >= slot);
+  EntryTable* table = table_.load(std::memory_order_relaxed);
+  assert_true(table && slot < table->capacity);
 
-  if (table_capacity_ >= slot) {
-    auto& entry = table_[slot];
-    entry.object = object;
+  if (table && slot < table->capacity) {
+    auto& entry = table->entries[slot];
     object->Retain();
+    entry.object.store(object, std::memory_order_release);
   }
 
   return X_STATUS_SUCCESS;
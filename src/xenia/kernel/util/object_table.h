@@ -10,6 +10,8 @@
 #ifndef XENIA_KERNEL_UTIL_OBJECT_TABLE_H_
 #define XENIA_KERNEL_UTIL_OBJECT_TABLE_H_
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -49,7 +51,7 @@ class ObjectTable {
 
   template <typename T>
   object_ref<T> LookupObject(X_HANDLE handle) {
-    auto object = LookupObject(handle, false);
+    auto object = LookupObject(handle);
     if (object) {
       assert_true(object->type() == T::kObjectType);
     }
@@ -83,11 +85,22 @@ class ObjectTable {
  private:
   struct ObjectTableEntry {
     int handle_ref_count = 0;
-    XObject* object = nullptr;
+    // Only modified with the lock held, but read by lookups without it.
+    std::atomic<XObject*> object{nullptr};
+  };
+  // Lookups may be reading a table while it's being grown, so a grown table is
+  // published as a copy and the old one is freed once no lookup can be using
+  // it anymore.
+  struct EntryTable {
+    explicit EntryTable(uint32_t capacity)
+        : capacity(capacity), entries(new ObjectTableEntry[capacity]) {}
+    const uint32_t capacity;
+    std::unique_ptr<ObjectTableEntry[]> entries;
   };
 
+  // The returned entry is only valid while the lock is held.
   ObjectTableEntry* LookupTable(X_HANDLE handle);
-  XObject* LookupObject(X_HANDLE handle, bool already_locked);
+  XObject* LookupObject(X_HANDLE handle);
   void GetObjectsByType(XObject::Type type,
                         std::vector<object_ref<XObject>>* results);
 
@@ -98,10 +111,35 @@ class ObjectTable {
   X_STATUS FindFreeSlot(uint32_t* out_slot);
   bool Resize(uint32_t new_capacity);
 
+  // Lookups don't take the lock - instead, they're counted as readers while
+  // they're dereferencing the table, and objects and tables that readers may
+  // have seen are retired rather than released right away. Readers are counted
+  // in one of two counters selected by the epoch, and retired items are
+  // released once the counter of the epoch before each of the next two epoch
+  // changes has drained. Writers never wait for the readers, which may be
+  // suspended in the middle of a lookup by the thread that's writing.
+  uint32_t BeginRead();
+  void EndRead(uint32_t epoch);
+  // Must be called with the lock held.
+  void RetireObject(XObject* object);
+  void RetireTable(EntryTable* table);
+  void ReclaimRetired();
+
+  struct RetiredItem {
+    // Value of reader_epoch_ when the item was retired.
+    uint32_t epoch;
+    XObject* object;
+    EntryTable* table;
+  };
+
   xe::global_critical_region global_critical_region_;
-  uint32_t table_capacity_ = 0;
-  ObjectTableEntry* table_ = nullptr;
+  std::atomic<EntryTable*> table_{nullptr};
   uint32_t last_free_entry_ = 0;
+  std::atomic<uint32_t> reader_epoch_{0};
+  std::atomic<uint32_t> reader_counts_[2] = {};
+  // Last epoch whose previous counter has been seen drained after it started.
+  uint32_t drained_epoch_ = 0;
+  std::vector<RetiredItem> retired_items_;
   std::unordered_map<string_key_case, X_HANDLE> name_table_;
 };
 
@@ -140,6 +140,9 @@ class Param {
     PPCContext* ppc_context;
     int ordinal;
     int float_ordinal;
+    // Integer arguments passed in host registers to the fast entry point, or
+    // nullptr to load them from the context.
+    const uint64_t* fast_args;
   };
 
   Param& operator=(const Param&) = delete;
@@ -152,7 +155,9 @@ class Param {
 
   template <typename V>
   void LoadValue(Init& init, V* out_value) {
-    if (ordinal_ <= 7) {
+    if (init.fast_args) {
+      *out_value = V(init.fast_args[ordinal_]);
+    } else if (ordinal_ <= 7) {
       *out_value = V(init.ppc_context->r[3 + ordinal_]);
     } else {
       uint32_t stack_ptr =
@@ -515,11 +520,13 @@ xe::cpu::Export* RegisterExport(R (*fn)(Ps&...), const char* name,
       tags | xe::cpu::ExportTag::kImplemented | xe::cpu::ExportTag::kLog);
   static R (*FN)(Ps & ...) = fn;
   struct X {
-    static void Trampoline(PPCContext* ppc_context) {
+    static void Call(PPCContext* ppc_context, const uint64_t* fast_args) {
       ++export_entry->function_data.call_count;
       Param::Init init = {
           ppc_context,
           0,
+          0,
+          fast_args,
       };
       // Using braces initializer instead of make_tuple because braces
       // enforce execution order across compilers.
@@ -540,8 +547,19 @@ xe::cpu::Export* RegisterExport(R (*fn)(Ps&...), const char* name,
         // TODO(benvanik): log result.
       }
     }
+    static void Trampoline(PPCContext* ppc_context) {
+      Call(ppc_context, nullptr);
+    }
+    static void FastCall(PPCContext* ppc_context, uint64_t arg0, uint64_t arg1,
+                         uint64_t arg2) {
+      const uint64_t fast_args[] = {arg0, arg1, arg2};
+      Call(ppc_context, fast_args);
+    }
   };
   export_entry->function_data.trampoline = &X::Trampoline;
+  if (sizeof...(Ps) <= xe::cpu::Export::kFastCallMaxArgCount) {
+    export_entry->function_data.fast_call = &X::FastCall;
+  }
   return export_entry;
 }
 
@@ -553,11 +571,13 @@ xe::cpu::Export* RegisterExport(void (*fn)(Ps&...), const char* name,
       tags | xe::cpu::ExportTag::kImplemented | xe::cpu::ExportTag::kLog);
   static void (*FN)(Ps & ...) = fn;
   struct X {
-    static void Trampoline(PPCContext* ppc_context) {
+    static void Call(PPCContext* ppc_context, const uint64_t* fast_args) {
       ++export_entry->function_data.call_count;
       Param::Init init = {
           ppc_context,
           0,
+          0,
+          fast_args,
       };
       // Using braces initializer instead of make_tuple because braces
       // enforce execution order across compilers.
@@ -572,8 +592,19 @@ xe::cpu::Export* RegisterExport(void (*fn)(Ps&...), const char* name,
       KernelTrampoline(FN, std::forward<std::tuple<Ps...>>(params),
                        std::make_index_sequence<sizeof...(Ps)>());
     }
+    static void Trampoline(PPCContext* ppc_context) {
+      Call(ppc_context, nullptr);
+    }
+    static void FastCall(PPCContext* ppc_context, uint64_t arg0, uint64_t arg1,
+                         uint64_t arg2) {
+      const uint64_t fast_args[] = {arg0, arg1, arg2};
+      Call(ppc_context, fast_args);
+    }
   };
   export_entry->function_data.trampoline = &X::Trampoline;
+  if (sizeof...(Ps) <= xe::cpu::Export::kFastCallMaxArgCount) {
+    export_entry->function_data.fast_call = &X::FastCall;
+  }
   return export_entry;
 }
 
@@ -920,6 +920,9 @@ dword_result_t NetDll_recv(dword_t caller, dword_t socket_handle,
     return -1;
   }
 
+  // Translated code in the buffer is write-protected, and the host would fail
+  // to receive into it.
+  kernel_memory()->TriggerCodeCallbacks(buf_ptr.guest_address(), buf_len);
   return socket->Recv(buf_ptr, buf_len, flags);
 }
 DECLARE_XAM_EXPORT1(NetDll_recv, kNetworking, kImplemented);
@@ -941,6 +944,7 @@ dword_result_t NetDll_recvfrom(dword_t caller, dword_t socket_handle,
     native_from = *from_ptr;
   }
   uint32_t native_fromlen = fromlen_ptr ? fromlen_ptr.value() : 0;
+  kernel_memory()->TriggerCodeCallbacks(buf_ptr.guest_address(), buf_len);
   int ret = socket->RecvFrom(buf_ptr, buf_len, flags, &native_from,
                              fromlen_ptr ? &native_fromlen : 0);
 
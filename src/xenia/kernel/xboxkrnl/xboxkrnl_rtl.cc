@@ -14,6 +14,7 @@
 
 #include "xenia/base/atomic.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/memory.h"
 #include "xenia/base/string.h"
 #include "xenia/base/threading.h"
 #include "xenia/kernel/kernel_state.h"
@@ -32,21 +33,9 @@ namespace xboxkrnl {
 // https://msdn.microsoft.com/en-us/library/ff561778
 dword_result_t RtlCompareMemory(lpvoid_t source1, lpvoid_t source2,
                                 dword_t length) {
-  uint8_t* p1 = source1;
-  uint8_t* p2 = source2;
-
   // Note that the return value is the number of bytes that match, so it's best
   // we just do this ourselves vs. using memcmp.
-  // On Windows we could use the builtin function.
-
-  uint32_t c = 0;
-  for (uint32_t n = 0; n < length; n++, p1++, p2++) {
-    if (*p1 == *p2) {
-      c++;
-    }
-  }
-
-  return c;
+  return uint32_t(xe::count_equal_bytes(source1, source2, length));
 }
 DECLARE_XBOXKRNL_EXPORT1(RtlCompareMemory, kMemory, kImplemented);
 
@@ -58,29 +47,16 @@ dword_result_t RtlCompareMemoryUlong(lpvoid_t source, dword_t length,
     return 0;
   }
 
-  uint32_t n = 0;
-  for (uint32_t i = 0; i < (length / 4); i++) {
-    // FIXME: This assumes as_array returns xe::be
-    uint32_t val = source.as_array<uint32_t>()[i];
-    if (val == pattern) {
-      n++;
-    }
-  }
-
-  return n;
+  // The source is big-endian in guest memory.
+  return uint32_t(xe::count_equal_32(
+      source, xe::byte_swap(pattern.value()), length / 4));
 }
 DECLARE_XBOXKRNL_EXPORT1(RtlCompareMemoryUlong, kMemory, kImplemented);
 
 // https://msdn.microsoft.com/en-us/library/ff552263
 void RtlFillMemoryUlong(lpvoid_t destination, dword_t length, dword_t pattern) {
   // NOTE: length must be % 4, so we can work on uint32s.
-  uint32_t count = length >> 2;
-
-  uint32_t* p = destination.as<uint32_t*>();
-  uint32_t swapped_pattern = xe::byte_swap(pattern.value());
-  for (uint32_t n = 0; n < count; n++, p++) {
-    *p = swapped_pattern;
-  }
+  xe::fill_32(destination, xe::byte_swap(pattern.value()), length >> 2);
 }
 DECLARE_XBOXKRNL_EXPORT1(RtlFillMemoryUlong, kMemory, kImplemented);
 
@@ -372,6 +348,31 @@ struct X_RTL_CRITICAL_SECTION {
 #pragma pack(pop)
 static_assert_size(X_RTL_CRITICAL_SECTION, 28);
 
+// The auto-reset event of the critical section is only waited on and set by
+// the functions below, so rather than creating a kernel event object for it,
+// its signal state in guest memory is used directly as a futex, waking only
+// the thread that will take the lock.
+volatile uint32_t* GetCriticalSectionSignalState(X_RTL_CRITICAL_SECTION* cs) {
+  return reinterpret_cast<volatile uint32_t*>(&cs->header.signal_state);
+}
+
+void xeRtlWaitForCriticalSectionEvent(X_RTL_CRITICAL_SECTION* cs) {
+  auto signal_state = GetCriticalSectionSignalState(cs);
+  // Big-endian 1, consumed by the waiter.
+  const int32_t signaled = int32_t(xe::byte_swap(uint32_t(1)));
+  while (!xe::atomic_cas(signaled, 0,
+                         reinterpret_cast<volatile int32_t*>(signal_state))) {
+    xe::threading::FutexWait(signal_state, 0);
+  }
+}
+
+void xeRtlSetCriticalSectionEvent(X_RTL_CRITICAL_SECTION* cs) {
+  auto signal_state = GetCriticalSectionSignalState(cs);
+  xe::atomic_exchange(int32_t(xe::byte_swap(uint32_t(1))),
+                      reinterpret_cast<volatile int32_t*>(signal_state));
+  xe::threading::FutexWake(signal_state);
+}
+
 void xeRtlInitializeCriticalSection(X_RTL_CRITICAL_SECTION* cs,
                                     uint32_t cs_ptr) {
   cs->header.type = 1;      // EventSynchronizationObject (auto reset)
@@ -437,9 +438,8 @@ void RtlEnterCriticalSection(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
   }
 
   if (xe::atomic_inc(&cs->lock_count) != 0) {
-    // Create a full waiter.
-    xeKeWaitForSingleObject(reinterpret_cast<void*>(cs.host_address()), 8, 0, 0,
-                            nullptr);
+    // Wait for the owner to hand the lock over.
+    xeRtlWaitForCriticalSectionEvent(cs);
   }
 
   assert_true(cs->owning_thread == 0);
@@ -468,8 +468,8 @@ dword_result_t RtlTryEnterCriticalSection(
   // Failed to acquire lock.
   return 0;
 }
-DECLARE_XBOXKRNL_EXPORT2(RtlTryEnterCriticalSection, kNone, kImplemented,
-                         kHighFrequency);
+DECLARE_XBOXKRNL_EXPORT3(RtlTryEnterCriticalSection, kNone, kImplemented,
+                         kHighFrequency, kFastCall);
 
 void RtlLeaveCriticalSection(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
   assert_true(cs->owning_thread == XThread::GetCurrentThread()->guest_object());
@@ -487,11 +487,11 @@ void RtlLeaveCriticalSection(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
   cs->owning_thread = 0;
   if (xe::atomic_dec(&cs->lock_count) != -1) {
     // There were waiters - wake one of them.
-    xeKeSetEvent(reinterpret_cast<X_KEVENT*>(cs.host_address()), 1, 0);
+    xeRtlSetCriticalSectionEvent(cs);
   }
 }
-DECLARE_XBOXKRNL_EXPORT2(RtlLeaveCriticalSection, kNone, kImplemented,
-                         kHighFrequency);
+DECLARE_XBOXKRNL_EXPORT3(RtlLeaveCriticalSection, kNone, kImplemented,
+                         kHighFrequency, kFastCall);
 
 struct X_TIME_FIELDS {
   xe::be<uint16_t> year;
@@ -288,8 +288,8 @@ DECLARE_XBOXKRNL_EXPORT1(KeSetDisableBoostThread, kThreading, kImplemented);
 dword_result_t KeGetCurrentProcessType() {
   return kernel_state()->process_type();
 }
-DECLARE_XBOXKRNL_EXPORT2(KeGetCurrentProcessType, kThreading, kImplemented,
-                         kHighFrequency);
+DECLARE_XBOXKRNL_EXPORT3(KeGetCurrentProcessType, kThreading, kImplemented,
+                         kHighFrequency, kFastCall);
 
 void KeSetCurrentProcessType(dword_t type) {
   // One of X_PROCTYPE_?
@@ -304,8 +304,8 @@ dword_result_t KeQueryPerformanceFrequency() {
   uint64_t result = Clock::guest_tick_frequency();
   return static_cast<uint32_t>(result);
 }
-DECLARE_XBOXKRNL_EXPORT2(KeQueryPerformanceFrequency, kThreading, kImplemented,
-                         kHighFrequency);
+DECLARE_XBOXKRNL_EXPORT3(KeQueryPerformanceFrequency, kThreading, kImplemented,
+                         kHighFrequency, kFastCall);
 
 dword_result_t KeDelayExecutionThread(dword_t processor_mode, dword_t alertable,
                                       lpqword_t interval_ptr) {
@@ -331,7 +331,8 @@ void KeQuerySystemTime(lpqword_t time_ptr) {
     *time_ptr = time;
   }
 }
-DECLARE_XBOXKRNL_EXPORT1(KeQuerySystemTime, kThreading, kImplemented);
+DECLARE_XBOXKRNL_EXPORT2(KeQuerySystemTime, kThreading, kImplemented,
+                         kFastCall);
 
 // https://msdn.microsoft.com/en-us/library/ms686801
 dword_result_t KeTlsAlloc() {
@@ -364,8 +365,8 @@ dword_result_t KeTlsGetValue(dword_t tls_index) {
 
   return 0;
 }
-DECLARE_XBOXKRNL_EXPORT2(KeTlsGetValue, kThreading, kImplemented,
-                         kHighFrequency);
+DECLARE_XBOXKRNL_EXPORT3(KeTlsGetValue, kThreading, kImplemented,
+                         kHighFrequency, kFastCall);
 
 // https://msdn.microsoft.com/en-us/library/ms686818
 dword_result_t KeTlsSetValue(dword_t tls_index, dword_t tls_value) {
@@ -377,7 +378,7 @@ dword_result_t KeTlsSetValue(dword_t tls_index, dword_t tls_value) {
 
   return 0;
 }
-DECLARE_XBOXKRNL_EXPORT1(KeTlsSetValue, kThreading, kImplemented);
+DECLARE_XBOXKRNL_EXPORT2(KeTlsSetValue, kThreading, kImplemented, kFastCall);
 
 void KeInitializeEvent(pointer_t<X_KEVENT> event_ptr, dword_t event_type,
                        dword_t initial_state) {
@@ -957,8 +958,8 @@ void KeReleaseSpinLockFromRaisedIrql(lpdword_t lock_ptr) {
   auto lock = reinterpret_cast<uint32_t*>(lock_ptr.host_address());
   xe::atomic_dec(lock);
 }
-DECLARE_XBOXKRNL_EXPORT2(KeReleaseSpinLockFromRaisedIrql, kThreading,
-                         kImplemented, kHighFrequency);
+DECLARE_XBOXKRNL_EXPORT3(KeReleaseSpinLockFromRaisedIrql, kThreading,
+                         kImplemented, kHighFrequency, kFastCall);
 
 void KeEnterCriticalRegion() { XThread::EnterCriticalRegion(); }
 DECLARE_XBOXKRNL_EXPORT2(KeEnterCriticalRegion, kThreading, kImplemented,
@@ -976,8 +977,8 @@ dword_result_t KeRaiseIrqlToDpcLevel() {
   auto old_value = kernel_state()->processor()->RaiseIrql(cpu::Irql::DPC);
   return (uint32_t)old_value;
 }
-DECLARE_XBOXKRNL_EXPORT2(KeRaiseIrqlToDpcLevel, kThreading, kImplemented,
-                         kHighFrequency);
+DECLARE_XBOXKRNL_EXPORT3(KeRaiseIrqlToDpcLevel, kThreading, kImplemented,
+                         kHighFrequency, kFastCall);
 
 void KfLowerIrql(dword_t old_value) {
   kernel_state()->processor()->LowerIrql(
@@ -140,6 +140,12 @@ X_STATUS XFile::Read(uint32_t buffer_guest_address, uint32_t buffer_length,
                 memory::PageAccess::kReadWrite) {
           result = X_STATUS_ACCESS_VIOLATION;
         } else {
+          if (!buffer_physical_heap) {
+            // Translated code in the buffer is write-protected, and the read
+            // would fail instead of causing an access violation.
+            memory()->TriggerCodeCallbacks(buffer_guest_address,
+                                           buffer_length);
+          }
           result = file_->ReadSync(
               buffer_physical_heap
                   ? memory()->TranslatePhysical(
@@ -9,6 +9,8 @@
 
 #include "xenia/kernel/xthread.h"
 
+#include <algorithm>
+#include <charconv>
 #include <cstring>
 
 #ifdef XE_PLATFORM_WIN32
@@ -22,6 +24,7 @@
 #include "xenia/base/math.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
+#include "xenia/base/utf8.h"
 #include "xenia/cpu/breakpoint.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
 #include "xenia/cpu/processor.h"
@@ -35,6 +38,29 @@ DEFINE_bool(ignore_thread_priorities, true,
             "Ignores game-specified thread priorities.", "Kernel");
 DEFINE_bool(ignore_thread_affinities, true,
             "Ignores game-specified thread affinities.", "Kernel");
+DEFINE_bool(pin_guest_threads, false,
+            "Runs the threads on each guest hardware thread on their own set "
+            "of host cores, keeping the host worker threads (such as the XMA "
+            "decoder, audio and GPU command processor) on other cores, and "
+            "applies game-specified thread priorities.",
+            "Kernel");
+DEFINE_string(guest_thread_host_cores, "",
+              "With --pin_guest_threads, the host cores for each of the 6 "
+              "guest hardware threads, separated by ';', each as core numbers "
+              "or ranges separated by ',', such as 2-3;4-5;6-7;8-9;10-11;12-"
+              "13. By default, the cores not reserved for the host worker "
+              "threads are split evenly.",
+              "Kernel");
+DEFINE_string(host_worker_thread_cores, "",
+              "With --pin_guest_threads, the host cores for the host worker "
+              "threads, as core numbers or ranges separated by ',', such as "
+              "0-1. By default, the first 2 cores on hosts with at least 8, "
+              "the first 1 with 7, or all the cores otherwise.",
+              "Kernel");
+DEFINE_bool(log_thread_statistics, false,
+            "Logs the host runtime and context switch counts of each thread "
+            "when it exits or the title is terminated.",
+            "Kernel");
 
 namespace xe {
 namespace kernel {
@@ -156,6 +182,104 @@ void XThread::set_name(const std::string_view name) {
   }
 }
 
+// Host cores each guest hardware thread and the host worker threads run on
+// with --pin_guest_threads.
+struct HostCoreMasks {
+  uint64_t guest[6];
+  uint64_t host_workers;
+};
+
+// Parses host core numbers and ranges such as "0,2-3", returning 0 if invalid.
+static uint64_t ParseHostCoreMask(const std::string_view cores,
+                                  uint32_t core_count) {
+  auto parse_core = [](const std::string_view number, uint32_t& core_out) {
+    auto [end, error] = std::from_chars(
+        number.data(), number.data() + number.size(), core_out);
+    return error == std::errc() && end == number.data() + number.size();
+  };
+  uint64_t mask = 0;
+  for (auto range : xe::utf8::split(cores, ",", true)) {
+    auto separator = range.find('-');
+    uint32_t first, last;
+    if (!parse_core(range.substr(0, separator), first)) {
+      return 0;
+    }
+    if (separator == std::string_view::npos) {
+      last = first;
+    } else if (!parse_core(range.substr(separator + 1), last)) {
+      return 0;
+    }
+    if (first > last || last >= core_count) {
+      return 0;
+    }
+    for (uint32_t core = first; core <= last; ++core) {
+      mask |= uint64_t(1) << core;
+    }
+  }
+  return mask;
+}
+
+static HostCoreMasks ComputeHostCoreMasks() {
+  HostCoreMasks masks;
+  uint32_t core_count =
+      std::min(xe::threading::logical_processor_count(), uint32_t(64));
+  uint64_t all_cores = core_count >= 64 ? ~uint64_t(0)
+                                        : (uint64_t(1) << core_count) - 1;
+
+  // By default, leave the first cores to the host workers and split the rest.
+  uint32_t reserved_count = core_count >= 8 ? 2 : (core_count == 7 ? 1 : 0);
+  uint32_t guest_core_count = core_count - reserved_count;
+  for (uint32_t i = 0; i < 6; ++i) {
+    if (guest_core_count >= 6) {
+      uint32_t first = reserved_count + i * guest_core_count / 6;
+      uint32_t end = reserved_count + (i + 1) * guest_core_count / 6;
+      masks.guest[i] = ((uint64_t(1) << (end - first)) - 1) << first;
+    } else {
+      masks.guest[i] = uint64_t(1) << (reserved_count + i % guest_core_count);
+    }
+  }
+  masks.host_workers =
+      reserved_count ? (uint64_t(1) << reserved_count) - 1 : all_cores;
+
+  if (!cvars::guest_thread_host_cores.empty()) {
+    auto lists = xe::utf8::split(cvars::guest_thread_host_cores, ";");
+    HostCoreMasks parsed_masks = masks;
+    bool valid = lists.size() == 6;
+    for (size_t i = 0; valid && i < 6; ++i) {
+      parsed_masks.guest[i] = ParseHostCoreMask(lists[i], core_count);
+      valid = parsed_masks.guest[i] != 0;
+    }
+    if (valid) {
+      std::memcpy(masks.guest, parsed_masks.guest, sizeof(masks.guest));
+    } else {
+      XELOGE("Invalid --guest_thread_host_cores {}, using the defaults",
+             cvars::guest_thread_host_cores);
+    }
+  }
+  if (!cvars::host_worker_thread_cores.empty()) {
+    uint64_t mask =
+        ParseHostCoreMask(cvars::host_worker_thread_cores, core_count);
+    if (mask) {
+      masks.host_workers = mask;
+    } else {
+      XELOGE("Invalid --host_worker_thread_cores {}, using the defaults",
+             cvars::host_worker_thread_cores);
+    }
+  }
+
+  XELOGI(
+      "Guest hardware thread host cores: {:X} {:X} {:X} {:X} {:X} {:X}, host "
+      "worker threads: {:X}",
+      masks.guest[0], masks.guest[1], masks.guest[2], masks.guest[3],
+      masks.guest[4], masks.guest[5], masks.host_workers);
+  return masks;
+}
+
+static const HostCoreMasks& GetHostCoreMasks() {
+  static const HostCoreMasks masks = ComputeHostCoreMasks();
+  return masks;
+}
+
 static uint8_t next_cpu = 0;
 static uint8_t GetFakeCpuNumber(uint8_t proc_mask) {
   // NOTE: proc_mask is logical processors, not physical processors or cores.
@@ -462,6 +586,8 @@ X_STATUS XThread::Exit(int exit_code) {
   // Notify processor of our exit.
   emulator()->processor()->OnThreadExit(thread_id_);
 
+  LogStatistics();
+
   // NOTE: unless PlatformExit fails, expect it to never return!
   current_xthread_tls_ = nullptr;
   current_thread_ = nullptr;
@@ -740,7 +866,7 @@ void XThread::SetPriority(int32_t increment) {
   } else {
     target_priority = xe::threading::ThreadPriority::kNormal;
   }
-  if (!cvars::ignore_thread_priorities) {
+  if (cvars::pin_guest_threads || !cvars::ignore_thread_priorities) {
     thread_->set_priority(target_priority);
   }
 }
@@ -768,7 +894,11 @@ void XThread::SetActiveCpu(uint8_t cpu_index) {
     thread_object.current_cpu = cpu_index;
   }
 
-  if (xe::threading::logical_processor_count() >= 6) {
+  if (cvars::pin_guest_threads) {
+    const HostCoreMasks& masks = GetHostCoreMasks();
+    thread_->set_affinity_mask(is_guest_thread() ? masks.guest[cpu_index]
+                                                 : masks.host_workers);
+  } else if (xe::threading::logical_processor_count() >= 6) {
     if (!cvars::ignore_thread_affinities) {
       thread_->set_affinity_mask(uint64_t(1) << cpu_index);
     }
@@ -777,6 +907,23 @@ void XThread::SetActiveCpu(uint8_t cpu_index) {
   }
 }
 
+void XThread::LogStatistics() {
+  if (!cvars::log_thread_statistics || !thread_) {
+    return;
+  }
+  xe::threading::ThreadStatistics statistics;
+  if (!thread_->QueryStatistics(&statistics)) {
+    return;
+  }
+  XELOGI(
+      "Thread {} on CPU {}: {} ms user, {} ms kernel, {} voluntary and {} "
+      "involuntary context switches",
+      thread_name_, active_cpu(), statistics.user_time.count() / 1000,
+      statistics.kernel_time.count() / 1000,
+      statistics.voluntary_context_switches,
+      statistics.involuntary_context_switches);
+}
+
 bool XThread::GetTLSValue(uint32_t slot, uint32_t* value_out) {
   if (slot * 4 > tls_total_size_) {
     return false;
@@ -217,6 +217,10 @@ class XThread : public XObject, public cpu::Thread {
   uint8_t active_cpu() const;
   void SetActiveCpu(uint8_t cpu_index);
 
+  // Logs the runtime and context switch counts of the host thread if
+  // --log_thread_statistics is enabled.
+  void LogStatistics();
+
   bool GetTLSValue(uint32_t slot, uint32_t* value_out);
   bool SetTLSValue(uint32_t slot, uint32_t value);
 
@@ -10,10 +10,15 @@
 #include "xenia/memory.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cstring>
+#include <functional>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 
 #include "third_party/fmt/include/fmt/format.h"
+#include "third_party/snappy/snappy.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
@@ -21,6 +26,7 @@
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/threading.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/mmio_handler.h"
 
 // TODO(benvanik): move xbox.h out
@@ -38,6 +44,14 @@ uint32_t get_page_count(uint32_t value, uint32_t page_size) {
   return xe::round_up(value, page_size) / page_size;
 }
 
+// Host commits replace the mapping on some hosts, so the advice is given again
+// for every committed range.
+void AdviseGuestHugePages(void* host_address, size_t length) {
+  if (xe::memory::IsHugePageBackingPreferred()) {
+    xe::memory::AdviseHugePages(host_address, length);
+  }
+}
+
 /**
  * Memory map:
  * 0x00000000 - 0x3FFFFFFF (1024mb) - virtual 4k pages
@@ -102,6 +116,9 @@ Memory::~Memory() {
   for (auto invalidation_callback : physical_memory_invalidation_callbacks_) {
     delete invalidation_callback;
   }
+  for (auto invalidation_callback : code_invalidation_callbacks_) {
+    delete invalidation_callback;
+  }
 
   heaps_.v00000000.Dispose();
   heaps_.v40000000.Dispose();
@@ -289,6 +306,10 @@ int Memory::MapViews(uint8_t* mapping_base) {
       UnmapViews();
       return 1;
     }
+    AdviseGuestHugePages(
+        views_.all_views[n],
+        map_info[n].virtual_address_end - map_info[n].virtual_address_start +
+            1);
   }
   return 0;
 }
@@ -401,18 +422,21 @@ uint32_t Memory::SearchAligned(uint32_t start, uint32_t end,
   auto p = TranslateVirtual<const uint32_t*>(start);
   auto pe = TranslateVirtual<const uint32_t*>(end);
   while (p != pe) {
-    if (*p == values[0]) {
-      const uint32_t* pc = p + 1;
-      size_t matched = 1;
-      for (size_t n = 1; n < value_count; n++, pc++) {
-        if (*pc != values[n]) {
-          break;
-        }
-        matched++;
-      }
-      if (matched == value_count) {
-        return HostToGuestVirtual(p);
+    // Skip to the next occurrence of the first value.
+    p += xe::find_32(p, values[0], pe - p);
+    if (p == pe) {
+      break;
+    }
+    const uint32_t* pc = p + 1;
+    size_t matched = 1;
+    for (size_t n = 1; n < value_count; n++, pc++) {
+      if (*pc != values[n]) {
+        break;
       }
+      matched++;
+    }
+    if (matched == value_count) {
+      return HostToGuestVirtual(p);
     }
     p++;
   }
@@ -451,6 +475,15 @@ bool Memory::AccessViolationCallback(
   }
   uint32_t virtual_address = HostToGuestVirtual(host_address);
   BaseHeap* heap = LookupHeap(virtual_address);
+  if (heap->heap_type() == HeapType::kGuestXex) {
+    // Write to translated guest code.
+    if (!is_write) {
+      return false;
+    }
+    auto virtual_heap = static_cast<VirtualHeap*>(heap);
+    return virtual_heap->TriggerCodeCallbacks(
+        std::move(global_lock_locked_once), virtual_address, 1);
+  }
   if (heap->heap_type() != HeapType::kGuestPhysical) {
     return false;
   }
@@ -512,6 +545,52 @@ void Memory::UnregisterPhysicalMemoryInvalidationCallback(
   delete entry;
 }
 
+void* Memory::RegisterCodeInvalidationCallback(
+    CodeInvalidationCallback callback, void* callback_context) {
+  auto entry = new std::pair<CodeInvalidationCallback, void*>(
+      callback, callback_context);
+  auto lock = global_critical_region_.Acquire();
+  code_invalidation_callbacks_.push_back(entry);
+  return entry;
+}
+
+void Memory::UnregisterCodeInvalidationCallback(void* callback_handle) {
+  auto entry = reinterpret_cast<std::pair<CodeInvalidationCallback, void*>*>(
+      callback_handle);
+  {
+    auto lock = global_critical_region_.Acquire();
+    auto it = std::find(code_invalidation_callbacks_.begin(),
+                        code_invalidation_callbacks_.end(), entry);
+    assert_true(it != code_invalidation_callbacks_.end());
+    if (it != code_invalidation_callbacks_.end()) {
+      code_invalidation_callbacks_.erase(it);
+    }
+  }
+  delete entry;
+}
+
+void Memory::WatchCode(uint32_t virtual_address, uint32_t length) {
+  BaseHeap* heap = LookupHeap(virtual_address);
+  if (heap && heap->heap_type() == HeapType::kGuestXex) {
+    static_cast<VirtualHeap*>(heap)->WatchCode(virtual_address, length);
+  }
+}
+
+void Memory::TriggerCodeCallbacks(uint32_t virtual_address, uint32_t length) {
+  uint64_t start = virtual_address;
+  uint64_t end = start + length;
+  for (VirtualHeap* heap : {&heaps_.v80000000, &heaps_.v90000000}) {
+    uint64_t heap_start = std::max(start, uint64_t(heap->heap_base()));
+    uint64_t heap_end =
+        std::min(end, uint64_t(heap->heap_base()) + heap->heap_size());
+    if (heap_start < heap_end) {
+      heap->TriggerCodeCallbacks(global_critical_region_.Acquire(),
+                                 uint32_t(heap_start),
+                                 uint32_t(heap_end - heap_start));
+    }
+  }
+}
+
 void Memory::EnablePhysicalMemoryAccessCallbacks(
     uint32_t physical_address, uint32_t length,
     bool enable_invalidation_notifications, bool enable_data_providers) {
@@ -580,24 +659,53 @@ void Memory::DumpMap() {
   XELOGE("");
 }
 
-bool Memory::Save(ByteStream* stream) {
+bool Memory::Save(ByteStream* stream, bool incremental) {
   XELOGD("Serializing memory...");
-  heaps_.v00000000.Save(stream);
-  heaps_.v40000000.Save(stream);
-  heaps_.v80000000.Save(stream);
-  heaps_.v90000000.Save(stream);
-  heaps_.physical.Save(stream);
+  if (!heaps_.v00000000.Save(stream, incremental) ||
+      !heaps_.v40000000.Save(stream, incremental) ||
+      !heaps_.v80000000.Save(stream, incremental) ||
+      !heaps_.v90000000.Save(stream, incremental) ||
+      !heaps_.physical.Save(stream, incremental)) {
+    return false;
+  }
+
+  return true;
+}
+
+void Memory::CaptureSnapshot(Snapshot* snapshot) {
+  XELOGD("Capturing memory...");
+  heaps_.v00000000.CaptureSnapshot(&snapshot->v00000000);
+  heaps_.v40000000.CaptureSnapshot(&snapshot->v40000000);
+  heaps_.v80000000.CaptureSnapshot(&snapshot->v80000000);
+  heaps_.v90000000.CaptureSnapshot(&snapshot->v90000000);
+  heaps_.physical.CaptureSnapshot(&snapshot->physical);
+}
+
+bool Memory::SaveSnapshot(const Snapshot& snapshot, ByteStream* stream,
+                          bool incremental) {
+  XELOGD("Serializing memory snapshot...");
+  if (!heaps_.v00000000.SaveSnapshot(snapshot.v00000000, stream,
+                                     incremental) ||
+      !heaps_.v40000000.SaveSnapshot(snapshot.v40000000, stream,
+                                     incremental) ||
+      !heaps_.v80000000.SaveSnapshot(snapshot.v80000000, stream,
+                                     incremental) ||
+      !heaps_.v90000000.SaveSnapshot(snapshot.v90000000, stream,
+                                     incremental) ||
+      !heaps_.physical.SaveSnapshot(snapshot.physical, stream, incremental)) {
+    return false;
+  }
 
   return true;
 }
 
 bool Memory::Restore(ByteStream* stream) {
   XELOGD("Restoring memory...");
-  heaps_.v00000000.Restore(stream);
-  heaps_.v40000000.Restore(stream);
-  heaps_.v80000000.Restore(stream);
-  heaps_.v90000000.Restore(stream);
-  heaps_.physical.Restore(stream);
+  if (!heaps_.v00000000.Restore(stream) || !heaps_.v40000000.Restore(stream) ||
+      !heaps_.v80000000.Restore(stream) || !heaps_.v90000000.Restore(stream) ||
+      !heaps_.physical.Restore(stream)) {
+    return false;
+  }
 
   return true;
 }
@@ -650,6 +758,10 @@ void BaseHeap::Initialize(Memory* memory, uint8_t* membase, HeapType heap_type,
   page_size_ = page_size;
   host_address_offset_ = host_address_offset;
   page_table_.resize(heap_size / page_size);
+  free_page_run_leaf_count_ =
+      xe::next_pow2(std::max(uint32_t(page_table_.size()), uint32_t(1)));
+  free_page_run_nodes_.resize(free_page_run_leaf_count_);
+  BuildFreePageRunIndex();
 }
 
 void BaseHeap::Dispose() {
@@ -745,85 +857,581 @@ uint32_t BaseHeap::GetUnreservedPageCount() {
   return count;
 }
 
-bool BaseHeap::Save(ByteStream* stream) {
+namespace {
+// How the contents of a committed page are stored in a save state.
+enum class SavedPageType : uint8_t {
+  // Compressed in one of the chunks of consecutive pages.
+  kData,
+  // Only contains zeros.
+  kZero,
+  // Same as an earlier kData page in the heap.
+  kDuplicate,
+  // Same as in the previous save state, which is restored first.
+  kUnchanged,
+};
+
+// Chunks are compressed independently, so they can be spread across threads,
+// but they must be large enough for snappy to find matches.
+constexpr uint32_t kSavedChunkMaxSize = 256 * 1024;
+// Number of chunks compressed at once - bounds the memory taken by the
+// compressed data before it's written.
+constexpr uint32_t kSavedChunkBatchSize = 64;
+
+// Calls function(index) for each index in [0, count) on all host cores.
+template <typename F>
+void ParallelFor(uint32_t count, F function) {
+  std::atomic<uint32_t> next_index(0);
+  auto worker = [&]() {
+    uint32_t index;
+    while ((index = next_index.fetch_add(1, std::memory_order_relaxed)) <
+           count) {
+      function(index);
+    }
+  };
+  uint32_t thread_count =
+      std::min(xe::threading::logical_processor_count(), count);
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i < thread_count; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// Calls function(first, count, key) for each run of consecutive indices in
+// [0, count) for which key(index) returns the same value.
+template <typename K, typename F>
+void ForEachRun(uint32_t count, K key, F function) {
+  for (uint32_t i = 0; i < count;) {
+    uint32_t run_start = i;
+    auto run_key = key(i);
+    while (++i < count && key(i) == run_key) {
+    }
+    function(run_start, i - run_start, run_key);
+  }
+}
+
+bool IsZeroPage(const uint8_t* data, uint32_t page_size) {
+  auto qwords = reinterpret_cast<const uint64_t*>(data);
+  for (uint32_t i = 0; i < page_size / sizeof(uint64_t); ++i) {
+    if (qwords[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+void BaseHeap::SetUnreadablePagesAccess(xe::memory::PageAccess access) {
+  ForEachRun(
+      uint32_t(page_table_.size()),
+      [this](uint32_t i) {
+        auto& page = page_table_[i];
+        return (page.state & kMemoryAllocationCommit) &&
+               !(page.current_protect & kMemoryProtectRead);
+      },
+      [this, access](uint32_t first, uint32_t count, bool unreadable) {
+        if (unreadable) {
+          xe::memory::Protect(TranslateRelative(first * page_size_),
+                              count * page_size_, access, nullptr);
+        }
+      });
+}
+
+bool BaseHeap::Save(ByteStream* stream, bool incremental) {
   XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    stream->Write(page.qword);
-    if (!page.state) {
-      // Unallocated.
-      continue;
+  std::vector<uint32_t> committed_pages;
+  for (uint32_t i = 0; i < page_table_.size(); ++i) {
+    if (page_table_[i].state & kMemoryAllocationCommit) {
+      committed_pages.push_back(i);
     }
+  }
 
-    // TODO(DrChat): write compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = TranslateRelative(i * page_size_);
+  // Make the committed pages readable while they're being saved.
+  SetUnreadablePagesAccess(memory::PageAccess::kReadOnly);
+  bool result = SavePages(
+      stream, page_table_, committed_pages,
+      [&](uint32_t i) {
+        return TranslateRelative<const uint8_t*>(committed_pages[i] *
+                                                 page_size_);
+      },
+      incremental);
+  SetUnreadablePagesAccess(memory::PageAccess::kNoAccess);
+  return result;
+}
+
+void BaseHeap::CaptureSnapshot(Snapshot* snapshot) {
+  snapshot->page_table = page_table_;
+  snapshot->committed_pages.clear();
+  for (uint32_t i = 0; i < page_table_.size(); ++i) {
+    if (page_table_[i].state & kMemoryAllocationCommit) {
+      snapshot->committed_pages.push_back(i);
+    }
+  }
+
+  // Copying is bandwidth-bound, unlike hashing and compressing, so this is
+  // much faster than Save.
+  uint32_t committed_count = uint32_t(snapshot->committed_pages.size());
+  snapshot->contents.reset(new uint8_t[size_t(committed_count) * page_size_]);
+  SetUnreadablePagesAccess(memory::PageAccess::kReadOnly);
+  const uint32_t copy_block_size = 256;
+  ParallelFor((committed_count + copy_block_size - 1) / copy_block_size,
+              [&](uint32_t block) {
+                uint32_t end = std::min((block + 1) * copy_block_size,
+                                        committed_count);
+                for (uint32_t i = block * copy_block_size; i < end; ++i) {
+                  std::memcpy(snapshot->contents.get() + size_t(i) * page_size_,
+                              TranslateRelative(snapshot->committed_pages[i] *
+                                                page_size_),
+                              page_size_);
+                }
+              });
+  SetUnreadablePagesAccess(memory::PageAccess::kNoAccess);
+}
+
+bool BaseHeap::SaveSnapshot(const Snapshot& snapshot, ByteStream* stream,
+                            bool incremental) {
+  XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
+
+  return SavePages(
+      stream, snapshot.page_table, snapshot.committed_pages,
+      [&](uint32_t i) {
+        return snapshot.contents.get() + size_t(i) * page_size_;
+      },
+      incremental);
+}
 
-      memory::PageAccess old_access;
-      memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                      &old_access);
+bool BaseHeap::SavePages(
+    ByteStream* stream, const std::vector<PageEntry>& page_table,
+    const std::vector<uint32_t>& committed_pages,
+    const std::function<const uint8_t*(uint32_t i)>& get_page_data,
+    bool incremental) {
+  auto has_space = [stream](size_t size) {
+    if (stream->data_length() - stream->offset() < size) {
+      XELOGE("Out of space for the saved memory");
+      return false;
+    }
+    return true;
+  };
 
-      stream->Write(addr, page_size_);
+  uint32_t page_count = uint32_t(page_table.size());
+  if (!has_space(sizeof(uint64_t) * page_count)) {
+    return false;
+  }
+  for (uint32_t i = 0; i < page_count; ++i) {
+    stream->Write(page_table[i].qword);
+  }
+  uint32_t committed_count = uint32_t(committed_pages.size());
+
+  // Hash the pages, with 0 reserved for zero pages.
+  std::vector<uint64_t> hashes(committed_count);
+  const uint32_t hash_block_size = 256;
+  ParallelFor((committed_count + hash_block_size - 1) / hash_block_size,
+              [&](uint32_t block) {
+                uint32_t end = std::min((block + 1) * hash_block_size,
+                                        committed_count);
+                for (uint32_t i = block * hash_block_size; i < end; ++i) {
+                  const uint8_t* data = get_page_data(i);
+                  hashes[i] =
+                      IsZeroPage(data, page_size_)
+                          ? 0
+                          : std::max(XXH3_64bits(data, page_size_),
+                                     uint64_t(1));
+                }
+              });
+
+  // Classify the pages, and gather the data pages into chunks.
+  struct SavedChunk {
+    uint32_t first_committed_index;
+    uint32_t page_number;
+    uint32_t page_count;
+  };
+  uint32_t chunk_max_page_count =
+      std::max(kSavedChunkMaxSize / page_size_, uint32_t(1));
+  std::vector<SavedPageType> types(committed_count);
+  std::vector<uint32_t> duplicate_sources;
+  std::vector<SavedChunk> chunks;
+  // Indices of the data pages in committed_pages.
+  std::unordered_map<uint64_t, uint32_t> data_pages_by_hash;
+  for (uint32_t i = 0; i < committed_count; ++i) {
+    uint32_t page_number = committed_pages[i];
+    uint64_t hash = hashes[i];
+    if (!hash) {
+      types[i] = SavedPageType::kZero;
+      continue;
+    }
+    if (incremental && page_number < saved_page_hashes_.size() &&
+        saved_page_hashes_[page_number] == hash) {
+      types[i] = SavedPageType::kUnchanged;
+      continue;
+    }
+    auto data_page = data_pages_by_hash.emplace(hash, i);
+    if (!data_page.second &&
+        !std::memcmp(get_page_data(data_page.first->second), get_page_data(i),
+                     page_size_)) {
+      types[i] = SavedPageType::kDuplicate;
+      duplicate_sources.push_back(committed_pages[data_page.first->second]);
+      continue;
+    }
+    types[i] = SavedPageType::kData;
+    if (!chunks.empty() &&
+        chunks.back().page_number + chunks.back().page_count == page_number &&
+        chunks.back().page_count < chunk_max_page_count) {
+      ++chunks.back().page_count;
+    } else {
+      chunks.push_back({i, page_number, 1});
+    }
+  }
 
-      memory::Protect(addr, page_size_, old_access, nullptr);
+  if (!has_space(sizeof(uint32_t) * 3 +
+                 sizeof(SavedPageType) * committed_count +
+                 sizeof(uint32_t) * duplicate_sources.size())) {
+    return false;
+  }
+  stream->Write(committed_count);
+  stream->Write(types.data(), committed_count * sizeof(SavedPageType));
+  stream->Write(uint32_t(duplicate_sources.size()));
+  stream->Write(duplicate_sources.data(),
+                duplicate_sources.size() * sizeof(uint32_t));
+  stream->Write(uint32_t(chunks.size()));
+  std::vector<std::vector<char>> compressed_chunks(kSavedChunkBatchSize);
+  for (size_t batch_start = 0; batch_start < chunks.size();
+       batch_start += kSavedChunkBatchSize) {
+    uint32_t batch_chunk_count = uint32_t(
+        std::min(chunks.size() - batch_start, size_t(kSavedChunkBatchSize)));
+    ParallelFor(batch_chunk_count, [&](uint32_t i) {
+      const SavedChunk& chunk = chunks[batch_start + i];
+      size_t size = chunk.page_count * page_size_;
+      auto& compressed_chunk = compressed_chunks[i];
+      compressed_chunk.resize(snappy::MaxCompressedLength(size));
+      size_t compressed_size;
+      snappy::RawCompress(
+          reinterpret_cast<const char*>(
+              get_page_data(chunk.first_committed_index)),
+          size, compressed_chunk.data(), &compressed_size);
+      compressed_chunk.resize(compressed_size);
+    });
+    for (uint32_t i = 0; i < batch_chunk_count; ++i) {
+      const SavedChunk& chunk = chunks[batch_start + i];
+      const auto& compressed_chunk = compressed_chunks[i];
+      if (!has_space(sizeof(uint32_t) * 3 + compressed_chunk.size())) {
+        return false;
+      }
+      stream->Write(chunk.page_number);
+      stream->Write(chunk.page_count);
+      stream->Write(uint32_t(compressed_chunk.size()));
+      stream->Write(compressed_chunk.data(), compressed_chunk.size());
     }
   }
 
+  saved_page_hashes_.assign(page_count, 0);
+  for (uint32_t i = 0; i < committed_count; ++i) {
+    saved_page_hashes_[committed_pages[i]] = hashes[i];
+  }
+
   return true;
 }
 
 bool BaseHeap::Restore(ByteStream* stream) {
   XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
+  // Commit the memory if it isn't already, and make the pages writable until
+  // their contents are restored. We do not need to reserve any memory, as the
+  // mapping has already taken care of that.
+  enum class RestoredPageState { kUncommitted, kCommitted, kNewlyCommitted };
+  uint32_t page_count = uint32_t(page_table_.size());
+  std::vector<RestoredPageState> page_states(page_count);
+  std::vector<uint32_t> committed_pages;
+  for (uint32_t i = 0; i < page_count; ++i) {
     auto& page = page_table_[i];
+    bool was_committed = (page.state & kMemoryAllocationCommit) != 0;
     page.qword = stream->Read<uint64_t>();
-    if (!page.state) {
-      // Unallocated.
-      continue;
+    if (page.state & kMemoryAllocationCommit) {
+      committed_pages.push_back(i);
+      page_states[i] = was_committed ? RestoredPageState::kCommitted
+                                     : RestoredPageState::kNewlyCommitted;
     }
+  }
+  ForEachRun(
+      page_count, [&](uint32_t i) { return page_states[i]; },
+      [this](uint32_t first, uint32_t count, RestoredPageState state) {
+        void* addr = TranslateRelative(first * page_size_);
+        if (state == RestoredPageState::kNewlyCommitted) {
+          xe::memory::AllocFixed(addr, count * page_size_,
+                                 memory::AllocationType::kCommit,
+                                 memory::PageAccess::kReadWrite);
+          AdviseGuestHugePages(addr, count * page_size_);
+        } else if (state == RestoredPageState::kCommitted) {
+          xe::memory::Protect(addr, count * page_size_,
+                              memory::PageAccess::kReadWrite, nullptr);
+        }
+      });
+  BuildFreePageRunIndex();
 
-    memory::PageAccess page_access = memory::PageAccess::kNoAccess;
-    if ((page.current_protect & kMemoryProtectRead) &&
-        (page.current_protect & kMemoryProtectWrite)) {
-      page_access = memory::PageAccess::kReadWrite;
-    } else if (page.current_protect & kMemoryProtectRead) {
-      page_access = memory::PageAccess::kReadOnly;
+  uint32_t committed_count = stream->Read<uint32_t>();
+  if (committed_count != committed_pages.size()) {
+    XELOGE("Heap {:08X}: Saved page table doesn't match the page contents",
+           heap_base_);
+    return false;
+  }
+  std::vector<SavedPageType> types(committed_count);
+  stream->Read(types.data(), committed_count * sizeof(SavedPageType));
+  std::vector<uint32_t> duplicate_sources(stream->Read<uint32_t>());
+  stream->Read(duplicate_sources.data(),
+               duplicate_sources.size() * sizeof(uint32_t));
+
+  // Decompress the chunks directly into guest memory.
+  struct SavedChunk {
+    uint32_t page_number;
+    uint32_t page_count;
+    const char* compressed_data;
+    uint32_t compressed_size;
+  };
+  std::vector<SavedChunk> chunks(stream->Read<uint32_t>());
+  for (auto& chunk : chunks) {
+    chunk.page_number = stream->Read<uint32_t>();
+    chunk.page_count = stream->Read<uint32_t>();
+    chunk.compressed_size = stream->Read<uint32_t>();
+    chunk.compressed_data =
+        reinterpret_cast<const char*>(stream->data() + stream->offset());
+    stream->Advance(chunk.compressed_size);
+    if (chunk.page_number >= page_count ||
+        chunk.page_count > page_count - chunk.page_number) {
+      XELOGE("Heap {:08X}: Saved pages are out of bounds", heap_base_);
+      return false;
     }
-
-    // Commit the memory if it isn't already. We do not need to reserve any
-    // memory, as the mapping has already taken care of that.
-    if (page.state & kMemoryAllocationCommit) {
-      xe::memory::AllocFixed(TranslateRelative(i * page_size_), page_size_,
-                             memory::AllocationType::kCommit,
-                             memory::PageAccess::kReadWrite);
+  }
+  std::atomic<bool> chunks_valid(true);
+  ParallelFor(uint32_t(chunks.size()), [&](uint32_t i) {
+    const SavedChunk& chunk = chunks[i];
+    size_t size;
+    if (!snappy::GetUncompressedLength(chunk.compressed_data,
+                                       chunk.compressed_size, &size) ||
+        size != chunk.page_count * page_size_ ||
+        !snappy::RawUncompress(chunk.compressed_data, chunk.compressed_size,
+                               reinterpret_cast<char*>(TranslateRelative(
+                                   chunk.page_number * page_size_)))) {
+      chunks_valid = false;
     }
+  });
+  if (!chunks_valid) {
+    XELOGE("Heap {:08X}: Failed to decompress the saved pages", heap_base_);
+    return false;
+  }
 
-    // Now read into memory. We'll set R/W protection first, then set the
-    // protection back to its previous state.
-    // TODO(DrChat): read compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = TranslateRelative(i * page_size_);
-      xe::memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                          nullptr);
-
-      stream->Read(addr, page_size_);
-
-      xe::memory::Protect(addr, page_size_, page_access, nullptr);
+  size_t duplicate_index = 0;
+  for (uint32_t i = 0; i < committed_count; ++i) {
+    uint8_t* data = TranslateRelative(committed_pages[i] * page_size_);
+    switch (types[i]) {
+      case SavedPageType::kZero:
+        std::memset(data, 0, page_size_);
+        break;
+      case SavedPageType::kDuplicate: {
+        if (duplicate_index >= duplicate_sources.size() ||
+            duplicate_sources[duplicate_index] >= page_count) {
+          XELOGE("Heap {:08X}: Invalid saved duplicate page", heap_base_);
+          return false;
+        }
+        std::memcpy(
+            data,
+            TranslateRelative(duplicate_sources[duplicate_index++] *
+                              page_size_),
+            page_size_);
+      } break;
+      default:
+        // kData pages have been decompressed, kUnchanged pages have been
+        // restored from the previous save state.
+        break;
     }
   }
 
+  // Set the protection back to the saved state.
+  ForEachRun(
+      page_count,
+      [this](uint32_t i) {
+        auto& page = page_table_[i];
+        return (page.state & kMemoryAllocationCommit)
+                   ? int(ToPageAccess(page.current_protect))
+                   : -1;
+      },
+      [this](uint32_t first, uint32_t count, int access) {
+        if (access >= 0) {
+          xe::memory::Protect(TranslateRelative(first * page_size_),
+                              count * page_size_,
+                              memory::PageAccess(access), nullptr);
+        }
+      });
+
   return true;
 }
 
 void BaseHeap::Reset() {
   // TODO(DrChat): protect pages.
   std::memset(page_table_.data(), 0, sizeof(PageEntry) * page_table_.size());
+  BuildFreePageRunIndex();
   // TODO(Triang3l): Remove access callbacks from pages if this is a physical
   // memory heap.
 }
 
+BaseHeap::FreePageRunNode BaseHeap::GetFreePageRunNode(uint32_t node) const {
+  if (node < free_page_run_leaf_count_) {
+    return free_page_run_nodes_[node];
+  }
+  uint32_t page_number = node - free_page_run_leaf_count_;
+  uint32_t is_free =
+      page_number < page_table_.size() && !page_table_[page_number].state;
+  return {is_free, is_free, is_free};
+}
+
+void BaseHeap::BuildFreePageRunIndex() {
+  UpdateFreePageRunIndex(0, free_page_run_leaf_count_ - 1);
+}
+
+void BaseHeap::UpdateFreePageRunIndex(uint32_t start_page_number,
+                                      uint32_t end_page_number) {
+  // Recalculate the ancestors of the changed leaves level by level.
+  uint32_t first_node = (free_page_run_leaf_count_ + start_page_number) >> 1;
+  uint32_t last_node = (free_page_run_leaf_count_ + end_page_number) >> 1;
+  for (uint32_t child_page_count = 1; first_node;
+       first_node >>= 1, last_node >>= 1, child_page_count <<= 1) {
+    for (uint32_t node = first_node; node <= last_node; ++node) {
+      FreePageRunNode left = GetFreePageRunNode(node * 2);
+      FreePageRunNode right = GetFreePageRunNode(node * 2 + 1);
+      FreePageRunNode& parent = free_page_run_nodes_[node];
+      parent.prefix = left.prefix == child_page_count
+                          ? child_page_count + right.prefix
+                          : left.prefix;
+      parent.suffix = right.suffix == child_page_count
+                          ? child_page_count + left.suffix
+                          : right.suffix;
+      parent.longest = std::max(std::max(left.longest, right.longest),
+                                left.suffix + right.prefix);
+    }
+  }
+}
+
+uint32_t BaseHeap::FindFreePagesForward(uint32_t first_page_number,
+                                        uint32_t page_count) const {
+  uint32_t run = 0;
+  return FindFreePagesForward(1, 0, free_page_run_leaf_count_,
+                              first_page_number, page_count, run);
+}
+
+uint32_t BaseHeap::FindFreePagesForward(uint32_t node,
+                                        uint32_t node_page_number,
+                                        uint32_t node_page_count,
+                                        uint32_t first_page_number,
+                                        uint32_t page_count,
+                                        uint32_t& run) const {
+  if (node_page_number + node_page_count <= first_page_number) {
+    return UINT32_MAX;
+  }
+  if (node_page_number >= first_page_number) {
+    FreePageRunNode node_runs = GetFreePageRunNode(node);
+    if (run + node_runs.prefix >= page_count) {
+      return node_page_number - run;
+    }
+    if (node_runs.longest < page_count) {
+      run = node_runs.prefix == node_page_count ? run + node_page_count
+                                                : node_runs.suffix;
+      return UINT32_MAX;
+    }
+  }
+  // Only partially requested nodes and nodes containing the free run are
+  // descended into, never leaves.
+  assert_true(node < free_page_run_leaf_count_);
+  uint32_t child_page_count = node_page_count >> 1;
+  uint32_t result =
+      FindFreePagesForward(node * 2, node_page_number, child_page_count,
+                           first_page_number, page_count, run);
+  if (result != UINT32_MAX) {
+    return result;
+  }
+  return FindFreePagesForward(node * 2 + 1, node_page_number + child_page_count,
+                              child_page_count, first_page_number, page_count,
+                              run);
+}
+
+uint32_t BaseHeap::FindFreePagesBackward(uint32_t last_page_number,
+                                         uint32_t page_count) const {
+  uint32_t run = 0;
+  uint32_t run_last_page_number =
+      FindFreePagesBackward(1, 0, free_page_run_leaf_count_, last_page_number,
+                            page_count, run);
+  if (run_last_page_number == UINT32_MAX) {
+    return UINT32_MAX;
+  }
+  return run_last_page_number + 1 - page_count;
+}
+
+uint32_t BaseHeap::FindFreePagesBackward(uint32_t node,
+                                         uint32_t node_page_number,
+                                         uint32_t node_page_count,
+                                         uint32_t last_page_number,
+                                         uint32_t page_count,
+                                         uint32_t& run) const {
+  if (node_page_number > last_page_number) {
+    return UINT32_MAX;
+  }
+  uint32_t node_last_page_number = node_page_number + node_page_count - 1;
+  if (node_last_page_number <= last_page_number) {
+    FreePageRunNode node_runs = GetFreePageRunNode(node);
+    if (run + node_runs.suffix >= page_count) {
+      return node_last_page_number + run;
+    }
+    if (node_runs.longest < page_count) {
+      run = node_runs.suffix == node_page_count ? run + node_page_count
+                                                : node_runs.prefix;
+      return UINT32_MAX;
+    }
+  }
+  assert_true(node < free_page_run_leaf_count_);
+  uint32_t child_page_count = node_page_count >> 1;
+  uint32_t result = FindFreePagesBackward(
+      node * 2 + 1, node_page_number + child_page_count, child_page_count,
+      last_page_number, page_count, run);
+  if (result != UINT32_MAX) {
+    return result;
+  }
+  return FindFreePagesBackward(node * 2, node_page_number, child_page_count,
+                               last_page_number, page_count, run);
+}
+
+uint32_t BaseHeap::GetFreePageRunLength(uint32_t page_number) const {
+  uint32_t used_page_number =
+      FindUsedPageForward(1, 0, free_page_run_leaf_count_, page_number);
+  return std::min(used_page_number, uint32_t(page_table_.size())) -
+         page_number;
+}
+
+uint32_t BaseHeap::FindUsedPageForward(uint32_t node,
+                                       uint32_t node_page_number,
+                                       uint32_t node_page_count,
+                                       uint32_t first_page_number) const {
+  if (node_page_number + node_page_count <= first_page_number) {
+    return UINT32_MAX;
+  }
+  if (node_page_number >= first_page_number) {
+    if (GetFreePageRunNode(node).prefix == node_page_count) {
+      return UINT32_MAX;
+    }
+    if (node_page_count == 1) {
+      return node_page_number;
+    }
+  }
+  uint32_t child_page_count = node_page_count >> 1;
+  uint32_t result = FindUsedPageForward(node * 2, node_page_number,
+                                        child_page_count, first_page_number);
+  if (result != UINT32_MAX) {
+    return result;
+  }
+  return FindUsedPageForward(node * 2 + 1, node_page_number + child_page_count,
+                             child_page_count, first_page_number);
+}
+
 bool BaseHeap::Alloc(uint32_t size, uint32_t alignment,
                      uint32_t allocation_type, uint32_t protect, bool top_down,
                      uint32_t* out_address) {
@@ -891,6 +1499,7 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
       XELOGE("BaseHeap::AllocFixed failed to alloc range from host");
       return false;
     }
+    AdviseGuestHugePages(result, page_count * page_size_);
 
     if (cvars::scribble_heap && protect & kMemoryProtectWrite) {
       std::memset(result, 0xCD, page_count * page_size_);
@@ -910,6 +1519,9 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  if (page_count) {
+    UpdateFreePageRunIndex(start_page_number, end_page_number);
+  }
 
   return true;
 }
@@ -939,85 +1551,60 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
   auto global_lock = global_critical_region_.Acquire();
 
   // Find a free page range.
-  // The base page must match the requested alignment, so we first scan for
-  // a free aligned page and only then check for continuous free pages.
-  // TODO(benvanik): optimized searching (free list buckets, bitmap, etc).
+  // The base page must match the requested alignment, so free ranges that
+  // don't start at an aligned page are skipped until one containing enough
+  // pages from an aligned page is found.
   uint32_t start_page_number = UINT_MAX;
   uint32_t end_page_number = UINT_MAX;
   uint32_t page_scan_stride = alignment / page_size_;
   high_page_number = high_page_number - (high_page_number % page_scan_stride);
+  // A zero-sized allocation still needs a free base page.
+  uint32_t search_page_count = std::max(page_count, uint32_t(1));
   if (top_down) {
-    for (int64_t base_page_number =
-             high_page_number - xe::round_up(page_count, page_scan_stride);
-         base_page_number >= low_page_number;
-         base_page_number -= page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = uint32_t(base_page_number);
-      end_page_number = uint32_t(base_page_number) + page_count - 1;
-      assert_true(end_page_number < page_table_.size());
-      bool any_taken = false;
-      for (uint32_t page_number = uint32_t(base_page_number);
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least before this page.
-          any_taken = true;
-          if (page_count > page_number) {
-            // Not enough space left to fit entire page range. Breaks outer
-            // loop.
-            base_page_number = -1;
-          } else {
-            base_page_number = page_number - page_count;
-            base_page_number -= base_page_number % page_scan_stride;
-            base_page_number += page_scan_stride;  // cancel out loop logic
-          }
+    uint32_t aligned_page_count = xe::round_up(page_count, page_scan_stride);
+    if (high_page_number >= aligned_page_count) {
+      uint32_t base_page_number = high_page_number - aligned_page_count;
+      while (base_page_number >= low_page_number) {
+        uint32_t free_page_number = FindFreePagesBackward(
+            base_page_number + search_page_count - 1, search_page_count);
+        if (free_page_number == UINT32_MAX ||
+            free_page_number < low_page_number) {
           break;
         }
+        if (!(free_page_number % page_scan_stride)) {
+          // Found our place.
+          start_page_number = free_page_number;
+          break;
+        }
+        // Retry from the closest aligned page below.
+        base_page_number =
+            free_page_number - free_page_number % page_scan_stride;
       }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
     }
   } else {
-    for (uint32_t base_page_number = low_page_number;
-         base_page_number <= high_page_number - page_count;
-         base_page_number += page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = base_page_number;
-      end_page_number = base_page_number + page_count - 1;
-      bool any_taken = false;
-      for (uint32_t page_number = base_page_number;
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least after this page.
-          any_taken = true;
-          base_page_number = xe::round_up(page_number + 1, page_scan_stride);
-          base_page_number -= page_scan_stride;  // cancel out loop logic
+    if (high_page_number >= page_count) {
+      uint32_t last_base_page_number = high_page_number - page_count;
+      uint32_t base_page_number =
+          xe::round_up(low_page_number, page_scan_stride);
+      while (base_page_number <= last_base_page_number) {
+        uint32_t free_page_number =
+            FindFreePagesForward(base_page_number, search_page_count);
+        if (free_page_number > last_base_page_number) {
           break;
         }
+        if (!(free_page_number % page_scan_stride)) {
+          // Found our place.
+          start_page_number = free_page_number;
+          break;
+        }
+        // Retry from the closest aligned page above.
+        base_page_number = xe::round_up(free_page_number, page_scan_stride);
       }
-      if (!any_taken) {
-        // Found our place.
-        break;
-      }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
     }
   }
+  if (start_page_number != UINT_MAX) {
+    end_page_number = start_page_number + page_count - 1;
+  }
   if (start_page_number == UINT_MAX || end_page_number == UINT_MAX) {
     // Out of memory.
     XELOGE("BaseHeap::Alloc failed to find contiguous range");
@@ -1039,6 +1626,7 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
       XELOGE("BaseHeap::Alloc failed to alloc range from host");
       return false;
     }
+    AdviseGuestHugePages(result, page_count * page_size_);
 
     if (cvars::scribble_heap && (protect & kMemoryProtectWrite)) {
       std::memset(result, 0xCD, page_count * page_size_);
@@ -1055,6 +1643,9 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  if (page_count) {
+    UpdateFreePageRunIndex(start_page_number, end_page_number);
+  }
 
   *out_address = heap_base_ + (start_page_number * page_size_);
   return true;
@@ -1145,6 +1736,9 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
     auto& page_entry = page_table_[page_number];
     page_entry.qword = 0;
   }
+  if (base_page_entry.region_page_count) {
+    UpdateFreePageRunIndex(base_page_number, end_page_number);
+  }
 
   return true;
 }
@@ -1277,15 +1871,8 @@ bool BaseHeap::QueryRegionInfo(uint32_t base_address,
     }
   } else {
     // Free region.
-    for (uint32_t page_number = start_page_number;
-         page_number < page_table_.size(); ++page_number) {
-      auto page_entry = page_table_[page_number];
-      if (page_entry.state) {
-        // First non-free page; done with region.
-        break;
-      }
-      out_info->region_size += page_size_;
-    }
+    out_info->region_size =
+        GetFreePageRunLength(start_page_number) * page_size_;
   }
   return true;
 }
@@ -1357,6 +1944,131 @@ void VirtualHeap::Initialize(Memory* memory, uint8_t* membase,
                              uint32_t heap_size, uint32_t page_size) {
   BaseHeap::Initialize(memory, membase, heap_type, heap_base, heap_size,
                        page_size);
+
+  // Only executable modules are loaded to XEX heaps.
+  if (heap_type == HeapType::kGuestXex) {
+    system_page_size_ = uint32_t(xe::memory::page_size());
+    system_page_count_ =
+        (heap_size_ + (system_page_size_ - 1)) / system_page_size_;
+    code_watch_bits_.resize((system_page_count_ + 63) / 64);
+  }
+}
+
+bool VirtualHeap::Decommit(uint32_t address, uint32_t size) {
+  auto global_lock = global_critical_region_.Acquire();
+  TriggerCodeCallbacks(std::move(global_lock), address, size);
+  return BaseHeap::Decommit(address, size);
+}
+
+bool VirtualHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
+  auto global_lock = global_critical_region_.Acquire();
+  uint32_t region_size;
+  if (QuerySize(base_address, &region_size)) {
+    TriggerCodeCallbacks(std::move(global_lock), base_address, region_size);
+  }
+  return BaseHeap::Release(base_address, out_region_size);
+}
+
+bool VirtualHeap::Protect(uint32_t address, uint32_t size, uint32_t protect,
+                          uint32_t* old_protect) {
+  // Read-only code isn't write-protected while watched, so it can only be
+  // modified after being made writable.
+  if (protect & kMemoryProtectWrite) {
+    auto global_lock = global_critical_region_.Acquire();
+    TriggerCodeCallbacks(std::move(global_lock), address, size);
+  }
+  return BaseHeap::Protect(address, size, protect, old_protect);
+}
+
+void VirtualHeap::WatchCode(uint32_t address, uint32_t length) {
+  if (code_watch_bits_.empty() || address < heap_base_ || !length) {
+    return;
+  }
+  uint32_t heap_relative_address = address - heap_base_;
+  if (heap_relative_address >= heap_size_) {
+    return;
+  }
+  length = std::min(length, heap_size_ - heap_relative_address);
+  uint32_t system_page_first = heap_relative_address / system_page_size_;
+  uint32_t system_page_last =
+      (heap_relative_address + length - 1) / system_page_size_;
+
+  uint8_t* protect_base = membase_ + heap_base_;
+  auto global_lock = global_critical_region_.Acquire();
+  for (uint32_t i = system_page_first; i <= system_page_last; ++i) {
+    uint64_t page_bit = uint64_t(1) << (i & 63);
+    if (code_watch_bits_[i >> 6] & page_bit) {
+      continue;
+    }
+    const PageEntry& page_entry =
+        page_table_[i * system_page_size_ / page_size_];
+    if (!(page_entry.state & kMemoryAllocationCommit)) {
+      continue;
+    }
+    code_watch_bits_[i >> 6] |= page_bit;
+    if (ToPageAccess(page_entry.current_protect) ==
+        xe::memory::PageAccess::kReadWrite) {
+      xe::memory::Protect(protect_base + i * system_page_size_,
+                          system_page_size_,
+                          xe::memory::PageAccess::kReadOnly);
+    }
+  }
+}
+
+bool VirtualHeap::TriggerCodeCallbacks(
+    std::unique_lock<std::recursive_mutex> global_lock_locked_once,
+    uint32_t virtual_address, uint32_t length) {
+  if (code_watch_bits_.empty() || virtual_address < heap_base_ || !length) {
+    return false;
+  }
+  uint32_t heap_relative_address = virtual_address - heap_base_;
+  if (heap_relative_address >= heap_size_) {
+    return false;
+  }
+  length = std::min(length, heap_size_ - heap_relative_address);
+  uint32_t system_page_first = heap_relative_address / system_page_size_;
+  uint32_t system_page_last =
+      (heap_relative_address + length - 1) / system_page_size_;
+
+  // Unwatch the pages, giving the guest its write access back.
+  uint8_t* protect_base = membase_ + heap_base_;
+  uint32_t unwatched_first = UINT32_MAX;
+  uint32_t unwatched_last = 0;
+  bool any_unprotected = false;
+  for (uint32_t i = system_page_first; i <= system_page_last; ++i) {
+    uint64_t page_bit = uint64_t(1) << (i & 63);
+    if (!(code_watch_bits_[i >> 6] & page_bit)) {
+      continue;
+    }
+    code_watch_bits_[i >> 6] &= ~page_bit;
+    unwatched_first = std::min(unwatched_first, i);
+    unwatched_last = i;
+    const PageEntry& page_entry =
+        page_table_[i * system_page_size_ / page_size_];
+    if ((page_entry.state & kMemoryAllocationCommit) &&
+        ToPageAccess(page_entry.current_protect) ==
+            xe::memory::PageAccess::kReadWrite) {
+      xe::memory::Protect(protect_base + i * system_page_size_,
+                          system_page_size_,
+                          xe::memory::PageAccess::kReadWrite);
+      any_unprotected = true;
+    }
+  }
+  if (unwatched_first == UINT32_MAX) {
+    return false;
+  }
+
+  uint32_t unwatched_address =
+      heap_base_ + unwatched_first * system_page_size_;
+  uint32_t unwatched_length = std::min(
+      (unwatched_last + 1 - unwatched_first) * system_page_size_,
+      heap_size_ - unwatched_first * system_page_size_);
+  for (auto invalidation_callback : memory_->code_invalidation_callbacks_) {
+    invalidation_callback->first(invalidation_callback->second,
+                                 unwatched_address, unwatched_length);
+  }
+  // Only a write access violation caused by watching can be retried.
+  return any_unprotected;
 }
 
 PhysicalHeap::PhysicalHeap() : parent_heap_(nullptr) {}
@@ -11,6 +11,7 @@
 #define XENIA_MEMORY_H_
 
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -187,9 +188,29 @@ class BaseHeap {
   xe::memory::PageAccess QueryRangeAccess(uint32_t low_address,
                                           uint32_t high_address);
 
-  bool Save(ByteStream* stream);
+  // Writes the page table and the contents of the committed pages. Zero pages
+  // and pages identical to an earlier one are stored as references, and the
+  // rest is compressed in parallel. If incremental is true, pages unchanged
+  // since the previous Save are skipped, and the heap must be restored from
+  // the previous save state before restoring the new one. Returns false if the
+  // stream is too small - the next incremental Save can't be based on it then.
+  bool Save(ByteStream* stream, bool incremental = false);
   bool Restore(ByteStream* stream);
 
+  // Page table and contents of the committed pages copied at one point, to be
+  // saved while the guest keeps running.
+  struct Snapshot {
+    std::vector<PageEntry> page_table;
+    std::vector<uint32_t> committed_pages;
+    // Contents of the committed pages, in the order of committed_pages.
+    std::unique_ptr<uint8_t[]> contents;
+  };
+  void CaptureSnapshot(Snapshot* snapshot);
+  // Same as Save, but with the captured state. May be called from any thread,
+  // but not while another Save is in progress.
+  bool SaveSnapshot(const Snapshot& snapshot, ByteStream* stream,
+                    bool incremental = false);
+
   void Reset();
 
  protected:
@@ -199,6 +220,23 @@ class BaseHeap {
                   uint32_t heap_base, uint32_t heap_size, uint32_t page_size,
                   uint32_t host_address_offset = 0);
 
+  // Rebuilds the free page run index after the whole page table was changed.
+  void BuildFreePageRunIndex();
+  // Updates the free page run index after the state of the pages in the range
+  // was changed.
+  void UpdateFreePageRunIndex(uint32_t start_page_number,
+                              uint32_t end_page_number);
+  // Returns the lowest page number not below first_page_number starting
+  // page_count free pages, or UINT32_MAX if there's none.
+  uint32_t FindFreePagesForward(uint32_t first_page_number,
+                                uint32_t page_count) const;
+  // Returns the highest page number starting page_count free pages, the last
+  // of which isn't above last_page_number, or UINT32_MAX if there's none.
+  uint32_t FindFreePagesBackward(uint32_t last_page_number,
+                                 uint32_t page_count) const;
+  // Returns the number of free pages starting at page_number.
+  uint32_t GetFreePageRunLength(uint32_t page_number) const;
+
   Memory* memory_;
   uint8_t* membase_;
   HeapType heap_type_;
@@ -208,6 +246,56 @@ class BaseHeap {
   uint32_t host_address_offset_;
   xe::global_critical_region global_critical_region_;
   std::vector<PageEntry> page_table_;
+
+ private:
+  // Node of a binary tree over the page table, padded to a power of two pages
+  // with allocated pages, for finding free ranges in logarithmic time.
+  // Lengths are in pages.
+  struct FreePageRunNode {
+    // Length of the free run at the beginning of the node's page range.
+    uint32_t prefix;
+    // Length of the free run at the end of the node's page range.
+    uint32_t suffix;
+    // Length of the longest free run within the node's page range.
+    uint32_t longest;
+  };
+  // Leaves aren't stored, they're derived from the page table.
+  FreePageRunNode GetFreePageRunNode(uint32_t node) const;
+  // Recursive parts of the searches, with the page range of the node, and the
+  // length of the free run adjacent to the node on the side the search comes
+  // from.
+  uint32_t FindFreePagesForward(uint32_t node, uint32_t node_page_number,
+                                uint32_t node_page_count,
+                                uint32_t first_page_number,
+                                uint32_t page_count, uint32_t& run) const;
+  uint32_t FindFreePagesBackward(uint32_t node, uint32_t node_page_number,
+                                 uint32_t node_page_count,
+                                 uint32_t last_page_number,
+                                 uint32_t page_count, uint32_t& run) const;
+  uint32_t FindUsedPageForward(uint32_t node, uint32_t node_page_number,
+                               uint32_t node_page_count,
+                               uint32_t first_page_number) const;
+
+  // Changes the host protection of the committed pages the guest can't read.
+  void SetUnreadablePagesAccess(xe::memory::PageAccess access);
+  // Writes the page table and the contents of its committed pages, the page
+  // at committed_pages[i] being at get_page_data(i), and contiguous with the
+  // next one if their page numbers are consecutive.
+  bool SavePages(
+      ByteStream* stream, const std::vector<PageEntry>& page_table,
+      const std::vector<uint32_t>& committed_pages,
+      const std::function<const uint8_t*(uint32_t i)>& get_page_data,
+      bool incremental);
+
+  // Power of two number of pages covered by the tree.
+  uint32_t free_page_run_leaf_count_ = 0;
+  // Internal nodes of the tree, with the root at 1 and the children of node i
+  // at 2 * i and 2 * i + 1. Protected by global_critical_region_.
+  std::vector<FreePageRunNode> free_page_run_nodes_;
+
+  // Hashes of the contents of the pages as of the last Save, or 0 for pages
+  // that weren't committed or only contained zeros, for incremental saving.
+  std::vector<uint64_t> saved_page_hashes_;
 };
 
 // Normal heap allowing allocations from guest virtual address ranges.
@@ -219,6 +307,30 @@ class VirtualHeap : public BaseHeap {
   // Initializes the heap properties and allocates the page table.
   void Initialize(Memory* memory, uint8_t* membase, HeapType heap_type,
                   uint32_t heap_base, uint32_t heap_size, uint32_t page_size);
+
+  bool Decommit(uint32_t address, uint32_t size) override;
+  bool Release(uint32_t base_address,
+               uint32_t* out_region_size = nullptr) override;
+  bool Protect(uint32_t address, uint32_t size, uint32_t protect,
+               uint32_t* old_protect = nullptr) override;
+
+  // Watches the guest code in the range, snapped to system page boundaries,
+  // for modification. Only supported in XEX heaps.
+  void WatchCode(uint32_t address, uint32_t length);
+  // Triggers the code invalidation callbacks for the watched pages in the
+  // range and unwatches them. Returns true if any of them was write-protected
+  // only for watching, so a write access violation in it can be retried.
+  bool TriggerCodeCallbacks(
+      std::unique_lock<std::recursive_mutex> global_lock_locked_once,
+      uint32_t virtual_address, uint32_t length);
+
+ protected:
+  uint32_t system_page_size_ = 0;
+  uint32_t system_page_count_ = 0;
+  // Protected by global_critical_region. Bits for each system page containing
+  // watched guest code, empty if the heap doesn't support code watches. Pages
+  // writable by the guest are also write-protected while they're watched.
+  std::vector<uint64_t> code_watch_bits_;
 };
 
 // A heap for ranges of memory that are mapped to physical ranges.
@@ -448,6 +560,39 @@ class Memory {
       uint32_t virtual_address, uint32_t length, bool is_write,
       bool unwatch_exact_range, bool unprotect = true);
 
+  // Code invalidation callbacks notify the CPU about writes to guest code it
+  // has translated - such as titles decrypting or patching their code at
+  // runtime - so it can retranslate the affected functions.
+  //
+  // Like physical memory invalidation notifications, they're one-shot and
+  // page-granular, triggered when a watched page is written to (by the guest
+  // or the host), made writable, decommitted or released. Pages are only
+  // write-protected while the guest can write to them, so code sections
+  // mapped as read-only don't cause any access violations.
+  //
+  // Called with the global critical region locked, with the range of the
+  // pages that aren't watched anymore.
+  typedef void (*CodeInvalidationCallback)(void* context_ptr,
+                                           uint32_t virtual_address,
+                                           uint32_t length);
+  // Returns a handle for unregistering.
+  void* RegisterCodeInvalidationCallback(CodeInvalidationCallback callback,
+                                         void* callback_context);
+  // Unregisters a code invalidation callback previously added with
+  // RegisterCodeInvalidationCallback.
+  void UnregisterCodeInvalidationCallback(void* callback_handle);
+
+  // Enables the code invalidation callbacks for the virtual address range,
+  // snapped to system page boundaries, if it's in a heap containing executable
+  // modules.
+  void WatchCode(uint32_t virtual_address, uint32_t length);
+  // Triggers the code invalidation callbacks for the watched pages in the
+  // virtual address range and unwatches them. Must be called before the host
+  // writes to guest memory through the OS, such as with file reads, as watched
+  // pages are write-protected and such writes fail instead of causing access
+  // violations.
+  void TriggerCodeCallbacks(uint32_t virtual_address, uint32_t length);
+
   // Allocates virtual memory from the 'system' heap.
   // System memory is kept separate from game memory but is still accessible
   // using normal guest virtual addresses. Kernel structures and other internal
@@ -475,9 +620,23 @@ class Memory {
   // Dumps a map of all allocated memory to the log.
   void DumpMap();
 
-  bool Save(ByteStream* stream);
+  // See BaseHeap::Save.
+  bool Save(ByteStream* stream, bool incremental = false);
   bool Restore(ByteStream* stream);
 
+  // Contents of the heaps written by Save, captured at one point.
+  struct Snapshot {
+    BaseHeap::Snapshot v00000000;
+    BaseHeap::Snapshot v40000000;
+    BaseHeap::Snapshot v80000000;
+    BaseHeap::Snapshot v90000000;
+    BaseHeap::Snapshot physical;
+  };
+  // See BaseHeap::CaptureSnapshot and BaseHeap::SaveSnapshot.
+  void CaptureSnapshot(Snapshot* snapshot);
+  bool SaveSnapshot(const Snapshot& snapshot, ByteStream* stream,
+                    bool incremental = false);
+
  private:
   int MapViews(uint8_t* mapping_base);
   void UnmapViews();
@@ -533,9 +692,12 @@ class Memory {
   friend class BaseHeap;
 
   friend class PhysicalHeap;
+  friend class VirtualHeap;
   xe::global_critical_region global_critical_region_;
   std::vector<std::pair<PhysicalMemoryInvalidationCallback, void*>*>
       physical_memory_invalidation_callbacks_;
+  std::vector<std::pair<CodeInvalidationCallback, void*>*>
+      code_invalidation_callbacks_;
 };
 
 }  // namespace xe
@@ -8,8 +8,12 @@ project("xenia-core")
   language("C++")
   links({
     "fmt",
+    "snappy",
     "xenia-base",
+    "xxhash",
   })
   defines({
   })
   files({"*.h", "*.cc"})
+
+include("testing")
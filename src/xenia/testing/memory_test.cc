@@ -0,0 +1,362 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "xenia/base/byte_stream.h"
+#include "xenia/base/math.h"
+#include "xenia/memory.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace test {
+
+// Tracks which pages of a heap are allocated, and finds free ranges the way
+// BaseHeap::AllocRange did by scanning the page table.
+class HeapModel {
+ public:
+  explicit HeapModel(BaseHeap* heap)
+      : heap_(heap), used_(heap->GetTotalPageCount()) {
+    for (uint32_t page_number = 0; page_number < used_.size();) {
+      HeapAllocationInfo info;
+      REQUIRE(heap->QueryRegionInfo(
+          heap->heap_base() + page_number * heap->page_size(), &info));
+      uint32_t page_count = info.region_size / heap->page_size();
+      REQUIRE(page_count);
+      if (info.state) {
+        Mark(page_number, page_count, true);
+      }
+      page_number += page_count;
+    }
+  }
+
+  void Mark(uint32_t page_number, uint32_t page_count, bool used) {
+    std::fill_n(used_.begin() + page_number, page_count, used);
+  }
+
+  uint32_t GetFreeRunLength(uint32_t page_number) const {
+    auto used_page = std::find(used_.begin() + page_number, used_.end(), true);
+    return uint32_t(used_page - used_.begin()) - page_number;
+  }
+
+  // Returns the address the heap is expected to allocate at, or 0.
+  uint32_t AllocRange(uint32_t low_address, uint32_t high_address,
+                      uint32_t size, uint32_t alignment, bool top_down) const {
+    uint32_t heap_base = heap_->heap_base();
+    uint32_t page_size = heap_->page_size();
+    alignment = xe::round_up(alignment, page_size);
+    uint32_t page_count = xe::round_up(size, page_size) / page_size;
+    low_address = std::max(heap_base, xe::align(low_address, alignment));
+    high_address = std::min(heap_base + (heap_->heap_size() - 1),
+                            xe::align(high_address, alignment));
+    int64_t last_page_number = int64_t(used_.size()) - 1;
+    int64_t low_page_number = std::min(
+        last_page_number, int64_t((low_address - heap_base) / page_size));
+    int64_t high_page_number = std::min(
+        last_page_number, int64_t((high_address - heap_base) / page_size));
+    if (page_count > high_page_number - low_page_number) {
+      return 0;
+    }
+    uint32_t stride = alignment / page_size;
+    high_page_number -= high_page_number % stride;
+    if (top_down) {
+      for (int64_t base_page_number =
+               high_page_number - xe::round_up(page_count, stride);
+           base_page_number >= low_page_number; base_page_number -= stride) {
+        if (IsFree(uint32_t(base_page_number), page_count)) {
+          return heap_base + uint32_t(base_page_number) * page_size;
+        }
+      }
+    } else {
+      for (int64_t base_page_number = low_page_number;
+           base_page_number <= high_page_number - page_count;
+           base_page_number += stride) {
+        if (IsFree(uint32_t(base_page_number), page_count)) {
+          return heap_base + uint32_t(base_page_number) * page_size;
+        }
+      }
+    }
+    return 0;
+  }
+
+ private:
+  bool IsFree(uint32_t page_number, uint32_t page_count) const {
+    return std::none_of(used_.begin() + page_number,
+                        used_.begin() + page_number + page_count,
+                        [](bool used) { return used; });
+  }
+
+  BaseHeap* heap_;
+  std::vector<bool> used_;
+};
+
+TEST_CASE("Allocate Ranges in a Fragmented Heap", "[memory]") {
+  Memory memory;
+  REQUIRE(memory.Initialize());
+  BaseHeap* heap = memory.LookupHeapByType(false, 4096);
+  HeapModel model(heap);
+  uint32_t heap_base = heap->heap_base();
+  uint32_t heap_size = heap->heap_size();
+  uint32_t page_size = heap->page_size();
+
+  struct Allocation {
+    uint32_t address;
+    uint32_t page_count;
+  };
+  std::vector<Allocation> allocations;
+  std::mt19937 random(0x4D656D);
+  for (uint32_t i = 0; i < 10000; ++i) {
+    // Keep a bounded number of allocations so the heap doesn't run out.
+    if (allocations.size() >= 256 ||
+        (!allocations.empty() && random() % 2 != 0)) {
+      size_t index = random() % allocations.size();
+      Allocation allocation = allocations[index];
+      allocations[index] = allocations.back();
+      allocations.pop_back();
+      REQUIRE(heap->Release(allocation.address));
+      model.Mark((allocation.address - heap_base) / page_size,
+                 allocation.page_count, false);
+      continue;
+    }
+
+    uint32_t page_count =
+        random() % 8 != 0 ? 1 + random() % 64 : 1 + random() % 4096;
+    uint32_t size = page_count * page_size - random() % page_size;
+    uint32_t alignment = page_size << (random() % 5);
+    bool top_down = random() % 2 != 0;
+    uint32_t low_address = heap_base;
+    uint32_t high_address = heap_base + (heap_size - 1);
+    if (random() % 4 == 0) {
+      low_address += random() % heap_size;
+      high_address = low_address + random() % (high_address - low_address);
+    }
+
+    uint32_t expected_address =
+        model.AllocRange(low_address, high_address, size, alignment, top_down);
+    if (!expected_address) {
+      // Failing allocations assert.
+      continue;
+    }
+    uint32_t address;
+    REQUIRE(heap->AllocRange(low_address, high_address, size, alignment,
+                             kMemoryAllocationReserve, kMemoryProtectRead,
+                             top_down, &address));
+    REQUIRE(address == expected_address);
+    model.Mark((address - heap_base) / page_size, page_count, true);
+    allocations.push_back({address, page_count});
+
+    uint32_t query_page_number = random() % heap->GetTotalPageCount();
+    HeapAllocationInfo info;
+    REQUIRE(heap->QueryRegionInfo(heap_base + query_page_number * page_size,
+                                  &info));
+    if (!info.state) {
+      REQUIRE(info.region_size ==
+              model.GetFreeRunLength(query_page_number) * page_size);
+    }
+  }
+
+  for (const Allocation& allocation : allocations) {
+    REQUIRE(heap->Release(allocation.address));
+  }
+}
+
+TEST_CASE("Save and Restore Memory", "[memory]") {
+  Memory memory;
+  REQUIRE(memory.Initialize());
+  BaseHeap* heap = memory.LookupHeapByType(false, 4096);
+  const uint32_t page_count = 64;
+  uint32_t address;
+  REQUIRE(heap->Alloc(page_count * 4096, 4096, kMemoryAllocationCommit,
+                      kMemoryProtectRead | kMemoryProtectWrite, false,
+                      &address));
+  auto data = memory.TranslateVirtual(address);
+
+  // Mix random, zero and duplicate pages.
+  std::mt19937 random(0x536176);
+  for (uint32_t i = 0; i < page_count * 4096; ++i) {
+    data[i] = uint8_t(random());
+  }
+  std::memset(data + 4 * 4096, 0, 8 * 4096);
+  std::memcpy(data + 20 * 4096, data + 2 * 4096, 4096);
+  std::memcpy(data + 21 * 4096, data + 2 * 4096, 4096);
+  std::vector<uint8_t> expected(data, data + page_count * 4096);
+
+  std::vector<uint8_t> full_state(64 * 1024 * 1024);
+  ByteStream full_stream(full_state.data(), full_state.size());
+  REQUIRE(memory.Save(&full_stream));
+
+  // Only the pages changed since the full save state are written to the
+  // incremental one.
+  std::vector<uint8_t> full_expected = expected;
+  std::memset(data + 30 * 4096, 0xCD, 2 * 4096);
+  std::memset(expected.data() + 30 * 4096, 0xCD, 2 * 4096);
+  std::vector<uint8_t> incremental_state(full_state.size());
+  ByteStream incremental_stream(incremental_state.data(),
+                                incremental_state.size());
+  REQUIRE(memory.Save(&incremental_stream, true));
+  REQUIRE(incremental_stream.offset() + 16 * 4096 < full_stream.offset());
+
+  std::memset(data, 0xEE, page_count * 4096);
+  full_stream.set_offset(0);
+  REQUIRE(memory.Restore(&full_stream));
+  REQUIRE(!std::memcmp(data, full_expected.data(), full_expected.size()));
+  incremental_stream.set_offset(0);
+  REQUIRE(memory.Restore(&incremental_stream));
+  REQUIRE(!std::memcmp(data, expected.data(), expected.size()));
+
+  REQUIRE(heap->Release(address));
+}
+
+TEST_CASE("Save a Memory Snapshot", "[memory]") {
+  Memory memory;
+  REQUIRE(memory.Initialize());
+  BaseHeap* heap = memory.LookupHeapByType(false, 4096);
+  const uint32_t page_count = 16;
+  uint32_t address;
+  REQUIRE(heap->Alloc(page_count * 4096, 4096, kMemoryAllocationCommit,
+                      kMemoryProtectRead | kMemoryProtectWrite, false,
+                      &address));
+  auto data = memory.TranslateVirtual(address);
+  for (uint32_t i = 0; i < page_count * 4096; ++i) {
+    data[i] = uint8_t(i * 7 / 4096);
+  }
+  std::vector<uint8_t> expected(data, data + page_count * 4096);
+
+  // Saved on another thread, like by the background save state writer, while
+  // the memory keeps changing. Changes made after the snapshot is captured
+  // aren't saved.
+  Memory::Snapshot snapshot;
+  memory.CaptureSnapshot(&snapshot);
+  std::vector<uint8_t> state(64 * 1024 * 1024);
+  ByteStream stream(state.data(), state.size());
+  std::atomic<bool> saved = false;
+  bool save_result = false;
+  std::thread save_thread([&] {
+    save_result = memory.SaveSnapshot(snapshot, &stream);
+    saved = true;
+  });
+  uint8_t value = 0;
+  do {
+    std::memset(data, ++value, page_count * 4096);
+  } while (!saved);
+  save_thread.join();
+  REQUIRE(save_result);
+
+  stream.set_offset(0);
+  REQUIRE(memory.Restore(&stream));
+  REQUIRE(!std::memcmp(data, expected.data(), expected.size()));
+
+  // Running out of space fails instead of writing past the end.
+  std::vector<uint8_t> small_state(4096);
+  ByteStream small_stream(small_state.data(), small_state.size());
+  REQUIRE(!memory.SaveSnapshot(snapshot, &small_stream));
+  REQUIRE(!memory.Save(&small_stream));
+
+  REQUIRE(heap->Release(address));
+}
+
+TEST_CASE("Trigger Code Callbacks Before Host Writes", "[memory]") {
+  Memory memory;
+  REQUIRE(memory.Initialize());
+  const uint32_t address = 0x90000000;
+  BaseHeap* heap = memory.LookupHeap(address);
+  REQUIRE(heap->AllocFixed(address, 4 * 4096, 4096, kMemoryAllocationCommit,
+                           kMemoryProtectRead | kMemoryProtectWrite));
+
+  std::vector<std::pair<uint32_t, uint32_t>> invalidated;
+  auto callback_handle = memory.RegisterCodeInvalidationCallback(
+      [](void* context, uint32_t virtual_address, uint32_t length) {
+        reinterpret_cast<std::vector<std::pair<uint32_t, uint32_t>>*>(context)
+            ->emplace_back(virtual_address, length);
+      },
+      &invalidated);
+  memory.WatchCode(address + 4096, 2 * 4096);
+
+  // Ranges outside the watched pages and outside XEX heaps are ignored.
+  memory.TriggerCodeCallbacks(address, 4096);
+  memory.TriggerCodeCallbacks(0x40000000, 4096);
+  REQUIRE(invalidated.empty());
+
+  // A host write, such as a file read, overlapping the watched pages.
+  memory.TriggerCodeCallbacks(address + 4000, 8192);
+  REQUIRE(invalidated.size() == 1);
+  REQUIRE(invalidated[0].first == address + 4096);
+  REQUIRE(invalidated[0].second == 2 * 4096);
+  std::memset(memory.TranslateVirtual(address), 0xCD, 4 * 4096);
+
+  // The pages aren't watched anymore.
+  memory.TriggerCodeCallbacks(address, 4 * 4096);
+  REQUIRE(invalidated.size() == 1);
+
+  memory.UnregisterCodeInvalidationCallback(callback_handle);
+  REQUIRE(heap->Release(address));
+}
+
+// Timing only - hidden, run with the [benchmark] tag. Allocates and releases
+// blocks of random sizes in heaps fragmented by many small allocations.
+TEST_CASE("Heap Allocation in a Fragmented Heap", "[.][benchmark]") {
+  Memory memory;
+  REQUIRE(memory.Initialize());
+  for (bool physical : {false, true}) {
+    BaseHeap* heap = memory.LookupHeapByType(physical, 4096);
+    std::mt19937 random(0x4D656D);
+
+    std::vector<uint32_t> fragments;
+    for (uint32_t i = 0; i < 8192; ++i) {
+      uint32_t address;
+      REQUIRE(heap->Alloc((1 + random() % 4) * 4096, 4096,
+                          kMemoryAllocationReserve, kMemoryProtectRead, false,
+                          &address));
+      fragments.push_back(address);
+    }
+    for (size_t i = 0; i < fragments.size(); i += 2) {
+      REQUIRE(heap->Release(fragments[i]));
+    }
+
+    const uint32_t iteration_count = 20000;
+    std::vector<uint32_t> addresses;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < iteration_count; ++i) {
+      uint32_t address;
+      REQUIRE(heap->Alloc((1 + random() % 32) * 4096, 4096,
+                          kMemoryAllocationReserve, kMemoryProtectRead,
+                          random() % 2 != 0, &address));
+      addresses.push_back(address);
+      if (addresses.size() >= 64) {
+        size_t index = random() % addresses.size();
+        REQUIRE(heap->Release(addresses[index]));
+        addresses[index] = addresses.back();
+        addresses.pop_back();
+      }
+    }
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    WARN((physical ? "PhysicalHeap" : "VirtualHeap")
+         << ": " << iteration_count << " allocations: " << duration.count()
+         << " us");
+
+    for (uint32_t address : addresses) {
+      REQUIRE(heap->Release(address));
+    }
+    for (size_t i = 1; i < fragments.size(); i += 2) {
+      REQUIRE(heap->Release(fragments[i]));
+    }
+  }
+}
+
+}  // namespace test
+}  // namespace xe